@@ -25,6 +25,7 @@
 #include "TelepathyQt/_gen/abstract-interface.moc.hpp"
 
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/introspection-trace-internal.h"
 
 #include <TelepathyQt/Constants>
 #include <TelepathyQt/DBusProxy>
@@ -114,7 +115,7 @@ PendingVariant *AbstractInterface::internalRequestProperty(const QString &name)
     QDBusMessage msg = QDBusMessage::createMethodCall(service(), path(),
             TP_QT_IFACE_PROPERTIES, QLatin1String("Get"));
     msg << interface() << name;
-    QDBusPendingCall pendingCall = connection().asyncCall(msg);
+    QDBusPendingCall pendingCall = internalAsyncCall(msg);
     DBusProxy *proxy = qobject_cast<DBusProxy*>(parent());
     return new PendingVariant(pendingCall, DBusProxyPtr(proxy));
 }
@@ -125,7 +126,7 @@ PendingOperation *AbstractInterface::internalSetProperty(const QString &name,
     QDBusMessage msg = QDBusMessage::createMethodCall(service(), path(),
             TP_QT_IFACE_PROPERTIES, QLatin1String("Set"));
     msg << interface() << name << QVariant::fromValue(QDBusVariant(newValue));
-    QDBusPendingCall pendingCall = connection().asyncCall(msg);
+    QDBusPendingCall pendingCall = internalAsyncCall(msg);
     DBusProxy *proxy = qobject_cast<DBusProxy*>(parent());
     return new PendingVoid(pendingCall, DBusProxyPtr(proxy));
 }
@@ -135,11 +136,31 @@ PendingVariantMap *AbstractInterface::internalRequestAllProperties() const
     QDBusMessage msg = QDBusMessage::createMethodCall(service(), path(),
             TP_QT_IFACE_PROPERTIES, QLatin1String("GetAll"));
     msg << interface();
-    QDBusPendingCall pendingCall = connection().asyncCall(msg);
+    QDBusPendingCall pendingCall = internalAsyncCall(msg);
     DBusProxy *proxy = qobject_cast<DBusProxy*>(parent());
     return new PendingVariantMap(pendingCall, DBusProxyPtr(proxy));
 }
 
+/**
+ * Send the given method call \a message asynchronously.
+ *
+ * The generated client side interfaces send all their method calls through this, so that they
+ * can be traced with IntrospectionTrace.
+ *
+ * \param message The method call to send.
+ * \param timeout The timeout in milliseconds, or -1 for the default one.
+ * \return The pending reply to \a message.
+ */
+QDBusPendingCall AbstractInterface::internalAsyncCall(const QDBusMessage &message,
+        int timeout) const
+{
+    QDBusPendingCall pendingCall = connection().asyncCall(message, timeout);
+    if (IntrospectionTracer::isEnabled()) {
+        IntrospectionTracer::instance()->traceCall(message, pendingCall);
+    }
+    return pendingCall;
+}
+
 /**
  * Sets whether this abstract interface will be monitoring properties or not. If it's set to monitor,
  * the signal propertiesChanged will be emitted whenever a property on this interface will
@@ -72,6 +72,8 @@ protected:
     PendingOperation *internalSetProperty(const QString &name, const QVariant &newValue);
     PendingVariantMap *internalRequestAllProperties() const;
 
+    QDBusPendingCall internalAsyncCall(const QDBusMessage &message, int timeout = -1) const;
+
 private Q_SLOTS:
     TP_QT_NO_EXPORT void onPropertiesChanged(const QString &interface,
             const QVariantMap &changedProperties,
@@ -0,0 +1,996 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/avatar-cache-internal.h"
+
+#include "TelepathyQt/_gen/avatar-cache-internal.moc.hpp"
+
+#include "TelepathyQt/debug-internal.h"
+
+#include <TelepathyQt/Utils>
+
+#include <QAtomicInt>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QRunnable>
+#include <QSet>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QThreadPool>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Tp
+{
+
+namespace
+{
+
+// The index is a journal: a header followed by one record per insertion or eviction. It is
+// compacted whenever it is loaded with too many superseded records in it.
+const quint32 IndexMagic = 0x54704176; // "TpAv"
+const quint32 IndexVersion = 1;
+const quint8 IndexRecordInsert = 1;
+const quint8 IndexRecordRemove = 2;
+const int IndexCompactionSlack = 64;
+
+// Escaped tokens never contain a dot, so this can't clash with a cached avatar
+const char IndexFileName[] = "avatars.index";
+
+struct AvatarCacheRegistry
+{
+    AvatarCacheRegistry()
+    {
+        writer.setMaxThreadCount(1);
+    }
+
+    QMutex mutex;
+    QHash<QString, WeakPtr<AvatarCache> > caches;
+
+    // A single worker shared by every cache, so writes and evictions don't race each other for
+    // the same directory, even when a cache is destroyed and opened again with jobs pending
+    QThreadPool writer;
+};
+
+Q_GLOBAL_STATIC(AvatarCacheRegistry, avatarCacheRegistry)
+
+bool writeFileAtomically(const QString &fileName, const QByteArray &contents)
+{
+    QTemporaryFile file(fileName);
+    if (!file.open() || file.write(contents) != contents.size() || !file.flush()) {
+        return false;
+    }
+
+#ifdef Q_OS_UNIX
+    // Make sure the contents hit the disk before the file shows up under its final name
+    if (::fsync(file.handle()) != 0) {
+        return false;
+    }
+#endif
+
+    file.setAutoRemove(false);
+    if (!file.rename(fileName)) {
+        file.remove();
+        return false;
+    }
+
+    return true;
+}
+
+AvatarCache::Entry entryFromDisk(const QString &avatarFileName, const QFileInfo &info)
+{
+    QFile mimeTypeFile(avatarFileName + QLatin1String(".mime"));
+    mimeTypeFile.open(QIODevice::ReadOnly);
+
+    AvatarCache::Entry entry;
+    entry.mimeType = QString(QLatin1String(mimeTypeFile.readAll()));
+    entry.size = info.size();
+    entry.mtime = info.lastModified().toTime_t();
+    return entry;
+}
+
+}
+
+struct TP_QT_NO_EXPORT AvatarCache::Private
+{
+    class Job;
+    class LoadJob;
+    class WriteJob;
+    class EvictJob;
+
+    struct IndexRecord
+    {
+        quint8 op;
+        QString fileName;
+        Entry entry;
+    };
+
+    struct Record
+    {
+        Record() : lastAccess(0) { }
+        Record(const Entry &entry) : entry(entry), lastAccess(0) { }
+
+        Entry entry;
+        quint64 lastAccess;
+    };
+
+    // Keyed by escaped token, which is also the name of the avatar file
+    struct Index
+    {
+        Index() : totalBytes(0) { }
+
+        void add(const QString &fileName, const Entry &entry);
+        void remove(const QString &fileName);
+
+        QHash<QString, Record> entries;
+        qint64 totalBytes;
+    };
+
+    // The part of the index file we know about, to tell when other processes changed it. The
+    // file is only ever appended to, or replaced as a whole when compacted.
+    struct IndexState
+    {
+        IndexState() : size(-1), id(0) { }
+
+        qint64 size;
+        quint64 id;
+    };
+
+    Private(AvatarCache *parent, const QString &path);
+
+    void ref();
+    void deref();
+
+    void load();
+    bool readIndex(QList<IndexRecord> *records, qint64 from, bool *dirty, qint64 *end) const;
+    void replay(Index *index, const QList<IndexRecord> &records);
+    bool writeIndex(const Index &index);
+    IndexState currentIndexState() const;
+    void refreshIndex();
+    void appendInsertRecord(const QString &fileName, const Entry &entry);
+    void appendRemoveRecords(const QStringList &fileNames);
+
+    void insert(const QString &fileName, const Entry &entry);
+    void touch(Record &record);
+
+    bool isOverBudget() const;
+    void scheduleEviction();
+    void evict();
+
+    void writeAvatar(const QString &token, const QByteArray &data, const QString &mimeType);
+
+    // Pending jobs keep us alive after the cache is gone, see ~AvatarCache()
+    QAtomicInt refCount;
+    // Cleared when the cache is destroyed, guarded by its own mutex so that emitting from the
+    // writer thread doesn't hold the index locked
+    QMutex parentMutex;
+    AvatarCache *parent;
+    QString path;
+    QString indexFileName;
+
+    mutable QMutex mutex;
+    Index index;
+    // Ticks on every lookup and insertion, evictions pick the entries with the oldest ticks
+    quint64 accessClock;
+
+    // The index is loaded by the writer thread, loaded() is emitted once it is
+    bool loaded;
+    IndexState indexState;
+
+    qint64 maxBytes;
+    int maxEntries;
+    bool evictionScheduled;
+
+    quint64 hits;
+    quint64 misses;
+    quint64 evictions;
+    qint64 evictedBytes;
+
+    // Avatars in use by live contacts, never evicted, with how many times each was pinned
+    QHash<QString, int> pinned;
+
+    QSet<QString> writesInFlight;
+};
+
+class TP_QT_NO_EXPORT AvatarCache::Private::Job : public QRunnable
+{
+public:
+    Job(AvatarCache::Private *priv)
+        : priv(priv)
+    {
+        priv->ref();
+    }
+
+    ~Job()
+    {
+        priv->deref();
+    }
+
+    static void start(Job *job)
+    {
+        avatarCacheRegistry()->writer.start(job);
+    }
+
+protected:
+    AvatarCache::Private *priv;
+};
+
+class TP_QT_NO_EXPORT AvatarCache::Private::LoadJob : public AvatarCache::Private::Job
+{
+public:
+    LoadJob(AvatarCache::Private *priv)
+        : Job(priv)
+    {
+    }
+
+    void run()
+    {
+        priv->load();
+    }
+};
+
+class TP_QT_NO_EXPORT AvatarCache::Private::WriteJob : public AvatarCache::Private::Job
+{
+public:
+    WriteJob(AvatarCache::Private *priv, const QString &token, const QByteArray &data,
+            const QString &mimeType)
+        : Job(priv), token(token), data(data), mimeType(mimeType)
+    {
+    }
+
+    void run()
+    {
+        priv->writeAvatar(token, data, mimeType);
+    }
+
+private:
+    QString token;
+    QByteArray data;
+    QString mimeType;
+};
+
+class TP_QT_NO_EXPORT AvatarCache::Private::EvictJob : public AvatarCache::Private::Job
+{
+public:
+    EvictJob(AvatarCache::Private *priv)
+        : Job(priv)
+    {
+    }
+
+    void run()
+    {
+        priv->evict();
+    }
+};
+
+AvatarCache::Private::Private(AvatarCache *parent, const QString &path)
+    : refCount(1),
+      parent(parent),
+      path(path),
+      indexFileName(QString(QLatin1String("%1/%2")).arg(path).arg(QLatin1String(IndexFileName))),
+      accessClock(0),
+      loaded(false),
+      maxBytes(AvatarCache::DefaultMaximumBytes),
+      maxEntries(AvatarCache::DefaultMaximumEntries),
+      evictionScheduled(false),
+      hits(0),
+      misses(0),
+      evictions(0),
+      evictedBytes(0)
+{
+}
+
+void AvatarCache::Private::ref()
+{
+    refCount.ref();
+}
+
+void AvatarCache::Private::deref()
+{
+    if (!refCount.deref()) {
+        delete this;
+    }
+}
+
+void AvatarCache::Private::Index::add(const QString &fileName, const Entry &entry)
+{
+    remove(fileName);
+    entries.insert(fileName, Record(entry));
+    totalBytes += entry.size;
+}
+
+void AvatarCache::Private::Index::remove(const QString &fileName)
+{
+    QHash<QString, Record>::iterator i = entries.find(fileName);
+    if (i != entries.end()) {
+        totalBytes -= i.value().entry.size;
+        entries.erase(i);
+    }
+}
+
+void AvatarCache::Private::load()
+{
+    // Runs on the writer thread, so that the constructing thread doesn't wait for the disk.
+    // The index is built aside and only published at the end.
+    Index loadedIndex;
+    IndexState state = currentIndexState();
+    QList<IndexRecord> records;
+    bool dirty = false;
+    if (readIndex(&records, 0, &dirty, &state.size)) {
+        replay(&loadedIndex, records);
+    } else {
+        dirty = true;
+    }
+
+    // List the directory once, so entries whose files were removed behind our back are dropped,
+    // and avatars cached by older versions or by other processes are picked up
+    QSet<QString> onDisk;
+    foreach (const QString &name, QDir(path).entryList(QDir::Files)) {
+        if (!name.contains(QLatin1Char('.'))) {
+            onDisk.insert(name);
+        }
+    }
+
+    foreach (const QString &name, loadedIndex.entries.keys()) {
+        if (!onDisk.contains(name)) {
+            loadedIndex.remove(name);
+            dirty = true;
+        }
+    }
+
+    foreach (const QString &name, onDisk) {
+        if (loadedIndex.entries.contains(name)) {
+            continue;
+        }
+
+        QString avatarFileName = QString(QLatin1String("%1/%2")).arg(path).arg(name);
+        loadedIndex.add(name, entryFromDisk(avatarFileName, QFileInfo(avatarFileName)));
+        dirty = true;
+    }
+
+    // Nothing cached yet, don't create the directory just for an empty index
+    if (!(onDisk.isEmpty() && records.isEmpty()) &&
+            (dirty || records.size() > 2 * loadedIndex.entries.size() + IndexCompactionSlack)) {
+        debug() << "Rewriting avatar cache index" << indexFileName << "with" <<
+            loadedIndex.entries.size() << "entries";
+        if (writeIndex(loadedIndex)) {
+            state = currentIndexState();
+        }
+    }
+
+    // We don't know how recently avatars were used in previous runs, so start with the order in
+    // which they were written
+    QList<QPair<qint64, QString> > order;
+    QHash<QString, Record>::const_iterator end = loadedIndex.entries.constEnd();
+    for (QHash<QString, Record>::const_iterator i = loadedIndex.entries.constBegin();
+            i != end; ++i) {
+        order << qMakePair(i.value().entry.mtime, i.key());
+    }
+    qSort(order);
+
+    QMutexLocker locker(&mutex);
+
+    for (int i = 0; i < order.size(); ++i) {
+        touch(loadedIndex.entries[order[i].second]);
+    }
+
+    // Avatars inserted while loading are the most recent ones
+    QHash<QString, Record>::const_iterator insertedEnd = index.entries.constEnd();
+    for (QHash<QString, Record>::const_iterator i = index.entries.constBegin();
+            i != insertedEnd; ++i) {
+        loadedIndex.add(i.key(), i.value().entry);
+        touch(loadedIndex.entries[i.key()]);
+    }
+
+    index = loadedIndex;
+    indexState = state;
+    loaded = true;
+    scheduleEviction();
+    locker.unlock();
+
+    QMutexLocker parentLocker(&parentMutex);
+    if (parent) {
+        emit parent->loaded();
+    }
+}
+
+bool AvatarCache::Private::readIndex(QList<IndexRecord> *records, qint64 from, bool *dirty,
+        qint64 *end) const
+{
+    QFile file(indexFileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+
+    if (from == 0) {
+        quint32 magic, version;
+        stream >> magic >> version;
+        if (stream.status() != QDataStream::Ok || magic != IndexMagic ||
+                version != IndexVersion) {
+            warning() << "Ignoring invalid avatar cache index" << indexFileName;
+            return false;
+        }
+    } else if (!file.seek(from)) {
+        return false;
+    }
+    *end = file.pos();
+
+    while (!stream.atEnd()) {
+        IndexRecord record;
+        stream >> record.op >> record.fileName;
+        if (record.op == IndexRecordInsert) {
+            stream >> record.entry.mimeType >> record.entry.size >> record.entry.mtime;
+        }
+
+        if (stream.status() != QDataStream::Ok ||
+                (record.op != IndexRecordInsert && record.op != IndexRecordRemove)) {
+            // A truncated tail, most likely from a crash while appending, or from another
+            // process appending right now. Keep what we have, and let the caller compact the
+            // index or read the rest later.
+            debug() << "Avatar cache index" << indexFileName << "is truncated";
+            *dirty = true;
+            return true;
+        }
+
+        *records << record;
+        *end = file.pos();
+    }
+
+    return true;
+}
+
+void AvatarCache::Private::replay(Index *index, const QList<IndexRecord> &records)
+{
+    foreach (const IndexRecord &record, records) {
+        if (record.op == IndexRecordRemove) {
+            index->remove(record.fileName);
+            continue;
+        }
+
+        // Our own records, read back from the journal, don't reset the entries
+        QHash<QString, Record>::const_iterator i = index->entries.constFind(record.fileName);
+        if (i == index->entries.constEnd() ||
+                i.value().entry.mimeType != record.entry.mimeType ||
+                i.value().entry.size != record.entry.size) {
+            index->add(record.fileName, record.entry);
+        }
+    }
+}
+
+bool AvatarCache::Private::writeIndex(const Index &index)
+{
+    QTemporaryFile file(indexFileName);
+    if (!file.open()) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << IndexMagic << IndexVersion;
+
+    QHash<QString, Record>::const_iterator end = index.entries.constEnd();
+    for (QHash<QString, Record>::const_iterator i = index.entries.constBegin(); i != end; ++i) {
+        const Entry &entry = i.value().entry;
+        stream << IndexRecordInsert << i.key() << entry.mimeType << entry.size << entry.mtime;
+    }
+
+    // QFile::rename() refuses to replace an existing file
+    QFile::remove(indexFileName);
+    file.setAutoRemove(false);
+    if (!file.rename(indexFileName)) {
+        file.remove();
+        return false;
+    }
+
+    return true;
+}
+
+AvatarCache::Private::IndexState AvatarCache::Private::currentIndexState() const
+{
+    IndexState ret;
+#ifdef Q_OS_UNIX
+    struct stat info;
+    if (::stat(QFile::encodeName(indexFileName).constData(), &info) == 0) {
+        ret.size = info.st_size;
+        ret.id = info.st_ino;
+    }
+#else
+    QFileInfo info(indexFileName);
+    if (info.exists()) {
+        ret.size = info.size();
+    }
+#endif
+    return ret;
+}
+
+void AvatarCache::Private::refreshIndex()
+{
+    // The journal is read without the mutex held, so that lookups don't wait for the disk
+    IndexState known;
+    {
+        QMutexLocker locker(&mutex);
+        if (!loaded) {
+            return;
+        }
+        known = indexState;
+    }
+
+    IndexState current = currentIndexState();
+    if (current.size < 0 || (current.size == known.size && current.id == known.id)) {
+        // Either unchanged, or removed, in which case the next load writes it again
+        return;
+    }
+
+    // Compacted by another process if replaced or shrunk, in which case it is read again in
+    // full, otherwise appended to, by another process or by ourselves
+    bool rewritten = current.id != known.id || current.size < known.size;
+    QList<IndexRecord> records;
+    bool dirty = false;
+    qint64 end = rewritten ? 0 : known.size;
+    if (!readIndex(&records, end, &dirty, &end)) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    if (indexState.size != known.size || indexState.id != known.id) {
+        // Another thread got there first
+        return;
+    }
+
+    if (rewritten) {
+        Index fresh;
+        replay(&fresh, records);
+
+        QHash<QString, Record>::iterator freshEnd = fresh.entries.end();
+        for (QHash<QString, Record>::iterator i = fresh.entries.begin(); i != freshEnd; ++i) {
+            QHash<QString, Record>::const_iterator old = index.entries.constFind(i.key());
+            if (old != index.entries.constEnd()) {
+                i.value().lastAccess = old.value().lastAccess;
+            }
+        }
+
+        debug() << "Avatar cache index" << indexFileName << "was rewritten, reloaded" <<
+            fresh.entries.size() << "entries";
+        index = fresh;
+        indexState.id = current.id;
+    } else {
+        replay(&index, records);
+    }
+    indexState.size = end;
+
+    QHash<QString, Record>::iterator indexEnd = index.entries.end();
+    for (QHash<QString, Record>::iterator i = index.entries.begin(); i != indexEnd; ++i) {
+        if (!i.value().lastAccess) {
+            touch(i.value());
+        }
+    }
+}
+
+void AvatarCache::Private::appendInsertRecord(const QString &fileName, const Entry &entry)
+{
+    QFile file(indexFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        // The next load will pick the avatar up from the directory listing
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    if (file.size() == 0) {
+        stream << IndexMagic << IndexVersion;
+    }
+    stream << IndexRecordInsert << fileName << entry.mimeType << entry.size << entry.mtime;
+}
+
+void AvatarCache::Private::appendRemoveRecords(const QStringList &fileNames)
+{
+    QFile file(indexFileName);
+    if (fileNames.isEmpty() || !file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        // The next load will drop the entries from the directory listing
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    if (file.size() == 0) {
+        stream << IndexMagic << IndexVersion;
+    }
+    foreach (const QString &fileName, fileNames) {
+        stream << IndexRecordRemove << fileName;
+    }
+}
+
+void AvatarCache::Private::insert(const QString &fileName, const Entry &entry)
+{
+    // Must be called with the mutex held
+    QHash<QString, Record>::iterator i = index.entries.find(fileName);
+    if (i != index.entries.end() && i.value().entry.mimeType == entry.mimeType &&
+            i.value().entry.size == entry.size) {
+        touch(i.value());
+        return;
+    }
+
+    index.add(fileName, entry);
+    touch(index.entries[fileName]);
+    appendInsertRecord(fileName, entry);
+    scheduleEviction();
+}
+
+void AvatarCache::Private::touch(Record &record)
+{
+    record.lastAccess = ++accessClock;
+}
+
+bool AvatarCache::Private::isOverBudget() const
+{
+    return (maxBytes > 0 && index.totalBytes > maxBytes) ||
+        (maxEntries > 0 && index.entries.size() > maxEntries);
+}
+
+void AvatarCache::Private::scheduleEviction()
+{
+    // Must be called with the mutex held
+    if (!loaded || evictionScheduled || !isOverBudget()) {
+        return;
+    }
+
+    evictionScheduled = true;
+    Job::start(new EvictJob(this));
+}
+
+void AvatarCache::Private::evict()
+{
+    // Runs on the writer thread
+    QStringList victims;
+
+    {
+        QMutexLocker locker(&mutex);
+        evictionScheduled = false;
+        if (!isOverBudget()) {
+            return;
+        }
+
+        // Go a bit below the limits, so the next few avatars don't trigger another pass right
+        // away
+        qint64 targetBytes = maxBytes - maxBytes / 10;
+        int targetEntries = maxEntries - maxEntries / 10;
+
+        QList<QPair<quint64, QString> > order;
+        QHash<QString, Record>::const_iterator end = index.entries.constEnd();
+        for (QHash<QString, Record>::const_iterator i = index.entries.constBegin(); i != end; ++i) {
+            order << qMakePair(i.value().lastAccess, i.key());
+        }
+        qSort(order);
+
+        for (int i = 0; i < order.size(); ++i) {
+            if ((maxBytes <= 0 || index.totalBytes <= targetBytes) &&
+                    (maxEntries <= 0 || index.entries.size() <= targetEntries)) {
+                break;
+            }
+
+            // If only pinned avatars are left, the cache stays over its limits until they are
+            // released
+            const QString &fileName = order[i].second;
+            if (pinned.contains(fileName)) {
+                continue;
+            }
+
+            evictedBytes += index.entries.value(fileName).entry.size;
+            ++evictions;
+            index.remove(fileName);
+            victims << fileName;
+        }
+
+        appendRemoveRecords(victims);
+    }
+
+    // The files go after the index is updated, so a crash in between leaves avatars that are
+    // picked up again on the next load rather than entries pointing to nothing
+    foreach (const QString &fileName, victims) {
+        QString avatarFileName = QString(QLatin1String("%1/%2")).arg(path).arg(fileName);
+        QFile::remove(avatarFileName);
+        QFile::remove(avatarFileName + QLatin1String(".mime"));
+    }
+
+    debug() << "Evicted" << victims.size() << "avatar(s) from" << path;
+}
+
+void AvatarCache::Private::writeAvatar(const QString &token, const QByteArray &data,
+        const QString &mimeType)
+{
+    // Runs on the writer thread, possibly after the cache is gone
+    QString fileName = escapeAsIdentifier(token);
+    QString avatarFileName = QString(QLatin1String("%1/%2")).arg(path).arg(fileName);
+    QString mimeTypeFileName = avatarFileName + QLatin1String(".mime");
+
+    bool success = false;
+    if (QDir().mkpath(path)) {
+        // The avatar file is written last, as its presence is what tells the avatar is cached
+        if (!QFile::exists(mimeTypeFileName)) {
+            writeFileAtomically(mimeTypeFileName, mimeType.toLatin1());
+        }
+
+        if (!QFile::exists(avatarFileName)) {
+            writeFileAtomically(avatarFileName, data);
+        }
+
+        success = QFile::exists(avatarFileName);
+    }
+
+    if (success) {
+        Entry entry;
+        entry.mimeType = mimeType;
+        entry.size = data.size();
+        entry.mtime = QDateTime::currentDateTime().toTime_t();
+
+        QMutexLocker locker(&mutex);
+        insert(fileName, entry);
+    } else {
+        warning() << "Unable to write avatar" << avatarFileName << "to the cache";
+    }
+
+    {
+        QMutexLocker locker(&mutex);
+        writesInFlight.remove(token);
+    }
+
+    QMutexLocker locker(&parentMutex);
+    if (parent) {
+        emit parent->avatarWritten(token, success);
+    }
+}
+
+/*
+ * In-memory index of the avatars cached on disk for a connection manager and protocol.
+ *
+ * The index is loaded once per directory, by the writer thread, and shared by every
+ * ContactManager using that directory, so checking whether an avatar is cached, and which mime
+ * type it has, costs no system call. It is persisted as a compact journal next to the avatars,
+ * which other processes append to as well when they cache or evict avatars: refresh() replays
+ * what they appended. Avatar files removed behind our back without a journal record are dropped
+ * by the next load, which lists the directory.
+ *
+ * New avatars are written by a worker thread shared by all caches, see write(). The same thread
+ * evicts the least recently used avatars whenever the cache grows over its limits, see
+ * setLimits(). Destroying the cache doesn't wait for it, pending writes still complete.
+ */
+
+// Evicting is opt-in, other processes may rely on the avatars we cached
+const qint64 AvatarCache::DefaultMaximumBytes = 0;
+const int AvatarCache::DefaultMaximumEntries = 0;
+
+QString AvatarCache::pathFor(const QString &cmName, const QString &protocolName)
+{
+    QString cacheDir = QString(QLatin1String(qgetenv("XDG_CACHE_HOME")));
+    if (cacheDir.isEmpty()) {
+        cacheDir = QString(QLatin1String("%1/.cache")).arg(QLatin1String(qgetenv("HOME")));
+    }
+
+    return QString(QLatin1String("%1/telepathy/avatars/%2/%3")).
+        arg(cacheDir).arg(cmName).arg(protocolName);
+}
+
+AvatarCachePtr AvatarCache::forPath(const QString &path)
+{
+    AvatarCacheRegistry *registry = avatarCacheRegistry();
+    QMutexLocker locker(&registry->mutex);
+
+    AvatarCachePtr cache(registry->caches.value(path));
+    if (!cache) {
+        cache = AvatarCachePtr(new AvatarCache(path));
+        registry->caches.insert(path, WeakPtr<AvatarCache>(cache));
+    }
+    return cache;
+}
+
+AvatarCache::AvatarCache(const QString &path)
+    : mPriv(new Private(this, path))
+{
+    Private::Job::start(new Private::LoadJob(mPriv));
+}
+
+AvatarCache::~AvatarCache()
+{
+    // Don't wait for pending jobs, dropping writes would lose avatars we already downloaded and
+    // waiting would block the owning thread on the disk. They keep the private data alive, and
+    // just stop signalling us.
+    {
+        QMutexLocker locker(&mPriv->parentMutex);
+        mPriv->parent = 0;
+    }
+    mPriv->deref();
+}
+
+QString AvatarCache::path() const
+{
+    return mPriv->path;
+}
+
+QString AvatarCache::avatarFileName(const QString &token) const
+{
+    return QString(QLatin1String("%1/%2")).arg(mPriv->path).arg(escapeAsIdentifier(token));
+}
+
+QString AvatarCache::mimeTypeFileName(const QString &token) const
+{
+    return QString(QLatin1String("%1.mime")).arg(avatarFileName(token));
+}
+
+/*
+ * Look \a token up in the index, without touching the disk. Until isLoaded(), only the avatars
+ * inserted since the cache was opened are found.
+ */
+bool AvatarCache::lookup(const QString &token, Entry *entry)
+{
+    QString fileName = escapeAsIdentifier(token);
+
+    QMutexLocker locker(&mPriv->mutex);
+
+    QHash<QString, Private::Record>::iterator i = mPriv->index.entries.find(fileName);
+    if (i == mPriv->index.entries.end()) {
+        ++mPriv->misses;
+        return false;
+    }
+
+    ++mPriv->hits;
+    mPriv->touch(i.value());
+    if (entry) {
+        *entry = i.value().entry;
+    }
+    return true;
+}
+
+/*
+ * Replay what other processes appended to the index since we last looked, or read it again if
+ * they compacted it. This costs a stat() of the index file, so it is meant to be called once
+ * before a batch of lookups.
+ */
+void AvatarCache::refresh()
+{
+    mPriv->refreshIndex();
+}
+
+bool AvatarCache::isLoaded() const
+{
+    QMutexLocker locker(&mPriv->mutex);
+    return mPriv->loaded;
+}
+
+void AvatarCache::insert(const QString &token, const Entry &entry)
+{
+    QMutexLocker locker(&mPriv->mutex);
+    mPriv->insert(escapeAsIdentifier(token), entry);
+}
+
+/*
+ * Keep the avatar at \a avatarFileName, as returned by avatarFileName(), from being evicted until
+ * it is unpinned as many times. Contacts pin the avatars they hand out, so their
+ * AvatarData::fileName stays valid as long as they live.
+ */
+void AvatarCache::pin(const QString &avatarFileName)
+{
+    QString fileName = QFileInfo(avatarFileName).fileName();
+
+    QMutexLocker locker(&mPriv->mutex);
+    ++mPriv->pinned[fileName];
+}
+
+void AvatarCache::unpin(const QString &avatarFileName)
+{
+    QString fileName = QFileInfo(avatarFileName).fileName();
+
+    QMutexLocker locker(&mPriv->mutex);
+    QHash<QString, int>::iterator i = mPriv->pinned.find(fileName);
+    if (i != mPriv->pinned.end() && --i.value() == 0) {
+        mPriv->pinned.erase(i);
+        // Evictions may have been waiting for it
+        mPriv->scheduleEviction();
+    }
+}
+
+/*
+ * Write an avatar to the cache, and add it to the index, without blocking the calling thread.
+ *
+ * avatarWritten() is emitted, from the writer thread, once the avatar is safely on disk or
+ * writing it failed. Writing a token that is already being written is a no-op, the signal is
+ * emitted once for both requests.
+ *
+ * QByteArray is implicitly shared, so the data is not copied when handed over to the writer.
+ */
+void AvatarCache::write(const QString &token, const QByteArray &data, const QString &mimeType)
+{
+    {
+        QMutexLocker locker(&mPriv->mutex);
+        if (mPriv->writesInFlight.contains(token)) {
+            debug() << "Avatar" << token << "is already being written, coalescing";
+            return;
+        }
+        mPriv->writesInFlight.insert(token);
+    }
+
+    Private::Job::start(new Private::WriteJob(mPriv, token, data, mimeType));
+}
+
+bool AvatarCache::isWriting(const QString &token) const
+{
+    QMutexLocker locker(&mPriv->mutex);
+    return mPriv->writesInFlight.contains(token);
+}
+
+qint64 AvatarCache::maximumBytes() const
+{
+    QMutexLocker locker(&mPriv->mutex);
+    return mPriv->maxBytes;
+}
+
+int AvatarCache::maximumEntries() const
+{
+    QMutexLocker locker(&mPriv->mutex);
+    return mPriv->maxEntries;
+}
+
+/*
+ * Limit the total size and number of the cached avatars, 0 meaning no limit. Going over either
+ * of them evicts the least recently used avatars on the writer thread, until the cache is back
+ * a bit under both.
+ */
+void AvatarCache::setLimits(qint64 maximumBytes, int maximumEntries)
+{
+    QMutexLocker locker(&mPriv->mutex);
+    mPriv->maxBytes = qMax(maximumBytes, Q_INT64_C(0));
+    mPriv->maxEntries = qMax(maximumEntries, 0);
+    mPriv->scheduleEviction();
+}
+
+int AvatarCache::count() const
+{
+    QMutexLocker locker(&mPriv->mutex);
+    return mPriv->index.entries.size();
+}
+
+AvatarCacheStatistics AvatarCache::statistics() const
+{
+    QMutexLocker locker(&mPriv->mutex);
+
+    AvatarCacheStatistics ret;
+    ret.hits = mPriv->hits;
+    ret.misses = mPriv->misses;
+    ret.evictions = mPriv->evictions;
+    ret.evictedBytes = mPriv->evictedBytes;
+    ret.entries = mPriv->index.entries.size();
+    ret.bytes = mPriv->index.totalBytes;
+    return ret;
+}
+
+} // Tp
@@ -0,0 +1,102 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_avatar_cache_internal_h_HEADER_GUARD_
+#define _TelepathyQt_avatar_cache_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/AvatarCacheStatistics>
+#include <TelepathyQt/Global>
+#include <TelepathyQt/SharedPtr>
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+class AvatarCache;
+typedef SharedPtr<AvatarCache> AvatarCachePtr;
+
+class TP_QT_NO_EXPORT AvatarCache : public QObject, public RefCounted
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(AvatarCache)
+
+public:
+    struct Entry
+    {
+        Entry() : size(0), mtime(0) { }
+
+        QString mimeType;
+        qint64 size;
+        qint64 mtime;
+    };
+
+    static const qint64 DefaultMaximumBytes;
+    static const int DefaultMaximumEntries;
+
+    static QString pathFor(const QString &cmName, const QString &protocolName);
+    static AvatarCachePtr forPath(const QString &path);
+
+    ~AvatarCache();
+
+    QString path() const;
+    QString avatarFileName(const QString &token) const;
+    QString mimeTypeFileName(const QString &token) const;
+
+    bool lookup(const QString &token, Entry *entry);
+    void refresh();
+    bool isLoaded() const;
+    void insert(const QString &token, const Entry &entry);
+
+    void pin(const QString &avatarFileName);
+    void unpin(const QString &avatarFileName);
+
+    void write(const QString &token, const QByteArray &data, const QString &mimeType);
+    bool isWriting(const QString &token) const;
+
+    qint64 maximumBytes() const;
+    int maximumEntries() const;
+    void setLimits(qint64 maximumBytes, int maximumEntries);
+
+    int count() const;
+    AvatarCacheStatistics statistics() const;
+
+Q_SIGNALS:
+    void loaded();
+    void avatarWritten(const QString &token, bool success);
+
+private:
+    AvatarCache(const QString &path);
+
+    struct Private;
+    friend struct Private;
+    Private *mPriv;
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
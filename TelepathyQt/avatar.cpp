@@ -33,6 +33,23 @@ namespace Tp
  * \brief The AvatarData class represents a Telepathy avatar.
  */
 
+/**
+ * \class AvatarCacheStatistics
+ * \ingroup wrappers
+ * \headerfile TelepathyQt/avatar.h <TelepathyQt/AvatarCacheStatistics>
+ *
+ * \brief The AvatarCacheStatistics class holds usage statistics of the on-disk avatar cache.
+ *
+ * The cache is shared by every ContactManager whose connection uses the same connection manager
+ * and protocol, so these numbers cover all of them, for the lifetime of the process.
+ *
+ * \li \c hits and \c misses count the lookups of avatar tokens in the cache;
+ * \li \c evictions and \c evictedBytes count the avatars removed to stay within the cache limits;
+ * \li \c entries and \c bytes are the current number and total size of the cached avatars.
+ *
+ * \sa ContactManager::avatarCacheStatistics()
+ */
+
 struct TP_QT_NO_EXPORT AvatarSpec::Private : public QSharedData
 {
     Private(const QStringList &supportedMimeTypes,
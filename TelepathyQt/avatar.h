@@ -48,6 +48,19 @@ public:
     QString mimeType;
 };
 
+struct TP_QT_EXPORT AvatarCacheStatistics
+{
+    inline AvatarCacheStatistics()
+        : hits(0), misses(0), evictions(0), evictedBytes(0), entries(0), bytes(0) {}
+
+    quint64 hits;
+    quint64 misses;
+    quint64 evictions;
+    qint64 evictedBytes;
+    int entries;
+    qint64 bytes;
+};
+
 class TP_QT_EXPORT AvatarSpec
 {
 public:
@@ -81,6 +94,7 @@ private:
 } // Tp
 
 Q_DECLARE_METATYPE(Tp::AvatarData);
+Q_DECLARE_METATYPE(Tp::AvatarCacheStatistics);
 Q_DECLARE_METATYPE(Tp::AvatarSpec);
 
 #endif
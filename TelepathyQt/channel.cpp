@@ -91,6 +91,7 @@ struct TP_QT_NO_EXPORT Channel::Private
     void doMembersChangedDetailed(const UIntList &, const UIntList &, const UIntList &,
             const UIntList &, const QVariantMap &);
     void processMembersChanged();
+    GroupMembersChangedInfo *dequeueMembersChanged();
     void updateContacts(const QList<ContactPtr> &contacts =
             QList<ContactPtr>());
     bool fakeGroupInterfaceIfNeeded();
@@ -116,6 +117,51 @@ struct TP_QT_NO_EXPORT Channel::Private
     struct GroupMembersChangedInfo;
     struct ConferenceChannelRemovedInfo;
 
+    // Implicitly shared copy of one of the member lists, built on first use after the list
+    // changes, so that the group accessors don't build a new set on every call
+    class GroupMemberSnapshot
+    {
+    public:
+        GroupMemberSnapshot() : upToDate(false), withoutSelfUpToDate(false) { }
+
+        void invalidate()
+        {
+            upToDate = false;
+            withoutSelfUpToDate = false;
+        }
+
+        Contacts contacts(const QHash<uint, ContactPtr> &members, const ContactPtr &self,
+                bool includeSelfContact)
+        {
+            if (!upToDate) {
+                all = members.values().toSet();
+                upToDate = true;
+                withoutSelfUpToDate = false;
+            }
+
+            if (includeSelfContact) {
+                return all;
+            }
+
+            if (!withoutSelfUpToDate || withoutSelfFor != self) {
+                withoutSelf = all;
+                if (self && all.contains(self)) {
+                    withoutSelf.remove(self);
+                }
+                withoutSelfFor = self;
+                withoutSelfUpToDate = true;
+            }
+            return withoutSelf;
+        }
+
+    private:
+        Contacts all;
+        Contacts withoutSelf;
+        ContactPtr withoutSelfFor;
+        bool upToDate;
+        bool withoutSelfUpToDate;
+    };
+
     // Public object
     Channel *parent;
 
@@ -181,6 +227,9 @@ struct TP_QT_NO_EXPORT Channel::Private
     QHash<uint, ContactPtr> groupContacts;
     QHash<uint, ContactPtr> groupLocalPendingContacts;
     QHash<uint, ContactPtr> groupRemotePendingContacts;
+    mutable GroupMemberSnapshot groupContactsSnapshot;
+    mutable GroupMemberSnapshot groupLocalPendingContactsSnapshot;
+    mutable GroupMemberSnapshot groupRemotePendingContactsSnapshot;
 
     // Stored change info
     QHash<uint, GroupMemberChangeDetails> groupLocalPendingContactsChangeInfo;
@@ -227,6 +276,32 @@ struct TP_QT_NO_EXPORT Channel::Private::GroupMembersChangedInfo
     {
     }
 
+    int changeCount() const
+    {
+        return eventDetails.isEmpty() ? 1 : eventDetails.size();
+    }
+
+    QVariantMap detailsFor(uint handle) const
+    {
+        int event = handleEvents.value(handle, -1);
+        return event < 0 ? details : eventDetails[event];
+    }
+
+    QSet<uint> actors() const
+    {
+        QSet<uint> ret;
+        if (actor) {
+            ret.insert(actor);
+        }
+        foreach (const QVariantMap &eventDetail, eventDetails) {
+            uint eventActor = qdbus_cast<uint>(eventDetail.value(keyActor));
+            if (eventActor) {
+                ret.insert(eventActor);
+            }
+        }
+        return ret;
+    }
+
     UIntList added;
     UIntList removed;
     UIntList localPending;
@@ -236,6 +311,11 @@ struct TP_QT_NO_EXPORT Channel::Private::GroupMembersChangedInfo
     uint reason;
     QString message;
 
+    // Set when several queued changes were coalesced into this one: the details of each of them,
+    // and for every handle, the change which decided where it ends up
+    QList<QVariantMap> eventDetails;
+    QHash<uint, int> handleEvents;
+
     static const QString keyChangeReason;
     static const QString keyMessage;
     static const QString keyContactIds;
@@ -837,9 +917,8 @@ void Channel::Private::buildContacts()
             pendingGroupLocalPendingMembers +
             pendingGroupRemotePendingMembers).toList();
 
-    if (currentGroupMembersChangedInfo &&
-            currentGroupMembersChangedInfo->actor != 0) {
-        toBuild.append(currentGroupMembersChangedInfo->actor);
+    if (currentGroupMembersChangedInfo) {
+        toBuild.append(currentGroupMembersChangedInfo->actors().toList());
     }
 
     if (!initiatorContact && initiatorHandle) {
@@ -928,7 +1007,7 @@ void Channel::Private::processMembersChanged()
     // contact is the same as the current contact.
     pendingRetrieveGroupSelfContact = false;
 
-    currentGroupMembersChangedInfo = groupMembersChangedQueue.dequeue();
+    currentGroupMembersChangedInfo = dequeueMembersChanged();
 
     foreach (uint handle, currentGroupMembersChangedInfo->added) {
         if (!groupContacts.contains(handle)) {
@@ -964,14 +1043,97 @@ void Channel::Private::processMembersChanged()
     buildContacts();
 }
 
+Channel::Private::GroupMembersChangedInfo *Channel::Private::dequeueMembersChanged()
+{
+    GroupMembersChangedInfo *info = groupMembersChangedQueue.dequeue();
+    if (groupMembersChangedQueue.isEmpty()) {
+        return info;
+    }
+
+    // More changes arrived while building the contacts for the previous one, as when a big room
+    // replays its members: merge them all into their net effect, so that they take a single
+    // contacts build and a single groupMembersChanged() emission. The last change of each handle
+    // decides which list it ends up in, removals coming last within a change as in
+    // updateContacts().
+    enum { Members, LocalPending, RemotePending, Removed, ListCount };
+
+    QList<uint> handles;
+    QHash<uint, QPair<int, int> > fates;
+    QSet<uint> removedOnTheWay;
+    QList<QVariantMap> eventDetails;
+    for (;;) {
+        int event = eventDetails.size();
+        eventDetails.append(info->details);
+
+        const UIntList *lists[ListCount] = {
+            &info->added, &info->localPending, &info->remotePending, &info->removed
+        };
+        for (int list = 0; list < ListCount; ++list) {
+            foreach (uint handle, *lists[list]) {
+                if (!fates.contains(handle)) {
+                    handles.append(handle);
+                }
+                fates.insert(handle, qMakePair(list, event));
+                if (list == Removed) {
+                    removedOnTheWay.insert(handle);
+                }
+            }
+        }
+        delete info;
+
+        if (groupMembersChangedQueue.isEmpty()) {
+            break;
+        }
+        info = groupMembersChangedQueue.dequeue();
+    }
+
+    UIntList lists[ListCount];
+    foreach (uint handle, handles) {
+        int list = fates.value(handle).first;
+        lists[list].append(handle);
+
+        // Removed, then put back as pending: the net change doesn't say it left the list it is
+        // in now, unlike a single change would. Becoming a member already takes it out of the
+        // pending lists.
+        if ((list != LocalPending && list != RemotePending) || !removedOnTheWay.contains(handle)) {
+            continue;
+        }
+
+        if (groupContacts.contains(handle) ||
+                (list == RemotePending && groupLocalPendingContacts.contains(handle))) {
+            lists[Removed].append(handle);
+        } else if (list == LocalPending && groupRemotePendingContacts.contains(handle)) {
+            // Removals go through the members and the local pending lists first, where we are
+            // about to add it
+            groupRemotePendingMembersToRemove.append(handle);
+        }
+    }
+
+    info = new GroupMembersChangedInfo(lists[Members], lists[Removed],
+            lists[LocalPending], lists[RemotePending], eventDetails.last());
+    info->eventDetails = eventDetails;
+    foreach (uint handle, handles) {
+        info->handleEvents.insert(handle, fates.value(handle).second);
+    }
+
+    debug() << "Coalesced" << eventDetails.size() << "group membership changes into one";
+    return info;
+}
+
 void Channel::Private::updateContacts(const QList<ContactPtr> &contacts)
 {
     Contacts groupContactsAdded;
     Contacts groupLocalPendingContactsAdded;
     Contacts groupRemotePendingContactsAdded;
     ContactPtr actorContact;
+    QHash<uint, ContactPtr> actorContacts;
+    QSet<uint> actors;
     bool selfContactUpdated = false;
 
+    if (currentGroupMembersChangedInfo) {
+        actors = currentGroupMembersChangedInfo->actors();
+    }
+
     debug() << "Entering Chan::Priv::updateContacts() with" << contacts.size() << "contacts";
 
     // FIXME: simplify. Some duplication of logic present.
@@ -1015,6 +1177,10 @@ void Channel::Private::updateContacts(const QList<ContactPtr> &contacts)
             currentGroupMembersChangedInfo->actor == contact->handle()[0]) {
             actorContact = contact;
         }
+
+        if (actors.contains(handle)) {
+            actorContacts.insert(handle, contact);
+        }
     }
 
     if (!groupSelfHandle && groupSelfContact) {
@@ -1031,24 +1197,29 @@ void Channel::Private::updateContacts(const QList<ContactPtr> &contacts)
     foreach (ContactPtr contact, contacts) {
         uint handle = contact->handle()[0];
         if (groupLocalPendingContactsChangeInfo.contains(handle)) {
+            QVariantMap handleDetails = currentGroupMembersChangedInfo ?
+                currentGroupMembersChangedInfo->detailsFor(handle) : QVariantMap();
             groupLocalPendingContactsChangeInfo[handle] =
-                GroupMemberChangeDetails(actorContact,
-                        currentGroupMembersChangedInfo ? currentGroupMembersChangedInfo->details : QVariantMap());
+                GroupMemberChangeDetails(
+                        actorContacts.value(qdbus_cast<uint>(handleDetails.value(keyActor))),
+                        handleDetails);
         }
     }
 
     Contacts groupContactsRemoved;
     ContactPtr contactToRemove;
+    int localPendingRemoved = 0;
+    int remotePendingRemoved = 0;
     foreach (uint handle, groupMembersToRemove) {
         if (groupContacts.contains(handle)) {
             contactToRemove = groupContacts[handle];
             groupContacts.remove(handle);
         } else if (groupLocalPendingContacts.contains(handle)) {
             contactToRemove = groupLocalPendingContacts[handle];
-            groupLocalPendingContacts.remove(handle);
+            localPendingRemoved += groupLocalPendingContacts.remove(handle);
         } else if (groupRemotePendingContacts.contains(handle)) {
             contactToRemove = groupRemotePendingContacts[handle];
-            groupRemotePendingContacts.remove(handle);
+            remotePendingRemoved += groupRemotePendingContacts.remove(handle);
         }
 
         if (groupLocalPendingContactsChangeInfo.contains(handle)) {
@@ -1063,15 +1234,26 @@ void Channel::Private::updateContacts(const QList<ContactPtr> &contacts)
 
     // FIXME: drop the LPToRemove and RPToRemove sets - they're redundant
     foreach (uint handle, groupLocalPendingMembersToRemove) {
-        groupLocalPendingContacts.remove(handle);
+        localPendingRemoved += groupLocalPendingContacts.remove(handle);
     }
     groupLocalPendingMembersToRemove.clear();
 
     foreach (uint handle, groupRemotePendingMembersToRemove) {
-        groupRemotePendingContacts.remove(handle);
+        remotePendingRemoved += groupRemotePendingContacts.remove(handle);
     }
     groupRemotePendingMembersToRemove.clear();
 
+    // The snapshots without the self contact follow groupSelfContact on their own
+    if (!groupContactsAdded.isEmpty() || !groupContactsRemoved.isEmpty()) {
+        groupContactsSnapshot.invalidate();
+    }
+    if (!groupLocalPendingContactsAdded.isEmpty() || localPendingRemoved) {
+        groupLocalPendingContactsSnapshot.invalidate();
+    }
+    if (!groupRemotePendingContactsAdded.isEmpty() || remotePendingRemoved) {
+        groupRemotePendingContactsSnapshot.invalidate();
+    }
+
     if (!groupContactsAdded.isEmpty() ||
         !groupLocalPendingContactsAdded.isEmpty() ||
         !groupRemotePendingContactsAdded.isEmpty() ||
@@ -1080,12 +1262,43 @@ void Channel::Private::updateContacts(const QList<ContactPtr> &contacts)
                 actorContact,
                 currentGroupMembersChangedInfo ? currentGroupMembersChangedInfo->details : QVariantMap());
 
+        if (currentGroupMembersChangedInfo && currentGroupMembersChangedInfo->changeCount() > 1) {
+            // Keep the details of each of the coalesced changes, for the contacts it decided on
+            QHash<int, GroupMemberChangeDetails> eventChangeDetails;
+            QList<const Contacts *> changed;
+            changed << &groupContactsAdded << &groupLocalPendingContactsAdded <<
+                &groupRemotePendingContactsAdded << &groupContactsRemoved;
+            foreach (const Contacts *contactsChanged, changed) {
+                foreach (const ContactPtr &contact, *contactsChanged) {
+                    int event = currentGroupMembersChangedInfo->handleEvents.value(
+                            contact->handle()[0], -1);
+                    if (event < 0) {
+                        continue;
+                    }
+
+                    if (!eventChangeDetails.contains(event)) {
+                        const QVariantMap &eventDetails =
+                            currentGroupMembersChangedInfo->eventDetails[event];
+                        eventChangeDetails.insert(event, GroupMemberChangeDetails(
+                                    actorContacts.value(qdbus_cast<uint>(
+                                            eventDetails.value(keyActor))),
+                                    eventDetails));
+                    }
+                    details.mPriv->contactDetails.insert(contact, eventChangeDetails.value(event));
+                }
+            }
+            details.mPriv->changeCount = currentGroupMembersChangedInfo->changeCount();
+        }
+
         if (currentGroupMembersChangedInfo
                 && currentGroupMembersChangedInfo->removed.contains(groupSelfHandle)) {
             // Update groupSelfContactRemoveInfo with the proper actor in case
             // the actor was not available by the time onMembersChangedDetailed
             // was called.
-            groupSelfContactRemoveInfo = details;
+            QVariantMap selfDetails = currentGroupMembersChangedInfo->detailsFor(groupSelfHandle);
+            groupSelfContactRemoveInfo = GroupMemberChangeDetails(
+                    actorContacts.value(qdbus_cast<uint>(selfDetails.value(keyActor))),
+                    selfDetails);
         }
 
         if (parent->isReady(Channel::FeatureCore)) {
@@ -1244,10 +1457,14 @@ void Channel::Private::processConferenceChannelRemoved()
 struct TP_QT_NO_EXPORT Channel::GroupMemberChangeDetails::Private : public QSharedData
 {
     Private(const ContactPtr &actor, const QVariantMap &details)
-        : actor(actor), details(details) {}
+        : actor(actor), details(details), changeCount(1) {}
 
     ContactPtr actor;
     QVariantMap details;
+
+    // Only set when several changes were coalesced
+    int changeCount;
+    QHash<ContactPtr, GroupMemberChangeDetails> contactDetails;
 };
 
 /**
@@ -1419,6 +1636,43 @@ QVariantMap Channel::GroupMemberChangeDetails::allDetails() const
     return isValid() ? mPriv->details : QVariantMap();
 }
 
+/**
+ * Return the number of membership changes signalled by the service that these details cover.
+ *
+ * When the service signals many membership changes in a row, as a big chat room does when
+ * replaying its members, Channel merges the changes queued while it was busy building contacts
+ * into their net effect, and emits a single groupMembersChanged() signal for them. The details
+ * are then those of the last of the changes, and detailsFor() gives the details of the change
+ * that affected a given contact.
+ *
+ * \return The number of changes, which is 1 unless several changes were merged.
+ * \sa detailsFor()
+ */
+int Channel::GroupMemberChangeDetails::changeCount() const
+{
+    return isValid() ? mPriv->changeCount : 1;
+}
+
+/**
+ * Return the details of the membership change which affected \a contact.
+ *
+ * This is only different from these details when several changes were merged, see
+ * changeCount().
+ *
+ * \param contact One of the contacts signalled along with these details.
+ * \return The details of the last change affecting \a contact, or these details if there are no
+ *         specific ones for it.
+ * \sa changeCount()
+ */
+Channel::GroupMemberChangeDetails Channel::GroupMemberChangeDetails::detailsFor(
+        const ContactPtr &contact) const
+{
+    if (!isValid()) {
+        return *this;
+    }
+    return mPriv->contactDetails.value(contact, *this);
+}
+
 Channel::GroupMemberChangeDetails::GroupMemberChangeDetails(const ContactPtr &actor,
         const QVariantMap &details)
     : mPriv(new Private(actor, details))
@@ -2375,11 +2629,8 @@ Contacts Channel::groupContacts(bool includeSelfContact) const
         warning() << "Channel::groupMembers() used channel not ready";
     }
 
-    Contacts ret = mPriv->groupContacts.values().toSet();
-    if (!includeSelfContact) {
-        ret.remove(groupSelfContact());
-    }
-    return ret;
+    return mPriv->groupContactsSnapshot.contacts(mPriv->groupContacts, mPriv->groupSelfContact,
+            includeSelfContact);
 }
 
 /**
@@ -2406,11 +2657,8 @@ Contacts Channel::groupLocalPendingContacts(bool includeSelfContact) const
         warning() << "Channel::groupLocalPendingContacts() used with no group interface";
     }
 
-    Contacts ret = mPriv->groupLocalPendingContacts.values().toSet();
-    if (!includeSelfContact) {
-        ret.remove(groupSelfContact());
-    }
-    return ret;
+    return mPriv->groupLocalPendingContactsSnapshot.contacts(mPriv->groupLocalPendingContacts, mPriv->groupSelfContact,
+            includeSelfContact);
 }
 
 /**
@@ -2438,11 +2686,8 @@ Contacts Channel::groupRemotePendingContacts(bool includeSelfContact) const
             "group interface";
     }
 
-    Contacts ret = mPriv->groupRemotePendingContacts.values().toSet();
-    if (!includeSelfContact) {
-        ret.remove(groupSelfContact());
-    }
-    return ret;
+    return mPriv->groupRemotePendingContactsSnapshot.contacts(mPriv->groupRemotePendingContacts, mPriv->groupSelfContact,
+            includeSelfContact);
 }
 
 /**
@@ -130,6 +130,9 @@ public:
 
         QVariantMap allDetails() const;
 
+        int changeCount() const;
+        GroupMemberChangeDetails detailsFor(const ContactPtr &contact) const;
+
     private:
         friend class Channel;
         friend class Contact;
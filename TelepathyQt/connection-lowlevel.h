@@ -71,9 +71,28 @@ public:
             const QStringList &interfaces, bool reference = true);
     QStringList contactAttributeInterfaces() const;
 
+    uint contactAttributesChunkSize() const;
+    void setContactAttributesChunkSize(uint chunkSize);
+    uint maxContactAttributesChunksInFlight() const;
+    void setMaxContactAttributesChunksInFlight(uint maxChunks);
+
+    int handleReleaseGracePeriod() const;
+    void setHandleReleaseGracePeriod(int msec);
+    uint handleReleaseBatchSize() const;
+    void setHandleReleaseBatchSize(uint size);
+    quint64 releasedHandlesCount() const;
+    quint64 resurrectedHandlesCount() const;
+
     void injectContactIds(const HandleIdentifierMap &contactIds);
     void injectContactId(uint handle, const QString &contactId);
 
+    int contactIdCacheCapacity() const;
+    void setContactIdCacheCapacity(int capacity);
+    int contactIdCacheSize() const;
+    quint64 contactIdCacheHits() const;
+    quint64 contactIdCacheMisses() const;
+    quint64 contactIdCacheEvictions() const;
+
 private:
     friend class Connection;
     friend class ContactManager;
@@ -83,6 +102,11 @@ private:
 
     TP_QT_NO_EXPORT bool hasImmortalHandles() const;
 
+    TP_QT_NO_EXPORT PendingContactAttributes *checkContactAttributes(const UIntList &handles,
+            const QStringList &interfaces, bool reference);
+    TP_QT_NO_EXPORT void contactAttributesRequestStarted();
+    TP_QT_NO_EXPORT void contactAttributesRequestLanded();
+
     TP_QT_NO_EXPORT bool hasContactId(uint handle) const;
     TP_QT_NO_EXPORT QString contactId(uint handle) const;
 
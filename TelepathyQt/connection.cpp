@@ -30,6 +30,7 @@
 #include "TelepathyQt/_gen/connection-internal.moc.hpp"
 #include "TelepathyQt/_gen/connection-lowlevel.moc.hpp"
 
+#include "TelepathyQt/contact-id-cache-internal.h"
 #include "TelepathyQt/debug-internal.h"
 
 #include <TelepathyQt/ChannelFactory>
@@ -46,6 +47,7 @@
 #include <TelepathyQt/PendingVoid>
 #include <TelepathyQt/ReferencedHandles>
 
+#include <QElapsedTimer>
 #include <QMetaObject>
 #include <QMutex>
 #include <QMutexLocker>
@@ -89,6 +91,8 @@ struct TP_QT_NO_EXPORT Connection::Private
     void invalidateResetCaps(const QString &errorName, const QString &errorMessage);
 
     struct HandleContext;
+    // To be called with the lock of the handle type held
+    void scheduleReleaseSweep(uint handleType);
 
     // Public object
     Connection *parent;
@@ -150,6 +154,11 @@ struct TP_QT_NO_EXPORT Connection::Private
     static QMutex handleContextsLock;
     HandleContext *handleContext;
 
+    // How this proxy schedules handle release sweeps, see HandleContext::Type::releaseScheduler
+    int handleReleaseGracePeriod;
+    uint handleReleaseBatchSize;
+    QTimer *releaseTimers[NUM_HANDLE_TYPES];
+
     QString cmName;
     QString protocolName;
 };
@@ -157,29 +166,85 @@ struct TP_QT_NO_EXPORT Connection::Private
 struct TP_QT_NO_EXPORT ConnectionLowlevel::Private
 {
     Private(Connection *conn)
-        : conn(conn)
+        : conn(conn),
+          contactAttributesChunkSize(0),
+          maxContactAttributesChunksInFlight(4)
     {
     }
 
+    // Keeps the identifiers of the contacts alive
+    struct LiveContact
+    {
+        LiveContact(const ContactManagerPtr &manager) : manager(manager) { }
+
+        bool operator()(uint handle) const
+        {
+            return manager && manager->lookupContactByHandle(handle);
+        }
+
+        ContactManagerPtr manager;
+    };
+
     WeakPtr<Connection> conn;
-    HandleIdentifierMap contactsIds;
+    ContactIdCache contactsIds;
+
+    uint contactAttributesChunkSize;
+    uint maxContactAttributesChunksInFlight;
 };
 
 // Handle tracking
 struct TP_QT_NO_EXPORT Connection::Private::HandleContext
 {
+    // Each handle type is tracked under its own lock, so that the contact handles churning don't
+    // hold up the other types
     struct Type
     {
-        QHash<uint, uint> refcounts;
-        QSet<uint> toRelease;
-        uint requestsInFlight;
-        bool releaseScheduled;
-
         Type()
             : requestsInFlight(0),
-              releaseScheduled(false)
+              releaseScheduled(false),
+              releaseScheduler(0),
+              releaseDelay(0),
+              releasedCount(0),
+              resurrectedCount(0)
+        {
+        }
+
+        void ref(uint handle)
+        {
+            uint &count = refcounts[handle];
+            if (!count++ && toRelease.remove(handle)) {
+                // Still ours, as the sweep didn't release it yet
+                ++resurrectedCount;
+            }
+        }
+
+        // Return whether the last reference to the handle was lost
+        bool unref(uint handle)
         {
+            QHash<uint, uint>::iterator i = refcounts.find(handle);
+            Q_ASSERT(i != refcounts.end());
+            if (i == refcounts.end() || --i.value()) {
+                return false;
+            }
+
+            refcounts.erase(i);
+            toRelease.insert(handle);
+            return true;
         }
+
+        QMutex lock;
+        QHash<uint, uint> refcounts;
+        QSet<uint> toRelease;
+        uint requestsInFlight;
+        // A sweep is pending, either right away or once the grace period ends
+        bool releaseScheduled;
+        // The proxy whose timer does the pending sweep. Each proxy arms its own timer in its own
+        // thread, and hands the sweep over to another proxy if it goes away before doing it.
+        Connection *releaseScheduler;
+        int releaseDelay;
+        QElapsedTimer releaseClock;
+        quint64 releasedCount;
+        quint64 resurrectedCount;
     };
 
     HandleContext()
@@ -187,9 +252,18 @@ struct TP_QT_NO_EXPORT Connection::Private::HandleContext
     {
     }
 
+    Type *type(uint handleType)
+    {
+        if (handleType >= static_cast<uint>(NUM_HANDLE_TYPES)) {
+            warning() << "Invalid handle type" << handleType;
+            return 0;
+        }
+        return &types[handleType];
+    }
+
     int refcount;
-    QMutex lock;
-    QHash<uint, Type> types;
+    QList<Connection *> proxies;
+    Type types[NUM_HANDLE_TYPES];
 };
 
 Connection::Private::Private(Connection *parent,
@@ -214,11 +288,21 @@ Connection::Private::Private(Connection *parent,
       introspectingSelfContact(false),
       reintrospectSelfContactRequired(false),
       maxPresenceStatusMessageLength(0),
-      handleContext(0)
+      handleContext(0),
+      handleReleaseGracePeriod(0),
+      handleReleaseBatchSize(0)
 {
     accountBalance.amount = 0;
     accountBalance.scale = 0;
 
+    for (uint handleType = 0; handleType < NUM_HANDLE_TYPES; ++handleType) {
+        releaseTimers[handleType] = new QTimer(parent);
+        releaseTimers[handleType]->setSingleShot(true);
+        parent->connect(releaseTimers[handleType],
+                SIGNAL(timeout()),
+                SLOT(onReleaseSweepTimeout()));
+    }
+
     Q_ASSERT(properties != 0);
 
     if (chanFactory->dbusConnection().name() != parent->dbusConnection().name()) {
@@ -337,12 +421,13 @@ Connection::Private::~Private()
 
     QMutexLocker locker(&handleContextsLock);
     // All handle contexts locked, so safe
+    handleContext->proxies.removeOne(parent);
     if (!--handleContext->refcount) {
         if (!immortalHandles) {
             debug() << "Destroying HandleContext";
 
-            foreach (uint handleType, handleContext->types.keys()) {
-                HandleContext::Type type = handleContext->types[handleType];
+            for (uint handleType = 0; handleType < NUM_HANDLE_TYPES; ++handleType) {
+                HandleContext::Type &type = handleContext->types[handleType];
 
                 if (!type.refcounts.empty()) {
                     debug() << " Still had references to" <<
@@ -364,7 +449,49 @@ Connection::Private::~Private()
         delete handleContext;
     } else {
         Q_ASSERT(handleContext->refcount > 0);
+
+        // Let another proxy do the sweeps we were going to do
+        for (uint handleType = 0; handleType < NUM_HANDLE_TYPES; ++handleType) {
+            HandleContext::Type &type = handleContext->types[handleType];
+            QMutexLocker typeLocker(&type.lock);
+
+            if (type.releaseScheduled && type.releaseScheduler == parent) {
+                debug() << "Handing the release sweep for type" << handleType << "over";
+                type.releaseScheduler = handleContext->proxies.first();
+                QMetaObject::invokeMethod(type.releaseScheduler, "armReleaseSweep",
+                        Qt::QueuedConnection, Q_ARG(uint, handleType));
+            }
+        }
+    }
+}
+
+void Connection::Private::scheduleReleaseSweep(uint handleType)
+{
+    HandleContext::Type *type = handleContext->type(handleType);
+    if (type->requestsInFlight) {
+        // handleRequestLanded() will get back here
+        return;
     }
+
+    bool full = handleReleaseBatchSize > 0 &&
+        static_cast<uint>(type->toRelease.size()) >= handleReleaseBatchSize;
+    int delay = full ? 0 : qMax(handleReleaseGracePeriod, 0);
+    if (type->releaseScheduled && (delay > 0 || type->releaseDelay == 0)) {
+        return;
+    }
+
+    // Reaching the batch size takes the pending sweep over with no delay, rather than sweeping
+    // on top of the grace period. We might be in any thread, so the timer is armed from the
+    // event loop of this proxy.
+    debug() << "Lost last reference to at least one handle of type" <<
+        handleType << "and no requests in flight for that type - scheduling a release sweep in" <<
+        delay << "ms";
+    type->releaseScheduled = true;
+    type->releaseScheduler = parent;
+    type->releaseDelay = delay;
+    type->releaseClock.start();
+    QMetaObject::invokeMethod(parent, "armReleaseSweep",
+            Qt::QueuedConnection, Q_ARG(uint, handleType));
 }
 
 void Connection::Private::init()
@@ -398,6 +525,7 @@ void Connection::Private::init()
 
     // All handle contexts locked, so safe
     ++handleContext->refcount;
+    handleContext->proxies.append(parent);
 }
 
 void Connection::Private::introspectMain(Connection::Private *self)
@@ -1989,9 +2117,12 @@ PendingHandles *ConnectionLowlevel::requestHandles(HandleType handleType, const
 
     ConnectionPtr conn(connection());
     if (!hasImmortalHandles()) {
-        Connection::Private::HandleContext *handleContext = conn->mPriv->handleContext;
-        QMutexLocker locker(&handleContext->lock);
-        handleContext->types[handleType].requestsInFlight++;
+        Connection::Private::HandleContext::Type *type =
+            conn->mPriv->handleContext->type(handleType);
+        if (type) {
+            QMutexLocker locker(&type->lock);
+            type->requestsInFlight++;
+        }
     }
 
     PendingHandles *pending =
@@ -2042,13 +2173,14 @@ PendingHandles *ConnectionLowlevel::referenceHandles(HandleType handleType, cons
     ConnectionPtr conn(connection());
     UIntList alreadyHeld;
     UIntList notYetHeld;
-    if (!hasImmortalHandles()) {
-        Connection::Private::HandleContext *handleContext = conn->mPriv->handleContext;
-        QMutexLocker locker(&handleContext->lock);
+    Connection::Private::HandleContext::Type *type = hasImmortalHandles() ? 0 :
+        conn->mPriv->handleContext->type(handleType);
+    if (type) {
+        QMutexLocker locker(&type->lock);
 
         foreach (uint handle, handles) {
-            if (handleContext->types[handleType].refcounts.contains(handle) ||
-                handleContext->types[handleType].toRelease.contains(handle)) {
+            if (type->refcounts.contains(handle) ||
+                type->toRelease.contains(handle)) {
                 alreadyHeld.push_back(handle);
             }
             else {
@@ -2162,6 +2294,28 @@ PendingContactAttributes *ConnectionLowlevel::contactAttributes(const UIntList &
 {
     debug() << "Request for attributes for" << handles.size() << "contacts";
 
+    PendingContactAttributes *failed = checkContactAttributes(handles, interfaces, reference);
+    if (failed) {
+        return failed;
+    }
+
+    PendingContactAttributes *pending =
+        new PendingContactAttributes(ConnectionPtr(connection()),
+                handles, interfaces, reference);
+    contactAttributesRequestStarted();
+    pending->start(mPriv->contactAttributesChunkSize, mPriv->maxContactAttributesChunksInFlight);
+    return pending;
+}
+
+/**
+ * Check whether a request for contact attributes can be made right now.
+ *
+ * \return A PendingContactAttributes which has already failed if the request can't be made, or
+ *         \c 0 if it can.
+ */
+PendingContactAttributes *ConnectionLowlevel::checkContactAttributes(const UIntList &handles,
+        const QStringList &interfaces, bool reference)
+{
     if (!isValid()) {
         PendingContactAttributes *pending = new PendingContactAttributes(ConnectionPtr(),
                 handles, interfaces, reference);
@@ -2171,41 +2325,244 @@ PendingContactAttributes *ConnectionLowlevel::contactAttributes(const UIntList &
     }
 
     ConnectionPtr conn(connection());
-    PendingContactAttributes *pending =
-        new PendingContactAttributes(conn,
-                handles, interfaces, reference);
     if (!conn->isReady(Connection::FeatureCore)) {
         warning() << "ConnectionLowlevel::contactAttributes() used when not ready";
+        PendingContactAttributes *pending =
+            new PendingContactAttributes(conn, handles, interfaces, reference);
         pending->failImmediately(TP_QT_ERROR_NOT_AVAILABLE,
                 QLatin1String("The connection isn't ready"));
         return pending;
     } else if (conn->mPriv->pendingStatus != ConnectionStatusConnected) {
         warning() << "ConnectionLowlevel::contactAttributes() used with status" << conn->status() << "!= ConnectionStatusConnected";
+        PendingContactAttributes *pending =
+            new PendingContactAttributes(conn, handles, interfaces, reference);
         pending->failImmediately(TP_QT_ERROR_NOT_AVAILABLE,
                 QLatin1String("The connection isn't Connected"));
         return pending;
     } else if (!conn->interfaces().contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACTS)) {
         warning() << "ConnectionLowlevel::contactAttributes() used without the remote object supporting"
                   << "the Contacts interface";
+        PendingContactAttributes *pending =
+            new PendingContactAttributes(conn, handles, interfaces, reference);
         pending->failImmediately(TP_QT_ERROR_NOT_IMPLEMENTED,
                 QLatin1String("The connection doesn't support the Contacts interface"));
         return pending;
     }
 
-    if (!hasImmortalHandles()) {
-        Connection::Private::HandleContext *handleContext = conn->mPriv->handleContext;
-        QMutexLocker locker(&handleContext->lock);
-        handleContext->types[HandleTypeContact].requestsInFlight++;
+    return 0;
+}
+
+/**
+ * Count a request for contact attributes as in flight, so that no release sweep releases the
+ * handles it asks for until contactAttributesRequestLanded() is called.
+ */
+void ConnectionLowlevel::contactAttributesRequestStarted()
+{
+    if (!isValid() || hasImmortalHandles()) {
+        return;
     }
 
-    Client::ConnectionInterfaceContactsInterface *contactsInterface =
-        conn->interface<Client::ConnectionInterfaceContactsInterface>();
-    QDBusPendingCallWatcher *watcher =
-        new QDBusPendingCallWatcher(contactsInterface->GetContactAttributes(handles, interfaces,
-                    reference));
-    pending->connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
-                              SLOT(onCallFinished(QDBusPendingCallWatcher*)));
-    return pending;
+    Connection::Private::HandleContext::Type *type =
+        connection()->mPriv->handleContext->type(HandleTypeContact);
+    QMutexLocker locker(&type->lock);
+    type->requestsInFlight++;
+}
+
+void ConnectionLowlevel::contactAttributesRequestLanded()
+{
+    if (!isValid()) {
+        return;
+    }
+
+    connection()->handleRequestLanded(HandleTypeContact);
+}
+
+/**
+ * Return the maximum number of handles requested in a single D-Bus call by contactAttributes().
+ *
+ * \return The chunk size, or 0 if requests are never split.
+ * \sa setContactAttributesChunkSize()
+ */
+uint ConnectionLowlevel::contactAttributesChunkSize() const
+{
+    return mPriv->contactAttributesChunkSize;
+}
+
+/**
+ * Set the maximum number of handles requested in a single D-Bus call by contactAttributes().
+ *
+ * Requests for more handles than \a chunkSize are split into several
+ * GetContactAttributes calls, of which at most maxContactAttributesChunksInFlight() are
+ * pending at any time. This avoids sending a single huge message when retrieving very large
+ * contact lists, which blocks the connection manager and requires demarshalling the whole
+ * reply at once. PendingContactAttributes::attributesReceived() is emitted as each chunk
+ * arrives, and PendingContacts builds the contacts progressively, emitting
+ * PendingContacts::contactsRetrieved().
+ *
+ * This also applies to the requests made by ContactManager.
+ *
+ * The default is 0, meaning that requests are never split.
+ *
+ * \param chunkSize The chunk size, or 0 to disable splitting.
+ * \sa setMaxContactAttributesChunksInFlight()
+ */
+void ConnectionLowlevel::setContactAttributesChunkSize(uint chunkSize)
+{
+    mPriv->contactAttributesChunkSize = chunkSize;
+}
+
+/**
+ * Return the maximum number of chunked GetContactAttributes calls which may be pending at the
+ * same time for a single contactAttributes() request.
+ *
+ * \return The maximum number of chunks in flight.
+ * \sa setMaxContactAttributesChunksInFlight()
+ */
+uint ConnectionLowlevel::maxContactAttributesChunksInFlight() const
+{
+    return mPriv->maxContactAttributesChunksInFlight;
+}
+
+/**
+ * Set the maximum number of chunked GetContactAttributes calls which may be pending at the
+ * same time for a single contactAttributes() request.
+ *
+ * This only has an effect if a chunk size has been set with setContactAttributesChunkSize().
+ * The default is 4. Values lower than 1 are treated as 1.
+ *
+ * \param maxChunks The maximum number of chunks in flight.
+ * \sa setContactAttributesChunkSize()
+ */
+void ConnectionLowlevel::setMaxContactAttributesChunksInFlight(uint maxChunks)
+{
+    mPriv->maxContactAttributesChunksInFlight = maxChunks;
+}
+
+/**
+ * Return how long handles which are no longer referenced are kept before being released.
+ *
+ * \return The grace period in milliseconds.
+ * \sa setHandleReleaseGracePeriod()
+ */
+int ConnectionLowlevel::handleReleaseGracePeriod() const
+{
+    if (!isValid()) {
+        return 0;
+    }
+
+    ConnectionPtr conn(connection());
+    return conn->mPriv->handleReleaseGracePeriod;
+}
+
+/**
+ * Set how long handles which are no longer referenced are kept before being released.
+ *
+ * The handles losing their last reference within the grace period are released together in a
+ * single ReleaseHandles call at its end. A handle referenced again before that, for instance
+ * because a contact leaving a chat room comes back, is simply kept, without any D-Bus call.
+ *
+ * The default is 0, which releases the handles as soon as the control returns to the
+ * event loop.
+ *
+ * \param msec The grace period in milliseconds.
+ * \sa setHandleReleaseBatchSize(), resurrectedHandlesCount()
+ */
+void ConnectionLowlevel::setHandleReleaseGracePeriod(int msec)
+{
+    if (!isValid()) {
+        warning() << "ConnectionLowlevel::setHandleReleaseGracePeriod() called for a destroyed "
+            "Connection";
+        return;
+    }
+
+    ConnectionPtr conn(connection());
+    conn->mPriv->handleReleaseGracePeriod = msec;
+}
+
+/**
+ * Return the number of handles waiting for release which cuts the grace period short.
+ *
+ * \return The batch size, or 0 if there is no limit.
+ * \sa setHandleReleaseBatchSize()
+ */
+uint ConnectionLowlevel::handleReleaseBatchSize() const
+{
+    if (!isValid()) {
+        return 0;
+    }
+
+    ConnectionPtr conn(connection());
+    return conn->mPriv->handleReleaseBatchSize;
+}
+
+/**
+ * Set the number of handles waiting for release which cuts the grace period short.
+ *
+ * Once that many handles of a type are waiting for the grace period set with
+ * setHandleReleaseGracePeriod() to end, they are released right away. The default is 0, meaning
+ * no limit.
+ *
+ * \param size The batch size.
+ * \sa setHandleReleaseGracePeriod()
+ */
+void ConnectionLowlevel::setHandleReleaseBatchSize(uint size)
+{
+    if (!isValid()) {
+        warning() << "ConnectionLowlevel::setHandleReleaseBatchSize() called for a destroyed "
+            "Connection";
+        return;
+    }
+
+    ConnectionPtr conn(connection());
+    conn->mPriv->handleReleaseBatchSize = size;
+}
+
+/**
+ * Return the number of handles released so far by the handle tracking shared by all the
+ * Connection objects for this connection.
+ *
+ * \return The number of handles released.
+ * \sa resurrectedHandlesCount()
+ */
+quint64 ConnectionLowlevel::releasedHandlesCount() const
+{
+    if (!isValid() || hasImmortalHandles()) {
+        return 0;
+    }
+
+    ConnectionPtr conn(connection());
+    quint64 ret = 0;
+    for (uint handleType = 0; handleType < NUM_HANDLE_TYPES; ++handleType) {
+        Connection::Private::HandleContext::Type *type =
+            conn->mPriv->handleContext->type(handleType);
+        QMutexLocker locker(&type->lock);
+        ret += type->releasedCount;
+    }
+    return ret;
+}
+
+/**
+ * Return the number of handles which were referenced again while waiting to be released, and
+ * thus never had to be released and requested again.
+ *
+ * \return The number of handles resurrected.
+ * \sa releasedHandlesCount(), setHandleReleaseGracePeriod()
+ */
+quint64 ConnectionLowlevel::resurrectedHandlesCount() const
+{
+    if (!isValid() || hasImmortalHandles()) {
+        return 0;
+    }
+
+    ConnectionPtr conn(connection());
+    quint64 ret = 0;
+    for (uint handleType = 0; handleType < NUM_HANDLE_TYPES; ++handleType) {
+        Connection::Private::HandleContext::Type *type =
+            conn->mPriv->handleContext->type(handleType);
+        QMutexLocker locker(&type->lock);
+        ret += type->resurrectedCount;
+    }
+    return ret;
 }
 
 QStringList ConnectionLowlevel::contactAttributeInterfaces() const
@@ -2233,19 +2590,22 @@ void ConnectionLowlevel::injectContactIds(const HandleIdentifierMap &contactIds)
         return;
     }
 
+    ConnectionPtr conn(connection());
+    Private::LiveContact isLive(conn ? conn->contactManager() : ContactManagerPtr());
+
     for (HandleIdentifierMap::const_iterator i = contactIds.constBegin();
             i != contactIds.constEnd(); ++i) {
         uint handle = i.key();
         QString id = i.value();
 
         if (!id.isEmpty()) {
-            QString currentId = mPriv->contactsIds.value(handle);
+            QString currentId = mPriv->contactsIds.peek(handle);
 
             if (!currentId.isEmpty() && id != currentId) {
                 warning() << "Trying to overwrite contact id from" << currentId << "to" << id
                     << "for the same handle" << handle << ", ignoring";
             } else {
-                mPriv->contactsIds.insert(handle, id);
+                mPriv->contactsIds.insert(handle, id, isLive);
             }
         }
     }
@@ -2268,6 +2628,83 @@ QString ConnectionLowlevel::contactId(uint handle) const
     return mPriv->contactsIds.value(handle);
 }
 
+/**
+ * Return the maximum number of contact identifiers remembered from the injected ones.
+ *
+ * \return The capacity of the contact identifier cache, or 0 if it is not limited.
+ * \sa setContactIdCacheCapacity()
+ */
+int ConnectionLowlevel::contactIdCacheCapacity() const
+{
+    return mPriv->contactsIds.capacity();
+}
+
+/**
+ * Set the maximum number of contact identifiers remembered from the injected ones.
+ *
+ * On connections with immortal handles, the identifiers given to injectContactIds() are
+ * remembered, so that ContactManager::contactsForHandles() can build the contacts without asking
+ * the connection manager. Once the cache is full, the identifiers not looked up lately make room
+ * for the new ones, except those of the contacts still alive, which are always kept. The cache
+ * thus goes over its capacity for as long as there are more contacts alive than that.
+ *
+ * The default capacity is 10000 identifiers. A smaller capacity takes effect progressively, as
+ * more identifiers are injected.
+ *
+ * \param capacity The capacity of the contact identifier cache, or 0 for no limit.
+ * \sa contactIdCacheHits(), contactIdCacheMisses()
+ */
+void ConnectionLowlevel::setContactIdCacheCapacity(int capacity)
+{
+    mPriv->contactsIds.setCapacity(capacity);
+}
+
+/**
+ * Return the number of contact identifiers currently remembered.
+ *
+ * \return The size of the contact identifier cache.
+ * \sa setContactIdCacheCapacity()
+ */
+int ConnectionLowlevel::contactIdCacheSize() const
+{
+    return mPriv->contactsIds.count();
+}
+
+/**
+ * Return the number of contacts built from a remembered identifier, saving a round trip to the
+ * connection manager.
+ *
+ * \return The number of contact identifier cache hits.
+ * \sa contactIdCacheMisses(), setContactIdCacheCapacity()
+ */
+quint64 ConnectionLowlevel::contactIdCacheHits() const
+{
+    return mPriv->contactsIds.hits();
+}
+
+/**
+ * Return the number of contacts whose identifier had to be retrieved from the connection manager
+ * as it wasn't remembered.
+ *
+ * \return The number of contact identifier cache misses.
+ * \sa contactIdCacheHits(), setContactIdCacheCapacity()
+ */
+quint64 ConnectionLowlevel::contactIdCacheMisses() const
+{
+    return mPriv->contactsIds.misses();
+}
+
+/**
+ * Return the number of contact identifiers forgotten so far to stay within the capacity.
+ *
+ * \return The number of contact identifier cache evictions.
+ * \sa setContactIdCacheCapacity()
+ */
+quint64 ConnectionLowlevel::contactIdCacheEvictions() const
+{
+    return mPriv->contactsIds.evictions();
+}
+
 /**
  * Return whether the handles last for the whole lifetime of the connection.
  *
@@ -2307,14 +2744,30 @@ void Connection::refHandle(HandleType handleType, uint handle)
         return;
     }
 
-    Private::HandleContext *handleContext = mPriv->handleContext;
-    QMutexLocker locker(&handleContext->lock);
+    Private::HandleContext::Type *type = mPriv->handleContext->type(handleType);
+    if (!type) {
+        return;
+    }
+
+    QMutexLocker locker(&type->lock);
+    type->ref(handle);
+}
+
+void Connection::refHandles(HandleType handleType, const UIntList &handles)
+{
+    if (mPriv->immortalHandles || handles.isEmpty()) {
+        return;
+    }
 
-    if (handleContext->types[handleType].toRelease.contains(handle)) {
-        handleContext->types[handleType].toRelease.remove(handle);
+    Private::HandleContext::Type *type = mPriv->handleContext->type(handleType);
+    if (!type) {
+        return;
     }
 
-    handleContext->types[handleType].refcounts[handle]++;
+    QMutexLocker locker(&type->lock);
+    for (UIntList::const_iterator i = handles.constBegin(); i != handles.constEnd(); ++i) {
+        type->ref(*i);
+    }
 }
 
 void Connection::unrefHandle(HandleType handleType, uint handle)
@@ -2323,27 +2776,40 @@ void Connection::unrefHandle(HandleType handleType, uint handle)
         return;
     }
 
-    Private::HandleContext *handleContext = mPriv->handleContext;
-    QMutexLocker locker(&handleContext->lock);
+    Private::HandleContext::Type *type = mPriv->handleContext->type(handleType);
+    if (!type) {
+        return;
+    }
+
+    QMutexLocker locker(&type->lock);
+    if (type->unref(handle)) {
+        mPriv->scheduleReleaseSweep(handleType);
+    }
+}
+
+void Connection::unrefHandles(HandleType handleType, const UIntList &handles)
+{
+    if (mPriv->immortalHandles || handles.isEmpty()) {
+        return;
+    }
 
-    Q_ASSERT(handleContext->types.contains(handleType));
-    Q_ASSERT(handleContext->types[handleType].refcounts.contains(handle));
+    Private::HandleContext::Type *type = mPriv->handleContext->type(handleType);
+    if (!type) {
+        return;
+    }
 
-    if (!--handleContext->types[handleType].refcounts[handle]) {
-        handleContext->types[handleType].refcounts.remove(handle);
-        handleContext->types[handleType].toRelease.insert(handle);
+    QMutexLocker locker(&type->lock);
 
-        if (!handleContext->types[handleType].releaseScheduled) {
-            if (!handleContext->types[handleType].requestsInFlight) {
-                debug() << "Lost last reference to at least one handle of type" <<
-                    handleType <<
-                    "and no requests in flight for that type - scheduling a release sweep";
-                QMetaObject::invokeMethod(this, "doReleaseSweep",
-                        Qt::QueuedConnection, Q_ARG(uint, handleType));
-                handleContext->types[handleType].releaseScheduled = true;
-            }
+    bool lostLastReference = false;
+    for (UIntList::const_iterator i = handles.constBegin(); i != handles.constEnd(); ++i) {
+        if (type->unref(*i)) {
+            lostLastReference = true;
         }
     }
+
+    if (lostLastReference) {
+        mPriv->scheduleReleaseSweep(handleType);
+    }
 }
 
 void Connection::doReleaseSweep(uint handleType)
@@ -2352,29 +2818,60 @@ void Connection::doReleaseSweep(uint handleType)
         return;
     }
 
-    Private::HandleContext *handleContext = mPriv->handleContext;
-    QMutexLocker locker(&handleContext->lock);
+    Private::HandleContext::Type *type = mPriv->handleContext->type(handleType);
+    Q_ASSERT(type);
+    QMutexLocker locker(&type->lock);
 
-    Q_ASSERT(handleContext->types.contains(handleType));
-    Q_ASSERT(handleContext->types[handleType].releaseScheduled);
+    if (!type->releaseScheduled || type->releaseScheduler != this) {
+        // Swept already, or another proxy took the sweep over
+        return;
+    }
 
     debug() << "Entering handle release sweep for type" << handleType;
-    handleContext->types[handleType].releaseScheduled = false;
+    type->releaseScheduled = false;
+    type->releaseScheduler = 0;
+    mPriv->releaseTimers[handleType]->stop();
 
-    if (handleContext->types[handleType].requestsInFlight > 0) {
+    if (type->requestsInFlight > 0) {
         debug() << " There are requests in flight, deferring sweep to when they have been completed";
         return;
     }
 
-    if (handleContext->types[handleType].toRelease.isEmpty()) {
+    if (type->toRelease.isEmpty()) {
         debug() << " No handles to release - every one has been resurrected";
         return;
     }
 
-    debug() << " Releasing" << handleContext->types[handleType].toRelease.size() << "handles";
+    debug() << " Releasing" << type->toRelease.size() << "handles";
+
+    mPriv->baseInterface->ReleaseHandles(handleType, type->toRelease.toList());
+    type->releasedCount += type->toRelease.size();
+    type->toRelease.clear();
+}
+
+void Connection::armReleaseSweep(uint handleType)
+{
+    Private::HandleContext::Type *type = mPriv->handleContext->type(handleType);
+    Q_ASSERT(type);
+    QMutexLocker locker(&type->lock);
+
+    if (!type->releaseScheduled || type->releaseScheduler != this) {
+        return;
+    }
+
+    // What is left of the delay, if the sweep was handed over to us
+    qint64 delay = qMax(type->releaseDelay - type->releaseClock.elapsed(), Q_INT64_C(0));
+    mPriv->releaseTimers[handleType]->start(static_cast<int>(delay));
+}
 
-    mPriv->baseInterface->ReleaseHandles(handleType, handleContext->types[handleType].toRelease.toList());
-    handleContext->types[handleType].toRelease.clear();
+void Connection::onReleaseSweepTimeout()
+{
+    for (uint handleType = 0; handleType < NUM_HANDLE_TYPES; ++handleType) {
+        if (mPriv->releaseTimers[handleType] == sender()) {
+            doReleaseSweep(handleType);
+            return;
+        }
+    }
 }
 
 void Connection::handleRequestLanded(HandleType handleType)
@@ -2383,19 +2880,17 @@ void Connection::handleRequestLanded(HandleType handleType)
         return;
     }
 
-    Private::HandleContext *handleContext = mPriv->handleContext;
-    QMutexLocker locker(&handleContext->lock);
+    Private::HandleContext::Type *type = mPriv->handleContext->type(handleType);
+    Q_ASSERT(type);
+    QMutexLocker locker(&type->lock);
 
-    Q_ASSERT(handleContext->types.contains(handleType));
-    Q_ASSERT(handleContext->types[handleType].requestsInFlight > 0);
+    Q_ASSERT(type->requestsInFlight > 0);
 
-    if (!--handleContext->types[handleType].requestsInFlight &&
-        !handleContext->types[handleType].toRelease.isEmpty() &&
-        !handleContext->types[handleType].releaseScheduled) {
+    if (!--type->requestsInFlight &&
+        !type->toRelease.isEmpty()) {
         debug() << "All handle requests for type" << handleType <<
-            "landed and there are handles of that type to release - scheduling a release sweep";
-        QMetaObject::invokeMethod(this, "doReleaseSweep", Qt::QueuedConnection, Q_ARG(uint, handleType));
-        handleContext->types[handleType].releaseScheduled = true;
+            "landed and there are handles of that type to release";
+        mPriv->scheduleReleaseSweep(handleType);
     }
 }
 
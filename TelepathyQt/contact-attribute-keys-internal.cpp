@@ -0,0 +1,99 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/contact-attribute-keys-internal.h"
+
+#include <TelepathyQt/Constants>
+
+namespace Tp
+{
+
+Q_GLOBAL_STATIC(ContactAttributeKeys, globalContactAttributeKeys)
+
+ContactAttributeKeys::ContactAttributeKeys()
+{
+    mNames[ContactId] = TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id");
+    mNames[Subscribe] = TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+        QLatin1String("/subscribe");
+    mNames[Publish] = TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+        QLatin1String("/publish");
+    mNames[PublishRequest] = TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+        QLatin1String("/publish-request");
+    mNames[Alias] = TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias");
+    mNames[AvatarToken] = TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token");
+    mNames[Capabilities] = TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_CAPABILITIES +
+        QLatin1String("/capabilities");
+    mNames[Info] = TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO + QLatin1String("/info");
+    mNames[Location] = TP_QT_IFACE_CONNECTION_INTERFACE_LOCATION + QLatin1String("/location");
+    mNames[SimplePresence] = TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE +
+        QLatin1String("/presence");
+    mNames[Groups] = TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS + QLatin1String("/groups");
+    mNames[Addresses] = TP_QT_IFACE_CONNECTION_INTERFACE_ADDRESSING +
+        QLatin1String("/addresses");
+    mNames[Uris] = TP_QT_IFACE_CONNECTION_INTERFACE_ADDRESSING + QLatin1String("/uris");
+    mNames[ClientTypes] = TP_QT_IFACE_CONNECTION_INTERFACE_CLIENT_TYPES +
+        QLatin1String("/client-types");
+
+    mIndex.reserve(NumKeys);
+    for (int i = 0; i < NumKeys; ++i) {
+        mIndex.insert(mNames[i], i);
+    }
+}
+
+const ContactAttributeKeys &ContactAttributeKeys::instance()
+{
+    return *globalContactAttributeKeys();
+}
+
+int ContactAttributeKeys::indexOf(const QString &name) const
+{
+    QHash<QString, int>::const_iterator i = mIndex.constFind(name);
+    if (i == mIndex.constEnd()) {
+        return -1;
+    }
+    return i.value();
+}
+
+ContactAttributeValues::ContactAttributeValues(const QVariantMap &attributes)
+{
+    for (int i = 0; i < ContactAttributeKeys::NumKeys; ++i) {
+        mValues[i] = 0;
+    }
+
+    // Walk the attributes once, sending each known key to its slot, instead of building and
+    // looking up every key separately for each requested feature
+    const ContactAttributeKeys &keys = ContactAttributeKeys::instance();
+    QVariantMap::const_iterator end = attributes.constEnd();
+    for (QVariantMap::const_iterator i = attributes.constBegin(); i != end; ++i) {
+        int index = keys.indexOf(i.key());
+        if (index >= 0) {
+            mValues[index] = &i.value();
+        }
+    }
+}
+
+const QVariant &ContactAttributeValues::value(ContactAttributeKeys::Key key) const
+{
+    static const QVariant invalid;
+    return mValues[key] ? *mValues[key] : invalid;
+}
+
+} // Tp
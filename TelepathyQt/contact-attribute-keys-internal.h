@@ -0,0 +1,87 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_contact_attribute_keys_internal_h_HEADER_GUARD_
+#define _TelepathyQt_contact_attribute_keys_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Global>
+
+#include <QHash>
+#include <QString>
+#include <QVariant>
+#include <QVariantMap>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+class TP_QT_NO_EXPORT ContactAttributeKeys
+{
+public:
+    enum Key {
+        ContactId = 0,
+        Subscribe,
+        Publish,
+        PublishRequest,
+        Alias,
+        AvatarToken,
+        Capabilities,
+        Info,
+        Location,
+        SimplePresence,
+        Groups,
+        Addresses,
+        Uris,
+        ClientTypes,
+        NumKeys
+    };
+
+    ContactAttributeKeys();
+
+    static const ContactAttributeKeys &instance();
+
+    const QString &name(Key key) const { return mNames[key]; }
+    int indexOf(const QString &name) const;
+
+private:
+    QString mNames[NumKeys];
+    QHash<QString, int> mIndex;
+};
+
+class TP_QT_NO_EXPORT ContactAttributeValues
+{
+public:
+    // The attributes map must outlive this object, as only pointers into it are kept
+    ContactAttributeValues(const QVariantMap &attributes);
+
+    bool contains(ContactAttributeKeys::Key key) const { return mValues[key] != 0; }
+    const QVariant &value(ContactAttributeKeys::Key key) const;
+
+private:
+    const QVariant *mValues[ContactAttributeKeys::NumKeys];
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
@@ -0,0 +1,253 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_contact_id_cache_internal_h_HEADER_GUARD_
+#define _TelepathyQt_contact_id_cache_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Global>
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+/*
+ * Bounded handle to identifier map, evicting with the CLOCK policy: every entry has a
+ * recently-used bit, set when it is looked up, and the clock hand sweeping over the entries gives
+ * a second chance to those having it set.
+ *
+ * The entries which are pinned, as told by the predicate passed to insert(), are never evicted.
+ * Should more of them than the capacity be pinned, the cache grows over it for a while, and
+ * shrinks back on later insertions once they are no longer pinned.
+ */
+class ContactIdCache
+{
+public:
+    enum {
+        DefaultCapacity = 10000,
+        // Bounds the pinned entries skipped per insertion, when most entries are pinned
+        MaxScan = 64
+    };
+
+    ContactIdCache(int capacity = DefaultCapacity)
+        : mCapacity(capacity), mHand(0), mHits(0), mMisses(0), mEvictions(0)
+    {
+    }
+
+    int capacity() const
+    {
+        return mCapacity;
+    }
+
+    void setCapacity(int capacity)
+    {
+        // Shrinking happens on the next insertions
+        mCapacity = capacity;
+    }
+
+    int count() const
+    {
+        return mSlots.size();
+    }
+
+    bool contains(uint handle)
+    {
+        int i = mIndex.value(handle, -1);
+        if (i < 0) {
+            ++mMisses;
+            return false;
+        }
+
+        ++mHits;
+        mSlots[i].recent = true;
+        return true;
+    }
+
+    // Doesn't count as a use of the entry, nor as a hit or a miss
+    QString peek(uint handle) const
+    {
+        int i = mIndex.value(handle, -1);
+        return i < 0 ? QString() : mSlots[i].id;
+    }
+
+    QString value(uint handle)
+    {
+        int i = mIndex.value(handle, -1);
+        if (i < 0) {
+            return QString();
+        }
+
+        mSlots[i].recent = true;
+        return mSlots[i].id;
+    }
+
+    template <class Pinned>
+    void insert(uint handle, const QString &id, const Pinned &isPinned)
+    {
+        int i = mIndex.value(handle, -1);
+        if (i >= 0) {
+            mSlots[i].id = id;
+            mSlots[i].recent = true;
+            return;
+        }
+
+        // Over capacity, after it was lowered or while too many entries were pinned
+        if (mCapacity > 0 && mSlots.size() > mCapacity) {
+            shrink(mCapacity, isPinned);
+        }
+
+        Slot slot;
+        slot.handle = handle;
+        slot.id = id;
+
+        int victim = -1;
+        if (mCapacity > 0 && mSlots.size() >= mCapacity) {
+            victim = findVictim(isPinned);
+        }
+
+        if (victim >= 0) {
+            // Take the place of the victim, which the hand just went past, so that the new entry
+            // goes round the clock once before being a candidate for eviction
+            mIndex.remove(mSlots[victim].handle);
+            mSlots[victim] = slot;
+            mIndex.insert(handle, victim);
+            ++mEvictions;
+        } else {
+            mIndex.insert(handle, mSlots.size());
+            mSlots.append(slot);
+        }
+    }
+
+    quint64 hits() const
+    {
+        return mHits;
+    }
+
+    quint64 misses() const
+    {
+        return mMisses;
+    }
+
+    quint64 evictions() const
+    {
+        return mEvictions;
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : handle(0), recent(false) { }
+
+        uint handle;
+        QString id;
+        bool recent;
+    };
+
+    // Return the entry the hand stops at, or -1 if it only met pinned entries for too long. The
+    // entries already marked as evicted, if any, are skipped.
+    template <class Pinned>
+    int findVictim(const Pinned &isPinned, const QVector<bool> &evicted = QVector<bool>())
+    {
+        // Clearing the recently-used bits terminates within a revolution of the hand, only the
+        // pinned entries are bounded
+        int pinned = 0;
+        while (pinned < MaxScan) {
+            if (mHand >= mSlots.size()) {
+                mHand = 0;
+            }
+
+            int i = mHand++;
+            Slot &slot = mSlots[i];
+            if (!evicted.isEmpty() && evicted[i]) {
+                ++pinned;
+            } else if (slot.recent) {
+                slot.recent = false;
+            } else if (isPinned(slot.handle)) {
+                ++pinned;
+            } else {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    template <class Pinned>
+    void shrink(int size, const Pinned &isPinned)
+    {
+        // The victims are only marked while the hand goes round, and squeezed out at the end, so
+        // that the other entries keep their place on the clock
+        QVector<bool> evicted(mSlots.size(), false);
+        int excess = mSlots.size() - size;
+        int count = 0;
+        while (count < excess) {
+            int victim = findVictim(isPinned, evicted);
+            if (victim < 0) {
+                break;
+            }
+
+            evicted[victim] = true;
+            mIndex.remove(mSlots[victim].handle);
+            ++count;
+            ++mEvictions;
+        }
+
+        if (!count) {
+            return;
+        }
+
+        int kept = 0;
+        int hand = 0;
+        for (int i = 0; i < mSlots.size(); ++i) {
+            if (i == mHand) {
+                hand = kept;
+            }
+            if (evicted[i]) {
+                continue;
+            }
+
+            if (i != kept) {
+                mSlots[kept] = mSlots[i];
+                mIndex.insert(mSlots[kept].handle, kept);
+            }
+            ++kept;
+        }
+        mSlots.resize(kept);
+        mHand = hand;
+    }
+
+    QVector<Slot> mSlots;
+    QHash<uint, int> mIndex;
+    int mCapacity;
+    int mHand;
+    quint64 mHits;
+    quint64 mMisses;
+    quint64 mEvictions;
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
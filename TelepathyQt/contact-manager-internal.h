@@ -34,9 +34,13 @@
 #include <QString>
 #include <QStringList>
 
+class QThreadPool;
+
 namespace Tp
 {
 
+class RosterSnapshot;
+
 class TP_QT_NO_EXPORT ContactManager::Roster : public QObject
 {
     Q_OBJECT
@@ -89,6 +93,11 @@ public:
     bool canReportAbuse() const;
     PendingOperation *blockContacts(const QList<ContactPtr> &contacts, bool value, bool reportAbuse);
 
+    QString snapshotFileName() const;
+    void setSnapshotFileName(const QString &fileName);
+
+    void updateGroupsIndex(const ContactPtr &contact, const QSet<QString> &oldGroups);
+
 private Q_SLOTS:
     void gotContactBlockingCapabilities(Tp::PendingOperation *op);
     void gotContactBlockingBlockedContacts(QDBusPendingCallWatcher *watcher);
@@ -123,6 +132,11 @@ private Q_SLOTS:
     void gotContactListGroupsProperties(Tp::PendingOperation *op);
     void onContactListContactsUpgraded(Tp::PendingOperation *op);
 
+    void onSnapshotAttributesReceived(const Tp::UIntList &handles,
+            const Tp::ContactAttributesMap &attributes);
+    void onSnapshotReconciled(Tp::PendingOperation *op);
+    void saveSnapshot();
+
     void onNewChannels(const Tp::ChannelDetailsList &channelDetailsList);
     void onContactListGroupChannelReady(Tp::PendingOperation *op);
     void gotChannels(QDBusPendingCallWatcher *watcher);
@@ -162,6 +176,13 @@ private Q_SLOTS:
         const QString &errorName, const QString &errorMessage);
 
 private:
+    // The lists a known contact can be on; the contact list channels of each
+    // ChannelInfo::Type have the bit (1 << type)
+    enum KnownContactSource {
+        SourceContactList = 0x100,
+        SourceBlocked = 0x200
+    };
+
     struct ChannelInfo;
     struct BlockedContactsChangedInfo;
     struct UpdateInfo;
@@ -174,6 +195,10 @@ private:
     void introspectContactBlockingBlockedContacts();
     void introspectContactList();
     void introspectContactListContacts();
+    QStringList contactListAttributeInterfaces();
+    void reconcileSnapshot(const UIntList &handles);
+    void reconcileSnapshotContacts(const ContactAttributesMap &attributes);
+    void scheduleSnapshotSave();
     void processContactListChanges();
     void processContactListBlockedContactsChanged();
     void processContactListUpdates();
@@ -186,9 +211,13 @@ private:
     void setContactListChannelsReady();
     void updateContactsBlockState();
     void updateContactsPresenceState();
-    void computeKnownContactsChanges(const Contacts &added,
+    void computeKnownContactsChanges(uint source, const Contacts &added,
             const Contacts &pendingAdded, const Contacts &remotePendingAdded,
             const Contacts &removed, const Channel::GroupMemberChangeDetails &details);
+    bool addKnownContactSource(const ContactPtr &contact, uint source);
+    void addKnownContactsSource(const Contacts &contacts, uint source);
+    void addToGroupsIndex(const ContactPtr &contact);
+    void removeFromGroupsIndex(const ContactPtr &contact);
     void checkContactListGroupsReady();
     void setContactListGroupChannelsReady();
     QString addContactListGroupChannel(const ChannelPtr &contactListGroupChannel);
@@ -196,6 +225,8 @@ private:
     ContactManager *contactManager;
 
     Contacts cachedAllKnownContacts;
+    // The KnownContactSource bits of each of cachedAllKnownContacts
+    QHash<ContactPtr, uint> knownContactSources;
 
     bool usingFallbackContactList;
     bool hasContactBlockingInterface;
@@ -212,6 +243,8 @@ private:
     bool gotContactListContactsChangedWithId;
     bool groupsReintrospectionRequired;
     QSet<QString> cachedAllKnownGroups;
+    // Members of each group, among cachedAllKnownContacts (Conn.I.ContactList only)
+    QHash<QString, Contacts> groupsIndex;
     bool contactListGroupPropertiesReceived;
     QQueue<void (ContactManager::Roster::*)()> contactListChangesQueue;
     QQueue<BlockedContactsChangedInfo> contactListBlockedContactsChangedQueue;
@@ -247,6 +280,14 @@ private:
     Contacts contactListContacts;
     // Blocked contacts using the new ContactBlocking API
     Contacts blockedContacts;
+
+    // Warm start snapshot of the roster, only loaded until the initial contacts are built from it
+    QString snapshotFile;
+    RosterSnapshot *snapshot;
+    bool reconcilingSnapshot;
+    bool snapshotReconciledIncrementally;
+    bool snapshotSaveScheduled;
+    QThreadPool *snapshotWriter;
 };
 
 struct TP_QT_NO_EXPORT ContactManager::Roster::ChannelInfo
@@ -288,6 +329,8 @@ struct TP_QT_NO_EXPORT ContactManager::Roster::BlockedContactsChangedInfo
     {
     }
 
+    void merge(const BlockedContactsChangedInfo &later);
+
     HandleIdentifierMap added;
     HandleIdentifierMap removed;
     bool continueIntrospectionWhenFinished;
@@ -303,9 +346,13 @@ struct TP_QT_NO_EXPORT ContactManager::Roster::UpdateInfo
     {
     }
 
+    void merge(const UpdateInfo &later);
+
     ContactSubscriptionMap changes;
     HandleIdentifierMap ids;
     HandleIdentifierMap removals;
+    // Contacts which were added by an update and removed by a later one merged into this one
+    QSet<uint> transientHandles;
 };
 
 struct TP_QT_NO_EXPORT ContactManager::Roster::GroupsUpdateInfo
@@ -24,12 +24,15 @@
 
 #include "TelepathyQt/_gen/contact-manager-internal.moc.hpp"
 
+#include "TelepathyQt/contact-attribute-keys-internal.h"
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/roster-snapshot-internal.h"
 
 #include <TelepathyQt/Connection>
 #include <TelepathyQt/ConnectionLowlevel>
 #include <TelepathyQt/ContactFactory>
 #include <TelepathyQt/PendingChannel>
+#include <TelepathyQt/PendingContactAttributes>
 #include <TelepathyQt/PendingContacts>
 #include <TelepathyQt/PendingFailure>
 #include <TelepathyQt/PendingHandles>
@@ -38,9 +41,55 @@
 #include <TelepathyQt/PendingReady>
 #include <TelepathyQt/ReferencedHandles>
 
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+
 namespace Tp
 {
 
+namespace
+{
+
+class SaveSnapshotJob : public QRunnable
+{
+public:
+    SaveSnapshotJob(const QString &fileName, const QList<RosterSnapshot::Entry> &entries)
+        : mFileName(fileName),
+          mEntries(entries)
+    {
+    }
+
+    void run()
+    {
+        RosterSnapshot::save(mFileName, mEntries);
+    }
+
+private:
+    QString mFileName;
+    QList<RosterSnapshot::Entry> mEntries;
+};
+
+uint snapshotSubscriptionState(bool known, bool removedRemotely, Contact::PresenceState state)
+{
+    if (!known) {
+        return SubscriptionStateUnknown;
+    } else if (removedRemotely) {
+        return SubscriptionStateRemovedRemotely;
+    }
+
+    switch (state) {
+        case Contact::PresenceStateYes:
+            return SubscriptionStateYes;
+        case Contact::PresenceStateAsk:
+            return SubscriptionStateAsk;
+        default:
+            return SubscriptionStateNo;
+    }
+}
+
+}
+
 ContactManager::Roster::Roster(ContactManager *contactManager)
     : QObject(),
       contactManager(contactManager),
@@ -61,12 +110,18 @@ ContactManager::Roster::Roster(ContactManager *contactManager)
       processingContactListChanges(false),
       contactListChannelsReady(0),
       featureContactListGroupsTodo(0),
-      groupsSetSuccess(false)
+      groupsSetSuccess(false),
+      snapshot(0),
+      reconcilingSnapshot(false),
+      snapshotReconciledIncrementally(false),
+      snapshotSaveScheduled(false),
+      snapshotWriter(0)
 {
 }
 
 ContactManager::Roster::~Roster()
 {
+    delete snapshot;
 }
 
 ContactListState ContactManager::Roster::state() const
@@ -296,12 +351,7 @@ Contacts ContactManager::Roster::groupContacts(const QString &group) const
         return channel->groupContacts();
     }
 
-    Contacts ret;
-    foreach (const ContactPtr &contact, allKnownContacts()) {
-        if (contact->groups().contains(group))
-            ret << contact;
-    }
-    return ret;
+    return groupsIndex.value(group);
 }
 
 PendingOperation *ContactManager::Roster::addContactsToGroup(const QString &group,
@@ -691,6 +741,19 @@ PendingOperation *ContactManager::Roster::blockContacts(
     }
 }
 
+QString ContactManager::Roster::snapshotFileName() const
+{
+    return snapshotFile;
+}
+
+void ContactManager::Roster::setSnapshotFileName(const QString &fileName)
+{
+    snapshotFile = fileName;
+
+    // Bring the new file up to date straight away if the roster is already known
+    scheduleSnapshotSave();
+}
+
 void ContactManager::Roster::gotContactBlockingCapabilities(PendingOperation *op)
 {
     if (op->isError()) {
@@ -817,18 +880,44 @@ void ContactManager::Roster::gotContactListContacts(QDBusPendingCallWatcher *wat
     gotContactListInitialContacts = true;
 
     ConnectionPtr conn(contactManager->connection());
+    const QString &idKey = ContactAttributeKeys::instance().name(ContactAttributeKeys::ContactId);
     ContactAttributesMap attrsMap = reply.value();
     ContactAttributesMap::const_iterator begin = attrsMap.constBegin();
     ContactAttributesMap::const_iterator end = attrsMap.constEnd();
+    UIntList handles;
     for (ContactAttributesMap::const_iterator i = begin; i != end; ++i) {
         uint bareHandle = i.key();
         QVariantMap attrs = i.value();
 
+        if (snapshot) {
+            int index = snapshot->indexOf(qdbus_cast<QString>(attrs.value(idKey)));
+            if (index >= 0) {
+                // Whatever the connection told us wins over the snapshot
+                QVariantMap snapshotAttrs = snapshot->attributes(index);
+                for (QVariantMap::const_iterator j = attrs.constBegin();
+                        j != attrs.constEnd(); ++j) {
+                    snapshotAttrs.insert(j.key(), j.value());
+                }
+                attrs = snapshotAttrs;
+            }
+        }
+
         ContactPtr contact = contactManager->ensureContact(ReferencedHandles(conn,
                     HandleTypeContact, UIntList() << bareHandle),
                 conn->contactFactory()->features(), attrs);
-        cachedAllKnownContacts.insert(contact);
+        if (addKnownContactSource(contact, SourceContactList)) {
+            addToGroupsIndex(contact);
+        }
         contactListContacts.insert(contact);
+        handles << bareHandle;
+    }
+
+    if (snapshot) {
+        delete snapshot;
+        snapshot = 0;
+        reconcileSnapshot(handles);
+    } else {
+        scheduleSnapshotSave();
     }
 
     if (contactManager->connection()->requestedFeatures().contains(
@@ -1001,7 +1090,7 @@ void ContactManager::Roster::onContactListBlockedContactsConstructed(Tp::Pending
     }
 
     // Perform the needed computation for allKnownContactsChanged
-    computeKnownContactsChanges(newBlockedContacts, Contacts(),
+    computeKnownContactsChanges(SourceBlocked, newBlockedContacts, Contacts(),
             Contacts(), unblockedContacts, Channel::GroupMemberChangeDetails());
 
     if (info.continueIntrospectionWhenFinished) {
@@ -1066,14 +1155,15 @@ void ContactManager::Roster::onContactListNewContactsConstructed(Tp::PendingOper
 
     foreach (uint bareHandle, info.removals.keys()) {
         ContactPtr contact = contactManager->lookupContactByHandle(bareHandle);
-        if (!contact) {
-            warning() << "Unable to find removed contact with handle" << bareHandle;
-            continue;
-        }
-
-        if (!contactListContacts.contains(contact)) {
-            warning() << "Contact" << contact->id() << "removed from ContactList "
-                "but it wasn't present, ignoring.";
+        if (!contact || !contactListContacts.contains(contact)) {
+            if (!info.transientHandles.contains(bareHandle)) {
+                if (!contact) {
+                    warning() << "Unable to find removed contact with handle" << bareHandle;
+                } else {
+                    warning() << "Contact" << contact->id() << "removed from ContactList "
+                        "but it wasn't present, ignoring.";
+                }
+            }
             continue;
         }
 
@@ -1081,7 +1171,7 @@ void ContactManager::Roster::onContactListNewContactsConstructed(Tp::PendingOper
         removed << contact;
     }
 
-    computeKnownContactsChanges(added, Contacts(), Contacts(),
+    computeKnownContactsChanges(SourceContactList, added, Contacts(), Contacts(),
             removed, Channel::GroupMemberChangeDetails());
 
     foreach (const Tp::ContactPtr &contact, removed) {
@@ -1257,7 +1347,7 @@ void ContactManager::Roster::onContactListChannelReady()
         updateContactsBlockState();
 
         if (denyChannel) {
-            cachedAllKnownContacts.unite(denyChannel->groupContacts());
+            addKnownContactsSource(denyChannel->groupContacts(), 1 << ChannelInfo::TypeDeny);
         }
 
         introspectContactList();
@@ -1284,9 +1374,10 @@ void ContactManager::Roster::onContactListChannelReady()
             if (!channel) {
                 continue;
             }
-            cachedAllKnownContacts.unite(channel->groupContacts());
-            cachedAllKnownContacts.unite(channel->groupLocalPendingContacts());
-            cachedAllKnownContacts.unite(channel->groupRemotePendingContacts());
+            uint source = 1 << contactListChannel.type;
+            addKnownContactsSource(channel->groupContacts(), source);
+            addKnownContactsSource(channel->groupLocalPendingContacts(), source);
+            addKnownContactsSource(channel->groupRemotePendingContacts(), source);
         }
 
         updateContactsPresenceState();
@@ -1372,6 +1463,81 @@ void ContactManager::Roster::onContactListContactsUpgraded(PendingOperation *op)
     processContactListChanges();
 }
 
+void ContactManager::Roster::onSnapshotAttributesReceived(const Tp::UIntList &handles,
+        const Tp::ContactAttributesMap &attributes)
+{
+    Q_UNUSED(handles);
+
+    snapshotReconciledIncrementally = true;
+    reconcileSnapshotContacts(attributes);
+}
+
+void ContactManager::Roster::onSnapshotReconciled(PendingOperation *op)
+{
+    reconcilingSnapshot = false;
+
+    if (op->isError()) {
+        warning() << "Reconciling the roster snapshot failed:" << op->errorName() << "-" <<
+            op->errorMessage();
+        return;
+    }
+
+    // Chunked requests have already been reconciled as each chunk arrived
+    if (!snapshotReconciledIncrementally) {
+        PendingContactAttributes *pca = qobject_cast<PendingContactAttributes *>(op);
+        reconcileSnapshotContacts(pca->attributes());
+    }
+
+    debug() << "Roster snapshot reconciled";
+    scheduleSnapshotSave();
+}
+
+void ContactManager::Roster::saveSnapshot()
+{
+    snapshotSaveScheduled = false;
+
+    // Until reconciled, the contacts still carry the snapshotted attributes; they will be saved
+    // once they are up to date
+    if (snapshotFile.isEmpty() || reconcilingSnapshot) {
+        return;
+    }
+
+    QList<RosterSnapshot::Entry> entries;
+    foreach (const ContactPtr &contact, contactListContacts) {
+        Features actualFeatures = contact->actualFeatures();
+
+        RosterSnapshot::Entry entry;
+        entry.id = contact->id();
+        if (actualFeatures.contains(Contact::FeatureAlias)) {
+            entry.alias = contact->alias();
+        }
+        if (actualFeatures.contains(Contact::FeatureAvatarToken)) {
+            entry.avatarTokenKnown = contact->isAvatarTokenKnown();
+            entry.avatarToken = contact->avatarToken();
+        }
+        if (actualFeatures.contains(Contact::FeatureSimplePresence)) {
+            entry.presence = contact->presence().barePresence();
+        }
+        if (actualFeatures.contains(Contact::FeatureRosterGroups)) {
+            entry.groups = contact->groups();
+        }
+        entry.subscribe = snapshotSubscriptionState(contact->isSubscriptionStateKnown(),
+                contact->isSubscriptionRejected(), contact->subscriptionState());
+        entry.publish = snapshotSubscriptionState(contact->isPublishStateKnown(),
+                contact->isPublishCancelled(), contact->publishState());
+        entry.publishRequest = contact->publishStateMessage();
+        entries.append(entry);
+    }
+
+    if (!snapshotWriter) {
+        snapshotWriter = new QThreadPool(this);
+        snapshotWriter->setMaxThreadCount(1);
+    }
+
+    debug() << "Saving roster snapshot with" << entries.size() << "contacts to" << snapshotFile;
+    snapshotWriter->start(new SaveSnapshotJob(snapshotFile, entries));
+}
+
 void ContactManager::Roster::onNewChannels(const Tp::ChannelDetailsList &channelDetailsList)
 {
     ConnectionPtr conn(contactManager->connection());
@@ -1467,7 +1633,7 @@ void ContactManager::Roster::onStoredChannelMembersChanged(
     }
 
     // Perform the needed computation for allKnownContactsChanged
-    computeKnownContactsChanges(groupMembersAdded,
+    computeKnownContactsChanges(1 << ChannelInfo::TypeStored, groupMembersAdded,
             groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
             groupMembersRemoved, details);
 }
@@ -1499,7 +1665,7 @@ void ContactManager::Roster::onSubscribeChannelMembersChanged(
     }
 
     // Perform the needed computation for allKnownContactsChanged
-    computeKnownContactsChanges(groupMembersAdded,
+    computeKnownContactsChanges(1 << ChannelInfo::TypeSubscribe, groupMembersAdded,
             groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
             groupMembersRemoved, details);
 }
@@ -1535,7 +1701,7 @@ void ContactManager::Roster::onPublishChannelMembersChanged(
     }
 
     // Perform the needed computation for allKnownContactsChanged
-    computeKnownContactsChanges(groupMembersAdded,
+    computeKnownContactsChanges(1 << ChannelInfo::TypePublish, groupMembersAdded,
             groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
             groupMembersRemoved, details);
 }
@@ -1566,7 +1732,7 @@ void ContactManager::Roster::onDenyChannelMembersChanged(
     }
 
     // Perform the needed computation for allKnownContactsChanged
-    computeKnownContactsChanges(groupMembersAdded, Contacts(),
+    computeKnownContactsChanges(1 << ChannelInfo::TypeDeny, groupMembersAdded, Contacts(),
             Contacts(), groupMembersRemoved, details);
 }
 
@@ -1679,6 +1845,33 @@ void ContactManager::Roster::introspectContactListContacts()
     Client::ConnectionInterfaceContactListInterface *iface =
         conn->interface<Client::ConnectionInterfaceContactListInterface>();
 
+    QStringList interfaces = contactListAttributeInterfaces();
+
+    // With a snapshot of the last known roster, only ask who is on the contact list and take
+    // everything else from the snapshot, so that the roster is ready without waiting for the
+    // attributes of every contact. These are then retrieved and reconciled in the background.
+    if (!gotContactListInitialContacts && !snapshotFile.isEmpty() && !snapshot) {
+        snapshot = new RosterSnapshot(snapshotFile);
+        if (snapshot->load()) {
+            debug() << "Warm starting the roster from" << snapshotFile;
+            interfaces = QStringList() << TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST;
+        } else {
+            delete snapshot;
+            snapshot = 0;
+        }
+    }
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(
+            iface->GetContactListAttributes(interfaces, true), contactManager);
+    connect(watcher,
+            SIGNAL(finished(QDBusPendingCallWatcher*)),
+            SLOT(gotContactListContacts(QDBusPendingCallWatcher*)));
+}
+
+QStringList ContactManager::Roster::contactListAttributeInterfaces()
+{
+    ConnectionPtr conn(contactManager->connection());
+
     Features features(conn->contactFactory()->features());
     Features supportedFeatures(contactManager->supportedFeatures());
     QSet<QString> interfaces;
@@ -1692,11 +1885,103 @@ void ContactManager::Roster::introspectContactListContacts()
     }
     interfaces.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST);
 
-    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(
-            iface->GetContactListAttributes(interfaces.toList(), true), contactManager);
-    connect(watcher,
-            SIGNAL(finished(QDBusPendingCallWatcher*)),
-            SLOT(gotContactListContacts(QDBusPendingCallWatcher*)));
+    return interfaces.toList();
+}
+
+void ContactManager::Roster::reconcileSnapshot(const UIntList &handles)
+{
+    if (handles.isEmpty()) {
+        scheduleSnapshotSave();
+        return;
+    }
+
+    debug() << "Reconciling" << handles.size() << "contacts built from the roster snapshot";
+
+    ConnectionPtr conn(contactManager->connection());
+
+    reconcilingSnapshot = true;
+    snapshotReconciledIncrementally = false;
+
+    // The contact list already holds the handles, there is no need to reference them again
+    PendingContactAttributes *pca = conn->lowlevel()->contactAttributes(handles,
+            contactListAttributeInterfaces(), false);
+    connect(pca,
+            SIGNAL(attributesReceived(Tp::UIntList,Tp::ContactAttributesMap)),
+            SLOT(onSnapshotAttributesReceived(Tp::UIntList,Tp::ContactAttributesMap)));
+    connect(pca,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(onSnapshotReconciled(Tp::PendingOperation*)));
+}
+
+void ContactManager::Roster::reconcileSnapshotContacts(const ContactAttributesMap &attributes)
+{
+    ConnectionPtr conn(contactManager->connection());
+    Features features(conn->contactFactory()->features());
+
+    ContactAttributesMap::const_iterator end = attributes.constEnd();
+    for (ContactAttributesMap::const_iterator i = attributes.constBegin(); i != end; ++i) {
+        uint bareHandle = i.key();
+
+        // The contact may have left the contact list while its attributes were being retrieved
+        ContactPtr contact = contactManager->lookupContactByHandle(bareHandle);
+        if (!contact || !contactListContacts.contains(contact)) {
+            continue;
+        }
+
+        // Only what differs from the snapshot ends up emitting change signals
+        contactManager->ensureContact(ReferencedHandles(conn,
+                    HandleTypeContact, UIntList() << bareHandle),
+                features, i.value());
+    }
+}
+
+void ContactManager::Roster::scheduleSnapshotSave()
+{
+    if (snapshotFile.isEmpty() || snapshotSaveScheduled || !gotContactListInitialContacts) {
+        return;
+    }
+
+    snapshotSaveScheduled = true;
+    QTimer::singleShot(0, this, SLOT(saveSnapshot()));
+}
+
+void ContactManager::Roster::BlockedContactsChangedInfo::merge(
+        const BlockedContactsChangedInfo &later)
+{
+    // The later change wins for contacts in both
+    HandleIdentifierMap::const_iterator i;
+    for (i = later.added.constBegin(); i != later.added.constEnd(); ++i) {
+        removed.remove(i.key());
+        added.insert(i.key(), i.value());
+    }
+    for (i = later.removed.constBegin(); i != later.removed.constEnd(); ++i) {
+        added.remove(i.key());
+        removed.insert(i.key(), i.value());
+    }
+
+    continueIntrospectionWhenFinished |= later.continueIntrospectionWhenFinished;
+}
+
+void ContactManager::Roster::UpdateInfo::merge(const UpdateInfo &later)
+{
+    // The later change wins for contacts in both
+    for (ContactSubscriptionMap::const_iterator i = later.changes.constBegin();
+            i != later.changes.constEnd(); ++i) {
+        removals.remove(i.key());
+        transientHandles.remove(i.key());
+        changes.insert(i.key(), i.value());
+    }
+    for (HandleIdentifierMap::const_iterator i = later.removals.constBegin();
+            i != later.removals.constEnd(); ++i) {
+        if (changes.remove(i.key())) {
+            transientHandles.insert(i.key());
+        }
+        removals.insert(i.key(), i.value());
+    }
+    for (HandleIdentifierMap::const_iterator i = later.ids.constBegin();
+            i != later.ids.constEnd(); ++i) {
+        ids.insert(i.key(), i.value());
+    }
 }
 
 void ContactManager::Roster::processContactListChanges()
@@ -1711,6 +1996,15 @@ void ContactManager::Roster::processContactListChanges()
 
 void ContactManager::Roster::processContactListBlockedContactsChanged()
 {
+    // Fold the updates queued right behind this one in, so that a burst of changes costs a
+    // single contact build and allKnownContactsChanged() emission
+    while (!contactListChangesQueue.isEmpty() && contactListChangesQueue.head() ==
+            &ContactManager::Roster::processContactListBlockedContactsChanged) {
+        contactListChangesQueue.dequeue();
+        contactListBlockedContactsChangedQueue.first().merge(
+                contactListBlockedContactsChangedQueue.takeAt(1));
+    }
+
     BlockedContactsChangedInfo info = contactListBlockedContactsChangedQueue.head();
 
     UIntList contacts;
@@ -1740,6 +2034,13 @@ void ContactManager::Roster::processContactListBlockedContactsChanged()
 
 void ContactManager::Roster::processContactListUpdates()
 {
+    // As for the blocked contacts, merge the consecutive updates
+    while (!contactListChangesQueue.isEmpty() && contactListChangesQueue.head() ==
+            &ContactManager::Roster::processContactListUpdates) {
+        contactListChangesQueue.dequeue();
+        contactListUpdatesQueue.first().merge(contactListUpdatesQueue.takeAt(1));
+    }
+
     UpdateInfo info = contactListUpdatesQueue.head();
 
     // construct Contact objects for all contacts in added to the contact list
@@ -1776,6 +2077,9 @@ void ContactManager::Roster::processContactListGroupsUpdates()
             }
             contacts << contact;
             contact->setAddedToGroup(group);
+            if (cachedAllKnownContacts.contains(contact)) {
+                groupsIndex[group].insert(contact);
+            }
         }
 
         emit contactManager->groupMembersChanged(group, contacts,
@@ -1793,12 +2097,21 @@ void ContactManager::Roster::processContactListGroupsUpdates()
             }
             contacts << contact;
             contact->setRemovedFromGroup(group);
+            if (groupsIndex.contains(group)) {
+                Contacts &members = groupsIndex[group];
+                members.remove(contact);
+                if (members.isEmpty()) {
+                    groupsIndex.remove(group);
+                }
+            }
         }
 
         emit contactManager->groupMembersChanged(group, Contacts(),
                 contacts, Channel::GroupMemberChangeDetails());
     }
 
+    scheduleSnapshotSave();
+
     processingContactListChanges = false;
     processContactListChanges();
 }
@@ -1820,6 +2133,12 @@ void ContactManager::Roster::processContactListGroupRenamed()
     GroupRenamedInfo info = contactListGroupRenamedQueue.dequeue();
     cachedAllKnownGroups.remove(info.oldName);
     cachedAllKnownGroups.insert(info.newName);
+    // The connection will move the members over with GroupsChanged as well, but have the new
+    // group populated right away
+    Contacts members = groupsIndex.take(info.oldName);
+    if (!members.isEmpty()) {
+        groupsIndex[info.newName].unite(members);
+    }
     emit contactManager->groupRenamed(info.oldName, info.newName);
 
     processingContactListChanges = false;
@@ -1831,6 +2150,7 @@ void ContactManager::Roster::processContactListGroupsRemoved()
     QStringList names = contactListGroupsRemovedQueue.dequeue();
     foreach (const QString &name, names) {
         cachedAllKnownGroups.remove(name);
+        groupsIndex.remove(name);
         emit contactManager->groupRemoved(name);
     }
 
@@ -2006,40 +2326,123 @@ void ContactManager::Roster::updateContactsPresenceState()
     }
 }
 
-void ContactManager::Roster::computeKnownContactsChanges(const Tp::Contacts& added,
-        const Tp::Contacts& pendingAdded, const Tp::Contacts& remotePendingAdded,
-        const Tp::Contacts& removed, const Channel::GroupMemberChangeDetails &details)
+void ContactManager::Roster::computeKnownContactsChanges(uint source,
+        const Tp::Contacts& added, const Tp::Contacts& pendingAdded,
+        const Tp::Contacts& remotePendingAdded, const Tp::Contacts& removed,
+        const Channel::GroupMemberChangeDetails &details)
 {
-    // First of all, compute the real additions/removals based upon our cache
+    // Only the contacts in the change are looked at: a contact is known as long as it is on at
+    // least one of the lists, which its source bits tell without looking the lists up
     Tp::Contacts realAdded;
-    realAdded.unite(added);
-    realAdded.unite(pendingAdded);
-    realAdded.unite(remotePendingAdded);
-    realAdded.subtract(cachedAllKnownContacts);
-    Tp::Contacts realRemoved = removed;
-    realRemoved.intersect(cachedAllKnownContacts);
-
-    // Check if realRemoved have been _really_ removed from all lists
-    foreach (const ChannelInfo &contactListChannel, contactListChannels) {
-        ChannelPtr channel = contactListChannel.channel;
-        if (!channel) {
-            continue;
+    foreach (const Tp::Contacts &contacts,
+            QList<Tp::Contacts>() << added << pendingAdded << remotePendingAdded) {
+        foreach (const ContactPtr &contact, contacts) {
+            if (addKnownContactSource(contact, source)) {
+                realAdded.insert(contact);
+            }
         }
-        realRemoved.subtract(channel->groupContacts());
-        realRemoved.subtract(channel->groupLocalPendingContacts());
-        realRemoved.subtract(channel->groupRemotePendingContacts());
     }
 
-    // ...and from the Conn.I.ContactList / Conn.I.ContactBlocking contacts
-    realRemoved.subtract(contactListContacts);
-    realRemoved.subtract(blockedContacts);
+    Tp::Contacts realRemoved;
+    foreach (const ContactPtr &contact, removed) {
+        QHash<ContactPtr, uint>::iterator i = knownContactSources.find(contact);
+        if (i == knownContactSources.end()) {
+            continue;
+        }
+
+        i.value() &= ~source;
+        if (!i.value()) {
+            knownContactSources.erase(i);
+            cachedAllKnownContacts.remove(contact);
+            if (!realAdded.remove(contact)) {
+                realRemoved.insert(contact);
+            }
+        }
+    }
 
     // Are there any real changes?
     if (!realAdded.isEmpty() || !realRemoved.isEmpty()) {
-        // Yes, update our "cache" and emit the signal
-        cachedAllKnownContacts.unite(realAdded);
-        cachedAllKnownContacts.subtract(realRemoved);
+        foreach (const ContactPtr &contact, realAdded) {
+            addToGroupsIndex(contact);
+        }
+        foreach (const ContactPtr &contact, realRemoved) {
+            removeFromGroupsIndex(contact);
+        }
         emit contactManager->allKnownContactsChanged(realAdded, realRemoved, details);
+
+        scheduleSnapshotSave();
+    }
+}
+
+bool ContactManager::Roster::addKnownContactSource(const ContactPtr &contact, uint source)
+{
+    uint &sources = knownContactSources[contact];
+    bool wasKnown = sources != 0;
+    sources |= source;
+    if (!wasKnown) {
+        cachedAllKnownContacts.insert(contact);
+    }
+    return !wasKnown;
+}
+
+void ContactManager::Roster::addKnownContactsSource(const Contacts &contacts, uint source)
+{
+    foreach (const ContactPtr &contact, contacts) {
+        if (addKnownContactSource(contact, source)) {
+            addToGroupsIndex(contact);
+        }
+    }
+}
+
+void ContactManager::Roster::updateGroupsIndex(const ContactPtr &contact,
+        const QSet<QString> &oldGroups)
+{
+    if (usingFallbackContactList || !cachedAllKnownContacts.contains(contact)) {
+        return;
+    }
+
+    QSet<QString> newGroups = contact->groups().toSet();
+    foreach (const QString &group, oldGroups - newGroups) {
+        if (groupsIndex.contains(group)) {
+            Contacts &members = groupsIndex[group];
+            members.remove(contact);
+            if (members.isEmpty()) {
+                groupsIndex.remove(group);
+            }
+        }
+    }
+    foreach (const QString &group, newGroups - oldGroups) {
+        groupsIndex[group].insert(contact);
+    }
+}
+
+void ContactManager::Roster::addToGroupsIndex(const ContactPtr &contact)
+{
+    if (usingFallbackContactList) {
+        return;
+    }
+
+    foreach (const QString &group, contact->groups()) {
+        groupsIndex[group].insert(contact);
+    }
+}
+
+void ContactManager::Roster::removeFromGroupsIndex(const ContactPtr &contact)
+{
+    if (usingFallbackContactList) {
+        return;
+    }
+
+    // Look in every group rather than just the contact's own, so that a contact is never kept
+    // alive by a stale entry if the connection didn't follow a rename with GroupsChanged
+    QHash<QString, Contacts>::iterator i = groupsIndex.begin();
+    while (i != groupsIndex.end()) {
+        i.value().remove(contact);
+        if (i.value().isEmpty()) {
+            i = groupsIndex.erase(i);
+        } else {
+            ++i;
+        }
     }
 }
 
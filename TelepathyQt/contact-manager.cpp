@@ -25,8 +25,12 @@
 
 #include "TelepathyQt/_gen/contact-manager.moc.hpp"
 
+#include "TelepathyQt/avatar-cache-internal.h"
+#include "TelepathyQt/contact-attribute-keys-internal.h"
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/feature-set-internal.h"
 #include "TelepathyQt/future-internal.h"
+#include "TelepathyQt/handle-table-internal.h"
 
 #include <TelepathyQt/AvatarData>
 #include <TelepathyQt/Connection>
@@ -52,8 +56,7 @@ struct TP_QT_NO_EXPORT ContactManager::Private
     ~Private();
 
     // avatar specific methods
-    bool buildAvatarFileName(QString token, bool createDir,
-        QString &avatarFileName, QString &mimeTypeFileName);
+    AvatarCachePtr avatarCache();
     Features realFeatures(const Features &features);
     QSet<QString> interfacesForFeatures(const Features &features);
 
@@ -61,25 +64,52 @@ struct TP_QT_NO_EXPORT ContactManager::Private
     WeakPtr<Connection> connection;
     ContactManager::Roster *roster;
 
-    QHash<uint, WeakPtr<Contact> > contacts;
+    HandleTable<Contact> contacts;
 
     QHash<Feature, bool> tracking;
     Features supportedFeatures;
 
     // avatar
+    struct AvatarWrite
+    {
+        QString fileName;
+        QString mimeType;
+        QSet<uint> handles;
+    };
+
+    AvatarCachePtr cachedAvatarCache;
+    bool avatarCacheLimitsSet;
+    qint64 avatarCacheMaxBytes;
+    int avatarCacheMaxEntries;
     QSet<ContactPtr> requestAvatarsQueue;
     bool requestAvatarsIdle;
+    // Waiting for the avatar cache index to be loaded, see onAvatarCacheLoaded()
+    bool requestAvatarsDeferred;
+    QHash<QString, AvatarWrite> avatarWrites;
 
     // contact info
     PendingRefreshContactInfo *refreshInfoOp;
+
+    bool contactChangeSignals;
+
+    // coalesced contact attributes requests
+    bool coalesceContactRequests;
+    QList<PendingContactAttributes *> contactAttributesQueue;
+    QHash<PendingOperation *, QList<PendingContactAttributes *> > contactAttributesBatches;
 };
 
 ContactManager::Private::Private(ContactManager *parent, Connection *connection)
     : parent(parent),
       connection(connection),
       roster(new ContactManager::Roster(parent)),
+      avatarCacheLimitsSet(false),
+      avatarCacheMaxBytes(AvatarCache::DefaultMaximumBytes),
+      avatarCacheMaxEntries(AvatarCache::DefaultMaximumEntries),
       requestAvatarsIdle(false),
-      refreshInfoOp(0)
+      requestAvatarsDeferred(false),
+      refreshInfoOp(0),
+      contactChangeSignals(true),
+      coalesceContactRequests(false)
 {
 }
 
@@ -89,26 +119,27 @@ ContactManager::Private::~Private()
     delete roster;
 }
 
-bool ContactManager::Private::buildAvatarFileName(QString token, bool createDir,
-        QString &avatarFileName, QString &mimeTypeFileName)
+AvatarCachePtr ContactManager::Private::avatarCache()
 {
-    QString cacheDir = QString(QLatin1String(qgetenv("XDG_CACHE_HOME")));
-    if (cacheDir.isEmpty()) {
-        cacheDir = QString(QLatin1String("%1/.cache")).arg(QLatin1String(qgetenv("HOME")));
-    }
-
+    // The location depends on XDG_CACHE_HOME, which may change under us, so check it is still
+    // the same directory before reusing the index we already have
     ConnectionPtr conn(parent->connection());
-    QString path = QString(QLatin1String("%1/telepathy/avatars/%2/%3")).
-        arg(cacheDir).arg(conn->cmName()).arg(conn->protocolName());
-
-    if (createDir && !QDir().mkpath(path)) {
-        return false;
+    QString path = AvatarCache::pathFor(conn->cmName(), conn->protocolName());
+    if (!cachedAvatarCache || cachedAvatarCache->path() != path) {
+        cachedAvatarCache = AvatarCache::forPath(path);
+        parent->connect(cachedAvatarCache.data(),
+                SIGNAL(loaded()),
+                SLOT(onAvatarCacheLoaded()),
+                Qt::UniqueConnection);
+        parent->connect(cachedAvatarCache.data(),
+                SIGNAL(avatarWritten(QString,bool)),
+                SLOT(onAvatarWritten(QString,bool)),
+                Qt::UniqueConnection);
+        if (avatarCacheLimitsSet) {
+            cachedAvatarCache->setLimits(avatarCacheMaxBytes, avatarCacheMaxEntries);
+        }
     }
-
-    avatarFileName = QString(QLatin1String("%1/%2")).arg(path).arg(escapeAsIdentifier(token));
-    mimeTypeFileName = QString(QLatin1String("%1.mime")).arg(avatarFileName);
-
-    return true;
+    return cachedAvatarCache;
 }
 
 Features ContactManager::Private::realFeatures(const Features &features)
@@ -219,6 +250,17 @@ ContactManager::ContactManager(Connection *connection)
  */
 ContactManager::~ContactManager()
 {
+    // Don't leave the requests still waiting for their batch hanging
+    QList<PendingContactAttributes *> requests = mPriv->contactAttributesQueue;
+    foreach (const QList<PendingContactAttributes *> &batchRequests,
+            mPriv->contactAttributesBatches) {
+        requests << batchRequests;
+    }
+    foreach (PendingContactAttributes *request, requests) {
+        request->failImmediately(TP_QT_ERROR_NOT_AVAILABLE,
+                QLatin1String("ContactManager destroyed before the attributes were retrieved"));
+    }
+
     delete mPriv;
 }
 
@@ -1022,10 +1064,11 @@ PendingContacts *ContactManager::contactsForHandles(const UIntList &handles,
         }
     }
 
+    FeatureSet realFeatureBits(realFeatures);
     foreach (uint handle, handles) {
         ContactPtr contact = lookupContactByHandle(handle);
         if (contact) {
-            if ((realFeatures - contact->requestedFeatures()).isEmpty()) {
+            if (contact->hasRequestedFeatures(realFeatureBits)) {
                 // Contact exists and has all the requested features
                 satisfyingContacts.insert(handle, contact);
             } else {
@@ -1176,17 +1219,8 @@ PendingContacts *ContactManager::upgradeContacts(const QList<ContactPtr> &contac
 
 ContactPtr ContactManager::lookupContactByHandle(uint handle)
 {
-    ContactPtr contact;
-
-    if (mPriv->contacts.contains(handle)) {
-        contact = ContactPtr(mPriv->contacts.value(handle));
-        if (!contact) {
-            // Dangling weak pointer, remove it
-            mPriv->contacts.remove(handle);
-        }
-    }
-
-    return contact;
+    // Dangling weak pointers are removed by the table as they are found
+    return mPriv->contacts.value(handle);
 }
 
 /**
@@ -1219,6 +1253,67 @@ void ContactManager::requestContactAvatars(const QList<ContactPtr> &contacts)
     mPriv->requestAvatarsQueue.unite(contacts.toSet());
 }
 
+/**
+ * Return usage statistics of the on-disk cache holding the avatars retrieved through
+ * Contact::FeatureAvatarData.
+ *
+ * The cache is shared with the other connections to the same connection manager and protocol,
+ * so the statistics cover all of them.
+ *
+ * \return The avatar cache statistics as an AvatarCacheStatistics.
+ * \sa setAvatarCacheLimits()
+ */
+AvatarCacheStatistics ContactManager::avatarCacheStatistics() const
+{
+    return mPriv->avatarCache()->statistics();
+}
+
+/**
+ * Return the maximum total size, in bytes, of the avatars kept in the on-disk cache.
+ *
+ * \return The maximum size of the avatar cache, or 0 if it is not limited.
+ * \sa setAvatarCacheLimits()
+ */
+qint64 ContactManager::avatarCacheMaximumBytes() const
+{
+    return mPriv->avatarCache()->maximumBytes();
+}
+
+/**
+ * Return the maximum number of avatars kept in the on-disk cache.
+ *
+ * \return The maximum number of cached avatars, or 0 if it is not limited.
+ * \sa setAvatarCacheLimits()
+ */
+int ContactManager::avatarCacheMaximumEntries() const
+{
+    return mPriv->avatarCache()->maximumEntries();
+}
+
+/**
+ * Set the limits of the on-disk cache holding the avatars retrieved through
+ * Contact::FeatureAvatarData.
+ *
+ * Whenever the cache grows over either limit, the least recently used avatars are removed from
+ * it until it is back under both. This happens in a background thread.
+ *
+ * The cache is shared with the other connections to the same connection manager and protocol,
+ * so the limits apply to all of them, and the last limits set win. By default the cache is
+ * not limited. Avatars in use by contacts that are still alive are never removed, even if that
+ * keeps the cache over its limits.
+ *
+ * \param maximumBytes The maximum total size of the cached avatars, in bytes, or 0 for no limit.
+ * \param maximumEntries The maximum number of cached avatars, or 0 for no limit.
+ * \sa avatarCacheStatistics()
+ */
+void ContactManager::setAvatarCacheLimits(qint64 maximumBytes, int maximumEntries)
+{
+    mPriv->avatarCacheLimitsSet = true;
+    mPriv->avatarCacheMaxBytes = maximumBytes;
+    mPriv->avatarCacheMaxEntries = maximumEntries;
+    mPriv->avatarCache()->setLimits(maximumBytes, maximumEntries);
+}
+
 /**
  * Refresh information for the given contact.
  *
@@ -1244,28 +1339,203 @@ PendingOperation *ContactManager::refreshContactInfo(const QList<ContactPtr> &co
     return mPriv->refreshInfoOp;
 }
 
+/**
+ * Return whether contact requests made in the same main loop iteration are coalesced.
+ *
+ * \return \c true if contact requests are coalesced, \c false otherwise.
+ * \sa setContactRequestCoalescingEnabled()
+ */
+bool ContactManager::isContactRequestCoalescingEnabled() const
+{
+    return mPriv->coalesceContactRequests;
+}
+
+/**
+ * Set whether contact requests made in the same main loop iteration should be coalesced.
+ *
+ * When enabled, the contact attributes needed by all calls to contactsForHandles() (and the
+ * methods built on top of it, such as upgradeContacts()) made before control returns to the
+ * main loop are retrieved with a single deduplicated GetContactAttributes call, using the union
+ * of the requested handles and features. The results are then split back to each
+ * PendingContacts, which finishes as it would have without coalescing. This can save a large
+ * number of D-Bus round trips when many components request contacts at the same time, for
+ * example on busy chat rooms.
+ *
+ * This is disabled by default.
+ *
+ * \param enabled Whether contact requests should be coalesced.
+ * \sa isContactRequestCoalescingEnabled()
+ */
+void ContactManager::setContactRequestCoalescingEnabled(bool enabled)
+{
+    mPriv->coalesceContactRequests = enabled;
+}
+
+/**
+ * Return the file the roster is snapshotted to, to speed up later introspections of
+ * Connection::FeatureRoster.
+ *
+ * \return The snapshot file name, or an empty string if the roster is not snapshotted.
+ * \sa setRosterSnapshotFileName()
+ */
+QString ContactManager::rosterSnapshotFileName() const
+{
+    return mPriv->roster->snapshotFileName();
+}
+
+/**
+ * Set the file the roster should be snapshotted to, to speed up later introspections of
+ * Connection::FeatureRoster.
+ *
+ * Once the roster is known, the identifier, alias, avatar token, presence, groups and
+ * subscription states of each contact on it are saved to \a fileName, and saved again whenever
+ * the roster changes. The file is written in a background thread.
+ *
+ * If \a fileName already holds a snapshot when Connection::FeatureRoster is introspected, only
+ * the list of contacts is retrieved from the connection, and the rest of their attributes are
+ * taken from the snapshot. The roster then becomes ready without waiting for the attributes of
+ * every contact, which can take a long time on large rosters. The attributes are retrieved in
+ * the background afterwards, and the contacts updated with whatever differs from the snapshot,
+ * emitting the usual change signals. Until then, the contacts may show stale information, such as
+ * their presence from the time the snapshot was saved.
+ *
+ * Handles are not kept across connections, so the snapshot is keyed by contact identifier. It
+ * should be kept per account, for example in a file named after Account::uniqueIdentifier()
+ * in the application cache directory. Snapshots are only used on connections implementing the
+ * ContactList interface.
+ *
+ * For the snapshot to be used, this has to be called before Connection::FeatureRoster is
+ * requested, so Connection::FeatureRoster should not be one of the features the ConnectionFactory
+ * makes ready, but be requested with Connection::becomeReady() afterwards.
+ *
+ * The roster is not snapshotted by default.
+ *
+ * \param fileName The snapshot file name, or an empty string to stop snapshotting the roster.
+ * \sa rosterSnapshotFileName()
+ */
+void ContactManager::setRosterSnapshotFileName(const QString &fileName)
+{
+    mPriv->roster->setSnapshotFileName(fileName);
+}
+
+/**
+ * Return the number of contacts built by this manager which are still alive.
+ *
+ * The contacts are only weakly referenced by the manager, so this is the number of contacts
+ * still referenced elsewhere, for example by the roster or by the application.
+ *
+ * This walks all the contacts known to the manager, so it should not be called too often.
+ *
+ * \return The number of live contacts.
+ * \sa deadContactCount(), totalContactsBuilt()
+ */
+int ContactManager::liveContactCount() const
+{
+    return mPriv->contacts.liveCount();
+}
+
+/**
+ * Return the number of contacts which have been destroyed but are still tracked by this manager.
+ *
+ * These are removed in small steps whenever new contacts are built, so this stays low in
+ * comparison to liveContactCount() even when many short-lived contacts are built, for example
+ * on busy chat rooms.
+ *
+ * This walks all the contacts known to the manager, so it should not be called too often.
+ *
+ * \return The number of dead contacts.
+ * \sa liveContactCount(), totalContactsBuilt()
+ */
+int ContactManager::deadContactCount() const
+{
+    return mPriv->contacts.deadCount();
+}
+
+/**
+ * Return the number of contacts this manager has built since its creation, including the ones
+ * which have since been destroyed.
+ *
+ * \return The total number of contacts built.
+ * \sa liveContactCount(), deadContactCount()
+ */
+quint64 ContactManager::totalContactsBuilt() const
+{
+    return mPriv->contacts.totalInserted();
+}
+
+/**
+ * Return whether contacts emit their own change signals for the changes signalled by the
+ * connection.
+ *
+ * \return \c true if the per-contact change signals are emitted, \c false otherwise.
+ * \sa setContactChangeSignalsEnabled()
+ */
+bool ContactManager::contactChangeSignalsEnabled() const
+{
+    return mPriv->contactChangeSignals;
+}
+
+/**
+ * Set whether contacts should emit their own change signals for the changes signalled by the
+ * connection.
+ *
+ * The presencesChanged(), aliasesChanged() and capabilitiesChanged() signals are emitted once
+ * for each batch of changes signalled by the connection, with all the contacts that changed in
+ * it. When a large roster comes online, this is one signal instead of one
+ * Contact::presenceChanged() signal per contact, so models can update in a single pass.
+ * Such models can then disable the per-contact Contact::presenceChanged(),
+ * Contact::aliasChanged() and Contact::capabilitiesChanged() signals for these changes.
+ *
+ * The per-contact signals are enabled by default.
+ *
+ * \param enabled Whether the per-contact change signals should be emitted.
+ * \sa contactChangeSignalsEnabled()
+ */
+void ContactManager::setContactChangeSignalsEnabled(bool enabled)
+{
+    mPriv->contactChangeSignals = enabled;
+}
+
 void ContactManager::onAliasesChanged(const AliasPairList &aliases)
 {
     debug() << "Got AliasesChanged for" << aliases.size() << "contacts";
 
+    Contacts changed;
     foreach (AliasPair pair, aliases) {
         ContactPtr contact = lookupContactByHandle(pair.handle);
 
-        if (contact) {
-            contact->receiveAlias(pair.alias);
+        if (contact && contact->receiveAlias(pair.alias, mPriv->contactChangeSignals)) {
+            changed.insert(contact);
         }
     }
+
+    if (!changed.isEmpty()) {
+        emit aliasesChanged(changed);
+    }
 }
 
 void ContactManager::doRequestAvatars()
 {
     Q_ASSERT(mPriv->requestAvatarsIdle);
+
+    AvatarCachePtr cache = mPriv->avatarCache();
+    if (!cache->isLoaded()) {
+        // Rather than looking each avatar up on disk, keep the requests queued until the
+        // index is there
+        debug() << "Avatar cache not loaded yet, deferring avatar requests";
+        mPriv->requestAvatarsDeferred = true;
+        return;
+    }
+
     QSet<ContactPtr> contacts = mPriv->requestAvatarsQueue;
     Q_ASSERT(contacts.size() > 0);
 
     mPriv->requestAvatarsQueue.clear();
     mPriv->requestAvatarsIdle = false;
 
+    // Pick up what other processes cached or evicted, once for the whole batch
+    cache->refresh();
+
     int found = 0;
     UIntList notFound;
     foreach (const ContactPtr &contact, contacts) {
@@ -1273,22 +1543,13 @@ void ContactManager::doRequestAvatars()
             continue;
         }
 
-        QString avatarFileName;
-        QString mimeTypeFileName;
-        bool success = (contact->isAvatarTokenKnown() &&
-            mPriv->buildAvatarFileName(contact->avatarToken(), false,
-                avatarFileName, mimeTypeFileName));
-
         /* Check if the avatar is already in the cache */
-        if (success && QFile::exists(avatarFileName)) {
-            QFile mimeTypeFile(mimeTypeFileName);
-            mimeTypeFile.open(QIODevice::ReadOnly);
-            QString mimeType = QString(QLatin1String(mimeTypeFile.readAll()));
-            mimeTypeFile.close();
-
+        AvatarCache::Entry entry;
+        if (contact->isAvatarTokenKnown() && cache->lookup(contact->avatarToken(), &entry)) {
             found++;
 
-            contact->receiveAvatarData(AvatarData(avatarFileName, mimeType));
+            contact->receiveAvatarData(AvatarData(
+                        cache->avatarFileName(contact->avatarToken()), entry.mimeType));
 
             continue;
         }
@@ -1315,6 +1576,15 @@ void ContactManager::doRequestAvatars()
         SLOT(deleteLater()));
 }
 
+void ContactManager::onAvatarCacheLoaded()
+{
+    // Only once the queued doRequestAvatars() call gave up, so it isn't run twice
+    if (mPriv->requestAvatarsDeferred) {
+        mPriv->requestAvatarsDeferred = false;
+        doRequestAvatars();
+    }
+}
+
 void ContactManager::onAvatarUpdated(uint handle, const QString &token)
 {
     debug() << "Got AvatarUpdate for contact with handle" << handle;
@@ -1328,46 +1598,44 @@ void ContactManager::onAvatarUpdated(uint handle, const QString &token)
 void ContactManager::onAvatarRetrieved(uint handle, const QString &token,
     const QByteArray &data, const QString &mimeType)
 {
-    QString avatarFileName;
-    QString mimeTypeFileName;
-
     debug() << "Got AvatarRetrieved for contact with handle" << handle;
 
-    bool success = mPriv->buildAvatarFileName(token, true, avatarFileName,
-        mimeTypeFileName);
-
-    if (success) {
-        debug() << "Write avatar in cache for handle" << handle;
-        debug() << "Filename:" << avatarFileName;
-        debug() << "MimeType:" << mimeType;
-
-        if (!QFile::exists(mimeTypeFileName)) {
-            QTemporaryFile mimeTypeFile(mimeTypeFileName);
-            if (mimeTypeFile.open()) {
-                mimeTypeFile.write(mimeType.toLatin1());
-                mimeTypeFile.setAutoRemove(false);
-                if (!mimeTypeFile.rename(mimeTypeFileName)) {
-                    mimeTypeFile.remove();
-                }
-            }
-        }
-
-        if (!QFile::exists(avatarFileName)) {
-            QTemporaryFile avatarFile(avatarFileName);
-            if (avatarFile.open()) {
-                avatarFile.write(data);
-                avatarFile.setAutoRemove(false);
-                if (!avatarFile.rename(avatarFileName)) {
-                    avatarFile.remove();
-                }
-            }
-        }
-    }
-
     ContactPtr contact = lookupContactByHandle(handle);
     if (contact) {
         contact->setAvatarToken(token);
-        contact->receiveAvatarData(AvatarData(avatarFileName, mimeType));
+    }
+
+    /* The avatar is written to the cache on a worker thread, so a burst of avatars doesn't
+     * block us. The contacts get it once it is safely on disk, see onAvatarWritten(). */
+    AvatarCachePtr cache = mPriv->avatarCache();
+    Private::AvatarWrite &write = mPriv->avatarWrites[token];
+    write.fileName = cache->avatarFileName(token);
+    write.mimeType = mimeType;
+    write.handles.insert(handle);
+
+    debug() << "Write avatar in cache for handle" << handle;
+    debug() << "Filename:" << write.fileName;
+    debug() << "MimeType:" << mimeType;
+
+    cache->write(token, data, mimeType);
+}
+
+void ContactManager::onAvatarWritten(const QString &token, bool success)
+{
+    if (!mPriv->avatarWrites.contains(token)) {
+        // Written on behalf of another ContactManager sharing the same cache
+        return;
+    }
+
+    Private::AvatarWrite write = mPriv->avatarWrites.take(token);
+    AvatarData avatar(success ? write.fileName : QString(), write.mimeType);
+
+    foreach (uint handle, write.handles) {
+        ContactPtr contact = lookupContactByHandle(handle);
+        // Skip contacts whose avatar changed again while this one was being written
+        if (contact && (!contact->isAvatarTokenKnown() || contact->avatarToken() == token)) {
+            contact->receiveAvatarData(avatar);
+        }
     }
 }
 
@@ -1375,26 +1643,38 @@ void ContactManager::onPresencesChanged(const SimpleContactPresences &presences)
 {
     debug() << "Got PresencesChanged for" << presences.size() << "contacts";
 
-    foreach (uint handle, presences.keys()) {
-        ContactPtr contact = lookupContactByHandle(handle);
+    Contacts changed;
+    SimpleContactPresences::const_iterator end = presences.constEnd();
+    for (SimpleContactPresences::const_iterator i = presences.constBegin(); i != end; ++i) {
+        ContactPtr contact = lookupContactByHandle(i.key());
 
-        if (contact) {
-            contact->receiveSimplePresence(presences[handle]);
+        if (contact && contact->receiveSimplePresence(i.value(), mPriv->contactChangeSignals)) {
+            changed.insert(contact);
         }
     }
+
+    if (!changed.isEmpty()) {
+        emit presencesChanged(changed);
+    }
 }
 
 void ContactManager::onCapabilitiesChanged(const ContactCapabilitiesMap &caps)
 {
     debug() << "Got ContactCapabilitiesChanged for" << caps.size() << "contacts";
 
-    foreach (uint handle, caps.keys()) {
-        ContactPtr contact = lookupContactByHandle(handle);
+    Contacts changed;
+    ContactCapabilitiesMap::const_iterator end = caps.constEnd();
+    for (ContactCapabilitiesMap::const_iterator i = caps.constBegin(); i != end; ++i) {
+        ContactPtr contact = lookupContactByHandle(i.key());
 
-        if (contact) {
-            contact->receiveCapabilities(caps[handle]);
+        if (contact && contact->receiveCapabilities(i.value(), mPriv->contactChangeSignals)) {
+            changed.insert(contact);
         }
     }
+
+    if (!changed.isEmpty()) {
+        emit capabilitiesChanged(changed);
+    }
 }
 
 void ContactManager::onLocationUpdated(uint handle, const QVariantMap &location)
@@ -1438,6 +1718,99 @@ void ContactManager::doRefreshInfo()
     op->refreshInfo();
 }
 
+void ContactManager::doRequestContactAttributes()
+{
+    QList<PendingContactAttributes *> requests = mPriv->contactAttributesQueue;
+    Q_ASSERT(!requests.isEmpty());
+    mPriv->contactAttributesQueue.clear();
+
+    ConnectionPtr conn(connection());
+    if (!conn) {
+        foreach (PendingContactAttributes *request, requests) {
+            request->failImmediately(TP_QT_ERROR_NOT_AVAILABLE,
+                    QLatin1String("Connection destroyed before the attributes were requested"));
+        }
+        return;
+    }
+
+    UIntList handles;
+    QSet<uint> seenHandles;
+    QSet<QString> interfaces;
+    foreach (PendingContactAttributes *request, requests) {
+        foreach (uint handle, request->contactsRequested()) {
+            if (!seenHandles.contains(handle)) {
+                seenHandles.insert(handle);
+                handles << handle;
+            }
+        }
+        interfaces.unite(request->interfacesRequested().toSet());
+    }
+
+    debug() << "Coalescing" << requests.size() << "contact attributes requests into one for" <<
+        handles.size() << "handles";
+
+    // The batch counts as in flight on its own from now on
+    ConnectionLowlevelPtr lowlevel = conn->lowlevel();
+    PendingContactAttributes *batch =
+        lowlevel->contactAttributes(handles, interfaces.toList(), true);
+    lowlevel->contactAttributesRequestLanded();
+    mPriv->contactAttributesBatches.insert(batch, requests);
+    connect(batch,
+            SIGNAL(attributesReceived(Tp::UIntList,Tp::ContactAttributesMap)),
+            SLOT(onContactAttributesBatchChunkReceived(Tp::UIntList,Tp::ContactAttributesMap)));
+    connect(batch,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(onContactAttributesBatchFinished(Tp::PendingOperation*)));
+}
+
+void ContactManager::onContactAttributesBatchChunkReceived(const UIntList &handles,
+        const ContactAttributesMap &attributes)
+{
+    QList<PendingContactAttributes *> requests = mPriv->contactAttributesBatches.value(
+            qobject_cast<PendingOperation *>(sender()));
+
+    foreach (PendingContactAttributes *request, requests) {
+        request->receiveChunkFromBatch(handles, attributes);
+    }
+}
+
+void ContactManager::onContactAttributesBatchFinished(PendingOperation *op)
+{
+    PendingContactAttributes *batch = qobject_cast<PendingContactAttributes *>(op);
+    QList<PendingContactAttributes *> requests = mPriv->contactAttributesBatches.take(op);
+
+    foreach (PendingContactAttributes *request, requests) {
+        request->finishFromBatch(batch);
+    }
+}
+
+PendingContactAttributes *ContactManager::requestContactAttributes(const UIntList &handles,
+        const QStringList &interfaces)
+{
+    ConnectionPtr conn(connection());
+    ConnectionLowlevelPtr lowlevel = conn->lowlevel();
+
+    if (!mPriv->coalesceContactRequests) {
+        return lowlevel->contactAttributes(handles, interfaces, true);
+    }
+
+    // Fail right away rather than when the batch is sent
+    PendingContactAttributes *failed = lowlevel->checkContactAttributes(handles, interfaces, true);
+    if (failed) {
+        return failed;
+    }
+
+    PendingContactAttributes *request =
+        new PendingContactAttributes(conn, handles, interfaces, true);
+    if (mPriv->contactAttributesQueue.isEmpty()) {
+        // Keep the handles from being released until the batch is sent
+        lowlevel->contactAttributesRequestStarted();
+        QTimer::singleShot(0, this, SLOT(doRequestContactAttributes()));
+    }
+    mPriv->contactAttributesQueue.append(request);
+    return request;
+}
+
 ContactPtr ContactManager::ensureContact(const ReferencedHandles &handle,
         const Features &features, const QVariantMap &attributes)
 {
@@ -1449,7 +1822,13 @@ ContactPtr ContactManager::ensureContact(const ReferencedHandles &handle,
         mPriv->contacts.insert(bareHandle, contact);
     }
 
-    contact->augment(features, attributes);
+    if (features.contains(Contact::FeatureRosterGroups)) {
+        QSet<QString> oldGroups = contact->groups().toSet();
+        contact->augment(features, attributes);
+        mPriv->roster->updateGroupsIndex(contact, oldGroups);
+    } else {
+        contact->augment(features, attributes);
+    }
 
     return contact;
 }
@@ -1461,7 +1840,8 @@ ContactPtr ContactManager::ensureContact(uint bareHandle, const QString &id,
 
     if (!contact) {
         QVariantMap attributes;
-        attributes.insert(TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id"), id);
+        attributes.insert(ContactAttributeKeys::instance().name(ContactAttributeKeys::ContactId),
+                id);
 
         contact = connection()->contactFactory()->construct(this,
                 ReferencedHandles(connection(), HandleTypeContact, UIntList() << bareHandle),
@@ -1664,4 +2044,34 @@ void ContactManager::resetRoster()
  * \sa allKnownContacts()
  */
 
+/**
+ * \fn void ContactManager::presencesChanged(const Tp::Contacts &contacts)
+ *
+ * Emitted once for each batch of presence changes signalled by the connection, with the
+ * contacts whose Contact::presence() changed in it.
+ *
+ * \param contacts The contacts whose presence changed.
+ * \sa setContactChangeSignalsEnabled(), Contact::presenceChanged()
+ */
+
+/**
+ * \fn void ContactManager::aliasesChanged(const Tp::Contacts &contacts)
+ *
+ * Emitted once for each batch of alias changes signalled by the connection, with the contacts
+ * whose Contact::alias() changed in it.
+ *
+ * \param contacts The contacts whose alias changed.
+ * \sa setContactChangeSignalsEnabled(), Contact::aliasChanged()
+ */
+
+/**
+ * \fn void ContactManager::capabilitiesChanged(const Tp::Contacts &contacts)
+ *
+ * Emitted once for each batch of capabilities changes signalled by the connection, with the
+ * contacts whose Contact::capabilities() changed in it.
+ *
+ * \param contacts The contacts whose capabilities changed.
+ * \sa setContactChangeSignalsEnabled(), Contact::capabilitiesChanged()
+ */
+
 } // Tp
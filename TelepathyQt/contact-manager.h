@@ -27,6 +27,7 @@
 #error IN_TP_QT_HEADER
 #endif
 
+#include <TelepathyQt/AvatarCacheStatistics>
 #include <TelepathyQt/Channel>
 #include <TelepathyQt/Contact>
 #include <TelepathyQt/Feature>
@@ -44,6 +45,7 @@ namespace Tp
 {
 
 class Connection;
+class PendingContactAttributes;
 class PendingContacts;
 class PendingOperation;
 
@@ -127,8 +129,26 @@ public:
 
     void requestContactAvatars(const QList<ContactPtr> &contacts);
 
+    AvatarCacheStatistics avatarCacheStatistics() const;
+    qint64 avatarCacheMaximumBytes() const;
+    int avatarCacheMaximumEntries() const;
+    void setAvatarCacheLimits(qint64 maximumBytes, int maximumEntries);
+
     PendingOperation *refreshContactInfo(const QList<ContactPtr> &contact);
 
+    bool isContactRequestCoalescingEnabled() const;
+    void setContactRequestCoalescingEnabled(bool enabled);
+
+    QString rosterSnapshotFileName() const;
+    void setRosterSnapshotFileName(const QString &fileName);
+
+    bool contactChangeSignalsEnabled() const;
+    void setContactChangeSignalsEnabled(bool enabled);
+
+    int liveContactCount() const;
+    int deadContactCount() const;
+    quint64 totalContactsBuilt() const;
+
 Q_SIGNALS:
     void stateChanged(Tp::ContactListState state);
 
@@ -147,23 +167,34 @@ Q_SIGNALS:
             const Tp::Contacts &contactsRemoved,
             const Tp::Channel::GroupMemberChangeDetails &details);
 
+    void presencesChanged(const Tp::Contacts &contacts);
+    void aliasesChanged(const Tp::Contacts &contacts);
+    void capabilitiesChanged(const Tp::Contacts &contacts);
+
 private Q_SLOTS:
     TP_QT_NO_EXPORT void onAliasesChanged(const Tp::AliasPairList &);
     TP_QT_NO_EXPORT void doRequestAvatars();
+    TP_QT_NO_EXPORT void onAvatarCacheLoaded();
     TP_QT_NO_EXPORT void onAvatarUpdated(uint, const QString &);
     TP_QT_NO_EXPORT void onAvatarRetrieved(uint, const QString &, const QByteArray &, const QString &);
+    TP_QT_NO_EXPORT void onAvatarWritten(const QString &, bool);
     TP_QT_NO_EXPORT void onPresencesChanged(const Tp::SimpleContactPresences &);
     TP_QT_NO_EXPORT void onCapabilitiesChanged(const Tp::ContactCapabilitiesMap &);
     TP_QT_NO_EXPORT void onLocationUpdated(uint, const QVariantMap &);
     TP_QT_NO_EXPORT void onContactInfoChanged(uint, const Tp::ContactInfoFieldList &);
     TP_QT_NO_EXPORT void onClientTypesUpdated(uint, const QStringList &);
     TP_QT_NO_EXPORT void doRefreshInfo();
+    TP_QT_NO_EXPORT void doRequestContactAttributes();
+    TP_QT_NO_EXPORT void onContactAttributesBatchChunkReceived(const Tp::UIntList &,
+            const Tp::ContactAttributesMap &);
+    TP_QT_NO_EXPORT void onContactAttributesBatchFinished(Tp::PendingOperation *);
 
 private:
     class PendingRefreshContactInfo;
     class Roster;
     friend class Channel;
     friend class Connection;
+    friend class ConnectionLowlevel;
     friend class PendingContacts;
     friend class PendingRefreshContactInfo;
     friend class Roster;
@@ -172,6 +203,9 @@ private:
 
     TP_QT_NO_EXPORT ContactPtr lookupContactByHandle(uint handle);
 
+    TP_QT_NO_EXPORT PendingContactAttributes *requestContactAttributes(const UIntList &handles,
+            const QStringList &interfaces);
+
     TP_QT_NO_EXPORT ContactPtr ensureContact(const ReferencedHandles &handle,
             const Features &features,
             const QVariantMap &attributes);
@@ -24,8 +24,12 @@
 
 #include "TelepathyQt/_gen/contact.moc.hpp"
 
+#include "TelepathyQt/avatar-cache-internal.h"
+#include "TelepathyQt/contact-attribute-keys-internal.h"
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/feature-set-internal.h"
 #include "TelepathyQt/future-internal.h"
+#include "TelepathyQt/test-backdoors.h"
 
 #include <TelepathyQt/AvatarData>
 #include <TelepathyQt/Connection>
@@ -40,27 +44,78 @@
 #include <TelepathyQt/Presence>
 #include <TelepathyQt/ReferencedHandles>
 
+#include <QFileInfo>
+
 namespace Tp
 {
 
 struct TP_QT_NO_EXPORT Contact::Private
 {
+    // The data only some features need lives in blocks allocated when the feature first gets
+    // some, so that contacts built with just a few features don't pay for all the others
+    struct AvatarInfo
+    {
+        AvatarInfo() : isAvatarTokenKnown(false) { }
+
+        bool isAvatarTokenKnown;
+        QString avatarToken;
+        AvatarData avatarData;
+        // The cache holding avatarData.fileName, pinned so it isn't evicted while we use it
+        AvatarCachePtr pinnedCache;
+    };
+
+    struct InfoCard
+    {
+        InfoCard() : isContactInfoKnown(false) { }
+
+        bool isContactInfoKnown;
+        InfoFields info;
+    };
+
+    struct Addresses
+    {
+        QMap<QString, QString> vcardAddresses;
+        QStringList uris;
+    };
+
     Private(Contact *parent, ContactManager *manager,
         const ReferencedHandles &handle)
         : parent(parent),
           manager(ContactManagerPtr(manager)),
           handle(handle),
-          caps(manager->supportedFeatures().contains(Contact::FeatureCapabilities) ?
-                   ContactCapabilities(true) :  ContactCapabilities(
-                           manager->connection()->capabilities().allClassSpecs(), false)),
-          isContactInfoKnown(false), isAvatarTokenKnown(false),
           subscriptionState(SubscriptionStateUnknown),
           publishState(SubscriptionStateUnknown),
-          blocked(false)
+          blocked(false),
+          avatar(0),
+          caps(initialCaps(manager)),
+          location(0),
+          infoCard(0),
+          addresses(0)
+    {
+    }
+
+    ~Private()
     {
+        if (avatar) {
+            pinAvatar(QString());
+        }
+        delete avatar;
+        delete location;
+        delete infoCard;
+        delete addresses;
     }
 
     void updateAvatarData();
+    void pinAvatar(const QString &fileName);
+
+    void insertActualFeature(const Feature &feature);
+
+    static ContactCapabilities initialCaps(ContactManager *manager);
+
+    AvatarInfo &ensureAvatar();
+    LocationInfo &ensureLocation();
+    InfoCard &ensureInfoCard();
+    Addresses &ensureAddresses();
 
     Contact *parent;
 
@@ -69,21 +124,12 @@ struct TP_QT_NO_EXPORT Contact::Private
     QString id;
 
     Features requestedFeatures;
+    // The same as requestedFeatures, for the checks done on every accessor and lookup
+    FeatureSet requestedFeatureBits;
     Features actualFeatures;
 
     QString alias;
-    QMap<QString, QString> vcardAddresses;
-    QStringList uris;
     Presence presence;
-    ContactCapabilities caps;
-    LocationInfo location;
-
-    bool isContactInfoKnown;
-    InfoFields info;
-
-    bool isAvatarTokenKnown;
-    QString avatarToken;
-    AvatarData avatarData;
 
     SubscriptionState subscriptionState;
     SubscriptionState publishState;
@@ -93,6 +139,12 @@ struct TP_QT_NO_EXPORT Contact::Private
     QSet<QString> groups;
 
     QStringList clientTypes;
+
+    AvatarInfo *avatar;
+    ContactCapabilities caps;
+    LocationInfo *location;
+    InfoCard *infoCard;
+    Addresses *addresses;
 };
 
 void Contact::Private::updateAvatarData()
@@ -101,21 +153,90 @@ void Contact::Private::updateAvatarData()
      * have to request the avatar data to get the token. This happens with XMPP
      * for offline contacts. We don't want to bypass the avatar cache, so we won't
      * update avatar. */
-    if (avatarToken.isNull()) {
+    if (!avatar || avatar->avatarToken.isNull()) {
         return;
     }
 
     /* If token is empty (""), it means the contact has no avatar. */
-    if (avatarToken.isEmpty()) {
+    if (avatar->avatarToken.isEmpty()) {
         debug() << "Contact" << parent->id() << "has no avatar";
-        avatarData = AvatarData();
-        emit parent->avatarDataChanged(avatarData);
+        pinAvatar(QString());
+        avatar->avatarData = AvatarData();
+        emit parent->avatarDataChanged(avatar->avatarData);
         return;
     }
 
     parent->manager()->requestContactAvatars(QList<ContactPtr>() << ContactPtr(parent));
 }
 
+void Contact::Private::pinAvatar(const QString &fileName)
+{
+    if (avatar->pinnedCache) {
+        avatar->pinnedCache->unpin(avatar->avatarData.fileName);
+        avatar->pinnedCache.reset();
+    }
+
+    if (!fileName.isEmpty()) {
+        avatar->pinnedCache = AvatarCache::forPath(QFileInfo(fileName).path());
+        avatar->pinnedCache->pin(fileName);
+    }
+}
+
+void Contact::Private::insertActualFeature(const Feature &feature)
+{
+    // Don't detach a set shared with other contacts for nothing
+    if (!actualFeatures.contains(feature)) {
+        actualFeatures.insert(feature);
+    }
+}
+
+Contact::Private::AvatarInfo &Contact::Private::ensureAvatar()
+{
+    if (!avatar) {
+        avatar = new AvatarInfo;
+    }
+    return *avatar;
+}
+
+ContactCapabilities Contact::Private::initialCaps(ContactManager *manager)
+{
+    if (manager->supportedFeatures().contains(Contact::FeatureCapabilities)) {
+        // Shared by the contacts until they get their own
+        static const ContactCapabilities unknownCaps(true);
+        return unknownCaps;
+    }
+
+    ConnectionPtr conn(manager->connection());
+    if (!conn) {
+        return ContactCapabilities(false);
+    }
+    return ContactCapabilities(conn->capabilities().allClassSpecs(), false);
+}
+
+LocationInfo &Contact::Private::ensureLocation()
+{
+    if (!location) {
+        location = new LocationInfo;
+    }
+    return *location;
+}
+
+Contact::Private::InfoCard &Contact::Private::ensureInfoCard()
+{
+    if (!infoCard) {
+        infoCard = new InfoCard;
+    }
+    return *infoCard;
+}
+
+Contact::Private::Addresses &Contact::Private::ensureAddresses()
+{
+    if (!addresses) {
+        addresses = new Addresses;
+    }
+    return *addresses;
+}
+
 struct TP_QT_NO_EXPORT Contact::InfoFields::Private : public QSharedData
 {
     Private(const ContactInfoFieldList &allFields)
@@ -321,9 +442,11 @@ Contact::Contact(ContactManager *manager, const ReferencedHandles &handle,
     : Object(),
       mPriv(new Private(this, manager, handle))
 {
-    mPriv->requestedFeatures.unite(requestedFeatures);
-    mPriv->id = qdbus_cast<QString>(attributes[
-            TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")]);
+    // Share the set with the other contacts built by the same request
+    mPriv->requestedFeatures = requestedFeatures;
+    mPriv->requestedFeatureBits = FeatureSet(requestedFeatures);
+    mPriv->id = qdbus_cast<QString>(attributes.value(
+            ContactAttributeKeys::instance().name(ContactAttributeKeys::ContactId)));
 }
 
 /**
@@ -375,6 +498,11 @@ Features Contact::requestedFeatures() const
     return mPriv->requestedFeatures;
 }
 
+bool Contact::hasRequestedFeatures(const FeatureSet &features) const
+{
+    return mPriv->requestedFeatureBits.contains(features);
+}
+
 /**
  * Return the features that are actually enabled on this contact.
  *
@@ -396,7 +524,7 @@ Features Contact::actualFeatures() const
  */
 QString Contact::alias() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureAlias)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureAlias)) {
         warning() << "Contact::alias() used on" << this
             << "for which FeatureAlias hasn't been requested - returning id";
         return id();
@@ -415,7 +543,7 @@ QString Contact::alias() const
  */
 QMap<QString, QString> Contact::vcardAddresses() const
 {
-    return mPriv->vcardAddresses;
+    return mPriv->addresses ? mPriv->addresses->vcardAddresses : QMap<QString, QString>();
 }
 
 /**
@@ -428,7 +556,7 @@ QMap<QString, QString> Contact::vcardAddresses() const
  */
 QStringList Contact::uris() const
 {
-    return mPriv->uris;
+    return mPriv->addresses ? mPriv->addresses->uris : QStringList();
 }
 
 /**
@@ -441,13 +569,13 @@ QStringList Contact::uris() const
  */
 bool Contact::isAvatarTokenKnown() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureAvatarToken)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureAvatarToken)) {
         warning() << "Contact::isAvatarTokenKnown() used on" << this
             << "for which FeatureAvatarToken hasn't been requested - returning false";
         return false;
     }
 
-    return mPriv->isAvatarTokenKnown;
+    return mPriv->avatar && mPriv->avatar->isAvatarTokenKnown;
 }
 
 /**
@@ -462,7 +590,7 @@ bool Contact::isAvatarTokenKnown() const
  */
 QString Contact::avatarToken() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureAvatarToken)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureAvatarToken)) {
         warning() << "Contact::avatarToken() used on" << this
             << "for which FeatureAvatarToken hasn't been requested - returning \"\"";
         return QString();
@@ -472,7 +600,7 @@ QString Contact::avatarToken() const
         return QString();
     }
 
-    return mPriv->avatarToken;
+    return mPriv->avatar->avatarToken;
 }
 
 /**
@@ -487,13 +615,13 @@ QString Contact::avatarToken() const
  */
 AvatarData Contact::avatarData() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureAvatarData)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureAvatarData)) {
         warning() << "Contact::avatarData() used on" << this
             << "for which FeatureAvatarData hasn't been requested - returning \"\"";
         return AvatarData();
     }
 
-    return mPriv->avatarData;
+    return mPriv->avatar ? mPriv->avatar->avatarData : AvatarData();
 }
 
 /**
@@ -513,7 +641,7 @@ AvatarData Contact::avatarData() const
  */
 void Contact::requestAvatarData()
 {
-    if (!mPriv->requestedFeatures.contains(FeatureAvatarData)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureAvatarData)) {
         warning() << "Contact::requestAvatarData() used on" << this
             << "for which FeatureAvatarData hasn't been requested - returning \"\"";
         return;
@@ -533,7 +661,7 @@ void Contact::requestAvatarData()
  */
 Presence Contact::presence() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureSimplePresence)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureSimplePresence)) {
         warning() << "Contact::presence() used on" << this
             << "for which FeatureSimplePresence hasn't been requested - returning Unknown";
         return Presence();
@@ -562,7 +690,7 @@ Presence Contact::presence() const
  */
 ContactCapabilities Contact::capabilities() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureCapabilities)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureCapabilities)) {
         warning() << "Contact::capabilities() used on" << this
             << "for which FeatureCapabilities hasn't been requested - returning 0";
         return ContactCapabilities(false);
@@ -582,13 +710,13 @@ ContactCapabilities Contact::capabilities() const
  */
 LocationInfo Contact::location() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureLocation)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureLocation)) {
         warning() << "Contact::location() used on" << this
             << "for which FeatureLocation hasn't been requested - returning 0";
         return LocationInfo();
     }
 
-    return mPriv->location;
+    return mPriv->location ? *mPriv->location : LocationInfo();
 }
 
 /**
@@ -605,13 +733,13 @@ LocationInfo Contact::location() const
  */
 bool Contact::isContactInfoKnown() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureInfo)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureInfo)) {
         warning() << "Contact::isContactInfoKnown() used on" << this
             << "for which FeatureInfo hasn't been requested - returning false";
         return false;
     }
 
-    return mPriv->isContactInfoKnown;
+    return mPriv->infoCard && mPriv->infoCard->isContactInfoKnown;
 }
 
 /**
@@ -628,14 +756,14 @@ bool Contact::isContactInfoKnown() const
  */
 Contact::InfoFields Contact::infoFields() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureInfo)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureInfo)) {
         warning() << "Contact::infoFields() used on" << this
             << "for which FeatureInfo hasn't been requested - returning empty "
                "InfoFields";
         return InfoFields();
     }
 
-    return mPriv->info;
+    return mPriv->infoCard ? mPriv->infoCard->info : InfoFields();
 }
 
 /**
@@ -652,7 +780,7 @@ Contact::InfoFields Contact::infoFields() const
 PendingOperation *Contact::refreshInfo()
 {
     ConnectionPtr conn = manager()->connection();
-    if (!mPriv->requestedFeatures.contains(FeatureInfo)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureInfo)) {
         warning() << "Contact::refreshInfo() used on" << this
             << "for which FeatureInfo hasn't been requested - failing";
         return new PendingFailure(TP_QT_ERROR_NOT_AVAILABLE,
@@ -947,7 +1075,7 @@ PendingOperation *Contact::removeFromGroup(const QString &group)
  */
 QStringList Contact::clientTypes() const
 {
-    if (!mPriv->requestedFeatures.contains(FeatureClientTypes)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureClientTypes)) {
         warning() << "Contact::clientTypes() used on" << this
             << "for which FeatureClientTypes hasn't been requested - returning an empty list";
         return QStringList();
@@ -972,7 +1100,7 @@ QStringList Contact::clientTypes() const
  */
 PendingStringList *Contact::requestClientTypes()
 {
-    if (!mPriv->requestedFeatures.contains(FeatureClientTypes)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureClientTypes)) {
         warning() << "Contact::requestClientTypes() used on" << this
             << "for which FeatureClientTypes hasn't been requested - the operation will fail";
     }
@@ -987,24 +1115,25 @@ PendingStringList *Contact::requestClientTypes()
 
 void Contact::augment(const Features &requestedFeatures, const QVariantMap &attributes)
 {
-    mPriv->requestedFeatures.unite(requestedFeatures);
+    ContactAttributeValues values(attributes);
 
-    mPriv->id = qdbus_cast<QString>(attributes[
-            TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")]);
+    FeatureSet requestedFeatureBits(requestedFeatures);
+    if (!mPriv->requestedFeatureBits.contains(requestedFeatureBits)) {
+        mPriv->requestedFeatures.unite(requestedFeatures);
+        mPriv->requestedFeatureBits.unite(requestedFeatureBits);
+    }
+
+    mPriv->id = qdbus_cast<QString>(values.value(ContactAttributeKeys::ContactId));
 
-    if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
-                QLatin1String("/subscribe"))) {
-        uint subscriptionState = qdbus_cast<uint>(attributes.value(
-                     TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/subscribe")));
+    if (values.contains(ContactAttributeKeys::Subscribe)) {
+        uint subscriptionState = qdbus_cast<uint>(values.value(ContactAttributeKeys::Subscribe));
         setSubscriptionState((SubscriptionState) subscriptionState);
     }
 
-    if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
-                QLatin1String("/publish"))) {
-        uint publishState = qdbus_cast<uint>(attributes.value(
-                    TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/publish")));
-        QString publishRequest = qdbus_cast<QString>(attributes.value(
-                    TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/publish-request")));
+    if (values.contains(ContactAttributeKeys::Publish)) {
+        uint publishState = qdbus_cast<uint>(values.value(ContactAttributeKeys::Publish));
+        QString publishRequest = qdbus_cast<QString>(
+                values.value(ContactAttributeKeys::PublishRequest));
         setPublishState((SubscriptionState) publishState, publishRequest);
     }
 
@@ -1016,8 +1145,7 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
         ContactInfoFieldList maybeInfo;
 
         if (feature == FeatureAlias) {
-            maybeAlias = qdbus_cast<QString>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias")));
+            maybeAlias = qdbus_cast<QString>(values.value(ContactAttributeKeys::Alias));
 
             if (!maybeAlias.isEmpty()) {
                 receiveAlias(maybeAlias);
@@ -1026,102 +1154,103 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
             }
         } else if (feature == FeatureAvatarData) {
             if (manager()->supportedFeatures().contains(FeatureAvatarData)) {
-                mPriv->actualFeatures.insert(FeatureAvatarData);
+                mPriv->insertActualFeature(FeatureAvatarData);
                 mPriv->updateAvatarData();
             }
         } else if (feature == FeatureAvatarToken) {
-            if (attributes.contains(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token"))) {
-                receiveAvatarToken(qdbus_cast<QString>(attributes.value(
-                                TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token"))));
+            if (values.contains(ContactAttributeKeys::AvatarToken)) {
+                receiveAvatarToken(qdbus_cast<QString>(
+                            values.value(ContactAttributeKeys::AvatarToken)));
             } else {
                 if (manager()->supportedFeatures().contains(FeatureAvatarToken)) {
                     // AvatarToken being supported but not included in the mapping indicates
                     // that the avatar token is not known - however, the feature is working fine
-                    mPriv->actualFeatures.insert(FeatureAvatarToken);
+                    mPriv->insertActualFeature(FeatureAvatarToken);
                 }
                 // In either case, the avatar token can't be known
-                mPriv->isAvatarTokenKnown = false;
-                mPriv->avatarToken = QLatin1String("");
+                Private::AvatarInfo &avatar = mPriv->ensureAvatar();
+                avatar.isAvatarTokenKnown = false;
+                avatar.avatarToken = QLatin1String("");
             }
         } else if (feature == FeatureCapabilities) {
-            maybeCaps = qdbus_cast<RequestableChannelClassList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_CAPABILITIES + QLatin1String("/capabilities")));
+            maybeCaps = qdbus_cast<RequestableChannelClassList>(
+                    values.value(ContactAttributeKeys::Capabilities));
 
             if (!maybeCaps.isEmpty()) {
                 receiveCapabilities(maybeCaps);
             } else {
                 if (manager()->supportedFeatures().contains(FeatureCapabilities) &&
-                    mPriv->requestedFeatures.contains(FeatureCapabilities)) {
+                    mPriv->requestedFeatureBits.contains(FeatureCapabilities)) {
                     // Capabilities being supported but not updated in the
                     // mapping indicates that the capabilities is not known -
                     // however, the feature is working fine.
-                    mPriv->actualFeatures.insert(FeatureCapabilities);
+                    mPriv->insertActualFeature(FeatureCapabilities);
                 }
             }
         } else if (feature == FeatureInfo) {
-            maybeInfo = qdbus_cast<ContactInfoFieldList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO + QLatin1String("/info")));
+            maybeInfo = qdbus_cast<ContactInfoFieldList>(
+                    values.value(ContactAttributeKeys::Info));
 
             if (!maybeInfo.isEmpty()) {
                 receiveInfo(maybeInfo);
             } else {
                 if (manager()->supportedFeatures().contains(FeatureInfo) &&
-                    mPriv->requestedFeatures.contains(FeatureInfo)) {
+                    mPriv->requestedFeatureBits.contains(FeatureInfo)) {
                     // Info being supported but not updated in the
                     // mapping indicates that the info is not known -
                     // however, the feature is working fine
-                    mPriv->actualFeatures.insert(FeatureInfo);
+                    mPriv->insertActualFeature(FeatureInfo);
                 }
             }
         } else if (feature == FeatureLocation) {
-            maybeLocation = qdbus_cast<QVariantMap>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_LOCATION + QLatin1String("/location")));
+            maybeLocation = qdbus_cast<QVariantMap>(
+                    values.value(ContactAttributeKeys::Location));
 
             if (!maybeLocation.isEmpty()) {
                 receiveLocation(maybeLocation);
             } else {
                 if (manager()->supportedFeatures().contains(FeatureLocation) &&
-                    mPriv->requestedFeatures.contains(FeatureLocation)) {
+                    mPriv->requestedFeatureBits.contains(FeatureLocation)) {
                     // Location being supported but not updated in the
                     // mapping indicates that the location is not known -
                     // however, the feature is working fine
-                    mPriv->actualFeatures.insert(FeatureLocation);
+                    mPriv->insertActualFeature(FeatureLocation);
                 }
             }
         } else if (feature == FeatureSimplePresence) {
-            maybePresence = qdbus_cast<SimplePresence>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE + QLatin1String("/presence")));
+            maybePresence = qdbus_cast<SimplePresence>(
+                    values.value(ContactAttributeKeys::SimplePresence));
 
             if (!maybePresence.status.isEmpty()) {
                 receiveSimplePresence(maybePresence);
             } else {
-                mPriv->presence.setStatus(ConnectionPresenceTypeUnknown,
+                // All the contacts we know nothing about share the same presence data
+                static const Presence unknownPresence(ConnectionPresenceTypeUnknown,
                         QLatin1String("unknown"), QLatin1String(""));
+                mPriv->presence = unknownPresence;
             }
         } else if (feature == FeatureRosterGroups) {
-            QStringList groups = qdbus_cast<QStringList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS + QLatin1String("/groups")));
+            QStringList groups = qdbus_cast<QStringList>(
+                    values.value(ContactAttributeKeys::Groups));
             mPriv->groups = groups.toSet();
         } else if (feature == FeatureAddresses) {
-            VCardFieldAddressMap addresses = qdbus_cast<VCardFieldAddressMap>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_ADDRESSING + QLatin1String("/addresses")));
-            QStringList uris = qdbus_cast<QStringList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_ADDRESSING + QLatin1String("/uris")));
+            VCardFieldAddressMap addresses = qdbus_cast<VCardFieldAddressMap>(
+                    values.value(ContactAttributeKeys::Addresses));
+            QStringList uris = qdbus_cast<QStringList>(values.value(ContactAttributeKeys::Uris));
             receiveAddresses(addresses, uris);
         } else if (feature == FeatureClientTypes) {
-            QStringList maybeClientTypes = qdbus_cast<QStringList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_CLIENT_TYPES + QLatin1String("/client-types")));
+            QStringList maybeClientTypes = qdbus_cast<QStringList>(
+                    values.value(ContactAttributeKeys::ClientTypes));
 
             if (!maybeClientTypes.isEmpty()) {
                 receiveClientTypes(maybeClientTypes);
             } else {
                 if (manager()->supportedFeatures().contains(FeatureClientTypes) &&
-                    mPriv->requestedFeatures.contains(FeatureClientTypes)) {
+                    mPriv->requestedFeatureBits.contains(FeatureClientTypes)) {
                     // ClientTypes being supported but not updated in the
                     // mapping indicates that the info is not known -
                     // however, the feature is working fine
-                    mPriv->actualFeatures.insert(FeatureClientTypes);
+                    mPriv->insertActualFeature(FeatureClientTypes);
                 }
             }
         } else {
@@ -1130,18 +1259,23 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
     }
 }
 
-void Contact::receiveAlias(const QString &alias)
+bool Contact::receiveAlias(const QString &alias, bool notify)
 {
-    if (!mPriv->requestedFeatures.contains(FeatureAlias)) {
-        return;
+    if (!mPriv->requestedFeatureBits.contains(FeatureAlias)) {
+        return false;
     }
 
-    mPriv->actualFeatures.insert(FeatureAlias);
+    mPriv->insertActualFeature(FeatureAlias);
 
     if (mPriv->alias != alias) {
         mPriv->alias = alias;
-        emit aliasChanged(alias);
+        if (notify) {
+            emit aliasChanged(alias);
+        }
+        return true;
     }
+
+    return false;
 }
 
 void Contact::receiveAvatarToken(const QString &token)
@@ -1155,104 +1289,124 @@ void Contact::receiveAvatarToken(const QString &token)
 
 void Contact::setAvatarToken(const QString &token)
 {
-    if (!mPriv->requestedFeatures.contains(FeatureAvatarToken)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureAvatarToken)) {
         return;
     }
 
-    mPriv->actualFeatures.insert(FeatureAvatarToken);
+    mPriv->insertActualFeature(FeatureAvatarToken);
 
-    if (!mPriv->isAvatarTokenKnown || mPriv->avatarToken != token) {
-        mPriv->isAvatarTokenKnown = true;
-        mPriv->avatarToken = token;
-        emit avatarTokenChanged(mPriv->avatarToken);
+    Private::AvatarInfo &avatar = mPriv->ensureAvatar();
+    if (!avatar.isAvatarTokenKnown || avatar.avatarToken != token) {
+        avatar.isAvatarTokenKnown = true;
+        avatar.avatarToken = token;
+        emit avatarTokenChanged(avatar.avatarToken);
     }
 }
 
 void Contact::receiveAvatarData(const AvatarData &avatar)
 {
-    if (mPriv->avatarData.fileName != avatar.fileName) {
-        mPriv->avatarData = avatar;
-        emit avatarDataChanged(mPriv->avatarData);
+    Private::AvatarInfo &info = mPriv->ensureAvatar();
+    if (info.avatarData.fileName != avatar.fileName) {
+        mPriv->pinAvatar(avatar.fileName);
+        info.avatarData = avatar;
+        emit avatarDataChanged(info.avatarData);
     }
 }
 
-void Contact::receiveSimplePresence(const SimplePresence &presence)
+bool Contact::receiveSimplePresence(const SimplePresence &presence, bool notify)
 {
-    if (!mPriv->requestedFeatures.contains(FeatureSimplePresence)) {
-        return;
+    if (!mPriv->requestedFeatureBits.contains(FeatureSimplePresence)) {
+        return false;
     }
 
-    mPriv->actualFeatures.insert(FeatureSimplePresence);
+    mPriv->insertActualFeature(FeatureSimplePresence);
 
     if (mPriv->presence.status() != presence.status ||
         mPriv->presence.statusMessage() != presence.statusMessage) {
         mPriv->presence.setStatus(presence);
-        emit presenceChanged(mPriv->presence);
+        if (notify) {
+            emit presenceChanged(mPriv->presence);
+        }
+        return true;
     }
+
+    return false;
 }
 
-void Contact::receiveCapabilities(const RequestableChannelClassList &caps)
+bool Contact::receiveCapabilities(const RequestableChannelClassList &caps, bool notify)
 {
-    if (!mPriv->requestedFeatures.contains(FeatureCapabilities)) {
-        return;
+    if (!mPriv->requestedFeatureBits.contains(FeatureCapabilities)) {
+        return false;
     }
 
-    mPriv->actualFeatures.insert(FeatureCapabilities);
+    mPriv->insertActualFeature(FeatureCapabilities);
 
     if (mPriv->caps.allClassSpecs().bareClasses() != caps) {
         mPriv->caps.updateRequestableChannelClasses(caps);
-        emit capabilitiesChanged(mPriv->caps);
+        if (notify) {
+            emit capabilitiesChanged(mPriv->caps);
+        }
+        return true;
     }
+
+    return false;
 }
 
 void Contact::receiveLocation(const QVariantMap &location)
 {
-    if (!mPriv->requestedFeatures.contains(FeatureLocation)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureLocation)) {
         return;
     }
 
-    mPriv->actualFeatures.insert(FeatureLocation);
+    mPriv->insertActualFeature(FeatureLocation);
 
-    if (mPriv->location.allDetails() != location) {
-        mPriv->location.updateData(location);
-        emit locationUpdated(mPriv->location);
+    LocationInfo &current = mPriv->ensureLocation();
+    if (current.allDetails() != location) {
+        current.updateData(location);
+        emit locationUpdated(current);
     }
 }
 
 void Contact::receiveInfo(const ContactInfoFieldList &info)
 {
-    if (!mPriv->requestedFeatures.contains(FeatureInfo)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureInfo)) {
         return;
     }
 
-    mPriv->actualFeatures.insert(FeatureInfo);
-    mPriv->isContactInfoKnown = true;
+    mPriv->insertActualFeature(FeatureInfo);
+    Private::InfoCard &infoCard = mPriv->ensureInfoCard();
+    infoCard.isContactInfoKnown = true;
 
-    if (mPriv->info.allFields() != info) {
-        mPriv->info = InfoFields(info);
-        emit infoFieldsChanged(mPriv->info);
+    if (infoCard.info.allFields() != info) {
+        infoCard.info = InfoFields(info);
+        emit infoFieldsChanged(infoCard.info);
     }
 }
 
 void Contact::receiveAddresses(const QMap<QString, QString> &addresses,
         const QStringList &uris)
 {
-    if (!mPriv->requestedFeatures.contains(FeatureAddresses)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureAddresses)) {
         return;
     }
 
-    mPriv->actualFeatures.insert(FeatureAddresses);
-    mPriv->vcardAddresses = addresses;
-    mPriv->uris = uris;
+    mPriv->insertActualFeature(FeatureAddresses);
+    if (addresses.isEmpty() && uris.isEmpty() && !mPriv->addresses) {
+        return;
+    }
+
+    Private::Addresses &current = mPriv->ensureAddresses();
+    current.vcardAddresses = addresses;
+    current.uris = uris;
 }
 
 void Contact::receiveClientTypes(const QStringList &clientTypes)
 {
-    if (!mPriv->requestedFeatures.contains(FeatureClientTypes)) {
+    if (!mPriv->requestedFeatureBits.contains(FeatureClientTypes)) {
         return;
     }
 
-    mPriv->actualFeatures.insert(FeatureClientTypes);
+    mPriv->insertActualFeature(FeatureClientTypes);
 
     if (mPriv->clientTypes != clientTypes) {
         mPriv->clientTypes = clientTypes;
@@ -1326,6 +1480,10 @@ void Contact::setRemovedFromGroup(const QString &group)
  *
  * Emitted when the value of alias() changes.
  *
+ * When the change is signalled by the connection, this is not emitted if
+ * ContactManager::setContactChangeSignalsEnabled() was used to disable it, in which case
+ * ContactManager::aliasesChanged() has to be used instead.
+ *
  * \param alias The new alias of this contact.
  * \sa alias()
  */
@@ -1353,6 +1511,10 @@ void Contact::setRemovedFromGroup(const QString &group)
  *
  * Emitted when the value of presence() changes.
  *
+ * When the change is signalled by the connection, this is not emitted if
+ * ContactManager::setContactChangeSignalsEnabled() was used to disable it, in which case
+ * ContactManager::presencesChanged() has to be used instead.
+ *
  * \param presence The new presence of this contact.
  * \sa presence()
  */
@@ -1362,6 +1524,10 @@ void Contact::setRemovedFromGroup(const QString &group)
  *
  * Emitted when the value of capabilities() changes.
  *
+ * When the change is signalled by the connection, this is not emitted if
+ * ContactManager::setContactChangeSignalsEnabled() was used to disable it, in which case
+ * ContactManager::capabilitiesChanged() has to be used instead.
+ *
  * \param caps The new capabilities of this contact.
  * \sa capabilities()
  */
@@ -1438,4 +1604,27 @@ void Contact::setRemovedFromGroup(const QString &group)
  * \sa clientTypes(), requestClientTypes()
  */
 
+// Defined here rather than in test-backdoors.cpp, as it needs Contact::Private
+int TestBackdoors::contactFootprint(const Features &features)
+{
+    int bytes = sizeof(Contact) + sizeof(Contact::Private);
+
+    // The blocks allocated the first time their feature receives something
+    if (features.contains(Contact::FeatureAvatarToken) ||
+            features.contains(Contact::FeatureAvatarData)) {
+        bytes += sizeof(Contact::Private::AvatarInfo);
+    }
+    if (features.contains(Contact::FeatureLocation)) {
+        bytes += sizeof(LocationInfo);
+    }
+    if (features.contains(Contact::FeatureInfo)) {
+        bytes += sizeof(Contact::Private::InfoCard);
+    }
+    if (features.contains(Contact::FeatureAddresses)) {
+        bytes += sizeof(Contact::Private::Addresses);
+    }
+
+    return bytes;
+}
+
 } // Tp
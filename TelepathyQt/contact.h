@@ -42,11 +42,13 @@ struct AvatarData;
 class ContactCapabilities;
 class LocationInfo;
 class ContactManager;
+class FeatureSet;
 class PendingContactInfo;
 class PendingOperation;
 class PendingStringList;
 class Presence;
 class ReferencedHandles;
+class TestBackdoors;
 
 class TP_QT_EXPORT Contact : public Object
 {
@@ -213,12 +215,16 @@ protected:
 private:
     static const Feature FeatureRosterGroups;
 
-    TP_QT_NO_EXPORT void receiveAlias(const QString &alias);
+    TP_QT_NO_EXPORT bool hasRequestedFeatures(const FeatureSet &features) const;
+
+    TP_QT_NO_EXPORT bool receiveAlias(const QString &alias, bool notify = true);
     TP_QT_NO_EXPORT void receiveAvatarToken(const QString &avatarToken);
     TP_QT_NO_EXPORT void setAvatarToken(const QString &token);
     TP_QT_NO_EXPORT void receiveAvatarData(const AvatarData &);
-    TP_QT_NO_EXPORT void receiveSimplePresence(const SimplePresence &presence);
-    TP_QT_NO_EXPORT void receiveCapabilities(const RequestableChannelClassList &caps);
+    TP_QT_NO_EXPORT bool receiveSimplePresence(const SimplePresence &presence,
+            bool notify = true);
+    TP_QT_NO_EXPORT bool receiveCapabilities(const RequestableChannelClassList &caps,
+            bool notify = true);
     TP_QT_NO_EXPORT void receiveLocation(const QVariantMap &location);
     TP_QT_NO_EXPORT void receiveInfo(const ContactInfoFieldList &info);
     TP_QT_NO_EXPORT void receiveAddresses(const QMap<QString, QString> &addresses,
@@ -237,6 +243,7 @@ private:
     friend class Connection;
     friend class ContactFactory;
     friend class ContactManager;
+    friend class TestBackdoors;
     friend struct Private;
     Private *mPriv;
 };
@@ -0,0 +1,196 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_feature_set_internal_h_HEADER_GUARD_
+#define _TelepathyQt_feature_set_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Feature>
+
+#include <QVarLengthArray>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+// The index of the feature in a registry of all the features ever constructed in the process, so
+// that equal features always have the same small index, computed without going through the
+// feature class name.
+//
+// Exported so the tests can use it even if they link dynamically. The header is not installed
+// though, so this should be considered private API.
+TP_QT_EXPORT uint featureIndex(const Feature &feature);
+
+/*
+ * Set of features stored as bits, indexed by featureIndex(). It has the same API as Features for
+ * the operations it supports, so that checks on the hot paths can use one in place of the other.
+ *
+ * The first 256 features don't need any allocation, which covers all the library ones.
+ */
+class FeatureSet
+{
+public:
+    FeatureSet()
+    {
+    }
+
+    FeatureSet(const Feature &feature)
+    {
+        insert(feature);
+    }
+
+    FeatureSet(const Features &features)
+    {
+        for (Features::const_iterator i = features.constBegin(); i != features.constEnd(); ++i) {
+            insert(*i);
+        }
+    }
+
+    bool isEmpty() const
+    {
+        for (int i = 0; i < mWords.size(); ++i) {
+            if (mWords[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int size() const
+    {
+        int ret = 0;
+        for (int i = 0; i < mWords.size(); ++i) {
+            for (quint64 word = mWords[i]; word; word &= word - 1) {
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+    int count() const
+    {
+        return size();
+    }
+
+    bool contains(const Feature &feature) const
+    {
+        uint index = featureIndex(feature);
+        int word = index / 64;
+        return word < mWords.size() && (mWords[word] & bit(index));
+    }
+
+    bool contains(const FeatureSet &other) const
+    {
+        for (int i = 0; i < other.mWords.size(); ++i) {
+            quint64 mine = i < mWords.size() ? mWords[i] : 0;
+            if (other.mWords[i] & ~mine) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    FeatureSet &insert(const Feature &feature)
+    {
+        uint index = featureIndex(feature);
+        int word = index / 64;
+        grow(word + 1);
+        mWords[word] |= bit(index);
+        return *this;
+    }
+
+    bool remove(const Feature &feature)
+    {
+        uint index = featureIndex(feature);
+        int word = index / 64;
+        if (word >= mWords.size() || !(mWords[word] & bit(index))) {
+            return false;
+        }
+        mWords[word] &= ~bit(index);
+        return true;
+    }
+
+    FeatureSet &unite(const FeatureSet &other)
+    {
+        grow(other.mWords.size());
+        for (int i = 0; i < other.mWords.size(); ++i) {
+            mWords[i] |= other.mWords[i];
+        }
+        return *this;
+    }
+
+    FeatureSet &subtract(const FeatureSet &other)
+    {
+        int n = qMin(mWords.size(), other.mWords.size());
+        for (int i = 0; i < n; ++i) {
+            mWords[i] &= ~other.mWords[i];
+        }
+        return *this;
+    }
+
+    FeatureSet &intersect(const FeatureSet &other)
+    {
+        for (int i = 0; i < mWords.size(); ++i) {
+            mWords[i] &= i < other.mWords.size() ? other.mWords[i] : 0;
+        }
+        return *this;
+    }
+
+    bool operator==(const FeatureSet &other) const
+    {
+        return contains(other) && other.contains(*this);
+    }
+
+    bool operator!=(const FeatureSet &other) const
+    {
+        return !(*this == other);
+    }
+
+    FeatureSet &operator<<(const Feature &feature) { return insert(feature); }
+    FeatureSet &operator|=(const FeatureSet &other) { return unite(other); }
+    FeatureSet &operator-=(const FeatureSet &other) { return subtract(other); }
+    FeatureSet &operator&=(const FeatureSet &other) { return intersect(other); }
+
+    FeatureSet operator|(const FeatureSet &other) const { return FeatureSet(*this).unite(other); }
+    FeatureSet operator-(const FeatureSet &other) const { return FeatureSet(*this).subtract(other); }
+    FeatureSet operator&(const FeatureSet &other) const { return FeatureSet(*this).intersect(other); }
+
+private:
+    static quint64 bit(uint index)
+    {
+        return Q_UINT64_C(1) << (index % 64);
+    }
+
+    void grow(int words)
+    {
+        while (mWords.size() < words) {
+            mWords.append(0);
+        }
+    }
+
+    QVarLengthArray<quint64, 4> mWords;
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
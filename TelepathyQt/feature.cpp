@@ -22,14 +22,51 @@
 
 #include <TelepathyQt/Feature>
 
+#include "TelepathyQt/feature-set-internal.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
 namespace Tp
 {
 
+namespace
+{
+
+// Gives each distinct feature a small integer, so that sets of features can be stored as bits
+struct FeatureRegistry
+{
+    QMutex mutex;
+    QHash<QPair<QString, uint>, uint> indexes;
+};
+
+Q_GLOBAL_STATIC(FeatureRegistry, featureRegistry)
+
+uint internFeature(const QString &className, uint id)
+{
+    FeatureRegistry *registry = featureRegistry();
+    QMutexLocker locker(&registry->mutex);
+
+    QPair<QString, uint> key(className, id);
+    QHash<QPair<QString, uint>, uint>::const_iterator i = registry->indexes.constFind(key);
+    if (i != registry->indexes.constEnd()) {
+        return i.value();
+    }
+
+    uint index = registry->indexes.size();
+    registry->indexes.insert(key, index);
+    return index;
+}
+
+}
+
 struct TP_QT_NO_EXPORT Feature::Private : public QSharedData
 {
-    Private(bool critical) : critical(critical) {}
+    Private(bool critical, uint index) : critical(critical), index(index) {}
 
     bool critical;
+    uint index;
 };
 
 /**
@@ -48,7 +85,7 @@ Feature::Feature()
 
 Feature::Feature(const QString &className, uint id, bool critical)
     : QPair<QString, uint>(className, id),
-      mPriv(new Private(critical))
+      mPriv(new Private(critical, internFeature(className, id)))
 {
 }
 
@@ -64,7 +101,7 @@ Feature::~Feature()
 
 Feature &Feature::operator=(const Feature &other)
 {
-    *this = other;
+    QPair<QString, uint>::operator=(other);
     this->mPriv = other.mPriv;
     return *this;
 }
@@ -78,6 +115,16 @@ bool Feature::isCritical() const
     return mPriv->critical;
 }
 
+uint featureIndex(const Feature &feature)
+{
+    if (!feature.isValid()) {
+        // Rare enough not to bother adding a shared data block to invalid features for it
+        return internFeature(feature.first, feature.second);
+    }
+
+    return feature.mPriv->index;
+}
+
 /**
  * \class Features
  * \ingroup utils
@@ -53,6 +53,8 @@ public:
     bool isCritical() const;
 
 private:
+    friend TP_QT_EXPORT uint featureIndex(const Feature &feature);
+
     struct Private;
     friend struct Private;
     QSharedDataPointer<Private> mPriv;
@@ -0,0 +1,254 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_handle_table_internal_h_HEADER_GUARD_
+#define _TelepathyQt_handle_table_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Global>
+#include <TelepathyQt/SharedPtr>
+
+#include <QVector>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+/*
+ * Flat hash table of weak pointers keyed by bare handle, using linear probing. As handle 0 is
+ * never valid, it marks the empty slots.
+ *
+ * Objects may die at any time behind the table's back, leaving dead slots. These are removed
+ * when looked up, by a sweep of a few slots on every insertion, and when the table is rehashed,
+ * so that they can't pile up when many short-lived objects are built.
+ */
+template <class T>
+class HandleTable
+{
+public:
+    enum {
+        MinimumCapacity = 16,
+        SweepStep = 4
+    };
+
+    HandleTable()
+        : mSize(0), mBits(0), mSweepPos(0), mTotalInserted(0)
+    {
+    }
+
+    SharedPtr<T> value(uint handle)
+    {
+        int i = find(handle);
+        if (i < 0) {
+            return SharedPtr<T>();
+        }
+
+        SharedPtr<T> ret(mSlots[i].object);
+        if (!ret) {
+            erase(i);
+        }
+        return ret;
+    }
+
+    void insert(uint handle, const SharedPtr<T> &object)
+    {
+        Q_ASSERT(handle != 0);
+
+        ++mTotalInserted;
+        sweep(SweepStep);
+
+        int i = find(handle);
+        if (i >= 0) {
+            mSlots[i].object = object;
+            return;
+        }
+
+        // Keep the load factor under 3/4
+        if ((mSize + 1) * 4 > capacity() * 3) {
+            rehash();
+        }
+
+        i = bucket(handle);
+        while (mSlots[i].handle) {
+            i = (i + 1) & (capacity() - 1);
+        }
+        mSlots[i].handle = handle;
+        mSlots[i].object = object;
+        ++mSize;
+    }
+
+    int sweep(int slots)
+    {
+        int removed = 0;
+        for (int n = 0; n < slots && mSize > 0; ++n) {
+            if (mSweepPos >= capacity()) {
+                mSweepPos = 0;
+            }
+
+            Slot &slot = mSlots[mSweepPos];
+            if (slot.handle && slot.object.isNull()) {
+                // Don't advance, erasing may have shifted another slot in here
+                erase(mSweepPos);
+                ++removed;
+            } else {
+                ++mSweepPos;
+            }
+        }
+        return removed;
+    }
+
+    int count() const
+    {
+        return mSize;
+    }
+
+    int liveCount() const
+    {
+        int ret = 0;
+        for (int i = 0; i < capacity(); ++i) {
+            if (mSlots[i].handle && !mSlots[i].object.isNull()) {
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+    int deadCount() const
+    {
+        return mSize - liveCount();
+    }
+
+    quint64 totalInserted() const
+    {
+        return mTotalInserted;
+    }
+
+    int capacity() const
+    {
+        return mSlots.size();
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : handle(0) { }
+
+        uint handle;
+        WeakPtr<T> object;
+    };
+
+    int bucket(uint handle) const
+    {
+        // Fibonacci hashing, so that runs of consecutive handles spread over the whole table
+        return (handle * 2654435769u) >> (32 - mBits);
+    }
+
+    int find(uint handle) const
+    {
+        if (!mSize) {
+            return -1;
+        }
+
+        int i = bucket(handle);
+        while (mSlots[i].handle) {
+            if (mSlots[i].handle == handle) {
+                return i;
+            }
+            i = (i + 1) & (capacity() - 1);
+        }
+        return -1;
+    }
+
+    void erase(int i)
+    {
+        // Shift the following slots of the probe sequence back instead of leaving a tombstone
+        int mask = capacity() - 1;
+        int j = i;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (!mSlots[j].handle) {
+                break;
+            }
+
+            int k = bucket(mSlots[j].handle);
+            bool inRange = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (!inRange) {
+                mSlots[i].handle = mSlots[j].handle;
+                mSlots[i].object.swap(mSlots[j].object);
+                i = j;
+            }
+        }
+
+        mSlots[i].handle = 0;
+        mSlots[i].object = WeakPtr<T>();
+        --mSize;
+    }
+
+    void rehash()
+    {
+        // Dead slots are dropped rather than carried over, which may well make growing needless
+        QVector<Slot> old;
+        old.swap(mSlots);
+
+        int live = 0;
+        for (int i = 0; i < old.size(); ++i) {
+            if (old[i].handle && !old[i].object.isNull()) {
+                ++live;
+            }
+        }
+
+        int bits = 4;
+        while ((1 << bits) < MinimumCapacity || (live + 1) * 2 > (1 << bits)) {
+            ++bits;
+        }
+
+        mBits = bits;
+        mSlots.resize(1 << bits);
+        mSize = 0;
+        mSweepPos = 0;
+
+        for (int i = 0; i < old.size(); ++i) {
+            if (!old[i].handle || old[i].object.isNull()) {
+                continue;
+            }
+
+            int j = bucket(old[i].handle);
+            while (mSlots[j].handle) {
+                j = (j + 1) & (capacity() - 1);
+            }
+            mSlots[j].handle = old[i].handle;
+            mSlots[j].object.swap(old[i].object);
+            ++mSize;
+        }
+    }
+
+    QVector<Slot> mSlots;
+    int mSize;
+    int mBits;
+    int mSweepPos;
+    quint64 mTotalInserted;
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
@@ -0,0 +1,111 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_introspection_trace_internal_h_HEADER_GUARD_
+#define _TelepathyQt_introspection_trace_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Feature>
+#include <TelepathyQt/IntrospectionTrace>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+
+class QDBusMessage;
+class QDBusPendingCall;
+class QDBusPendingCallWatcher;
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+class PendingOperation;
+class PendingReady;
+
+/*
+ * Records the events behind IntrospectionTrace. Events are identified by a serial number, so
+ * that clearing the trace while some of them are still running doesn't mix them up with the
+ * new ones.
+ */
+class TP_QT_NO_EXPORT IntrospectionTracer : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(IntrospectionTracer)
+
+public:
+    static IntrospectionTracer *instance();
+
+    static bool isEnabled()
+    {
+        return enabled;
+    }
+
+    IntrospectionTracer();
+    ~IntrospectionTracer();
+
+    void setEnabled(bool enabled);
+    QList<IntrospectionEvent> events();
+    void clear();
+
+    int beginIntrospection(const Feature &feature, const QString &service,
+            const QString &objectPath);
+    void endIntrospection(int event, bool success, const QString &errorName);
+
+    // Calls issued between these are attributed to the feature being introspected
+    int enterIntrospection(int event);
+    void leaveIntrospection(int previousEvent);
+
+    void traceCall(const QDBusMessage &message, const QDBusPendingCall &call);
+    void traceBecomeReady(PendingReady *operation, const Features &features,
+            const QString &service, const QString &objectPath);
+
+    static QString featureName(const Feature &feature);
+
+private Q_SLOTS:
+    void onCallFinished(QDBusPendingCallWatcher *watcher);
+    void onBecomeReadyFinished(Tp::PendingOperation *operation);
+
+private:
+    IntrospectionEvent *event(int event);
+    int append(const IntrospectionEvent &event);
+    void finish(int event, bool success, const QString &errorName);
+    qint64 now() const;
+
+    static volatile bool enabled;
+
+    QMutex mutex;
+    QElapsedTimer clock;
+    QList<IntrospectionEvent> mEvents;
+    int mFirstEvent;
+    int mCurrentIntrospection;
+    // Introspections running, by "service path", for the calls issued from their callbacks
+    QMultiHash<QString, int> mRunningIntrospections;
+    QHash<QDBusPendingCallWatcher *, int> mCalls;
+    QHash<PendingOperation *, int> mBecomeReadys;
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
@@ -0,0 +1,453 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <TelepathyQt/IntrospectionTrace>
+#include "TelepathyQt/introspection-trace-internal.h"
+
+#include "TelepathyQt/_gen/introspection-trace-internal.moc.hpp"
+
+#include "TelepathyQt/debug-internal.h"
+
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/PendingReady>
+
+#include <QCoreApplication>
+#include <QDBusMessage>
+#include <QDBusPendingCall>
+#include <QDBusPendingCallWatcher>
+#include <QFile>
+#include <QMutexLocker>
+#include <QStringList>
+
+namespace Tp
+{
+
+namespace
+{
+
+QString eventCategory(IntrospectionEvent::Type type)
+{
+    switch (type) {
+        case IntrospectionEvent::Introspection:
+            return QLatin1String("introspection");
+        case IntrospectionEvent::DBusCall:
+            return QLatin1String("dbus");
+        case IntrospectionEvent::BecomeReady:
+            return QLatin1String("becomeReady");
+    }
+    return QString();
+}
+
+QByteArray jsonString(const QString &string)
+{
+    QByteArray ret;
+    ret.reserve(string.size() + 2);
+    ret += '"';
+    foreach (QChar c, string) {
+        ushort u = c.unicode();
+        if (u == '"' || u == '\\') {
+            ret += '\\';
+            ret += char(u);
+        } else if (u < 0x20 || u >= 0x7f) {
+            ret += "\\u";
+            ret += QByteArray::number(u, 16).rightJustified(4, '0');
+        } else {
+            ret += char(u);
+        }
+    }
+    ret += '"';
+    return ret;
+}
+
+}
+
+Q_GLOBAL_STATIC(IntrospectionTracer, globalIntrospectionTracer)
+
+volatile bool IntrospectionTracer::enabled = false;
+
+IntrospectionTracer *IntrospectionTracer::instance()
+{
+    return globalIntrospectionTracer();
+}
+
+IntrospectionTracer::IntrospectionTracer()
+    : mFirstEvent(0),
+      mCurrentIntrospection(-1)
+{
+    clock.start();
+}
+
+IntrospectionTracer::~IntrospectionTracer()
+{
+    // The watchers of the calls still running are leaked on purpose, the D-Bus connection may
+    // well be gone already when this is destroyed on exit
+}
+
+void IntrospectionTracer::setEnabled(bool enable)
+{
+    QMutexLocker locker(&mutex);
+    if (enable && !enabled) {
+        // The timestamps of a trace start when it is enabled
+        if (mEvents.isEmpty()) {
+            clock.restart();
+        }
+    }
+    enabled = enable;
+}
+
+QList<IntrospectionEvent> IntrospectionTracer::events()
+{
+    QMutexLocker locker(&mutex);
+    return mEvents;
+}
+
+void IntrospectionTracer::clear()
+{
+    QMutexLocker locker(&mutex);
+    mFirstEvent += mEvents.size();
+    mEvents.clear();
+    mRunningIntrospections.clear();
+    clock.restart();
+}
+
+int IntrospectionTracer::beginIntrospection(const Feature &feature, const QString &service,
+        const QString &objectPath)
+{
+    IntrospectionEvent e;
+    e.type = IntrospectionEvent::Introspection;
+    e.name = featureName(feature);
+    e.service = service;
+    e.objectPath = objectPath;
+    e.feature = e.name;
+
+    QMutexLocker locker(&mutex);
+    int ret = append(e);
+    mRunningIntrospections.insert(service + QLatin1Char(' ') + objectPath, ret);
+    return ret;
+}
+
+void IntrospectionTracer::endIntrospection(int event, bool success, const QString &errorName)
+{
+    QMutexLocker locker(&mutex);
+    IntrospectionEvent *e = this->event(event);
+    if (e) {
+        mRunningIntrospections.remove(e->service + QLatin1Char(' ') + e->objectPath, event);
+    }
+    finish(event, success, errorName);
+}
+
+int IntrospectionTracer::enterIntrospection(int event)
+{
+    QMutexLocker locker(&mutex);
+    int previous = mCurrentIntrospection;
+    mCurrentIntrospection = event;
+    return previous;
+}
+
+void IntrospectionTracer::leaveIntrospection(int previousEvent)
+{
+    QMutexLocker locker(&mutex);
+    mCurrentIntrospection = previousEvent;
+}
+
+void IntrospectionTracer::traceCall(const QDBusMessage &message, const QDBusPendingCall &call)
+{
+    IntrospectionEvent e;
+    e.type = IntrospectionEvent::DBusCall;
+    e.name = message.interface() + QLatin1Char('.') + message.member();
+    if (message.interface() == TP_QT_IFACE_PROPERTIES && !message.arguments().isEmpty()) {
+        // Which interface the properties are for matters more than anything else here
+        e.name += QLatin1Char('(') + message.arguments().first().toString() + QLatin1Char(')');
+    }
+    e.service = message.service();
+    e.objectPath = message.path();
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call);
+
+    {
+        QMutexLocker locker(&mutex);
+
+        // The calls issued by an introspection function belong to its feature, and so do those
+        // issued later on for the same object, as long as there is no doubt about which feature
+        // they are for
+        IntrospectionEvent *current = event(mCurrentIntrospection);
+        if (current) {
+            e.feature = current->feature;
+        } else {
+            QList<int> running = mRunningIntrospections.values(
+                    e.service + QLatin1Char(' ') + e.objectPath);
+            if (running.size() == 1 && event(running.first())) {
+                e.feature = event(running.first())->feature;
+            }
+        }
+
+        mCalls.insert(watcher, append(e));
+    }
+
+    // The watcher may well live in another thread
+    connect(watcher,
+            SIGNAL(finished(QDBusPendingCallWatcher*)),
+            SLOT(onCallFinished(QDBusPendingCallWatcher*)),
+            Qt::DirectConnection);
+}
+
+void IntrospectionTracer::traceBecomeReady(PendingReady *operation, const Features &features,
+        const QString &service, const QString &objectPath)
+{
+    QStringList names;
+    foreach (const Feature &feature, features) {
+        names << featureName(feature);
+    }
+    names.sort();
+
+    IntrospectionEvent e;
+    e.type = IntrospectionEvent::BecomeReady;
+    e.name = QLatin1String("becomeReady(") + names.join(QLatin1String(", ")) +
+        QLatin1Char(')');
+    e.service = service;
+    e.objectPath = objectPath;
+
+    {
+        QMutexLocker locker(&mutex);
+        mBecomeReadys.insert(operation, append(e));
+    }
+
+    connect(operation,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(onBecomeReadyFinished(Tp::PendingOperation*)),
+            Qt::DirectConnection);
+}
+
+QString IntrospectionTracer::featureName(const Feature &feature)
+{
+    return feature.first + QLatin1Char('#') + QString::number(feature.second);
+}
+
+void IntrospectionTracer::onCallFinished(QDBusPendingCallWatcher *watcher)
+{
+    QMutexLocker locker(&mutex);
+    finish(mCalls.value(watcher, -1), !watcher->isError(), watcher->error().name());
+    mCalls.remove(watcher);
+    watcher->deleteLater();
+}
+
+void IntrospectionTracer::onBecomeReadyFinished(PendingOperation *operation)
+{
+    QMutexLocker locker(&mutex);
+    finish(mBecomeReadys.value(operation, -1), operation->isValid(), operation->errorName());
+    mBecomeReadys.remove(operation);
+}
+
+IntrospectionEvent *IntrospectionTracer::event(int event)
+{
+    int i = event - mFirstEvent;
+    if (event < 0 || i < 0 || i >= mEvents.size()) {
+        return 0;
+    }
+    return &mEvents[i];
+}
+
+int IntrospectionTracer::append(const IntrospectionEvent &event)
+{
+    mEvents.append(event);
+    mEvents.last().startTime = now();
+    return mFirstEvent + mEvents.size() - 1;
+}
+
+void IntrospectionTracer::finish(int event, bool success, const QString &errorName)
+{
+    IntrospectionEvent *e = this->event(event);
+    if (!e) {
+        // Cleared in the meantime
+        return;
+    }
+
+    e->endTime = now();
+    e->success = success;
+    e->errorName = errorName;
+}
+
+qint64 IntrospectionTracer::now() const
+{
+    return clock.nsecsElapsed() / 1000;
+}
+
+/**
+ * \class IntrospectionEvent
+ * \ingroup utils
+ * \headerfile TelepathyQt/introspection-trace.h <TelepathyQt/IntrospectionEvent>
+ *
+ * \brief The IntrospectionEvent class represents an event recorded by IntrospectionTrace.
+ *
+ * \li \c type tells whether the event is the introspection of a feature, a D-Bus call, or a
+ *     PendingReady returned by becomeReady();
+ * \li \c name is the feature introspected, the D-Bus method called, or the features requested;
+ * \li \c service and \c objectPath identify the remote object involved, if any;
+ * \li \c feature is the feature the event belongs to, if known;
+ * \li \c startTime and \c endTime are in microseconds since tracing started, \c endTime being -1
+ *     until the event ends;
+ * \li \c success and \c errorName tell how the event ended.
+ */
+
+/**
+ * \class IntrospectionTrace
+ * \ingroup utils
+ * \headerfile TelepathyQt/introspection-trace.h <TelepathyQt/IntrospectionTrace>
+ *
+ * \brief The IntrospectionTrace class records how long the objects take to become ready.
+ *
+ * Once enabled, all the objects of the process record when the introspection of each of their
+ * features starts and ends, the D-Bus calls issued meanwhile, and when each PendingReady
+ * returned by becomeReady() finishes. The trace can then be saved in the Chrome trace event
+ * format, to be loaded in chrome://tracing or any compatible viewer.
+ *
+ * The D-Bus calls issued by the introspection of a feature are attributed to it. So are the
+ * calls issued later on to the same remote object while that feature is the only one of it
+ * being introspected; otherwise only the remote object is known.
+ *
+ * Tracing is disabled by default and costs nothing then.
+ */
+
+/**
+ * Return whether the introspection events are being recorded.
+ *
+ * \return \c true if tracing is enabled, \c false otherwise.
+ * \sa setEnabled()
+ */
+bool IntrospectionTrace::isEnabled()
+{
+    return IntrospectionTracer::isEnabled();
+}
+
+/**
+ * Set whether the introspection events are recorded.
+ *
+ * The timestamps of the events are relative to when tracing was first enabled after the trace
+ * was last cleared.
+ *
+ * \param enabled Whether to record the introspection events.
+ * \sa events(), writeChromeTrace()
+ */
+void IntrospectionTrace::setEnabled(bool enabled)
+{
+    IntrospectionTracer::instance()->setEnabled(enabled);
+}
+
+/**
+ * Return the introspection events recorded so far.
+ *
+ * \return The events as a list of IntrospectionEvent objects, in the order they started.
+ */
+QList<IntrospectionEvent> IntrospectionTrace::events()
+{
+    return IntrospectionTracer::instance()->events();
+}
+
+/**
+ * Drop the introspection events recorded so far.
+ *
+ * Events still running are dropped as well, and won't be recorded when they end.
+ */
+void IntrospectionTrace::clear()
+{
+    IntrospectionTracer::instance()->clear();
+}
+
+/**
+ * Return the introspection events recorded so far in the Chrome trace event JSON format.
+ *
+ * Each event is an asynchronous slice, in the \c introspection, \c dbus or \c becomeReady
+ * category, with the remote object and the feature it belongs to as arguments. The events still
+ * running are cut at the time of the call.
+ *
+ * \return The trace as UTF-8 encoded JSON.
+ * \sa writeChromeTrace()
+ */
+QByteArray IntrospectionTrace::toChromeTrace()
+{
+    IntrospectionTracer *tracer = IntrospectionTracer::instance();
+    QList<IntrospectionEvent> events = tracer->events();
+    QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    qint64 lastTime = 0;
+    foreach (const IntrospectionEvent &e, events) {
+        lastTime = qMax(lastTime, qMax(e.startTime, e.endTime));
+    }
+
+    QByteArray ret("{\"traceEvents\":[");
+    int id = 0;
+    foreach (const IntrospectionEvent &e, events) {
+        QByteArray common = "\"name\":" + jsonString(e.name) +
+            ",\"cat\":" + jsonString(eventCategory(e.type)) +
+            ",\"id\":" + QByteArray::number(id++) +
+            ",\"pid\":" + pid + ",\"tid\":0";
+
+        QByteArray args = "{\"service\":" + jsonString(e.service) +
+            ",\"objectPath\":" + jsonString(e.objectPath) +
+            ",\"feature\":" + jsonString(e.feature);
+        if (e.endTime < 0) {
+            args += ",\"finished\":false";
+        } else {
+            args += ",\"success\":";
+            args += e.success ? "true" : "false";
+            if (!e.errorName.isEmpty()) {
+                args += ",\"error\":" + jsonString(e.errorName);
+            }
+        }
+        args += '}';
+
+        if (id > 1) {
+            ret += ',';
+        }
+        ret += "\n{" + common + ",\"ph\":\"b\",\"ts\":" + QByteArray::number(e.startTime) +
+            ",\"args\":" + args + "},";
+        ret += "\n{" + common + ",\"ph\":\"e\",\"ts\":" +
+            QByteArray::number(e.endTime < 0 ? lastTime : e.endTime) + '}';
+    }
+    ret += "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return ret;
+}
+
+/**
+ * Save the introspection events recorded so far in the Chrome trace event JSON format.
+ *
+ * \param fileName The name of the file to write the trace to.
+ * \return \c true if the trace was written, \c false otherwise.
+ * \sa toChromeTrace()
+ */
+bool IntrospectionTrace::writeChromeTrace(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        warning() << "Couldn't open" << fileName << "to write the introspection trace:" <<
+            file.errorString();
+        return false;
+    }
+
+    QByteArray trace = toChromeTrace();
+    if (file.write(trace) != trace.size()) {
+        warning() << "Couldn't write the introspection trace to" << fileName << ":" <<
+            file.errorString();
+        return false;
+    }
+    return true;
+}
+
+} // Tp
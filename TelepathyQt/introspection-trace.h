@@ -0,0 +1,82 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_introspection_trace_h_HEADER_GUARD_
+#define _TelepathyQt_introspection_trace_h_HEADER_GUARD_
+
+#ifndef IN_TP_QT_HEADER
+#error IN_TP_QT_HEADER
+#endif
+
+#include <TelepathyQt/Global>
+
+#include <QByteArray>
+#include <QList>
+#include <QMetaType>
+#include <QString>
+
+namespace Tp
+{
+
+struct TP_QT_EXPORT IntrospectionEvent
+{
+public:
+    enum Type {
+        Introspection,
+        DBusCall,
+        BecomeReady
+    };
+
+    inline IntrospectionEvent()
+        : type(Introspection), startTime(0), endTime(-1), success(false) {}
+
+    Type type;
+    QString name;
+    QString service;
+    QString objectPath;
+    QString feature;
+    qint64 startTime;
+    qint64 endTime;
+    bool success;
+    QString errorName;
+};
+
+class TP_QT_EXPORT IntrospectionTrace
+{
+public:
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+
+    static QList<IntrospectionEvent> events();
+    static void clear();
+
+    static QByteArray toChromeTrace();
+    static bool writeChromeTrace(const QString &fileName);
+
+private:
+    IntrospectionTrace();
+};
+
+} // Tp
+
+Q_DECLARE_METATYPE(Tp::IntrospectionEvent);
+
+#endif
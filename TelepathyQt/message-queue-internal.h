@@ -0,0 +1,316 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_message_queue_internal_h_HEADER_GUARD_
+#define _TelepathyQt_message_queue_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Global>
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+/*
+ * Queue of received messages in arrival order, indexed by pending message id.
+ *
+ * Removed messages leave a hole behind, so that the positions of the others stay valid in the
+ * index, and the holes are compacted away once they make up half of the queue, which keeps
+ * removals O(1) amortized. Pending ids aren't necessarily unique, hence the multi-hash.
+ *
+ * The number of messages, and their estimated size, kept in memory can be bounded: the oldest
+ * ones are then spilled by the codec into a compact form, and restored when they are accessed,
+ * without the restored copy being kept. As a restored message isn't the one which was spilled,
+ * the codec tells which message a spilled one matches.
+ *
+ * T must have an operator==. It doesn't need to be default constructible, as ReceivedMessage
+ * isn't. Codec must provide, as ReceivedMessage::pendingId() is private to TextChannel:
+ *
+ *   typedef ... Spilled;  // copyable
+ *   uint pendingId(const T &message) const;
+ *   bool spill(const T &message, Spilled *spilled) const;  // false to keep the message in memory
+ *   T restore(const Spilled &spilled) const;
+ *   bool matches(const Spilled &spilled, const T &message) const;
+ *   qint64 size(const T &message) const;
+ *   qint64 size(const Spilled &spilled) const;
+ */
+template <class T, class Codec>
+class MessageQueue
+{
+    Q_DISABLE_COPY(MessageQueue)
+
+public:
+    typedef typename Codec::Spilled Spilled;
+
+    MessageQueue(const Codec &codec = Codec())
+        : mCodec(codec), mSize(0), mSpilledCount(0), mMemoryUsage(0), mSpilledSize(0),
+          mMaxInMemory(0), mMaxMemoryUsage(0), mSpillPos(0), mListUpToDate(true)
+    {
+    }
+
+    ~MessageQueue()
+    {
+        for (int i = 0; i < mSlots.size(); ++i) {
+            delete mSlots[i].message;
+            delete mSlots[i].spilled;
+        }
+    }
+
+    int size() const
+    {
+        return mSize;
+    }
+
+    bool isEmpty() const
+    {
+        return mSize == 0;
+    }
+
+    // 0 for no limit
+    void setLimits(int maxInMemory, qint64 maxMemoryUsage)
+    {
+        mMaxInMemory = qMax(maxInMemory, 0);
+        mMaxMemoryUsage = qMax(maxMemoryUsage, Q_INT64_C(0));
+        spillIfNeeded();
+    }
+
+    int maxInMemory() const
+    {
+        return mMaxInMemory;
+    }
+
+    qint64 maxMemoryUsage() const
+    {
+        return mMaxMemoryUsage;
+    }
+
+    int spilledCount() const
+    {
+        return mSpilledCount;
+    }
+
+    // Estimated size of the messages kept in memory, and size of the spilled ones
+    qint64 memoryUsage() const
+    {
+        return mMemoryUsage;
+    }
+
+    qint64 spilledSize() const
+    {
+        return mSpilledSize;
+    }
+
+    void append(const T &message)
+    {
+        Slot slot;
+        slot.message = new T(message);
+        slot.spilled = 0;
+        slot.pendingId = mCodec.pendingId(message);
+        slot.size = mCodec.size(message);
+
+        mIndex.insertMulti(slot.pendingId, mSlots.size());
+        mSlots.append(slot);
+        ++mSize;
+        mMemoryUsage += slot.size;
+
+        if (mListUpToDate) {
+            mList.append(message);
+        }
+
+        spillIfNeeded();
+    }
+
+    // Removes the messages with the given pending id, returning them in arrival order
+    QList<T> takeAll(uint pendingId)
+    {
+        QList<T> ret;
+
+        QList<int> positions = mIndex.values(pendingId);
+        if (positions.isEmpty()) {
+            return ret;
+        }
+        mIndex.remove(pendingId);
+
+        // values() returns the most recently inserted first
+        for (int i = positions.size() - 1; i >= 0; --i) {
+            Slot &slot = mSlots[positions[i]];
+            ret << value(slot);
+            clear(slot);
+        }
+
+        compactIfNeeded();
+        return ret;
+    }
+
+    bool remove(const T &message)
+    {
+        uint pendingId = mCodec.pendingId(message);
+        typename QHash<uint, int>::iterator i = mIndex.find(pendingId);
+        while (i != mIndex.end() && i.key() == pendingId) {
+            Slot &slot = mSlots[i.value()];
+            if (slot.message ? *slot.message == message : mCodec.matches(*slot.spilled, message)) {
+                mIndex.erase(i);
+                clear(slot);
+                compactIfNeeded();
+                return true;
+            }
+            ++i;
+        }
+        return false;
+    }
+
+    QList<T> toList() const
+    {
+        if (mListUpToDate) {
+            return mList;
+        }
+
+        QList<T> ret;
+        ret.reserve(mSize);
+        for (int i = 0; i < mSlots.size(); ++i) {
+            if (mSlots[i].message || mSlots[i].spilled) {
+                ret << value(mSlots[i]);
+            }
+        }
+
+        // Keeping the restored copies would defeat spilling them
+        if (!mSpilledCount) {
+            mList = ret;
+            mListUpToDate = true;
+        }
+        return ret;
+    }
+
+private:
+    // Neither a message nor a spilled one for the removed ones
+    struct Slot
+    {
+        T *message;
+        Spilled *spilled;
+        uint pendingId;
+        qint64 size;
+    };
+
+    T value(const Slot &slot) const
+    {
+        return slot.message ? *slot.message : mCodec.restore(*slot.spilled);
+    }
+
+    void clear(Slot &slot)
+    {
+        if (slot.message) {
+            mMemoryUsage -= slot.size;
+            delete slot.message;
+            slot.message = 0;
+        } else {
+            mSpilledSize -= slot.size;
+            --mSpilledCount;
+            delete slot.spilled;
+            slot.spilled = 0;
+        }
+
+        --mSize;
+        mListUpToDate = false;
+        mList.clear();
+    }
+
+    bool overLimits() const
+    {
+        return (mMaxInMemory > 0 && mSize - mSpilledCount > mMaxInMemory) ||
+            (mMaxMemoryUsage > 0 && mMemoryUsage > mMaxMemoryUsage);
+    }
+
+    void spillIfNeeded()
+    {
+        // The messages before mSpillPos are either spilled, removed or can't be spilled, so that
+        // each message is considered once
+        while (overLimits() && mSpillPos < mSlots.size()) {
+            Slot &slot = mSlots[mSpillPos++];
+            if (!slot.message) {
+                continue;
+            }
+
+            Spilled spilled;
+            if (!mCodec.spill(*slot.message, &spilled)) {
+                continue;
+            }
+
+            mMemoryUsage -= slot.size;
+            delete slot.message;
+            slot.message = 0;
+            slot.spilled = new Spilled(spilled);
+            slot.size = mCodec.size(spilled);
+            mSpilledSize += slot.size;
+            ++mSpilledCount;
+
+            mListUpToDate = false;
+            mList.clear();
+        }
+    }
+
+    void compactIfNeeded()
+    {
+        if (mSize * 2 >= mSlots.size()) {
+            return;
+        }
+
+        QVector<Slot> slots;
+        slots.reserve(mSize);
+        mIndex.clear();
+        int spillPos = 0;
+        for (int i = 0; i < mSlots.size(); ++i) {
+            if (i == mSpillPos) {
+                spillPos = slots.size();
+            }
+            if (mSlots[i].message || mSlots[i].spilled) {
+                mIndex.insertMulti(mSlots[i].pendingId, slots.size());
+                slots.append(mSlots[i]);
+            }
+        }
+        mSpillPos = mSpillPos >= mSlots.size() ? slots.size() : spillPos;
+        mSlots = slots;
+    }
+
+    Codec mCodec;
+    QVector<Slot> mSlots;
+    QHash<uint, int> mIndex;
+    int mSize;
+    int mSpilledCount;
+    qint64 mMemoryUsage;
+    qint64 mSpilledSize;
+    int mMaxInMemory;
+    qint64 mMaxMemoryUsage;
+    int mSpillPos;
+
+    // Cached copy for toList(), appended to as long as nothing is removed or spilled
+    mutable QList<T> mList;
+    mutable bool mListUpToDate;
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
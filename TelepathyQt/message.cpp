@@ -87,8 +87,38 @@ struct TP_QT_NO_EXPORT Message::Private : public QSharedData
     uint pendingId() const;
     void clearSenderHandle();
 
+    void parse();
+
     MessagePartList parts;
 
+    // Parsed from the parts once, whenever they are set, as user interfaces and loggers call the
+    // accessors over and over for each message
+    struct Header
+    {
+        Header()
+            : sent(0), received(0), messageType(0), senderHandle(0), pendingId(0),
+              scrollback(false), rescued(false)
+        {
+        }
+
+        uint sent;
+        uint received;
+        uint messageType;
+        uint senderHandle;
+        uint pendingId;
+        bool scrollback;
+        bool rescued;
+        QString messageToken;
+        QString interface;
+        QString senderId;
+        QString senderNickname;
+        QString supersededToken;
+    };
+    Header header;
+    QString text;
+    bool truncated;
+    bool nonTextContent;
+
     // if the Text interface says "non-text" we still only have the text,
     // because the interface can't tell us anything else...
     bool forceNonText;
@@ -100,9 +130,12 @@ struct TP_QT_NO_EXPORT Message::Private : public QSharedData
 
 Message::Private::Private(const MessagePartList &parts)
     : parts(parts),
+      truncated(false),
+      nonTextContent(false),
       forceNonText(false),
       sender(0)
 {
+    parse();
 }
 
 Message::Private::~Private()
@@ -111,22 +144,99 @@ Message::Private::~Private()
 
 inline uint Message::Private::senderHandle() const
 {
-    return uintOrZeroFromPart(parts, 0, "message-sender");
+    return header.senderHandle;
 }
 
 inline QString Message::Private::senderId() const
 {
-    return stringOrEmptyFromPart(parts, 0, "message-sender-id");
+    return header.senderId;
 }
 
 inline uint Message::Private::pendingId() const
 {
-    return uintOrZeroFromPart(parts, 0, "pending-message-id");
+    return header.pendingId;
 }
 
 void Message::Private::clearSenderHandle()
 {
     parts[0].remove(QLatin1String("message-sender"));
+    header.senderHandle = 0;
+}
+
+void Message::Private::parse()
+{
+    header = Header();
+    text = QString();
+    truncated = false;
+    nonTextContent = true;
+
+    if (parts.isEmpty()) {
+        return;
+    }
+
+    // FIXME See http://bugs.freedesktop.org/show_bug.cgi?id=21690
+    header.sent = valueFromPart(parts, 0, "message-sent").toUInt();
+    header.received = valueFromPart(parts, 0, "message-received").toUInt();
+    header.messageType = uintOrZeroFromPart(parts, 0, "message-type");
+    header.senderHandle = uintOrZeroFromPart(parts, 0, "message-sender");
+    header.pendingId = uintOrZeroFromPart(parts, 0, "pending-message-id");
+    header.scrollback = booleanFromPart(parts, 0, "scrollback", false);
+    header.rescued = booleanFromPart(parts, 0, "rescued", false);
+    header.messageToken = stringOrEmptyFromPart(parts, 0, "message-token");
+    header.interface = stringOrEmptyFromPart(parts, 0, "interface");
+    header.senderId = stringOrEmptyFromPart(parts, 0, "message-sender-id");
+    header.senderNickname = stringOrEmptyFromPart(parts, 0, "sender-nickname");
+    header.supersededToken = stringOrEmptyFromPart(parts, 0, "supersedes");
+
+    // The text is made of all the text/plain parts, but only one per alternative group. The
+    // other parts make the message have non-text content, unless there's a text/plain
+    // alternative to them.
+    bool nonTextPart = false;
+    QSet<QString> altGroupsUsed;
+    QSet<QString> texts;
+    QSet<QString> textNeeded;
+
+    for (int i = 1; i < parts.size(); i++) {
+        if (booleanFromPart(parts, i, "truncated", false)) {
+            truncated = true;
+        }
+
+        QString altGroup = stringOrEmptyFromPart(parts, i, "alternative");
+        QString contentType = stringOrEmptyFromPart(parts, i, "content-type");
+
+        if (contentType == QLatin1String("text/plain")) {
+            if (!altGroup.isEmpty()) {
+                // we can use this as an alternative for a non-text part
+                // with the same altGroup
+                texts << altGroup;
+
+                if (altGroupsUsed.contains(altGroup)) {
+                    continue;
+                } else {
+                    altGroupsUsed << altGroup;
+                }
+            }
+
+            QVariant content = valueFromPart(parts, i, "content");
+            if (content.type() == QVariant::String) {
+                text += content.toString();
+            } else {
+                // O RLY?
+                debug() << "allegedly text/plain part wasn't";
+            }
+        } else if (altGroup.isEmpty()) {
+            // we can't possibly rescue this part by using a text/plain
+            // alternative, because it's not in any alternative group
+            nonTextPart = true;
+        } else {
+            // maybe we'll find a text/plain alternative for this
+            textNeeded << altGroup;
+        }
+    }
+
+    textNeeded -= texts;
+    nonTextContent = parts.size() <= 1 || !header.interface.isEmpty() || nonTextPart ||
+        !textNeeded.isEmpty();
 }
 
 /**
@@ -177,6 +287,7 @@ Message::Message(uint timestamp, uint type, const QString &text)
     mPriv->parts[1].insert(QLatin1String("content-type"),
             QDBusVariant(QLatin1String("text/plain")));
     mPriv->parts[1].insert(QLatin1String("content"), QDBusVariant(text));
+    mPriv->parse();
 }
 
 /**
@@ -194,6 +305,7 @@ Message::Message(ChannelTextMessageType type, const QString &text)
     mPriv->parts[1].insert(QLatin1String("content-type"),
             QDBusVariant(QLatin1String("text/plain")));
     mPriv->parts[1].insert(QLatin1String("content"), QDBusVariant(text));
+    mPriv->parse();
 }
 
 /**
@@ -239,8 +351,7 @@ Message::~Message()
  */
 QDateTime Message::sent() const
 {
-    // FIXME See http://bugs.freedesktop.org/show_bug.cgi?id=21690
-    uint stamp = valueFromPart(mPriv->parts, 0, "message-sent").toUInt();
+    uint stamp = mPriv->header.sent;
     if (stamp != 0) {
         return QDateTime::fromTime_t(stamp);
     } else {
@@ -256,7 +367,7 @@ QDateTime Message::sent() const
  */
 ChannelTextMessageType Message::messageType() const
 {
-    uint raw = valueFromPart(mPriv->parts, 0, "message-type").toUInt();
+    uint raw = mPriv->header.messageType;
 
     if (raw < static_cast<uint>(NUM_CHANNEL_TEXT_MESSAGE_TYPES)) {
         return ChannelTextMessageType(raw);
@@ -272,12 +383,7 @@ ChannelTextMessageType Message::messageType() const
  */
 bool Message::isTruncated() const
 {
-    for (int i = 1; i < size(); i++) {
-        if (booleanFromPart(mPriv->parts, i, "truncated", false)) {
-            return true;
-        }
-    }
-    return false;
+    return mPriv->truncated;
 }
 
 /**
@@ -289,38 +395,7 @@ bool Message::isTruncated() const
  */
 bool Message::hasNonTextContent() const
 {
-    if (mPriv->forceNonText || size() <= 1 || isSpecificToDBusInterface()) {
-        return true;
-    }
-
-    QSet<QString> texts;
-    QSet<QString> textNeeded;
-
-    for (int i = 1; i < size(); i++) {
-        QString altGroup = stringOrEmptyFromPart(mPriv->parts, i, "alternative");
-        QString contentType = stringOrEmptyFromPart(mPriv->parts, i, "content-type");
-
-        if (contentType == QLatin1String("text/plain")) {
-            if (!altGroup.isEmpty()) {
-                // we can use this as an alternative for a non-text part
-                // with the same altGroup
-                texts << altGroup;
-            }
-        } else {
-            QString alt = stringOrEmptyFromPart(mPriv->parts, i, "alternative");
-            if (altGroup.isEmpty()) {
-                // we can't possibly rescue this part by using a text/plain
-                // alternative, because it's not in any alternative group
-                return true;
-            } else {
-                // maybe we'll find a text/plain alternative for this
-                textNeeded << altGroup;
-            }
-        }
-    }
-
-    textNeeded -= texts;
-    return !textNeeded.isEmpty();
+    return mPriv->forceNonText || mPriv->nonTextContent;
 }
 
 /**
@@ -331,7 +406,7 @@ bool Message::hasNonTextContent() const
  */
 QString Message::messageToken() const
 {
-    return stringOrEmptyFromPart(mPriv->parts, 0, "message-token");
+    return mPriv->header.messageToken;
 }
 
 /**
@@ -361,7 +436,7 @@ bool Message::isSpecificToDBusInterface() const
  */
 QString Message::dbusInterface() const
 {
-    return stringOrEmptyFromPart(mPriv->parts, 0, "interface");
+    return mPriv->header.interface;
 }
 
 /**
@@ -371,34 +446,7 @@ QString Message::dbusInterface() const
  */
 QString Message::text() const
 {
-    // Alternative-groups for which we've already emitted an alternative
-    QSet<QString> altGroupsUsed;
-    QString text;
-
-    for (int i = 1; i < size(); i++) {
-        QString altGroup = stringOrEmptyFromPart(mPriv->parts, i, "alternative");
-        QString contentType = stringOrEmptyFromPart(mPriv->parts, i, "content-type");
-
-        if (contentType == QLatin1String("text/plain")) {
-            if (!altGroup.isEmpty()) {
-                if (altGroupsUsed.contains(altGroup)) {
-                    continue;
-                } else {
-                    altGroupsUsed << altGroup;
-                }
-            }
-
-            QVariant content = valueFromPart(mPriv->parts, i, "content");
-            if (content.type() == QVariant::String) {
-                text += content.toString();
-            } else {
-                // O RLY?
-                debug() << "allegedly text/plain part wasn't";
-            }
-        }
-    }
-
-    return text;
+    return mPriv->text;
 }
 
 /**
@@ -723,9 +771,10 @@ ReceivedMessage::ReceivedMessage(const MessagePartList &parts,
     : Message(parts)
 {
     if (!mPriv->parts[0].contains(QLatin1String("message-received"))) {
+        uint received = QDateTime::currentDateTime().toTime_t();
         mPriv->parts[0].insert(QLatin1String("message-received"),
-                QDBusVariant(static_cast<qlonglong>(
-                        QDateTime::currentDateTime().toTime_t())));
+                QDBusVariant(static_cast<qlonglong>(received)));
+        mPriv->header.received = received;
     }
     mPriv->textChannel = channel;
 }
@@ -764,8 +813,7 @@ ReceivedMessage::~ReceivedMessage()
  */
 QDateTime ReceivedMessage::received() const
 {
-    // FIXME See http://bugs.freedesktop.org/show_bug.cgi?id=21690
-    uint stamp = valueFromPart(mPriv->parts, 0, "message-received").toUInt();
+    uint stamp = mPriv->header.received;
     if (stamp != 0) {
         return QDateTime::fromTime_t(stamp);
     } else {
@@ -793,7 +841,7 @@ ContactPtr ReceivedMessage::sender() const
  */
 QString ReceivedMessage::senderNickname() const
 {
-    QString ret = stringOrEmptyFromPart(mPriv->parts, 0, "sender-nickname");
+    QString ret = mPriv->header.senderNickname;
     if (ret.isEmpty() && mPriv->sender) {
         ret = mPriv->sender->alias();
     }
@@ -811,7 +859,7 @@ QString ReceivedMessage::senderNickname() const
  */
 QString ReceivedMessage::supersededToken() const
 {
-    return stringOrEmptyFromPart(mPriv->parts, 0, "supersedes");
+    return mPriv->header.supersededToken;
 }
 
 /**
@@ -826,7 +874,7 @@ QString ReceivedMessage::supersededToken() const
  */
 bool ReceivedMessage::isScrollback() const
 {
-    return booleanFromPart(mPriv->parts, 0, "scrollback", false);
+    return mPriv->header.scrollback;
 }
 
 /**
@@ -840,7 +888,7 @@ bool ReceivedMessage::isScrollback() const
  */
 bool ReceivedMessage::isRescued() const
 {
-    return booleanFromPart(mPriv->parts, 0, "rescued", false);
+    return mPriv->header.rescued;
 }
 
 /**
@@ -29,6 +29,8 @@
 
 #include "TelepathyQt/debug-internal.h"
 
+#include <QSet>
+
 namespace Tp
 {
 
@@ -48,12 +50,27 @@ namespace Tp
 
 struct TP_QT_NO_EXPORT PendingContactAttributes::Private
 {
+    Private()
+        : shouldReference(false),
+          maxChunksInFlight(1),
+          chunked(false)
+    {
+    }
+
     UIntList contactsRequested;
     QStringList interfacesRequested;
     bool shouldReference;
     ReferencedHandles validHandles;
     UIntList invalidHandles;
     ContactAttributesMap attributes;
+
+    // chunked retrieval
+    QList<UIntList> pendingChunks;
+    QHash<QDBusPendingCallWatcher *, UIntList> chunksInFlight;
+    uint maxChunksInFlight;
+    bool chunked;
+    // The first chunk error, reported once the chunks still in flight have landed
+    QDBusError error;
 };
 
 PendingContactAttributes::PendingContactAttributes(const ConnectionPtr &connection,
@@ -182,13 +199,48 @@ ContactAttributesMap PendingContactAttributes::attributes() const
 void PendingContactAttributes::onCallFinished(QDBusPendingCallWatcher* watcher)
 {
     QDBusPendingReply<ContactAttributesMap> reply = *watcher;
+    UIntList chunk = mPriv->chunksInFlight.take(watcher);
 
     if (reply.isError()) {
         debug().nospace() << "GetCAs: error " << reply.error().name() << ": " << reply.error().message();
-        setFinishedWithError(reply.error());
+        // Stop sending chunks, but wait for the ones in flight to land before failing, so that
+        // the handles they referenced get released
+        mPriv->pendingChunks.clear();
+        if (!mPriv->error.isValid()) {
+            mPriv->error = reply.error();
+        }
     } else {
-        mPriv->attributes = reply.value();
+        ContactAttributesMap chunkAttributes = reply.value();
+        if (!mPriv->chunked) {
+            mPriv->attributes = chunkAttributes;
+        } else {
+            for (ContactAttributesMap::const_iterator i = chunkAttributes.constBegin();
+                    i != chunkAttributes.constEnd(); ++i) {
+                mPriv->attributes.insert(i.key(), i.value());
+            }
+
+            if (!mPriv->error.isValid()) {
+                emit attributesReceived(chunk, chunkAttributes);
+                sendChunks();
+            }
+        }
+    }
+
+    watcher->deleteLater();
+
+    if (!mPriv->chunksInFlight.isEmpty() || !mPriv->pendingChunks.isEmpty()) {
+        return;
+    }
 
+    if (mPriv->error.isValid()) {
+        if (shouldReference() && !mPriv->attributes.isEmpty()) {
+            // Referenced by the chunks which succeeded, and released once dropped
+            ReferencedHandles referenced(connection(), HandleTypeContact,
+                    mPriv->attributes.keys());
+        }
+        mPriv->attributes.clear();
+        setFinishedWithError(mPriv->error);
+    } else {
         UIntList validHandles;
         foreach (uint contact, mPriv->contactsRequested) {
             if (mPriv->attributes.contains(contact)) {
@@ -206,9 +258,46 @@ void PendingContactAttributes::onCallFinished(QDBusPendingCallWatcher* watcher)
         setFinished();
     }
 
+    // The whole request counts as a single request in flight, regardless of the number of chunks
     connection()->handleRequestLanded(HandleTypeContact);
+}
 
-    watcher->deleteLater();
+void PendingContactAttributes::start(uint chunkSize, uint maxChunksInFlight)
+{
+    const UIntList &handles = mPriv->contactsRequested;
+
+    if (chunkSize == 0 || static_cast<uint>(handles.size()) <= chunkSize) {
+        mPriv->pendingChunks << handles;
+    } else {
+        for (int i = 0; i < handles.size(); i += chunkSize) {
+            mPriv->pendingChunks << handles.mid(i, chunkSize);
+        }
+
+        debug() << "Splitting request for attributes for" << handles.size() << "contacts in" <<
+            mPriv->pendingChunks.size() << "chunks";
+        mPriv->chunked = true;
+    }
+
+    mPriv->maxChunksInFlight = qMax(maxChunksInFlight, 1u);
+    sendChunks();
+}
+
+void PendingContactAttributes::sendChunks()
+{
+    Client::ConnectionInterfaceContactsInterface *contactsInterface =
+        connection()->interface<Client::ConnectionInterfaceContactsInterface>();
+
+    while (!mPriv->pendingChunks.isEmpty() &&
+           static_cast<uint>(mPriv->chunksInFlight.size()) < mPriv->maxChunksInFlight) {
+        UIntList chunk = mPriv->pendingChunks.takeFirst();
+        QDBusPendingCallWatcher *watcher =
+            new QDBusPendingCallWatcher(contactsInterface->GetContactAttributes(chunk,
+                        mPriv->interfacesRequested, mPriv->shouldReference), this);
+        mPriv->chunksInFlight.insert(watcher, chunk);
+        connect(watcher,
+                SIGNAL(finished(QDBusPendingCallWatcher*)),
+                SLOT(onCallFinished(QDBusPendingCallWatcher*)));
+    }
 }
 
 void PendingContactAttributes::failImmediately(const QString &error, const QString &errorMessage)
@@ -216,4 +305,71 @@ void PendingContactAttributes::failImmediately(const QString &error, const QStri
     setFinishedWithError(error, errorMessage);
 }
 
+void PendingContactAttributes::receiveChunkFromBatch(const UIntList &handles,
+        const ContactAttributesMap &attributes)
+{
+    // The part of the chunk of the batch we asked for
+    QSet<uint> requested = mPriv->contactsRequested.toSet();
+    UIntList chunk;
+    ContactAttributesMap chunkAttributes;
+    foreach (uint contact, handles) {
+        if (!requested.contains(contact)) {
+            continue;
+        }
+
+        chunk << contact;
+        ContactAttributesMap::const_iterator i = attributes.constFind(contact);
+        if (i != attributes.constEnd()) {
+            chunkAttributes.insert(contact, i.value());
+        }
+    }
+
+    if (!chunk.isEmpty()) {
+        emit attributesReceived(chunk, chunkAttributes);
+    }
+}
+
+void PendingContactAttributes::finishFromBatch(const PendingContactAttributes *batch)
+{
+    if (batch->isError()) {
+        setFinishedWithError(batch->errorName(), batch->errorMessage());
+        return;
+    }
+
+    UIntList validHandles;
+    foreach (uint contact, mPriv->contactsRequested) {
+        ContactAttributesMap::const_iterator i = batch->mPriv->attributes.constFind(contact);
+        if (i != batch->mPriv->attributes.constEnd()) {
+            validHandles << contact;
+            mPriv->attributes.insert(contact, i.value());
+        } else {
+            mPriv->invalidHandles << contact;
+        }
+    }
+
+    if (shouldReference()) {
+        mPriv->validHandles = ReferencedHandles(connection(), HandleTypeContact,
+                validHandles);
+    }
+
+    setFinished();
+}
+
+/**
+ * \fn void PendingContactAttributes::attributesReceived(const Tp::UIntList &handles,
+ *          const Tp::ContactAttributesMap &attributes)
+ *
+ * Emitted when the attributes for a chunk of the requested contacts have been retrieved.
+ *
+ * This is only emitted if the request was split into several D-Bus calls, as configured with
+ * ConnectionLowlevel::setContactAttributesChunkSize(). For the requests ContactManager coalesces,
+ * this is emitted with the part of each chunk of the coalesced request they asked for. The
+ * operation still finishes once every
+ * chunk has been retrieved, at which point attributes() contains the attributes for all of the
+ * contacts.
+ *
+ * \param handles The handles that were requested in this chunk.
+ * \param attributes The attributes for the valid handles in \a handles.
+ */
+
 } // Tp
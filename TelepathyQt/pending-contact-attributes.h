@@ -55,17 +55,27 @@ public:
     UIntList invalidHandles() const;
     ContactAttributesMap attributes() const;
 
+Q_SIGNALS:
+    void attributesReceived(const Tp::UIntList &handles,
+            const Tp::ContactAttributesMap &attributes);
+
 private Q_SLOTS:
     TP_QT_NO_EXPORT void onCallFinished(QDBusPendingCallWatcher *watcher);
 
 private:
     friend class ConnectionLowlevel;
+    friend class ContactManager;
 
     TP_QT_NO_EXPORT PendingContactAttributes(const ConnectionPtr &connection,
             const UIntList &handles,
             const QStringList &interfaces, bool reference);
 
     TP_QT_NO_EXPORT void failImmediately(const QString &error, const QString &errorMessage);
+    TP_QT_NO_EXPORT void receiveChunkFromBatch(const UIntList &handles,
+            const ContactAttributesMap &attributes);
+    TP_QT_NO_EXPORT void finishFromBatch(const PendingContactAttributes *batch);
+    TP_QT_NO_EXPORT void start(uint chunkSize, uint maxChunksInFlight);
+    TP_QT_NO_EXPORT void sendChunks();
 
     struct Private;
     friend struct Private;
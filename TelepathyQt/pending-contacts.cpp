@@ -26,6 +26,7 @@
 #include "TelepathyQt/_gen/pending-contacts.moc.hpp"
 #include "TelepathyQt/_gen/pending-contacts-internal.moc.hpp"
 
+#include "TelepathyQt/contact-attribute-keys-internal.h"
 #include "TelepathyQt/debug-internal.h"
 
 #include <TelepathyQt/Connection>
@@ -54,7 +55,9 @@ struct TP_QT_NO_EXPORT PendingContacts::Private
           satisfyingContacts(satisfyingContacts),
           requestType(PendingContacts::ForHandles),
           handles(handles),
-          nested(0)
+          nested(0),
+          handlesRetrieved(0),
+          handlesToRetrieve(0)
     {
     }
 
@@ -66,7 +69,9 @@ struct TP_QT_NO_EXPORT PendingContacts::Private
           missingFeatures(features),
           requestType(type),
           addresses(list),
-          nested(0)
+          nested(0),
+          handlesRetrieved(0),
+          handlesToRetrieve(0)
     {
         if (type != PendingContacts::ForIdentifiers &&
             type != PendingContacts::ForUris) {
@@ -83,7 +88,9 @@ struct TP_QT_NO_EXPORT PendingContacts::Private
           requestType(PendingContacts::ForVCardAddresses),
           addresses(vcardAddresses),
           vcardField(vcardField),
-          nested(0)
+          nested(0),
+          handlesRetrieved(0),
+          handlesToRetrieve(0)
     {
     }
 
@@ -95,7 +102,9 @@ struct TP_QT_NO_EXPORT PendingContacts::Private
           features(features),
           requestType(PendingContacts::Upgrade),
           contactsToUpgrade(contactsToUpgrade),
-          nested(0)
+          nested(0),
+          handlesRetrieved(0),
+          handlesToRetrieve(0)
     {
     }
 
@@ -129,6 +138,10 @@ struct TP_QT_NO_EXPORT PendingContacts::Private
     QStringList invalidAddresses;
 
     ReferencedHandles handlesToInspect;
+
+    // Progressive retrieval
+    int handlesRetrieved;
+    int handlesToRetrieve;
 };
 
 void PendingContacts::Private::setFinished()
@@ -197,9 +210,12 @@ PendingContacts::PendingContacts(const ContactManagerPtr &manager,
         ConnectionPtr conn = manager->connection();
         if (conn->interfaces().contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACTS)) {
             PendingContactAttributes *attributes =
-                conn->lowlevel()->contactAttributes(otherContacts.toList(),
-                        interfaces, true);
+                manager->requestContactAttributes(otherContacts.toList(), interfaces);
+            mPriv->handlesToRetrieve = otherContacts.size();
 
+            connect(attributes,
+                    SIGNAL(attributesReceived(Tp::UIntList,Tp::ContactAttributesMap)),
+                    SLOT(onAttributesReceived(Tp::UIntList,Tp::ContactAttributesMap)));
             connect(attributes,
                     SIGNAL(finished(Tp::PendingOperation*)),
                     SLOT(onAttributesFinished(Tp::PendingOperation*)));
@@ -479,6 +495,32 @@ QStringList PendingContacts::invalidUris() const
     return mPriv->invalidAddresses;
 }
 
+void PendingContacts::onAttributesReceived(const UIntList &handles,
+        const ContactAttributesMap &attributes)
+{
+    ConnectionPtr conn = mPriv->manager->connection();
+    QList<ContactPtr> contacts;
+
+    foreach (uint handle, handles) {
+        ContactAttributesMap::const_iterator i = attributes.constFind(handle);
+        if (i == attributes.constEnd() || mPriv->satisfyingContacts.contains(handle)) {
+            continue;
+        }
+
+        ReferencedHandles referencedHandle(conn, HandleTypeContact, UIntList() << handle);
+        ContactPtr contact = manager()->ensureContact(referencedHandle,
+                mPriv->missingFeatures, i.value());
+        mPriv->satisfyingContacts.insert(handle, contact);
+        contacts << contact;
+    }
+
+    mPriv->handlesRetrieved += handles.size();
+
+    debug() << "Retrieved" << mPriv->handlesRetrieved << "out of" << mPriv->handlesToRetrieve <<
+        "contacts";
+    emit contactsRetrieved(contacts, mPriv->handlesRetrieved, mPriv->handlesToRetrieve);
+}
+
 void PendingContacts::onAttributesFinished(PendingOperation *operation)
 {
     PendingContactAttributes *pendingAttributes =
@@ -629,10 +671,11 @@ void PendingContacts::onInspectHandlesFinished(QDBusPendingCallWatcher *watcher)
     QStringList names = reply.value();
     int i = 0;
     ConnectionPtr conn = mPriv->manager->connection();
+    const QString &contactIdKey =
+        ContactAttributeKeys::instance().name(ContactAttributeKeys::ContactId);
     foreach (uint handle, mPriv->handlesToInspect) {
         QVariantMap handleAttributes;
-        handleAttributes.insert(TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id"),
-                names[i++]);
+        handleAttributes.insert(contactIdKey, names[i++]);
         ReferencedHandles referencedHandle(conn, HandleTypeContact,
                 UIntList() << handle);
         mPriv->satisfyingContacts.insert(handle, manager()->ensureContact(referencedHandle,
@@ -720,4 +763,21 @@ void PendingAddressingGetContacts::onGetContactsFinished(QDBusPendingCallWatcher
     watcher->deleteLater();
 }
 
+/**
+ * \fn void PendingContacts::contactsRetrieved(const QList<Tp::ContactPtr> &contacts,
+ *          int retrievedHandles, int totalHandles)
+ *
+ * Emitted when part of the contacts of a request for handles have been built, before the
+ * operation finishes.
+ *
+ * This is only emitted when the contact attributes are retrieved in several chunks, as configured
+ * with ConnectionLowlevel::setContactAttributesChunkSize(), which allows to start using the
+ * contacts of a very large request before all of them have been retrieved. contacts() still
+ * returns all of the contacts, in the requested order, once the operation has finished.
+ *
+ * \param contacts The contacts built from the chunk that was just retrieved.
+ * \param retrievedHandles The number of handles retrieved so far, including invalid ones.
+ * \param totalHandles The number of handles that need to be retrieved.
+ */
+
 } // Tp
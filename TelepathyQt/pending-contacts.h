@@ -79,7 +79,13 @@ public:
     QStringList validUris() const;
     QStringList invalidUris() const;
 
+Q_SIGNALS:
+    void contactsRetrieved(const QList<Tp::ContactPtr> &contacts, int retrievedHandles,
+            int totalHandles);
+
 private Q_SLOTS:
+    TP_QT_NO_EXPORT void onAttributesReceived(const Tp::UIntList &,
+            const Tp::ContactAttributesMap &);
     TP_QT_NO_EXPORT void onAttributesFinished(Tp::PendingOperation *);
     TP_QT_NO_EXPORT void onRequestHandlesFinished(Tp::PendingOperation *);
     TP_QT_NO_EXPORT void onAddressingGetContactsFinished(Tp::PendingOperation *);
@@ -25,6 +25,7 @@
 #include "TelepathyQt/_gen/readiness-helper.moc.hpp"
 
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/introspection-trace-internal.h"
 
 #include <TelepathyQt/Constants>
 #include <TelepathyQt/DBusProxy>
@@ -107,8 +108,11 @@ struct TP_QT_NO_EXPORT ReadinessHelper::Private
     void setIntrospectCompleted(const Feature &feature, bool success,
             const QString &errorName = QString(),
             const QString &errorMessage = QString());
+    void scheduleIteration();
     void iterateIntrospection();
     Features depsFor(const Feature &feature); // Recursive dependencies for a feature
+    bool dependsOnMissing(const Feature &feature);
+    bool dependenciesSatisfied(const Feature &feature) const;
 
     void abortOperations(const QString &errorName, const QString &errorMessage);
 
@@ -128,6 +132,13 @@ struct TP_QT_NO_EXPORT ReadinessHelper::Private
     QHash<Feature, QPair<QString, QString> > missingFeaturesErrors;
     QList<PendingReady *> pendingOperations;
 
+    // The dependency graph only changes when introspectables are added
+    QHash<Feature, Features> depsCache;
+
+    // IntrospectionTracer events of the features being introspected, while tracing
+    QHash<Feature, int> traceEvents;
+
+    bool iterationScheduled;
     bool pendingStatusChange;
     uint pendingStatus;
 };
@@ -142,6 +153,7 @@ ReadinessHelper::Private::Private(
       proxy(0),
       currentStatus(currentStatus),
       introspectables(introspectables),
+      iterationScheduled(false),
       pendingStatusChange(false),
       pendingStatus(-1)
 {
@@ -165,6 +177,7 @@ ReadinessHelper::Private::Private(
       proxy(proxy),
       currentStatus(currentStatus),
       introspectables(introspectables),
+      iterationScheduled(false),
       pendingStatusChange(false),
       pendingStatus(-1)
 {
@@ -205,7 +218,7 @@ void ReadinessHelper::Private::setCurrentStatus(uint newStatus)
         // in the requested set, so we don't have to re-add them here
 
         if (supportedStatuses.contains(currentStatus)) {
-            QTimer::singleShot(0, parent, SLOT(iterateIntrospection()));
+            scheduleIteration();
         } else {
             emit parent->statusReady(currentStatus);
         }
@@ -221,6 +234,12 @@ void ReadinessHelper::Private::setIntrospectCompleted(const Feature &feature,
 {
     debug() << "ReadinessHelper::setIntrospectCompleted: feature:" << feature <<
         "- success:" << success;
+
+    QHash<Feature, int>::iterator traceEvent = traceEvents.find(feature);
+    if (traceEvent != traceEvents.end()) {
+        IntrospectionTracer::instance()->endIntrospection(traceEvent.value(), success, errorName);
+        traceEvents.erase(traceEvent);
+    }
     if (pendingStatusChange) {
         debug() << "ReadinessHelper::setIntrospectCompleted called while there is "
             "a pending status change - ignoring";
@@ -255,11 +274,25 @@ void ReadinessHelper::Private::setIntrospectCompleted(const Feature &feature,
     pendingFeatures.remove(feature);
     inFlightFeatures.remove(feature);
 
+    scheduleIteration();
+}
+
+void ReadinessHelper::Private::scheduleIteration()
+{
+    // Features completing together only need a single iteration to go on with the ones depending
+    // on them
+    if (iterationScheduled) {
+        return;
+    }
+
+    iterationScheduled = true;
     QTimer::singleShot(0, parent, SLOT(iterateIntrospection()));
 }
 
 void ReadinessHelper::Private::iterateIntrospection()
 {
+    iterationScheduled = false;
+
     if (proxy && !proxy->isValid()) {
         debug() << "ReadinessHelper: not iterating as the proxy is invalidated";
         return;
@@ -283,7 +316,7 @@ void ReadinessHelper::Private::iterateIntrospection()
     // Flag the currently pending reverse dependencies of any previously discovered missing features
     // as missing
     foreach (const Feature &feature, pendingFeatures) {
-        if (!depsFor(feature).intersect(missingFeatures).isEmpty()) {
+        if (dependsOnMissing(feature)) {
             missingFeatures.insert(feature);
             missingFeaturesErrors.insert(feature,
                     QPair<QString, QString>(TP_QT_ERROR_NOT_AVAILABLE,
@@ -332,13 +365,15 @@ void ReadinessHelper::Private::iterateIntrospection()
     Features readyToIntrospect;
     foreach (const Feature &feature, pendingFeatures) {
         // missing doesn't have to be considered here anymore
-        if ((introspectables[feature].mPriv->dependsOnFeatures - satisfiedFeatures).isEmpty()) {
+        if (dependenciesSatisfied(feature)) {
             readyToIntrospect.insert(feature);
         }
     }
 
     // now readyToIntrospect should contain all the features which have
-    // all their feature dependencies satisfied
+    // all their feature dependencies satisfied, so they are all started at once; the features
+    // completing right away don't hold the others back, their dependents are started in the next
+    // iteration
     foreach (const Feature &feature, readyToIntrospect) {
         if (inFlightFeatures.contains(feature)) {
             continue;
@@ -352,7 +387,7 @@ void ReadinessHelper::Private::iterateIntrospection()
             // No-op satisfy features for which nothing has to be done in
             // the current state
             setIntrospectCompleted(feature, true);
-            return; // will be called with a single-shot soon again
+            continue;
         }
 
         foreach (const QString &interface, introspectable.mPriv->dependsOnInterfaces) {
@@ -365,19 +400,45 @@ void ReadinessHelper::Private::iterateIntrospection()
                 setIntrospectCompleted(feature, false,
                         TP_QT_ERROR_NOT_AVAILABLE,
                         QLatin1String("Feature depend on interfaces that are not available"));
-                return; // will be called with a single-shot soon again
+                break;
             }
         }
+        if (!inFlightFeatures.contains(feature)) {
+            continue;
+        }
 
         // yes, with the dependency info, we can even parallelize
         // introspection of several features at once, reducing total round trip
         // time considerably with many independent features!
-        (*(introspectable.mPriv->introspectFunc))(introspectable.mPriv->introspectFuncData);
+        if (IntrospectionTracer::isEnabled()) {
+            IntrospectionTracer *tracer = IntrospectionTracer::instance();
+            int traceEvent = tracer->beginIntrospection(feature,
+                    proxy ? proxy->busName() : QString(),
+                    proxy ? proxy->objectPath() : QString());
+            traceEvents.insert(feature, traceEvent);
+
+            int previousEvent = tracer->enterIntrospection(traceEvent);
+            (*(introspectable.mPriv->introspectFunc))(introspectable.mPriv->introspectFuncData);
+            tracer->leaveIntrospection(previousEvent);
+        } else {
+            (*(introspectable.mPriv->introspectFunc))(introspectable.mPriv->introspectFuncData);
+        }
+
+        if (pendingStatusChange) {
+            // The introspection function changed the status, the other features will be
+            // introspected for the new one
+            return;
+        }
     }
 }
 
 Features ReadinessHelper::Private::depsFor(const Feature &feature)
 {
+    QHash<Feature, Features>::const_iterator i = depsCache.constFind(feature);
+    if (i != depsCache.constEnd()) {
+        return i.value();
+    }
+
     Features deps;
 
     foreach (Feature dep, introspectables[feature].mPriv->dependsOnFeatures) {
@@ -385,9 +446,37 @@ Features ReadinessHelper::Private::depsFor(const Feature &feature)
         deps += depsFor(dep);
     }
 
+    depsCache.insert(feature, deps);
     return deps;
 }
 
+bool ReadinessHelper::Private::dependsOnMissing(const Feature &feature)
+{
+    if (missingFeatures.isEmpty()) {
+        return false;
+    }
+
+    const Features deps = depsFor(feature);
+    for (Features::const_iterator i = deps.constBegin(); i != deps.constEnd(); ++i) {
+        if (missingFeatures.contains(*i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ReadinessHelper::Private::dependenciesSatisfied(const Feature &feature) const
+{
+    const Introspectable introspectable = introspectables.value(feature);
+    const Features &deps = introspectable.mPriv->dependsOnFeatures;
+    for (Features::const_iterator i = deps.constBegin(); i != deps.constEnd(); ++i) {
+        if (!satisfiedFeatures.contains(*i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void ReadinessHelper::Private::abortOperations(const QString &errorName,
         const QString &errorMessage)
 {
@@ -456,6 +545,7 @@ void ReadinessHelper::addIntrospectables(const Introspectables &introspectables)
             mPriv->supportedFeatures += feature;
         }
     }
+    mPriv->depsCache.clear();
 
     debug() << "ReadinessHelper: new supportedStatuses =" << mPriv->supportedStatuses;
     debug() << "ReadinessHelper: new supportedFeatures =" << mPriv->supportedFeatures;
@@ -642,10 +732,15 @@ PendingReady *ReadinessHelper::becomeReady(const Features &requestedFeatures)
 
     operation = new PendingReady(SharedPtr<RefCounted>(mPriv->object), requestedFeatures);
     mPriv->pendingOperations.append(operation);
+    if (IntrospectionTracer::isEnabled()) {
+        IntrospectionTracer::instance()->traceBecomeReady(operation, requestedFeatures,
+                mPriv->proxy ? mPriv->proxy->busName() : QString(),
+                mPriv->proxy ? mPriv->proxy->objectPath() : QString());
+    }
     // Only we finish these PendingReadys, so we don't need destroyed or finished handling for them
     // - we already know when that happens, as we caused it!
 
-    QTimer::singleShot(0, this, SLOT(iterateIntrospection()));
+    mPriv->scheduleIteration();
 
     return operation;
 }
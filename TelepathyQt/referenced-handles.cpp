@@ -49,9 +49,7 @@ struct TP_QT_NO_EXPORT ReferencedHandles::Private : public QSharedData
         Q_ASSERT(!conn.isNull());
         Q_ASSERT(handleType != 0);
 
-        foreach (uint handle, handles) {
-            conn->refHandle(handleType, handle);
-        }
+        conn->refHandles(handleType, handles);
     }
 
     Private(const Private &a)
@@ -68,9 +66,7 @@ struct TP_QT_NO_EXPORT ReferencedHandles::Private : public QSharedData
                 return;
             }
 
-            for (const_iterator i = handles.constBegin(); i != handles.constEnd(); ++i) {
-                conn->refHandle(handleType, *i);
-            }
+            conn->refHandles(handleType, handles);
         }
     }
 
@@ -84,9 +80,7 @@ struct TP_QT_NO_EXPORT ReferencedHandles::Private : public QSharedData
                 return;
             }
 
-            for (const_iterator i = handles.constBegin(); i != handles.constEnd(); ++i) {
-                conn->unrefHandle(handleType, *i);
-            }
+            conn->unrefHandles(handleType, handles);
         }
     }
 
@@ -198,9 +192,7 @@ void ReferencedHandles::clear()
     if (!mPriv->handles.empty()) {
         ConnectionPtr conn(mPriv->connection);
         if (conn) {
-            foreach (uint handle, mPriv->handles) {
-                conn->unrefHandle(handleType(), handle);
-            }
+            conn->unrefHandles(handleType(), mPriv->handles);
         } else {
             warning() << "Connection already destroyed in "
                 "ReferencedHandles::clear() so can't unref!";
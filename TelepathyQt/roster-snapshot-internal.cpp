@@ -0,0 +1,403 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/roster-snapshot-internal.h"
+
+#include "TelepathyQt/contact-attribute-keys-internal.h"
+#include "TelepathyQt/debug-internal.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QTemporaryFile>
+#include <QVector>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace Tp
+{
+
+namespace
+{
+
+// The snapshot is laid out so that it can be used straight from a read-only mapping of the file:
+// a header, a fixed size record per contact, the group references and finally a pool of UTF-16
+// strings the other sections point into. Everything is stored in host byte order; a snapshot
+// written on a machine with a different one simply fails the magic check and is ignored.
+const quint32 SnapshotMagic = 0x54705273; // "TpRs"
+const quint32 SnapshotVersion = 1;
+
+const quint8 ContactFlagAvatarTokenKnown = 0x1;
+
+struct FileHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 contactCount;
+    quint32 groupRefCount;
+    quint32 stringsLength; // in UTF-16 code units
+    quint32 reserved;
+};
+
+struct FileString
+{
+    quint32 offset;
+    quint32 length;
+};
+
+struct FileContact
+{
+    FileString id;
+    FileString alias;
+    FileString avatarToken;
+    FileString presenceStatus;
+    FileString presenceMessage;
+    FileString publishRequest;
+    quint32 presenceType;
+    quint32 firstGroupRef;
+    quint32 groupRefCount;
+    quint8 subscribe;
+    quint8 publish;
+    quint8 flags;
+    quint8 reserved;
+};
+
+class StringPool
+{
+public:
+    FileString add(const QString &str)
+    {
+        QHash<QString, FileString>::const_iterator i = mRefs.constFind(str);
+        if (i != mRefs.constEnd()) {
+            return i.value();
+        }
+
+        FileString ref;
+        ref.offset = mStrings.size();
+        ref.length = str.size();
+        mStrings.append(str);
+        mRefs.insert(str, ref);
+        return ref;
+    }
+
+    const QString &strings() const
+    {
+        return mStrings;
+    }
+
+private:
+    QString mStrings;
+    QHash<QString, FileString> mRefs;
+};
+
+template<typename T>
+void appendRaw(QByteArray &data, const T *items, int count)
+{
+    data.append(reinterpret_cast<const char *>(items), count * sizeof(T));
+}
+
+}
+
+struct TP_QT_NO_EXPORT RosterSnapshot::Private
+{
+    Private(const QString &fileName)
+        : file(fileName),
+          data(0),
+          header(0),
+          contacts(0),
+          groupRefs(0),
+          strings(0)
+    {
+    }
+
+    bool isValid(const FileString &ref) const
+    {
+        return ref.offset <= header->stringsLength &&
+            ref.length <= header->stringsLength - ref.offset;
+    }
+
+    bool isValid(const FileContact &contact) const
+    {
+        return isValid(contact.id) && isValid(contact.alias) && isValid(contact.avatarToken) &&
+            isValid(contact.presenceStatus) && isValid(contact.presenceMessage) &&
+            isValid(contact.publishRequest) &&
+            contact.firstGroupRef <= header->groupRefCount &&
+            contact.groupRefCount <= header->groupRefCount - contact.firstGroupRef;
+    }
+
+    QString string(const FileString &ref) const
+    {
+        return QString(reinterpret_cast<const QChar *>(strings + ref.offset), ref.length);
+    }
+
+    QFile file;
+    uchar *data;
+    const FileHeader *header;
+    const FileContact *contacts;
+    const FileString *groupRefs;
+    const ushort *strings;
+    QHash<QString, int> idIndex;
+};
+
+RosterSnapshot::RosterSnapshot(const QString &fileName)
+    : mPriv(new Private(fileName))
+{
+}
+
+RosterSnapshot::~RosterSnapshot()
+{
+    unload();
+    delete mPriv;
+}
+
+QString RosterSnapshot::fileName() const
+{
+    return mPriv->file.fileName();
+}
+
+bool RosterSnapshot::load()
+{
+    unload();
+
+    if (!mPriv->file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    qint64 size = mPriv->file.size();
+    if (size < (qint64) sizeof(FileHeader)) {
+        warning() << "Ignoring truncated roster snapshot" << fileName();
+        mPriv->file.close();
+        return false;
+    }
+
+    mPriv->data = mPriv->file.map(0, size);
+    if (!mPriv->data) {
+        warning() << "Unable to map roster snapshot" << fileName();
+        mPriv->file.close();
+        return false;
+    }
+
+    mPriv->header = reinterpret_cast<const FileHeader *>(mPriv->data);
+    const FileHeader *header = mPriv->header;
+    if (header->magic != SnapshotMagic || header->version != SnapshotVersion) {
+        warning() << "Ignoring roster snapshot" << fileName() << "with unknown format";
+        unload();
+        return false;
+    }
+
+    quint64 expectedSize = sizeof(FileHeader) +
+        (quint64) header->contactCount * sizeof(FileContact) +
+        (quint64) header->groupRefCount * sizeof(FileString) +
+        (quint64) header->stringsLength * sizeof(ushort);
+    if ((quint64) size != expectedSize) {
+        warning() << "Ignoring roster snapshot" << fileName() << "with unexpected size";
+        unload();
+        return false;
+    }
+
+    const uchar *pos = mPriv->data + sizeof(FileHeader);
+    mPriv->contacts = reinterpret_cast<const FileContact *>(pos);
+    pos += header->contactCount * sizeof(FileContact);
+    mPriv->groupRefs = reinterpret_cast<const FileString *>(pos);
+    pos += header->groupRefCount * sizeof(FileString);
+    mPriv->strings = reinterpret_cast<const ushort *>(pos);
+
+    // Check every reference once here, so that the accessors can trust the mapping
+    for (quint32 i = 0; i < header->groupRefCount; ++i) {
+        if (!mPriv->isValid(mPriv->groupRefs[i])) {
+            warning() << "Ignoring corrupt roster snapshot" << fileName();
+            unload();
+            return false;
+        }
+    }
+
+    mPriv->idIndex.reserve(header->contactCount);
+    for (quint32 i = 0; i < header->contactCount; ++i) {
+        if (!mPriv->isValid(mPriv->contacts[i])) {
+            warning() << "Ignoring corrupt roster snapshot" << fileName();
+            unload();
+            return false;
+        }
+
+        mPriv->idIndex.insert(mPriv->string(mPriv->contacts[i].id), i);
+    }
+
+    debug() << "Loaded roster snapshot" << fileName() << "with" << count() << "contacts";
+    return true;
+}
+
+bool RosterSnapshot::isLoaded() const
+{
+    return mPriv->header != 0;
+}
+
+void RosterSnapshot::unload()
+{
+    if (mPriv->data) {
+        mPriv->file.unmap(mPriv->data);
+    }
+    mPriv->file.close();
+
+    mPriv->data = 0;
+    mPriv->header = 0;
+    mPriv->contacts = 0;
+    mPriv->groupRefs = 0;
+    mPriv->strings = 0;
+    mPriv->idIndex.clear();
+}
+
+int RosterSnapshot::count() const
+{
+    return isLoaded() ? mPriv->header->contactCount : 0;
+}
+
+int RosterSnapshot::indexOf(const QString &id) const
+{
+    return mPriv->idIndex.value(id, -1);
+}
+
+RosterSnapshot::Entry RosterSnapshot::entry(int index) const
+{
+    Q_ASSERT(index >= 0 && index < count());
+
+    const FileContact &contact = mPriv->contacts[index];
+
+    Entry ret;
+    ret.id = mPriv->string(contact.id);
+    ret.alias = mPriv->string(contact.alias);
+    ret.avatarTokenKnown = (contact.flags & ContactFlagAvatarTokenKnown) != 0;
+    ret.avatarToken = mPriv->string(contact.avatarToken);
+    ret.presence.type = contact.presenceType;
+    ret.presence.status = mPriv->string(contact.presenceStatus);
+    ret.presence.statusMessage = mPriv->string(contact.presenceMessage);
+    for (quint32 i = 0; i < contact.groupRefCount; ++i) {
+        ret.groups << mPriv->string(mPriv->groupRefs[contact.firstGroupRef + i]);
+    }
+    ret.subscribe = contact.subscribe;
+    ret.publish = contact.publish;
+    ret.publishRequest = mPriv->string(contact.publishRequest);
+    return ret;
+}
+
+/*
+ * Return the snapshotted state of the contact at \a index as contact attributes, in the same form
+ * they would be retrieved from the connection, so that they can be fed to Contact::augment().
+ */
+QVariantMap RosterSnapshot::attributes(int index) const
+{
+    const ContactAttributeKeys &keys = ContactAttributeKeys::instance();
+    Entry e = entry(index);
+
+    QVariantMap ret;
+    ret.insert(keys.name(ContactAttributeKeys::ContactId), e.id);
+    ret.insert(keys.name(ContactAttributeKeys::Subscribe), e.subscribe);
+    ret.insert(keys.name(ContactAttributeKeys::Publish), e.publish);
+    ret.insert(keys.name(ContactAttributeKeys::PublishRequest), e.publishRequest);
+    if (!e.alias.isEmpty()) {
+        ret.insert(keys.name(ContactAttributeKeys::Alias), e.alias);
+    }
+    if (e.avatarTokenKnown) {
+        ret.insert(keys.name(ContactAttributeKeys::AvatarToken), e.avatarToken);
+    }
+    if (!e.presence.status.isEmpty()) {
+        ret.insert(keys.name(ContactAttributeKeys::SimplePresence),
+                QVariant::fromValue(e.presence));
+    }
+    ret.insert(keys.name(ContactAttributeKeys::Groups), e.groups);
+    return ret;
+}
+
+bool RosterSnapshot::save(const QString &fileName, const QList<Entry> &entries)
+{
+    StringPool pool;
+    QVector<FileContact> contacts;
+    QVector<FileString> groupRefs;
+
+    contacts.reserve(entries.size());
+    foreach (const Entry &e, entries) {
+        FileContact contact;
+        contact.id = pool.add(e.id);
+        contact.alias = pool.add(e.alias);
+        contact.avatarToken = pool.add(e.avatarToken);
+        contact.presenceStatus = pool.add(e.presence.status);
+        contact.presenceMessage = pool.add(e.presence.statusMessage);
+        contact.publishRequest = pool.add(e.publishRequest);
+        contact.presenceType = e.presence.type;
+        contact.firstGroupRef = groupRefs.size();
+        contact.groupRefCount = e.groups.size();
+        contact.subscribe = e.subscribe;
+        contact.publish = e.publish;
+        contact.flags = e.avatarTokenKnown ? ContactFlagAvatarTokenKnown : 0;
+        contact.reserved = 0;
+        foreach (const QString &group, e.groups) {
+            groupRefs.append(pool.add(group));
+        }
+        contacts.append(contact);
+    }
+
+    FileHeader header;
+    header.magic = SnapshotMagic;
+    header.version = SnapshotVersion;
+    header.contactCount = contacts.size();
+    header.groupRefCount = groupRefs.size();
+    header.stringsLength = pool.strings().size();
+    header.reserved = 0;
+
+    QByteArray data;
+    data.reserve(sizeof(FileHeader) + contacts.size() * sizeof(FileContact) +
+            groupRefs.size() * sizeof(FileString) + pool.strings().size() * sizeof(ushort));
+    appendRaw(data, &header, 1);
+    appendRaw(data, contacts.constData(), contacts.size());
+    appendRaw(data, groupRefs.constData(), groupRefs.size());
+    appendRaw(data, pool.strings().utf16(), pool.strings().size());
+
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    QTemporaryFile file(fileName);
+    if (!file.open() || file.write(data) != data.size() || !file.flush()) {
+        warning() << "Unable to write roster snapshot" << fileName;
+        return false;
+    }
+
+#ifdef Q_OS_UNIX
+    // Make sure the contents hit the disk before the file shows up under its final name
+    if (::fsync(file.handle()) != 0) {
+        warning() << "Unable to write roster snapshot" << fileName;
+        return false;
+    }
+#endif
+
+    // QFile::rename() refuses to replace an existing file
+    QFile::remove(fileName);
+    file.setAutoRemove(false);
+    if (!file.rename(fileName)) {
+        warning() << "Unable to write roster snapshot" << fileName;
+        file.remove();
+        return false;
+    }
+
+    return true;
+}
+
+} // Tp
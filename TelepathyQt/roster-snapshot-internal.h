@@ -0,0 +1,84 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2012 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_roster_snapshot_internal_h_HEADER_GUARD_
+#define _TelepathyQt_roster_snapshot_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Global>
+#include <TelepathyQt/Types>
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+class TP_QT_NO_EXPORT RosterSnapshot
+{
+    Q_DISABLE_COPY(RosterSnapshot)
+
+public:
+    struct Entry
+    {
+        Entry() : avatarTokenKnown(false), subscribe(0), publish(0) { }
+
+        QString id;
+        QString alias;
+        bool avatarTokenKnown;
+        QString avatarToken;
+        SimplePresence presence;
+        QStringList groups;
+        uint subscribe;
+        uint publish;
+        QString publishRequest;
+    };
+
+    RosterSnapshot(const QString &fileName);
+    ~RosterSnapshot();
+
+    QString fileName() const;
+
+    bool load();
+    bool isLoaded() const;
+    void unload();
+
+    int count() const;
+    int indexOf(const QString &id) const;
+    Entry entry(int index) const;
+    QVariantMap attributes(int index) const;
+
+    static bool save(const QString &fileName, const QList<Entry> &entries);
+
+private:
+    struct Private;
+    friend struct Private;
+    Private *mPriv;
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
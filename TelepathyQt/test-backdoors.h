@@ -30,6 +30,7 @@
 #include <TelepathyQt/Global>
 #include <TelepathyQt/ConnectionCapabilities>
 #include <TelepathyQt/ContactCapabilities>
+#include <TelepathyQt/Feature>
 
 #include <QString>
 
@@ -50,6 +51,10 @@ struct TP_QT_EXPORT TestBackdoors
             const RequestableChannelClassSpecList &rccSpecs);
     static ContactCapabilities createContactCapabilities(
             const RequestableChannelClassSpecList &rccSpecs, bool specificToContact);
+
+    // Bytes taken by a contact which received all of the given features, not counting the heap
+    // data of its members
+    static int contactFootprint(const Features &features);
 };
 
 } // Tp
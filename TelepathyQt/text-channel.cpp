@@ -25,6 +25,7 @@
 #include "TelepathyQt/_gen/text-channel.moc.hpp"
 
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/message-queue-internal.h"
 
 #include <TelepathyQt/Connection>
 #include <TelepathyQt/ConnectionLowlevel>
@@ -36,7 +37,9 @@
 #include <TelepathyQt/ReceivedMessage>
 #include <TelepathyQt/ReferencedHandles>
 
+#include <QDataStream>
 #include <QDateTime>
+#include <QTimer>
 
 namespace Tp
 {
@@ -57,6 +60,10 @@ struct TP_QT_NO_EXPORT TextChannel::Private
     void processMessageQueue();
     void processChatStateQueue();
 
+    // The delayed acknowledgements, split into calls of at most acknowledgeBatchSize
+    QList<UIntList> takeDelayedAcknowledgements();
+    void acknowledgeNow(const UIntList &ids);
+
     void contactLost(uint handle);
     void contactFound(ContactPtr contact);
 
@@ -95,10 +102,58 @@ struct TP_QT_NO_EXPORT TextChannel::Private
         ReceivedMessage message;
         uint removed;
     };
-    QList<ReceivedMessage> messages;
+
+    // Spills the received messages as their compressed parts, for the messages kept in the queue
+    // over messageQueueLimit() or messageQueueMemoryLimit()
+    struct MessageCodec
+    {
+        struct Spilled
+        {
+            QByteArray parts;
+            ContactPtr sender;
+            uint pendingId;
+            uint senderHandle;
+            bool forceNonText;
+        };
+
+        MessageCodec(TextChannel *channel) : channel(channel) { }
+
+        uint pendingId(const ReceivedMessage &message) const
+        {
+            return message.pendingId();
+        }
+
+        bool spill(const ReceivedMessage &message, Spilled *spilled) const;
+        ReceivedMessage restore(const Spilled &spilled) const;
+
+        bool matches(const Spilled &spilled, const ReceivedMessage &message) const
+        {
+            return spilled.pendingId == message.pendingId() &&
+                spilled.senderHandle == message.senderHandle();
+        }
+
+        qint64 size(const ReceivedMessage &message) const;
+
+        qint64 size(const Spilled &spilled) const
+        {
+            return sizeof(Spilled) + spilled.parts.size();
+        }
+
+        static bool isStreamable(const QVariant &value);
+        static qint64 sizeOf(const QVariant &value);
+
+        TextChannel *channel;
+    };
+    MessageQueue<ReceivedMessage, MessageCodec> messages;
     QList<MessageEvent *> incompleteMessages;
     QHash<QDBusPendingCallWatcher *, UIntList> acknowledgeBatches;
 
+    // Acknowledgements gathered before being sent in a single call, when they are delayed
+    int acknowledgeDelay;
+    int acknowledgeBatchSize;
+    UIntList delayedAcknowledgements;
+    QTimer *acknowledgeTimer;
+
     // FeatureChatState
     struct ChatStateEvent
     {
@@ -125,7 +180,11 @@ TextChannel::Private::Private(TextChannel *parent)
       gotProperties(false),
       messagePartSupport(0),
       deliveryReportingSupport(0),
-      initialMessagesReceived(false)
+      initialMessagesReceived(false),
+      messages(MessageCodec(parent)),
+      acknowledgeDelay(0),
+      acknowledgeBatchSize(TextChannel::DefaultAcknowledgeBatchSize),
+      acknowledgeTimer(0)
 {
     ReadinessHelper::Introspectables introspectables;
 
@@ -175,6 +234,154 @@ TextChannel::Private::~Private()
     }
 }
 
+QList<UIntList> TextChannel::Private::takeDelayedAcknowledgements()
+{
+    QList<UIntList> batches;
+    int size = acknowledgeBatchSize > 0 ? acknowledgeBatchSize : delayedAcknowledgements.size();
+    for (int i = 0; i < delayedAcknowledgements.size(); i += size) {
+        batches << delayedAcknowledgements.mid(i, size);
+    }
+    delayedAcknowledgements.clear();
+    return batches;
+}
+
+void TextChannel::Private::acknowledgeNow(const UIntList &ids)
+{
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(
+            textInterface->AcknowledgePendingMessages(ids),
+            parent);
+    parent->connect(watcher,
+            SIGNAL(finished(QDBusPendingCallWatcher*)),
+            SLOT(onAcknowledgePendingMessagesReply(QDBusPendingCallWatcher*)));
+    acknowledgeBatches[watcher] = ids;
+}
+
+bool TextChannel::Private::MessageCodec::spill(const ReceivedMessage &message,
+        Spilled *spilled) const
+{
+    MessagePartList parts = message.parts();
+    foreach (const MessagePart &part, parts) {
+        for (MessagePart::const_iterator i = part.constBegin(); i != part.constEnd(); ++i) {
+            if (!isStreamable(i.value().variant())) {
+                // Such as D-Bus structures, which can't be restored as they were
+                return false;
+            }
+        }
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << static_cast<quint32>(parts.size());
+    foreach (const MessagePart &part, parts) {
+        stream << static_cast<quint32>(part.size());
+        for (MessagePart::const_iterator i = part.constBegin(); i != part.constEnd(); ++i) {
+            stream << i.key() << i.value().variant();
+        }
+    }
+
+    spilled->parts = qCompress(data);
+    spilled->sender = message.sender();
+    spilled->pendingId = message.pendingId();
+    spilled->senderHandle = message.senderHandle();
+    spilled->forceNonText = message.hasNonTextContent();
+    return true;
+}
+
+ReceivedMessage TextChannel::Private::MessageCodec::restore(const Spilled &spilled) const
+{
+    QByteArray data = qUncompress(spilled.parts);
+    QDataStream stream(data);
+
+    MessagePartList parts;
+    quint32 partsCount;
+    stream >> partsCount;
+    for (quint32 i = 0; i < partsCount; ++i) {
+        MessagePart part;
+        quint32 count;
+        stream >> count;
+        for (quint32 j = 0; j < count; ++j) {
+            QString key;
+            QVariant value;
+            stream >> key >> value;
+            part.insert(key, QDBusVariant(value));
+        }
+        parts << part;
+    }
+
+    ReceivedMessage message(parts, TextChannelPtr(channel));
+    message.setSender(spilled.sender);
+    if (spilled.forceNonText && !message.hasNonTextContent()) {
+        message.setForceNonText();
+    }
+    return message;
+}
+
+qint64 TextChannel::Private::MessageCodec::size(const ReceivedMessage &message) const
+{
+    qint64 ret = sizeof(ReceivedMessage);
+    foreach (const MessagePart &part, message.parts()) {
+        for (MessagePart::const_iterator i = part.constBegin(); i != part.constEnd(); ++i) {
+            ret += i.key().size() * sizeof(QChar) + sizeOf(i.value().variant());
+        }
+    }
+    return ret;
+}
+
+bool TextChannel::Private::MessageCodec::isStreamable(const QVariant &value)
+{
+    if (value.type() == QVariant::List) {
+        foreach (const QVariant &item, value.toList()) {
+            if (!isStreamable(item)) {
+                return false;
+            }
+        }
+        return true;
+    } else if (value.type() == QVariant::Map) {
+        QVariantMap map = value.toMap();
+        for (QVariantMap::const_iterator i = map.constBegin(); i != map.constEnd(); ++i) {
+            if (!isStreamable(i.value())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    return value.userType() < QVariant::UserType;
+}
+
+qint64 TextChannel::Private::MessageCodec::sizeOf(const QVariant &value)
+{
+    qint64 ret = sizeof(QVariant);
+    switch (value.type()) {
+        case QVariant::String:
+            ret += value.toString().size() * sizeof(QChar);
+            break;
+        case QVariant::ByteArray:
+            ret += value.toByteArray().size();
+            break;
+        case QVariant::StringList:
+            foreach (const QString &item, value.toStringList()) {
+                ret += sizeof(QString) + item.size() * sizeof(QChar);
+            }
+            break;
+        case QVariant::List:
+            foreach (const QVariant &item, value.toList()) {
+                ret += sizeOf(item);
+            }
+            break;
+        case QVariant::Map: {
+            QVariantMap map = value.toMap();
+            for (QVariantMap::const_iterator i = map.constBegin(); i != map.constEnd(); ++i) {
+                ret += i.key().size() * sizeof(QChar) + sizeOf(i.value());
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return ret;
+}
+
 void TextChannel::Private::introspectMessageQueue(
         TextChannel::Private *self)
 {
@@ -359,20 +566,13 @@ void TextChannel::Private::processMessageQueue()
 
             // if we reach here, the message is ready
             debug() << "Message is usable, copying to main queue";
-            messages << e->message;
+            messages.append(e->message);
             emit parent->messageReceived(e->message);
         } else {
             // forget about the message(s) with ID e->removed (there should be
             // at most one under normal circumstances)
-            int i = 0;
-            while (i < messages.size()) {
-                if (messages.at(i).pendingId() == e->removed) {
-                    ReceivedMessage removedMessage = messages.at(i);
-                    messages.removeAt(i);
-                    emit parent->pendingMessageRemoved(removedMessage);
-                } else {
-                    i++;
-                }
+            foreach (const ReceivedMessage &removedMessage, messages.takeAll(e->removed)) {
+                emit parent->pendingMessageRemoved(removedMessage);
             }
         }
 
@@ -560,6 +760,14 @@ const Feature TextChannel::FeatureMessageSentSignal = Feature(QLatin1String(Text
  */
 const Feature TextChannel::FeatureChatState = Feature(QLatin1String(TextChannel::staticMetaObject.className()), 3);
 
+/**
+ * \var TextChannel::DefaultAcknowledgeBatchSize
+ *
+ * The default maximum number of delayed acknowledgements sent in a single call.
+ *
+ * \sa setAcknowledgeBatchSize()
+ */
+
 /**
  * \fn void TextChannel::messageSent(const Tp::Message &message,
  *          Tp::MessageSendingFlags flags,
@@ -662,6 +870,11 @@ TextChannel::TextChannel(const ConnectionPtr &connection,
  */
 TextChannel::~TextChannel()
 {
+    // Nobody is left to handle a failure
+    foreach (const UIntList &batch, mPriv->takeDelayedAcknowledgements()) {
+        mPriv->textInterface->AcknowledgePendingMessages(batch);
+    }
+
     delete mPriv;
 }
 
@@ -825,7 +1038,97 @@ DeliveryReportingSupportFlags TextChannel::deliveryReportingSupport() const
  */
 QList<ReceivedMessage> TextChannel::messageQueue() const
 {
-    return mPriv->messages;
+    return mPriv->messages.toList();
+}
+
+/**
+ * Return how many of the messages in messageQueue() are kept as they were received at most.
+ *
+ * \return The maximum number of messages kept in memory, or 0 if there is no limit.
+ * \sa setMessageQueueLimit(), messageQueueMemoryLimit()
+ */
+int TextChannel::messageQueueLimit() const
+{
+    return mPriv->messages.maxInMemory();
+}
+
+/**
+ * Set how many of the messages in messageQueue() are kept as they were received at most.
+ *
+ * Long-lived channels whose messages are never acknowledged, as can happen with chat rooms
+ * nobody is looking at, otherwise keep all of them in memory. Over the limit, the oldest messages
+ * are spilled: their parts are compressed, and they are restored whenever messageQueue() returns
+ * them. The restored copies aren't kept, so holding on to the messages returned by
+ * messageQueue() keeps them in memory anyway.
+ *
+ * Messages having parts which can't be serialized, such as D-Bus structures, are never spilled,
+ * and stay in memory over the limit. Raising the limit doesn't restore the messages already
+ * spilled.
+ *
+ * \param count The maximum number of messages kept in memory, or 0 for no limit, which is
+ *              the default.
+ * \sa messageQueueLimit(), setMessageQueueMemoryLimit(), spilledMessagesCount()
+ */
+void TextChannel::setMessageQueueLimit(int count)
+{
+    mPriv->messages.setLimits(count, mPriv->messages.maxMemoryUsage());
+}
+
+/**
+ * Return how much memory the messages in messageQueue() kept as they were received use at most.
+ *
+ * \return The maximum estimated size in bytes, or 0 if there is no limit.
+ * \sa setMessageQueueMemoryLimit(), messageQueueLimit()
+ */
+qint64 TextChannel::messageQueueMemoryLimit() const
+{
+    return mPriv->messages.maxMemoryUsage();
+}
+
+/**
+ * Set how much memory the messages in messageQueue() kept as they were received use at most.
+ *
+ * Over the limit, the oldest messages are spilled, as described in setMessageQueueLimit().
+ *
+ * \param bytes The maximum estimated size in bytes, or 0 for no limit, which is the default.
+ * \sa messageQueueMemoryLimit(), messageQueueMemoryUsage(), setMessageQueueLimit()
+ */
+void TextChannel::setMessageQueueMemoryLimit(qint64 bytes)
+{
+    mPriv->messages.setLimits(mPriv->messages.maxInMemory(), bytes);
+}
+
+/**
+ * Return the estimated size of the messages in messageQueue() kept as they were received.
+ *
+ * \return The estimated size in bytes.
+ * \sa setMessageQueueMemoryLimit(), spilledMessagesSize()
+ */
+qint64 TextChannel::messageQueueMemoryUsage() const
+{
+    return mPriv->messages.memoryUsage();
+}
+
+/**
+ * Return how many of the messages in messageQueue() are spilled.
+ *
+ * \return The number of spilled messages.
+ * \sa setMessageQueueLimit(), spilledMessagesSize()
+ */
+int TextChannel::spilledMessagesCount() const
+{
+    return mPriv->messages.spilledCount();
+}
+
+/**
+ * Return the size of the messages in messageQueue() which are spilled.
+ *
+ * \return The size in bytes of the spilled messages, once compressed.
+ * \sa spilledMessagesCount(), messageQueueMemoryUsage()
+ */
+qint64 TextChannel::spilledMessagesSize() const
+{
+    return mPriv->messages.spilledSize();
 }
 
 /**
@@ -883,6 +1186,9 @@ void TextChannel::onAcknowledgePendingMessagesReply(
  * Processes other than the main handler of a channel can free memory used
  * by the library by calling forget() instead.
  *
+ * The acknowledgements are sent to the service right away, unless setAcknowledgeDelay() was
+ * used to gather them.
+ *
  * This method requires TextChannel::FeatureMessageQueue to be ready.
  *
  * \param messages A list of received messages that have now been displayed.
@@ -909,13 +1215,117 @@ void TextChannel::acknowledge(const QList<ReceivedMessage> &messages)
     // them from the list immediately
     forget(messages);
 
-    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(
-            mPriv->textInterface->AcknowledgePendingMessages(ids),
-            this);
-    connect(watcher,
-            SIGNAL(finished(QDBusPendingCallWatcher*)),
-            SLOT(onAcknowledgePendingMessagesReply(QDBusPendingCallWatcher*)));
-    mPriv->acknowledgeBatches[watcher] = ids;
+    if (mPriv->acknowledgeDelay <= 0) {
+        mPriv->acknowledgeNow(ids);
+        return;
+    }
+
+    mPriv->delayedAcknowledgements << ids;
+    if (mPriv->acknowledgeBatchSize > 0 &&
+            mPriv->delayedAcknowledgements.size() >= mPriv->acknowledgeBatchSize) {
+        flushAcknowledgements();
+        return;
+    }
+
+    if (!mPriv->acknowledgeTimer) {
+        mPriv->acknowledgeTimer = new QTimer(this);
+        mPriv->acknowledgeTimer->setSingleShot(true);
+        connect(mPriv->acknowledgeTimer,
+                SIGNAL(timeout()),
+                SLOT(flushAcknowledgements()));
+    }
+
+    // Not restarted by later acknowledgements, so that they are never delayed for longer
+    if (!mPriv->acknowledgeTimer->isActive()) {
+        mPriv->acknowledgeTimer->start(mPriv->acknowledgeDelay);
+    }
+}
+
+/**
+ * Send the acknowledgements delayed by acknowledge() right away.
+ *
+ * This does nothing unless acknowledgeDelay() is set.
+ *
+ * \sa acknowledge(), setAcknowledgeDelay()
+ */
+void TextChannel::flushAcknowledgements()
+{
+    if (mPriv->acknowledgeTimer) {
+        mPriv->acknowledgeTimer->stop();
+    }
+
+    if (mPriv->delayedAcknowledgements.isEmpty()) {
+        return;
+    }
+
+    foreach (const UIntList &batch, mPriv->takeDelayedAcknowledgements()) {
+        mPriv->acknowledgeNow(batch);
+    }
+}
+
+/**
+ * Return for how long acknowledge() gathers the acknowledgements before sending them to the
+ * service in a single call.
+ *
+ * \return The delay in milliseconds, or 0 if acknowledgements are sent right away.
+ * \sa setAcknowledgeDelay(), acknowledgeBatchSize()
+ */
+int TextChannel::acknowledgeDelay() const
+{
+    return mPriv->acknowledgeDelay;
+}
+
+/**
+ * Set for how long acknowledge() gathers the acknowledgements before sending them to the
+ * service in a single call.
+ *
+ * Handlers acknowledging the messages one by one as they display them make one D-Bus call per
+ * message by default. Delaying the acknowledgements lets a single call acknowledge all the
+ * messages acknowledged in the meantime, up to acknowledgeBatchSize() of them. The messages are
+ * removed from messageQueue() right away in any case.
+ *
+ * The acknowledgements still delayed when the channel is destroyed are sent at that point, and
+ * flushAcknowledgements() sends them at any other time.
+ *
+ * \param msec The delay in milliseconds, or 0 to send acknowledgements right away, which is
+ *             the default.
+ * \sa acknowledgeDelay(), setAcknowledgeBatchSize()
+ */
+void TextChannel::setAcknowledgeDelay(int msec)
+{
+    mPriv->acknowledgeDelay = qMax(msec, 0);
+    if (!mPriv->acknowledgeDelay) {
+        flushAcknowledgements();
+    }
+}
+
+/**
+ * Return how many delayed acknowledgements are sent at most in a single call.
+ *
+ * \return The maximum number of messages acknowledged at once, or 0 if there is no limit.
+ * \sa setAcknowledgeBatchSize(), acknowledgeDelay()
+ */
+int TextChannel::acknowledgeBatchSize() const
+{
+    return mPriv->acknowledgeBatchSize;
+}
+
+/**
+ * Set how many delayed acknowledgements are sent at most in a single call.
+ *
+ * Once that many messages are waiting to be acknowledged, they are acknowledged without waiting
+ * for acknowledgeDelay() to elapse. The default is #DefaultAcknowledgeBatchSize.
+ *
+ * \param size The maximum number of messages acknowledged at once, or 0 for no limit.
+ * \sa acknowledgeBatchSize(), setAcknowledgeDelay()
+ */
+void TextChannel::setAcknowledgeBatchSize(int size)
+{
+    mPriv->acknowledgeBatchSize = qMax(size, 0);
+    if (mPriv->acknowledgeBatchSize > 0 &&
+            mPriv->delayedAcknowledgements.size() >= mPriv->acknowledgeBatchSize) {
+        flushAcknowledgements();
+    }
 }
 
 /**
@@ -936,7 +1346,7 @@ void TextChannel::forget(const QList<ReceivedMessage> &messages)
     foreach (const ReceivedMessage &m, messages) {
         if (!m.isFromChannel(TextChannelPtr(this))) {
             warning() << "message did not come from this channel, ignoring";
-        } else if (mPriv->messages.removeOne(m)) {
+        } else if (mPriv->messages.remove(m)) {
             emit pendingMessageRemoved(m);
         }
     }
@@ -49,6 +49,10 @@ public:
     static const Feature FeatureMessageSentSignal;
     static const Feature FeatureChatState;
 
+    enum {
+        DefaultAcknowledgeBatchSize = 100
+    };
+
     static TextChannelPtr create(const ConnectionPtr &connection,
             const QString &objectPath, const QVariantMap &immutableProperties);
 
@@ -68,11 +72,25 @@ public:
     // requires FeatureMessageQueue
     QList<ReceivedMessage> messageQueue() const;
 
+    int messageQueueLimit() const;
+    void setMessageQueueLimit(int count);
+    qint64 messageQueueMemoryLimit() const;
+    void setMessageQueueMemoryLimit(qint64 bytes);
+    qint64 messageQueueMemoryUsage() const;
+    int spilledMessagesCount() const;
+    qint64 spilledMessagesSize() const;
+
+    int acknowledgeDelay() const;
+    void setAcknowledgeDelay(int msec);
+    int acknowledgeBatchSize() const;
+    void setAcknowledgeBatchSize(int size);
+
     // requires FeatureChatState
     ChannelChatState chatState(const ContactPtr &contact) const;
 
 public Q_SLOTS:
     void acknowledge(const QList<ReceivedMessage> &messages);
+    void flushAcknowledgements();
 
     void forget(const QList<ReceivedMessage> &messages);
 
@@ -0,0 +1,454 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/Debug>
+
+#include "TelepathyQt/avatar-cache-internal.h"
+
+using namespace Tp;
+
+namespace {
+
+void writeFile(const QString &fileName, const QByteArray &contents)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(contents);
+}
+
+// As another process caching an avatar would
+void appendIndexRecord(const QString &path, const QString &fileName, const QString &mimeType,
+        qint64 size)
+{
+    QFile index(path + QLatin1String("/avatars.index"));
+    QVERIFY(index.open(QIODevice::WriteOnly | QIODevice::Append));
+    QDataStream stream(&index);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << static_cast<quint8>(1) << fileName << mimeType << size <<
+        static_cast<qint64>(QDateTime::currentDateTime().toTime_t());
+}
+
+// As another process evicting an avatar would
+void appendIndexRemoveRecord(const QString &path, const QString &fileName)
+{
+    QFile index(path + QLatin1String("/avatars.index"));
+    QVERIFY(index.open(QIODevice::WriteOnly | QIODevice::Append));
+    QDataStream stream(&index);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << static_cast<quint8>(2) << fileName;
+}
+
+void removeDirectory(const QString &path)
+{
+    QDir dir(path);
+    foreach (const QString &name, dir.entryList(QDir::Files | QDir::Hidden)) {
+        dir.remove(name);
+    }
+    QDir().rmdir(path);
+}
+
+}
+
+class TestAvatarCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestAvatarCache(QObject *parent = 0);
+
+protected Q_SLOTS:
+    void onAvatarWritten(const QString &token, bool success);
+
+private Q_SLOTS:
+    void init();
+
+    void testPathFor();
+    void testLookup();
+    void testPersistence();
+    void testMigration();
+    void testStaleEntries();
+    void testTruncatedIndex();
+    void testExternalChanges();
+    void testWrite();
+    void testDestroyWhileWriting();
+    void testEviction();
+    void testStatistics();
+
+    void cleanup();
+
+private:
+    AvatarCachePtr openCache(const QString &path);
+    AvatarCache::Entry cacheAvatar(const AvatarCachePtr &cache, const QString &token,
+            const QByteArray &data, const QString &mimeType);
+
+    QString mPath;
+    QList<QPair<QString, bool> > mWritten;
+};
+
+TestAvatarCache::TestAvatarCache(QObject *parent)
+    : QObject(parent)
+{
+    Tp::enableDebug(true);
+    Tp::enableWarnings(true);
+}
+
+AvatarCachePtr TestAvatarCache::openCache(const QString &path)
+{
+    // The index is loaded by the writer thread
+    AvatarCachePtr cache = AvatarCache::forPath(path);
+    for (int i = 0; i < 500 && !cache->isLoaded(); ++i) {
+        QTest::qWait(10);
+    }
+    return cache;
+}
+
+AvatarCache::Entry TestAvatarCache::cacheAvatar(const AvatarCachePtr &cache,
+        const QString &token, const QByteArray &data, const QString &mimeType)
+{
+    writeFile(cache->avatarFileName(token), data);
+    writeFile(cache->mimeTypeFileName(token), mimeType.toLatin1());
+
+    AvatarCache::Entry entry;
+    entry.mimeType = mimeType;
+    entry.size = data.size();
+    entry.mtime = QDateTime::currentDateTime().toTime_t();
+    cache->insert(token, entry);
+    return entry;
+}
+
+void TestAvatarCache::onAvatarWritten(const QString &token, bool success)
+{
+    mWritten << qMakePair(token, success);
+}
+
+void TestAvatarCache::init()
+{
+    mWritten.clear();
+
+    // Make sure we don't mess up the user's avatar cache
+    mPath = QString(QLatin1String("%1/avatar-cache-test-%2")).
+        arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+    removeDirectory(mPath);
+    QVERIFY(QDir().mkpath(mPath));
+}
+
+void TestAvatarCache::testPathFor()
+{
+    QByteArray oldCacheHome = qgetenv("XDG_CACHE_HOME");
+
+    qputenv("XDG_CACHE_HOME", "/tmp/cache-home");
+    QCOMPARE(AvatarCache::pathFor(QLatin1String("gabble"), QLatin1String("jabber")),
+            QString(QLatin1String("/tmp/cache-home/telepathy/avatars/gabble/jabber")));
+
+    qputenv("XDG_CACHE_HOME", oldCacheHome);
+}
+
+void TestAvatarCache::testLookup()
+{
+    AvatarCachePtr cache = openCache(mPath);
+    QVERIFY(cache);
+    QVERIFY(cache->isLoaded());
+    QCOMPARE(cache->path(), mPath);
+    QCOMPARE(cache->count(), 0);
+
+    // There is a single index per directory
+    QCOMPARE(AvatarCache::forPath(mPath).data(), cache.data());
+
+    // Tokens may contain anything, file names are escaped
+    QString token = QLatin1String("http://example.com/avatar.png");
+    QVERIFY(!cache->lookup(token, 0));
+    QVERIFY(!cache->avatarFileName(token).mid(mPath.length() + 1).contains(QLatin1Char('.')));
+    QCOMPARE(cache->mimeTypeFileName(token), cache->avatarFileName(token) +
+            QLatin1String(".mime"));
+
+    cacheAvatar(cache, token, "avatar-data", QLatin1String("image/png"));
+
+    AvatarCache::Entry entry;
+    QVERIFY(cache->lookup(token, &entry));
+    QCOMPARE(entry.mimeType, QString(QLatin1String("image/png")));
+    QCOMPARE(entry.size, Q_INT64_C(11));
+    QCOMPARE(cache->count(), 1);
+    QVERIFY(!cache->lookup(QLatin1String("some-other-token"), &entry));
+}
+
+void TestAvatarCache::testPersistence()
+{
+    AvatarCachePtr cache = openCache(mPath);
+    for (int i = 0; i < 10; ++i) {
+        cacheAvatar(cache, QString(QLatin1String("token%1")).arg(i), "data",
+                QString(QLatin1String("image/x-%1")).arg(i));
+    }
+    QVERIFY(QFile::exists(mPath + QLatin1String("/avatars.index")));
+
+    // Mime types must now come from the index rather than from the .mime files
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(QFile::remove(cache->mimeTypeFileName(QString(QLatin1String("token%1")).arg(i))));
+    }
+
+    cache.reset();
+    cache = openCache(mPath);
+    QCOMPARE(cache->count(), 10);
+    for (int i = 0; i < 10; ++i) {
+        AvatarCache::Entry entry;
+        QVERIFY(cache->lookup(QString(QLatin1String("token%1")).arg(i), &entry));
+        QCOMPARE(entry.mimeType, QString(QLatin1String("image/x-%1")).arg(i));
+        QCOMPARE(entry.size, Q_INT64_C(4));
+    }
+}
+
+void TestAvatarCache::testMigration()
+{
+    // A cache directory written before there was an index
+    writeFile(mPath + QLatin1String("/token1"), "first");
+    writeFile(mPath + QLatin1String("/token1.mime"), "image/png");
+    writeFile(mPath + QLatin1String("/token2"), "second!");
+    writeFile(mPath + QLatin1String("/token2.mime"), "image/jpeg");
+
+    AvatarCachePtr cache = openCache(mPath);
+    QCOMPARE(cache->count(), 2);
+
+    AvatarCache::Entry entry;
+    QVERIFY(cache->lookup(QLatin1String("token1"), &entry));
+    QCOMPARE(entry.mimeType, QString(QLatin1String("image/png")));
+    QCOMPARE(entry.size, Q_INT64_C(5));
+    QVERIFY(cache->lookup(QLatin1String("token2"), &entry));
+    QCOMPARE(entry.mimeType, QString(QLatin1String("image/jpeg")));
+    QCOMPARE(entry.size, Q_INT64_C(7));
+
+    QVERIFY(QFile::exists(mPath + QLatin1String("/avatars.index")));
+}
+
+void TestAvatarCache::testStaleEntries()
+{
+    AvatarCachePtr cache = openCache(mPath);
+    cacheAvatar(cache, QLatin1String("kept"), "data", QLatin1String("image/png"));
+    cacheAvatar(cache, QLatin1String("removed"), "data", QLatin1String("image/png"));
+    QCOMPARE(cache->count(), 2);
+
+    QVERIFY(QFile::remove(cache->avatarFileName(QLatin1String("removed"))));
+
+    cache.reset();
+    cache = openCache(mPath);
+    QCOMPARE(cache->count(), 1);
+    QVERIFY(cache->lookup(QLatin1String("kept"), 0));
+    QVERIFY(!cache->lookup(QLatin1String("removed"), 0));
+}
+
+void TestAvatarCache::testTruncatedIndex()
+{
+    AvatarCachePtr cache = openCache(mPath);
+    cacheAvatar(cache, QLatin1String("token"), "data", QLatin1String("image/png"));
+    cache.reset();
+
+    QFile index(mPath + QLatin1String("/avatars.index"));
+    QVERIFY(index.open(QIODevice::WriteOnly | QIODevice::Append));
+    index.write("\x01\x00\x00", 3);
+    index.close();
+
+    cache = openCache(mPath);
+    QCOMPARE(cache->count(), 1);
+    AvatarCache::Entry entry;
+    QVERIFY(cache->lookup(QLatin1String("token"), &entry));
+    QCOMPARE(entry.mimeType, QString(QLatin1String("image/png")));
+}
+
+void TestAvatarCache::testExternalChanges()
+{
+    AvatarCachePtr cache = openCache(mPath);
+    cacheAvatar(cache, QLatin1String("removed"), "data", QLatin1String("image/png"));
+    cacheAvatar(cache, QLatin1String("replaced"), "data", QLatin1String("image/png"));
+
+    // Other processes share the directory, and journal what they do to it
+    QString removed = cache->avatarFileName(QLatin1String("removed"));
+    QVERIFY(QFile::remove(removed));
+    appendIndexRemoveRecord(mPath, QFileInfo(removed).fileName());
+    QString replaced = cache->avatarFileName(QLatin1String("replaced"));
+    writeFile(replaced, "new-data!");
+    writeFile(cache->mimeTypeFileName(QLatin1String("replaced")), "image/jpeg");
+    appendIndexRecord(mPath, QFileInfo(replaced).fileName(), QLatin1String("image/jpeg"), 9);
+
+    // Lookups don't touch the disk, the changes are only picked up when refreshing
+    AvatarCache::Entry entry;
+    QVERIFY(cache->lookup(QLatin1String("removed"), &entry));
+    cache->refresh();
+    QVERIFY(!cache->lookup(QLatin1String("removed"), &entry));
+    QVERIFY(cache->lookup(QLatin1String("replaced"), &entry));
+    QCOMPARE(entry.mimeType, QString(QLatin1String("image/jpeg")));
+    QCOMPARE(entry.size, Q_INT64_C(9));
+    QCOMPARE(cache->count(), 1);
+
+    // An avatar cached by another process is found from the records it appended to the index
+    QString token = QLatin1String("other");
+    writeFile(cache->avatarFileName(token), "other");
+    writeFile(cache->mimeTypeFileName(token), "image/gif");
+    appendIndexRecord(mPath, QFileInfo(cache->avatarFileName(token)).fileName(),
+            QLatin1String("image/gif"), 5);
+
+    QVERIFY(!cache->lookup(token, &entry));
+    cache->refresh();
+    QVERIFY(cache->lookup(token, &entry));
+    QCOMPARE(entry.mimeType, QString(QLatin1String("image/gif")));
+    QCOMPARE(entry.size, Q_INT64_C(5));
+    QCOMPARE(cache->count(), 2);
+
+    // A removal which wasn't journaled is noticed by the next load, which lists the directory
+    QVERIFY(QFile::remove(cache->avatarFileName(token)));
+    cache.reset();
+    cache = openCache(mPath);
+    QVERIFY(!cache->lookup(token, &entry));
+    QCOMPARE(cache->count(), 1);
+}
+
+void TestAvatarCache::testWrite()
+{
+    // The writer creates the directory if needed
+    QString path = mPath + QLatin1String("/sub");
+    AvatarCachePtr cache = openCache(path);
+    QVERIFY(connect(cache.data(),
+                SIGNAL(avatarWritten(QString,bool)),
+                SLOT(onAvatarWritten(QString,bool))));
+
+    QString token = QLatin1String("token");
+    QByteArray data("avatar-data");
+    cache->write(token, data, QLatin1String("image/png"));
+    cache->write(QLatin1String("other-token"), "other-data", QLatin1String("image/jpeg"));
+
+    // The signal comes from the writer thread, so it is queued to us
+    for (int i = 0; i < 500 && mWritten.size() < 2; ++i) {
+        QTest::qWait(10);
+    }
+    QCOMPARE(mWritten.size(), 2);
+    QVERIFY(mWritten.contains(qMakePair(token, true)));
+    QVERIFY(mWritten.contains(qMakePair(QString(QLatin1String("other-token")), true)));
+    QVERIFY(!cache->isWriting(token));
+
+    AvatarCache::Entry entry;
+    QVERIFY(cache->lookup(token, &entry));
+    QCOMPARE(entry.mimeType, QString(QLatin1String("image/png")));
+    QCOMPARE(entry.size, static_cast<qint64>(data.size()));
+
+    QFile avatarFile(cache->avatarFileName(token));
+    QVERIFY(avatarFile.open(QIODevice::ReadOnly));
+    QCOMPARE(avatarFile.readAll(), data);
+    QFile mimeTypeFile(cache->mimeTypeFileName(token));
+    QVERIFY(mimeTypeFile.open(QIODevice::ReadOnly));
+    QCOMPARE(mimeTypeFile.readAll(), QByteArray("image/png"));
+
+    // Nothing is left behind by the atomic renames
+    QCOMPARE(QDir(path).entryList(QDir::Files).size(), 5);
+
+    cache.reset();
+    removeDirectory(path);
+}
+
+void TestAvatarCache::testDestroyWhileWriting()
+{
+    AvatarCachePtr cache = openCache(mPath);
+    QVERIFY(connect(cache.data(),
+                SIGNAL(avatarWritten(QString,bool)),
+                SLOT(onAvatarWritten(QString,bool))));
+
+    QStringList tokens;
+    for (int i = 0; i < 20; ++i) {
+        tokens << QString(QLatin1String("token%1")).arg(i);
+        cache->write(tokens.last(), "avatar-data", QLatin1String("image/png"));
+    }
+
+    // Destroying the cache doesn't wait for the writes, nor drop them
+    cache.reset();
+
+    cache = openCache(mPath);
+    QCOMPARE(cache->count(), tokens.size());
+    foreach (const QString &token, tokens) {
+        AvatarCache::Entry entry;
+        QVERIFY(cache->lookup(token, &entry));
+        QCOMPARE(entry.size, Q_INT64_C(11));
+    }
+}
+
+void TestAvatarCache::testEviction()
+{
+    // Not limited unless asked to
+    AvatarCachePtr cache = openCache(mPath);
+    QCOMPARE(cache->maximumBytes(), Q_INT64_C(0));
+    QCOMPARE(cache->maximumEntries(), 0);
+
+    // The oldest avatar, never looked up, but in use by a contact
+    cacheAvatar(cache, QLatin1String("pinned"), "data", QLatin1String("image/png"));
+    cache->pin(cache->avatarFileName(QLatin1String("pinned")));
+
+    cache->setLimits(0, 10);
+    QCOMPARE(cache->maximumBytes(), Q_INT64_C(0));
+    QCOMPARE(cache->maximumEntries(), 10);
+
+    QStringList hot;
+    for (int i = 0; i < 5; ++i) {
+        hot << QString(QLatin1String("hot%1")).arg(i);
+        cacheAvatar(cache, hot.last(), "data", QLatin1String("image/png"));
+    }
+
+    // Keep using the first avatars while new ones come in, so they are never the least
+    // recently used
+    for (int i = 0; i < 15; ++i) {
+        foreach (const QString &token, hot) {
+            QVERIFY(cache->lookup(token, 0));
+        }
+        cacheAvatar(cache, QString(QLatin1String("cold%1")).arg(i), "data",
+                QLatin1String("image/png"));
+    }
+
+    for (int i = 0; i < 500 && cache->count() > 10; ++i) {
+        QTest::qWait(10);
+    }
+    QVERIFY(cache->count() <= 10);
+
+    AvatarCacheStatistics statistics = cache->statistics();
+    QCOMPARE(statistics.entries, cache->count());
+    QCOMPARE(static_cast<int>(statistics.evictions), 21 - statistics.entries);
+    QCOMPARE(statistics.evictedBytes, static_cast<qint64>(statistics.evictions * 4));
+    QCOMPARE(statistics.bytes, static_cast<qint64>(statistics.entries * 4));
+
+    foreach (const QString &token, hot) {
+        QVERIFY(cache->lookup(token, 0));
+    }
+    QVERIFY(cache->lookup(QLatin1String("pinned"), 0));
+    QVERIFY(!cache->lookup(QLatin1String("cold0"), 0));
+
+    // Opening the cache again waits for the eviction to remove the files, as the index is
+    // loaded by the same writer thread
+    cache.reset();
+    cache = openCache(mPath);
+    QCOMPARE(cache->count(), statistics.entries);
+
+    QStringList avatarFiles = QDir(mPath).entryList(QDir::Files).filter(
+            QRegExp(QLatin1String("^[^.]+$")));
+    QCOMPARE(avatarFiles.size(), statistics.entries);
+    QVERIFY(!QFile::exists(mPath + QLatin1String("/cold0")));
+    QVERIFY(!QFile::exists(mPath + QLatin1String("/cold0.mime")));
+}
+
+void TestAvatarCache::testStatistics()
+{
+    AvatarCachePtr cache = openCache(mPath);
+    cacheAvatar(cache, QLatin1String("token"), "avatar-data", QLatin1String("image/png"));
+
+    QVERIFY(cache->lookup(QLatin1String("token"), 0));
+    QVERIFY(cache->lookup(QLatin1String("token"), 0));
+    QVERIFY(!cache->lookup(QLatin1String("unknown"), 0));
+
+    AvatarCacheStatistics statistics = cache->statistics();
+    QCOMPARE(statistics.hits, Q_UINT64_C(2));
+    QCOMPARE(statistics.misses, Q_UINT64_C(1));
+    QCOMPARE(statistics.evictions, Q_UINT64_C(0));
+    QCOMPARE(statistics.evictedBytes, Q_INT64_C(0));
+    QCOMPARE(statistics.entries, 1);
+    QCOMPARE(statistics.bytes, Q_INT64_C(11));
+}
+
+void TestAvatarCache::cleanup()
+{
+    removeDirectory(mPath);
+}
+
+QTEST_MAIN(TestAvatarCache)
+
+#include "_gen/avatar-cache.cpp.moc.hpp"
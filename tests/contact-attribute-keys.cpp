@@ -0,0 +1,236 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/Debug>
+#include <TelepathyQt/Types>
+
+#include "TelepathyQt/contact-attribute-keys-internal.h"
+
+using namespace Tp;
+
+namespace {
+
+struct AugmentResult
+{
+    AugmentResult() : subscribe(0), publish(0) { }
+
+    bool operator==(const AugmentResult &other) const
+    {
+        return id == other.id && alias == other.alias &&
+            avatarToken == other.avatarToken && presence == other.presence &&
+            groups == other.groups && subscribe == other.subscribe &&
+            publish == other.publish && publishRequest == other.publishRequest;
+    }
+
+    QString id;
+    QString alias;
+    QString avatarToken;
+    QString presence;
+    QStringList groups;
+    uint subscribe;
+    uint publish;
+    QString publishRequest;
+};
+
+// Mirrors what Contact::augment() used to do: build each key on the fly and look it up
+// separately for every requested feature
+AugmentResult legacyAugment(const QVariantMap &attributes)
+{
+    AugmentResult ret;
+
+    ret.id = qdbus_cast<QString>(attributes[
+            TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")]);
+
+    if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                QLatin1String("/subscribe"))) {
+        ret.subscribe = qdbus_cast<uint>(attributes.value(
+                     TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/subscribe")));
+    }
+
+    if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                QLatin1String("/publish"))) {
+        ret.publish = qdbus_cast<uint>(attributes.value(
+                    TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/publish")));
+        ret.publishRequest = qdbus_cast<QString>(attributes.value(
+                    TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/publish-request")));
+    }
+
+    ret.alias = qdbus_cast<QString>(attributes.value(
+                TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias")));
+
+    if (attributes.contains(
+                TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token"))) {
+        ret.avatarToken = qdbus_cast<QString>(attributes.value(
+                    TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token")));
+    }
+
+    ret.presence = qdbus_cast<SimplePresence>(attributes.value(
+                TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE + QLatin1String("/presence"))).status;
+
+    ret.groups = qdbus_cast<QStringList>(attributes.value(
+                TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS + QLatin1String("/groups")));
+
+    return ret;
+}
+
+AugmentResult internedAugment(const QVariantMap &attributes)
+{
+    AugmentResult ret;
+    ContactAttributeValues values(attributes);
+
+    ret.id = qdbus_cast<QString>(values.value(ContactAttributeKeys::ContactId));
+
+    if (values.contains(ContactAttributeKeys::Subscribe)) {
+        ret.subscribe = qdbus_cast<uint>(values.value(ContactAttributeKeys::Subscribe));
+    }
+
+    if (values.contains(ContactAttributeKeys::Publish)) {
+        ret.publish = qdbus_cast<uint>(values.value(ContactAttributeKeys::Publish));
+        ret.publishRequest = qdbus_cast<QString>(
+                values.value(ContactAttributeKeys::PublishRequest));
+    }
+
+    ret.alias = qdbus_cast<QString>(values.value(ContactAttributeKeys::Alias));
+
+    if (values.contains(ContactAttributeKeys::AvatarToken)) {
+        ret.avatarToken = qdbus_cast<QString>(values.value(ContactAttributeKeys::AvatarToken));
+    }
+
+    ret.presence = qdbus_cast<SimplePresence>(
+            values.value(ContactAttributeKeys::SimplePresence)).status;
+
+    ret.groups = qdbus_cast<QStringList>(values.value(ContactAttributeKeys::Groups));
+
+    return ret;
+}
+
+ContactAttributesMap syntheticAttributes(uint count)
+{
+    ContactAttributesMap ret;
+
+    for (uint handle = 1; handle <= count; ++handle) {
+        QVariantMap attributes;
+        QString id = QString(QLatin1String("contact%1@example.com")).arg(handle);
+
+        attributes.insert(TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id"), id);
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                QLatin1String("/subscribe"), static_cast<uint>(SubscriptionStateYes));
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                QLatin1String("/publish"), static_cast<uint>(SubscriptionStateAsk));
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                QLatin1String("/publish-request"), QLatin1String("Please let me see you"));
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias"),
+                QString(QLatin1String("Contact %1")).arg(handle));
+
+        // Leave some tokens unknown, as CMs do for offline contacts
+        if (handle % 3) {
+            attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token"),
+                    QString::number(handle, 16));
+        }
+
+        SimplePresence presence;
+        presence.type = ConnectionPresenceTypeAvailable;
+        presence.status = QLatin1String("available");
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE +
+                QLatin1String("/presence"), QVariant::fromValue(presence));
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS +
+                QLatin1String("/groups"), QStringList() << QLatin1String("Friends") <<
+                QString(QLatin1String("Group %1")).arg(handle % 10));
+
+        ret.insert(handle, attributes);
+    }
+
+    return ret;
+}
+
+}
+
+class TestContactAttributeKeys : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestContactAttributeKeys(QObject *parent = 0);
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void testKeys();
+    void testValues();
+
+    void benchmarkLegacyAugment();
+    void benchmarkInternedAugment();
+
+private:
+    ContactAttributesMap mAttributes;
+};
+
+TestContactAttributeKeys::TestContactAttributeKeys(QObject *parent)
+    : QObject(parent)
+{
+    Tp::enableDebug(true);
+    Tp::enableWarnings(true);
+}
+
+void TestContactAttributeKeys::initTestCase()
+{
+    Tp::registerTypes();
+
+    mAttributes = syntheticAttributes(20000);
+}
+
+void TestContactAttributeKeys::testKeys()
+{
+    const ContactAttributeKeys &keys = ContactAttributeKeys::instance();
+
+    QCOMPARE(&keys, &ContactAttributeKeys::instance());
+
+    for (int i = 0; i < ContactAttributeKeys::NumKeys; ++i) {
+        ContactAttributeKeys::Key key = static_cast<ContactAttributeKeys::Key>(i);
+        QVERIFY(!keys.name(key).isEmpty());
+        QCOMPARE(keys.indexOf(keys.name(key)), i);
+    }
+
+    QCOMPARE(keys.name(ContactAttributeKeys::ContactId),
+            QString(TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")));
+    QCOMPARE(keys.name(ContactAttributeKeys::AvatarToken),
+            QString(TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token")));
+    QCOMPARE(keys.indexOf(QLatin1String("org.example.Unknown/attribute")), -1);
+}
+
+void TestContactAttributeKeys::testValues()
+{
+    QVariantMap noAttributes;
+    ContactAttributeValues empty(noAttributes);
+    for (int i = 0; i < ContactAttributeKeys::NumKeys; ++i) {
+        ContactAttributeKeys::Key key = static_cast<ContactAttributeKeys::Key>(i);
+        QVERIFY(!empty.contains(key));
+        QVERIFY(!empty.value(key).isValid());
+    }
+
+    foreach (const QVariantMap &attributes, mAttributes) {
+        QVERIFY(legacyAugment(attributes) == internedAugment(attributes));
+    }
+}
+
+void TestContactAttributeKeys::benchmarkLegacyAugment()
+{
+    QBENCHMARK {
+        foreach (const QVariantMap &attributes, mAttributes) {
+            legacyAugment(attributes);
+        }
+    }
+}
+
+void TestContactAttributeKeys::benchmarkInternedAugment()
+{
+    QBENCHMARK {
+        foreach (const QVariantMap &attributes, mAttributes) {
+            internedAugment(attributes);
+        }
+    }
+}
+
+QTEST_MAIN(TestContactAttributeKeys)
+
+#include "_gen/contact-attribute-keys.cpp.moc.hpp"
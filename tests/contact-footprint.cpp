@@ -0,0 +1,86 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/Contact>
+#include <TelepathyQt/Debug>
+#include <TelepathyQt/Feature>
+
+#include <TelepathyQt/test-backdoors.h>
+
+using namespace Tp;
+
+namespace {
+
+Features featureSet(int level)
+{
+    Features features;
+    if (level >= 1) {
+        features << Contact::FeatureAlias << Contact::FeatureSimplePresence;
+    }
+    if (level >= 2) {
+        features << Contact::FeatureAvatarToken << Contact::FeatureCapabilities;
+    }
+    if (level >= 3) {
+        features << Contact::FeatureLocation << Contact::FeatureInfo
+            << Contact::FeatureAddresses << Contact::FeatureClientTypes;
+    }
+    return features;
+}
+
+}
+
+class TestContactFootprint : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestContactFootprint(QObject *parent = 0);
+
+private Q_SLOTS:
+    void testLazyBlocks();
+
+    void benchmarkFootprint_data();
+    void benchmarkFootprint();
+};
+
+TestContactFootprint::TestContactFootprint(QObject *parent)
+    : QObject(parent)
+{
+    Tp::enableDebug(true);
+    Tp::enableWarnings(true);
+}
+
+void TestContactFootprint::testLazyBlocks()
+{
+    int bare = TestBackdoors::contactFootprint(featureSet(0));
+
+    // The features stored inline cost nothing more
+    QCOMPARE(TestBackdoors::contactFootprint(featureSet(1)), bare);
+    QCOMPARE(TestBackdoors::contactFootprint(Features() << Contact::FeatureCapabilities), bare);
+
+    // Only the ones which received something pay for their block
+    QVERIFY(TestBackdoors::contactFootprint(featureSet(2)) > bare);
+    QVERIFY(TestBackdoors::contactFootprint(featureSet(3)) >
+            TestBackdoors::contactFootprint(featureSet(2)));
+}
+
+void TestContactFootprint::benchmarkFootprint_data()
+{
+    QTest::addColumn<int>("level");
+
+    QTest::newRow("bare") << 0;
+    QTest::newRow("alias and presence") << 1;
+    QTest::newRow("roster") << 2;
+    QTest::newRow("everything") << 3;
+}
+
+void TestContactFootprint::benchmarkFootprint()
+{
+    QFETCH(int, level);
+
+    QTest::setBenchmarkResult(TestBackdoors::contactFootprint(featureSet(level)),
+            QTest::BytesAllocated);
+}
+
+QTEST_MAIN(TestContactFootprint)
+
+#include "_gen/contact-footprint.cpp.moc.hpp"
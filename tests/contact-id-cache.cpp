@@ -0,0 +1,185 @@
+#include <QtTest/QtTest>
+
+#include "TelepathyQt/contact-id-cache-internal.h"
+
+using namespace Tp;
+
+namespace {
+
+QString idFor(uint handle)
+{
+    return QString(QLatin1String("contact%1@example.com")).arg(handle);
+}
+
+struct NotPinned
+{
+    bool operator()(uint) const { return false; }
+};
+
+struct PinnedSet
+{
+    PinnedSet(const QSet<uint> &handles) : handles(handles) { }
+
+    bool operator()(uint handle) const { return handles.contains(handle); }
+
+    QSet<uint> handles;
+};
+
+}
+
+class TestContactIdCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestContactIdCache(QObject *parent = 0);
+
+private Q_SLOTS:
+    void testInsertLookup();
+    void testEviction();
+    void testSecondChance();
+    void testFreshEntriesSurvive();
+    void testPinned();
+    void testUnbounded();
+};
+
+TestContactIdCache::TestContactIdCache(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void TestContactIdCache::testInsertLookup()
+{
+    ContactIdCache cache;
+    QCOMPARE(cache.capacity(), static_cast<int>(ContactIdCache::DefaultCapacity));
+    QCOMPARE(cache.count(), 0);
+
+    for (uint handle = 1; handle <= 100; ++handle) {
+        cache.insert(handle, idFor(handle), NotPinned());
+    }
+    QCOMPARE(cache.count(), 100);
+
+    for (uint handle = 1; handle <= 100; ++handle) {
+        QVERIFY(cache.contains(handle));
+        QCOMPARE(cache.value(handle), idFor(handle));
+    }
+    QVERIFY(!cache.contains(101));
+    QCOMPARE(cache.value(101), QString());
+    QCOMPARE(cache.hits(), Q_UINT64_C(100));
+    QCOMPARE(cache.misses(), Q_UINT64_C(1));
+
+    // Peeking doesn't count
+    QCOMPARE(cache.peek(1), idFor(1));
+    QCOMPARE(cache.peek(101), QString());
+    QCOMPARE(cache.hits(), Q_UINT64_C(100));
+    QCOMPARE(cache.misses(), Q_UINT64_C(1));
+}
+
+void TestContactIdCache::testEviction()
+{
+    ContactIdCache cache(100);
+
+    for (uint handle = 1; handle <= 10000; ++handle) {
+        cache.insert(handle, idFor(handle), NotPinned());
+        QVERIFY(cache.count() <= 100);
+    }
+
+    QCOMPARE(cache.count(), 100);
+    QCOMPARE(cache.evictions(), Q_UINT64_C(9900));
+    QVERIFY(cache.contains(10000));
+    QVERIFY(!cache.contains(1));
+
+    // Shrinking takes effect on the next insertions
+    cache.setCapacity(10);
+    QCOMPARE(cache.count(), 100);
+    for (uint handle = 10001; handle <= 10100; ++handle) {
+        cache.insert(handle, idFor(handle), NotPinned());
+    }
+    QCOMPARE(cache.count(), 10);
+}
+
+void TestContactIdCache::testSecondChance()
+{
+    ContactIdCache cache(10);
+
+    for (uint handle = 1; handle <= 10; ++handle) {
+        cache.insert(handle, idFor(handle), NotPinned());
+    }
+
+    // Keep using the first contact while many others come and go
+    for (uint handle = 11; handle <= 1000; ++handle) {
+        QVERIFY(cache.contains(1));
+        cache.insert(handle, idFor(handle), NotPinned());
+    }
+
+    QCOMPARE(cache.count(), 10);
+    QCOMPARE(cache.value(1), idFor(1));
+}
+
+void TestContactIdCache::testFreshEntriesSurvive()
+{
+    ContactIdCache cache(100);
+
+    for (uint handle = 1; handle <= 100; ++handle) {
+        cache.insert(handle, idFor(handle), NotPinned());
+    }
+    for (uint handle = 1; handle <= 100; ++handle) {
+        QVERIFY(cache.contains(handle));
+    }
+
+    // A burst of new contacts only evicts older entries, never the ones it just inserted
+    for (uint handle = 101; handle <= 150; ++handle) {
+        cache.insert(handle, idFor(handle), NotPinned());
+    }
+
+    QCOMPARE(cache.count(), 100);
+    QCOMPARE(cache.evictions(), Q_UINT64_C(50));
+    for (uint handle = 101; handle <= 150; ++handle) {
+        QCOMPARE(cache.peek(handle), idFor(handle));
+    }
+    for (uint handle = 51; handle <= 100; ++handle) {
+        QCOMPARE(cache.peek(handle), idFor(handle));
+    }
+}
+
+void TestContactIdCache::testPinned()
+{
+    ContactIdCache cache(10);
+
+    QSet<uint> alive;
+    for (uint handle = 1; handle <= 20; ++handle) {
+        alive.insert(handle);
+        cache.insert(handle, idFor(handle), PinnedSet(alive));
+    }
+
+    // Nothing to evict, the cache grows over its capacity
+    QCOMPARE(cache.count(), 20);
+    QCOMPARE(cache.evictions(), Q_UINT64_C(0));
+
+    // And shrinks back once the contacts are gone, keeping the ones still alive
+    alive.clear();
+    alive << 5 << 15;
+    for (uint handle = 21; handle <= 100; ++handle) {
+        cache.insert(handle, idFor(handle), PinnedSet(alive));
+    }
+
+    QCOMPARE(cache.count(), 10);
+    QCOMPARE(cache.value(5), idFor(5));
+    QCOMPARE(cache.value(15), idFor(15));
+}
+
+void TestContactIdCache::testUnbounded()
+{
+    ContactIdCache cache(0);
+
+    for (uint handle = 1; handle <= 20000; ++handle) {
+        cache.insert(handle, idFor(handle), NotPinned());
+    }
+
+    QCOMPARE(cache.count(), 20000);
+    QCOMPARE(cache.evictions(), Q_UINT64_C(0));
+}
+
+QTEST_MAIN(TestContactIdCache)
+
+#include "_gen/contact-id-cache.cpp.moc.hpp"
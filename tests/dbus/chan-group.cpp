@@ -24,7 +24,7 @@ class TestChanGroup : public Test
 
 public:
     TestChanGroup(QObject *parent = 0)
-        : Test(parent), mConn(0), mChanService(0),
+        : Test(parent), mConn(0), mChanService(0), mMembersChangedCount(0),
           mGotGroupFlagsChanged(false),
           mGroupFlags((ChannelGroupFlags) 0),
           mGroupFlagsAdded((ChannelGroupFlags) 0),
@@ -50,6 +50,8 @@ private Q_SLOTS:
     void testPropertylessGroup();
     void testLeave();
     void testLeaveWithFallback();
+    void testCoalescedMembersChanged();
+    void testCoalescedRemoveThenPending();
     void testGroupFlagsChange();
 
     void cleanup();
@@ -70,6 +72,7 @@ private:
     Contacts mChangedRP;
     Contacts mChangedRemoved;
     Channel::GroupMemberChangeDetails mDetails;
+    int mMembersChangedCount;
     UIntList mInitialMembers;
     bool mGotGroupFlagsChanged;
     ChannelGroupFlags mGroupFlags;
@@ -90,6 +93,7 @@ void TestChanGroup::onGroupMembersChanged(
     mChangedRP = groupRemotePendingMembersAdded;
     mChangedRemoved = groupMembersRemoved;
     mDetails = details;
+    ++mMembersChangedCount;
     debugContacts();
     mLoop->exit(0);
 }
@@ -157,6 +161,7 @@ void TestChanGroup::init()
     mChangedRP.clear();
     mChangedRemoved.clear();
     mDetails = Channel::GroupMemberChangeDetails();
+    mMembersChangedCount = 0;
     mGotGroupFlagsChanged = false;
     mGroupFlags = (ChannelGroupFlags) 0;
     mGroupFlagsAdded = (ChannelGroupFlags) 0;
@@ -205,6 +210,12 @@ void TestChanGroup::testCreateChannel()
 
     QCOMPARE(mChan->groupContacts().count(), 4);
 
+    // Repeated calls share the same snapshot until the membership changes
+    Contacts members = mChan->groupContacts();
+    QVERIFY(mChan->groupContacts().constBegin() == members.constBegin());
+    QVERIFY(mChan->groupContacts(false).constBegin() == mChan->groupContacts(false).constBegin());
+    QVERIFY(!mChan->groupContacts(false).contains(mChan->groupSelfContact()));
+
     QVERIFY(connect(mChan.data(),
                     SIGNAL(groupMembersChanged(
                             const Tp::Contacts &,
@@ -232,6 +243,8 @@ void TestChanGroup::testCreateChannel()
     QVERIFY(mChangedRemoved.contains(mContacts[0]));
 
     QCOMPARE(mChan->groupContacts().count(), 3);
+    QCOMPARE(members.count(), 4);
+    QVERIFY(!mChan->groupContacts().contains(mContacts[0]));
 }
 
 void TestChanGroup::testMCDGroup()
@@ -440,6 +453,181 @@ void TestChanGroup::testLeaveWithFallback()
     QVERIFY(!mChan->groupSelfContactRemoveInfo().hasMessage());
 }
 
+void TestChanGroup::testCoalescedMembersChanged()
+{
+    mChanObjectPath = QString(QLatin1String("%1/ChannelForTpQtCoalesceTest"))
+        .arg(mConn->objectPath());
+    QByteArray chanPathLatin1(mChanObjectPath.toLatin1());
+
+    mChanService = TP_TESTS_TEXT_CHANNEL_GROUP(g_object_new(
+                TP_TESTS_TYPE_TEXT_CHANNEL_GROUP,
+                "connection", mConn->service(),
+                "object-path", chanPathLatin1.data(),
+                "detailed", TRUE,
+                "properties", TRUE,
+                NULL));
+    QVERIFY(mChanService != 0);
+
+    TpIntSet *members = tp_intset_sized_new(1);
+    tp_intset_add(members, mConn->client()->selfHandle());
+    QVERIFY(tp_group_mixin_change_members(G_OBJECT(mChanService), "",
+                members, NULL, NULL, NULL, 0, TP_CHANNEL_GROUP_CHANGE_REASON_NONE));
+    tp_intset_destroy(members);
+
+    mChan = Channel::create(mConn->client(), mChanObjectPath, QVariantMap());
+    QVERIFY(connect(mChan->becomeReady(),
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectSuccessfulCall(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mChan->groupContacts().size(), 1);
+
+    QVERIFY(connect(mChan.data(),
+                    SIGNAL(groupMembersChanged(
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Channel::GroupMemberChangeDetails &)),
+                    SLOT(onGroupMembersChanged(
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Channel::GroupMemberChangeDetails &))));
+
+    TpHandleRepoIface *contactRepo = tp_base_connection_get_handles(
+            TP_BASE_CONNECTION(mConn->service()),
+            TP_HANDLE_TYPE_CONTACT);
+
+    // A burst of changes, as a big room replaying its members, one of them joining and leaving
+    // again before the end
+    const int joining = 50;
+    guint leaving = tp_handle_ensure(contactRepo, "leaving@localhost", 0, 0);
+    for (int i = 0; i < joining; ++i) {
+        QByteArray id = QString(QLatin1String("member%1@localhost")).arg(i).toLatin1();
+        TpIntSet *added = tp_intset_sized_new(2);
+        tp_intset_add(added, tp_handle_ensure(contactRepo, id.constData(), 0, 0));
+        if (i == 0) {
+            tp_intset_add(added, leaving);
+        }
+
+        TpIntSet *removed = tp_intset_sized_new(1);
+        if (i == joining - 1) {
+            tp_intset_add(removed, leaving);
+        }
+
+        QVERIFY(tp_group_mixin_change_members(G_OBJECT(mChanService), id.constData(),
+                    added, removed, NULL, NULL, 0, TP_CHANNEL_GROUP_CHANGE_REASON_NONE));
+        tp_intset_destroy(added);
+        tp_intset_destroy(removed);
+    }
+
+    while (mChan->groupContacts().size() < joining + 1) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    processDBusQueue(mConn->client().data());
+
+    // The changes queued while building the contacts for the first one are merged
+    QVERIFY(mMembersChangedCount < joining);
+    QVERIFY(mDetails.changeCount() > 1);
+    QCOMPARE(mDetails.message(), QString(QLatin1String("member%1@localhost")).arg(joining - 1));
+
+    Q_FOREACH (const ContactPtr &contact, mChangedCurrent) {
+        QCOMPARE(mDetails.detailsFor(contact).message(), contact->id());
+    }
+
+    QCOMPARE(mChan->groupContacts().size(), joining + 1);
+    Q_FOREACH (const ContactPtr &contact, mChan->groupContacts()) {
+        QVERIFY(contact->id() != QLatin1String("leaving@localhost"));
+    }
+}
+
+void TestChanGroup::testCoalescedRemoveThenPending()
+{
+    mChanObjectPath = QString(QLatin1String("%1/ChannelForTpQtCoalesceRemoveTest"))
+        .arg(mConn->objectPath());
+    QByteArray chanPathLatin1(mChanObjectPath.toLatin1());
+
+    mChanService = TP_TESTS_TEXT_CHANNEL_GROUP(g_object_new(
+                TP_TESTS_TYPE_TEXT_CHANNEL_GROUP,
+                "connection", mConn->service(),
+                "object-path", chanPathLatin1.data(),
+                "detailed", TRUE,
+                "properties", TRUE,
+                NULL));
+    QVERIFY(mChanService != 0);
+
+    TpHandleRepoIface *contactRepo = tp_base_connection_get_handles(
+            TP_BASE_CONNECTION(mConn->service()),
+            TP_HANDLE_TYPE_CONTACT);
+    guint rejoining = tp_handle_ensure(contactRepo, "rejoining@localhost", 0, 0);
+
+    TpIntSet *members = tp_intset_sized_new(2);
+    tp_intset_add(members, mConn->client()->selfHandle());
+    tp_intset_add(members, rejoining);
+    QVERIFY(tp_group_mixin_change_members(G_OBJECT(mChanService), "",
+                members, NULL, NULL, NULL, 0, TP_CHANNEL_GROUP_CHANGE_REASON_NONE));
+    tp_intset_destroy(members);
+
+    mChan = Channel::create(mConn->client(), mChanObjectPath, QVariantMap());
+    QVERIFY(connect(mChan->becomeReady(),
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectSuccessfulCall(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mChan->groupContacts().size(), 2);
+
+    QVERIFY(connect(mChan.data(),
+                    SIGNAL(groupMembersChanged(
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Channel::GroupMemberChangeDetails &)),
+                    SLOT(onGroupMembersChanged(
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Contacts &,
+                            const Tp::Channel::GroupMemberChangeDetails &))));
+
+    // A member leaves and asks to join again while other changes keep Channel busy, so that the
+    // removal and the local pending addition are merged
+    const int joining = 10;
+    for (int i = 0; i < joining; ++i) {
+        QByteArray id = QString(QLatin1String("member%1@localhost")).arg(i).toLatin1();
+        TpIntSet *added = tp_intset_sized_new(1);
+        tp_intset_add(added, tp_handle_ensure(contactRepo, id.constData(), 0, 0));
+        TpIntSet *removed = tp_intset_sized_new(1);
+        TpIntSet *localPending = tp_intset_sized_new(1);
+        if (i == 1) {
+            tp_intset_add(removed, rejoining);
+        } else if (i == 2) {
+            tp_intset_add(localPending, rejoining);
+        }
+
+        QVERIFY(tp_group_mixin_change_members(G_OBJECT(mChanService), id.constData(),
+                    added, removed, localPending, NULL, 0, TP_CHANNEL_GROUP_CHANGE_REASON_NONE));
+        tp_intset_destroy(added);
+        tp_intset_destroy(removed);
+        tp_intset_destroy(localPending);
+    }
+
+    while (mChan->groupContacts().size() < joining + 1 ||
+            mChan->groupLocalPendingContacts().isEmpty()) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    processDBusQueue(mConn->client().data());
+
+    // It is local pending only, not a member any more
+    QCOMPARE(mChan->groupContacts().size(), joining + 1);
+    Q_FOREACH (const ContactPtr &contact, mChan->groupContacts()) {
+        QVERIFY(contact->id() != QLatin1String("rejoining@localhost"));
+    }
+    QCOMPARE(mChan->groupLocalPendingContacts().size(), 1);
+    QCOMPARE((*mChan->groupLocalPendingContacts().begin())->id(),
+            QString(QLatin1String("rejoining@localhost")));
+}
+
 void TestChanGroup::testGroupFlagsChange()
 {
     TpHandleRepoIface *contactRepo = tp_base_connection_get_handles(
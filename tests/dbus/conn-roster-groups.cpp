@@ -433,6 +433,18 @@ void TestConnRosterGroups::testRosterGroups()
     Q_FOREACH (const ContactPtr &contact, contacts) {
         QVERIFY(contact->groups().contains(group));
     }
+    QCOMPARE(contactManager->groupContacts(group), contacts);
+
+    // The group membership index agrees with the groups of each contact
+    Q_FOREACH (const QString &knownGroup, contactManager->allKnownGroups()) {
+        Contacts expected;
+        Q_FOREACH (const ContactPtr &contact, contactManager->allKnownContacts()) {
+            if (contact->groups().contains(knownGroup)) {
+                expected << contact;
+            }
+        }
+        QCOMPARE(contactManager->groupContacts(knownGroup), expected);
+    }
 
     causeCongestion(mConn, mConn->selfContact());
 
@@ -454,6 +466,7 @@ void TestConnRosterGroups::testRosterGroups()
     Q_FOREACH (const ContactPtr &contact, contacts) {
         QVERIFY(!contact->groups().contains(group));
     }
+    QVERIFY(contactManager->groupContacts(group).isEmpty());
 
     causeCongestion(mConn, mConn->selfContact());
 
@@ -11,6 +11,8 @@
 #include <TelepathyQt/ContactManager>
 #include <TelepathyQt/PendingContacts>
 
+#include "TelepathyQt/roster-snapshot-internal.h"
+
 #include <telepathy-glib/debug.h>
 
 using namespace Tp;
@@ -35,12 +37,16 @@ protected Q_SLOTS:
     void expectPresenceStateChanged(Tp::Contact::PresenceState);
     void expectAllKnownContactsChanged(const Tp::Contacts &added, const Tp::Contacts &removed,
             const Tp::Channel::GroupMemberChangeDetails &details);
+    void onAllKnownContactsChanged(const Tp::Contacts &added, const Tp::Contacts &removed,
+            const Tp::Channel::GroupMemberChangeDetails &details);
 
 private Q_SLOTS:
     void initTestCase();
     void init();
 
     void testRoster();
+    void testRosterSnapshot();
+    void testUpdateBurst();
 
     void cleanup();
     void cleanupTestCase();
@@ -52,6 +58,7 @@ private:
     int mHowManyKnownContacts;
     bool mGotPresenceStateChanged;
     bool mGotPPR;
+    QList<Contacts> mKnownContactsAdded;
 };
 
 void TestConnRoster::expectBlockingContactsFinished(Tp::PendingOperation *op)
@@ -119,6 +126,17 @@ void TestConnRoster::expectAllKnownContactsChanged(const Tp::Contacts& added, co
     }
 }
 
+void TestConnRoster::onAllKnownContactsChanged(const Tp::Contacts &added,
+        const Tp::Contacts &removed, const Tp::Channel::GroupMemberChangeDetails &details)
+{
+    Q_UNUSED(removed);
+    Q_UNUSED(details);
+
+    if (!added.isEmpty()) {
+        mKnownContactsAdded << added;
+    }
+}
+
 void TestConnRoster::expectPresencePublicationRequested(const Tp::Contacts &contacts)
 {
     Q_FOREACH(Tp::ContactPtr contact, contacts) {
@@ -479,6 +497,138 @@ void TestConnRoster::testRoster()
     }
 }
 
+void TestConnRoster::testRosterSnapshot()
+{
+    QString fileName = QString(QLatin1String("%1/conn-roster-snapshot-%2")).
+        arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+
+    // Snapshot a stale alias for a contact still on the roster, and a contact which is gone
+    RosterSnapshot::Entry sjoerd;
+    sjoerd.id = QLatin1String("sjoerd@example.com");
+    sjoerd.alias = QLatin1String("Stale Sjoerd");
+    RosterSnapshot::Entry gone;
+    gone.id = QLatin1String("gone@example.com");
+    gone.alias = QLatin1String("Gone");
+    QVERIFY(RosterSnapshot::save(fileName, QList<RosterSnapshot::Entry>() << sjoerd << gone));
+
+    TestConnHelper *conn = new TestConnHelper(this,
+            ChannelFactory::create(QDBusConnection::sessionBus()),
+            ContactFactory::create(Contact::FeatureAlias),
+            EXAMPLE_TYPE_CONTACT_LIST_CONNECTION,
+            "account", "snapshot@example.com",
+            "protocol", "contactlist",
+            "simulation-delay", 1,
+            NULL);
+    QCOMPARE(conn->connect(), true);
+
+    ContactManagerPtr contactManager = conn->client()->contactManager();
+    contactManager->setRosterSnapshotFileName(fileName);
+    QCOMPARE(contactManager->rosterSnapshotFileName(), fileName);
+
+    QCOMPARE(conn->enableFeatures(Features() << Connection::FeatureRoster), true);
+    QCOMPARE(contactManager->state(), ContactListStateSuccess);
+
+    // Only the contacts actually on the roster are built, whatever the snapshot says
+    ContactPtr sjoerdContact;
+    Q_FOREACH (const ContactPtr &contact, contactManager->allKnownContacts()) {
+        QVERIFY(contact->id() != gone.id);
+        if (contact->id() == sjoerd.id) {
+            sjoerdContact = contact;
+        }
+    }
+    QCOMPARE(contactManager->allKnownContacts().size(), 10);
+    QVERIFY(!sjoerdContact.isNull());
+
+    // The alias from the snapshot is then reconciled with the live one
+    if (sjoerdContact->alias() == sjoerd.alias) {
+        QVERIFY(connect(sjoerdContact.data(),
+                    SIGNAL(aliasChanged(QString)),
+                    mLoop,
+                    SLOT(quit())));
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    QCOMPARE(sjoerdContact->alias(), QString(QLatin1String("Sjoerd")));
+
+    // ...and the snapshot is brought up to date in the background
+    RosterSnapshot snapshot(fileName);
+    for (int i = 0; i < 100; ++i) {
+        if (snapshot.load() && snapshot.count() == 10) {
+            break;
+        }
+        QTest::qWait(50);
+    }
+    QCOMPARE(snapshot.count(), 10);
+    QVERIFY(snapshot.indexOf(gone.id) < 0);
+    QCOMPARE(snapshot.entry(snapshot.indexOf(sjoerd.id)).alias,
+            QString(QLatin1String("Sjoerd")));
+    snapshot.unload();
+
+    QCOMPARE(conn->disconnect(), true);
+    delete conn;
+    QFile::remove(fileName);
+}
+
+void TestConnRoster::testUpdateBurst()
+{
+    TestConnHelper *conn = new TestConnHelper(this,
+            ChannelFactory::create(QDBusConnection::sessionBus()),
+            ContactFactory::create(Contact::FeatureAlias),
+            EXAMPLE_TYPE_CONTACT_LIST_CONNECTION,
+            "account", "burst@example.com",
+            "protocol", "contactlist",
+            "simulation-delay", 1,
+            NULL);
+    QCOMPARE(conn->connect(), true);
+    QCOMPARE(conn->enableFeatures(Features() << Connection::FeatureRoster), true);
+
+    ContactManagerPtr contactManager = conn->client()->contactManager();
+    QCOMPARE(contactManager->state(), ContactListStateSuccess);
+    int initialKnownContacts = contactManager->allKnownContacts().size();
+
+    QStringList ids;
+    for (int i = 0; i < 6; ++i) {
+        ids << QString(QLatin1String("burst%1@example.com")).arg(i);
+    }
+    QList<ContactPtr> contacts = conn->contacts(ids);
+    QCOMPARE(contacts.size(), ids.size());
+
+    mKnownContactsAdded.clear();
+    QVERIFY(connect(contactManager.data(),
+                SIGNAL(allKnownContactsChanged(Tp::Contacts,Tp::Contacts,
+                        Tp::Channel::GroupMemberChangeDetails)),
+                SLOT(onAllKnownContactsChanged(Tp::Contacts,Tp::Contacts,
+                        Tp::Channel::GroupMemberChangeDetails))));
+
+    // Fire all the requests at once; the resulting ContactsChanged signals queue up behind the
+    // first one and get merged
+    Q_FOREACH (const ContactPtr &contact, contacts) {
+        contact->requestPresenceSubscription(QLatin1String("add me now"));
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        if (contactManager->allKnownContacts().size() == initialKnownContacts + ids.size()) {
+            break;
+        }
+        QTest::qWait(50);
+    }
+    QCOMPARE(contactManager->allKnownContacts().size(), initialKnownContacts + ids.size());
+
+    Contacts added;
+    Q_FOREACH (const Contacts &batch, mKnownContactsAdded) {
+        QVERIFY((added & batch).isEmpty());
+        added.unite(batch);
+    }
+    QCOMPARE(added, contacts.toSet());
+    QVERIFY(mKnownContactsAdded.size() < ids.size());
+
+    QVERIFY(disconnect(contactManager.data(), 0, this, 0));
+    contacts.clear();
+    contactManager.reset();
+
+    QCOMPARE(conn->disconnect(), true);
+    delete conn;
+}
+
 void TestConnRoster::cleanup()
 {
     cleanupImpl();
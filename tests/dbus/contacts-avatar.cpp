@@ -212,6 +212,12 @@ void TestContactsAvatar::testAvatar()
     createContactWithFakeAvatar("bar");
     QVERIFY(!mGotAvatarRetrieved);
 
+    AvatarCacheStatistics statistics =
+        mConn->client()->contactManager()->avatarCacheStatistics();
+    QVERIFY(statistics.hits >= 1);
+    QVERIFY(statistics.entries >= 1);
+    QVERIFY(statistics.bytes >= static_cast<qint64>(strlen("fake-avatar-data")));
+
     QVERIFY(SmartDir(tmpDir).removeDirectory());
 }
 
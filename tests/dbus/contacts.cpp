@@ -13,6 +13,7 @@
 #include <TelepathyQt/Contact>
 #include <TelepathyQt/ContactFactory>
 #include <TelepathyQt/ContactManager>
+#include <TelepathyQt/PendingContactAttributes>
 #include <TelepathyQt/PendingContacts>
 #include <TelepathyQt/PendingVoid>
 #include <TelepathyQt/PendingReady>
@@ -21,7 +22,12 @@
 #include <TelepathyQt/Debug>
 #include <TelepathyQt/Types>
 
+#include <telepathy-glib/dbus.h>
 #include <telepathy-glib/debug.h>
+#include <telepathy-glib/errors.h>
+#include <telepathy-glib/interfaces.h>
+
+#include <dbus/dbus-glib-lowlevel.h>
 
 #include <tests/lib/glib/contacts-conn.h>
 #include <tests/lib/glib/simple-conn.h>
@@ -29,13 +35,43 @@
 
 using namespace Tp;
 
+namespace {
+
+// Counts the GetContactAttributes calls as seen by the service
+DBusHandlerResult countGetContactAttributes(DBusConnection *, DBusMessage *message, void *data)
+{
+    if (dbus_message_is_method_call(message, TP_IFACE_CONNECTION_INTERFACE_CONTACTS,
+                "GetContactAttributes")) {
+        ++*static_cast<int *>(data);
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+// Fails the second GetContactAttributes call the service receives
+DBusHandlerResult failSecondGetContactAttributes(DBusConnection *connection,
+        DBusMessage *message, void *data)
+{
+    if (!dbus_message_is_method_call(message, TP_IFACE_CONNECTION_INTERFACE_CONTACTS,
+                "GetContactAttributes") || ++*static_cast<int *>(data) != 2) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    DBusMessage *reply = dbus_message_new_error(message, TP_ERROR_STR_NOT_AVAILABLE,
+            "Injected failure");
+    dbus_connection_send(connection, reply, NULL);
+    dbus_message_unref(reply);
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+}
+
 class TestContacts : public Test
 {
     Q_OBJECT
 
 public:
     TestContacts(QObject *parent = 0)
-        : Test(parent), mConnService(0)
+        : Test(parent), mConnService(0), mTotalHandles(0), mContactPresenceChanges(0)
     {
     }
 
@@ -43,6 +79,12 @@ protected Q_SLOTS:
     void expectConnReady(Tp::ConnectionStatus, Tp::ConnectionStatusReason);
     void expectConnInvalidated();
     void expectPendingContactsFinished(Tp::PendingOperation *);
+    void expectCoalescedPendingContactsFinished(Tp::PendingOperation *);
+    void onContactsRetrieved(const QList<Tp::ContactPtr> &contacts, int retrievedHandles,
+            int totalHandles);
+    void onPresencesChanged(const Tp::Contacts &contacts);
+    void onAliasesChanged(const Tp::Contacts &contacts);
+    void onContactPresenceChanged();
 
 private Q_SLOTS:
     void initTestCase();
@@ -51,12 +93,20 @@ private Q_SLOTS:
     void testSupport();
     void testSelfContact();
     void testForHandles();
+    void testForHandlesCoalesced();
+    void testForHandlesChunked();
+    void testForHandlesCoalescedChunked();
+    void testForHandlesChunkFailure();
     void testForIdentifiers();
     void testFeatures();
     void testFeaturesNotRequested();
+    void testBulkChangeSignals();
     void testUpgrade();
     void testSelfContactFallback();
 
+    void benchmarkContactsForHandles_data();
+    void benchmarkContactsForHandles();
+
     void cleanup();
     void cleanupTestCase();
 
@@ -66,6 +116,13 @@ private:
     ConnectionPtr mConn;
     QList<ContactPtr> mContacts;
     Tp::UIntList mInvalidHandles;
+    QHash<PendingOperation *, QList<ContactPtr> > mCoalescedContacts;
+    QList<ContactPtr> mRetrievedContacts;
+    QList<int> mRetrievedHandles;
+    int mTotalHandles;
+    QList<Contacts> mPresencesChanged;
+    QList<Contacts> mAliasesChanged;
+    int mContactPresenceChanges;
 };
 
 void TestContacts::expectConnReady(Tp::ConnectionStatus newStatus,
@@ -110,6 +167,39 @@ void TestContacts::expectPendingContactsFinished(PendingOperation *op)
     mLoop->exit(0);
 }
 
+void TestContacts::expectCoalescedPendingContactsFinished(PendingOperation *op)
+{
+    TEST_VERIFY_OP(op);
+
+    PendingContacts *pending = qobject_cast<PendingContacts *>(op);
+    mCoalescedContacts.insert(op, pending->contacts());
+
+    mLoop->exit(0);
+}
+
+void TestContacts::onContactsRetrieved(const QList<Tp::ContactPtr> &contacts,
+        int retrievedHandles, int totalHandles)
+{
+    mRetrievedContacts << contacts;
+    mRetrievedHandles << retrievedHandles;
+    mTotalHandles = totalHandles;
+}
+
+void TestContacts::onPresencesChanged(const Tp::Contacts &contacts)
+{
+    mPresencesChanged << contacts;
+}
+
+void TestContacts::onAliasesChanged(const Tp::Contacts &contacts)
+{
+    mAliasesChanged << contacts;
+}
+
+void TestContacts::onContactPresenceChanged()
+{
+    ++mContactPresenceChanges;
+}
+
 void TestContacts::initTestCase()
 {
     initTestCaseImpl();
@@ -335,6 +425,256 @@ void TestContacts::testForHandles()
     processDBusQueue(mConn.data());
 }
 
+void TestContacts::testForHandlesCoalesced()
+{
+    TpHandleRepoIface *serviceRepo =
+        tp_base_connection_get_handles(TP_BASE_CONNECTION(mConnService), TP_HANDLE_TYPE_CONTACT);
+
+    Tp::UIntList firstHandles;
+    firstHandles << tp_handle_ensure(serviceRepo, "alice", NULL, NULL);
+    firstHandles << tp_handle_ensure(serviceRepo, "bob", NULL, NULL);
+    firstHandles << 31337;
+    QVERIFY(!tp_handle_is_valid(serviceRepo, firstHandles[2], NULL));
+
+    Tp::UIntList secondHandles;
+    secondHandles << firstHandles[1];
+    secondHandles << tp_handle_ensure(serviceRepo, "chris", NULL, NULL);
+
+    const char *aliases[] = {
+        "Bob The Builder",
+        "Chris Sawyer"
+    };
+    tp_tests_contacts_connection_change_aliases(mConnService, 2,
+            secondHandles.toVector().constData(), aliases);
+
+    ContactManagerPtr manager = mConn->contactManager();
+    QVERIFY(!manager->isContactRequestCoalescingEnabled());
+    manager->setContactRequestCoalescingEnabled(true);
+    QVERIFY(manager->isContactRequestCoalescingEnabled());
+
+    int calls = 0;
+    TpDBusDaemon *dbusDaemon = tp_dbus_daemon_dup(NULL);
+    DBusConnection *serviceBus =
+        dbus_g_connection_get_connection(tp_proxy_get_dbus_connection(dbusDaemon));
+    QVERIFY(dbus_connection_add_filter(serviceBus, countGetContactAttributes, &calls, NULL));
+
+    // Both requests are made in the same main loop iteration, so they should share one call but
+    // still finish with their own results
+    PendingContacts *first = manager->contactsForHandles(firstHandles);
+    PendingContacts *second = manager->contactsForHandles(secondHandles,
+            Features() << Contact::FeatureAlias);
+
+    QVERIFY(connect(first,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectCoalescedPendingContactsFinished(Tp::PendingOperation*))));
+    QVERIFY(connect(second,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectCoalescedPendingContactsFinished(Tp::PendingOperation*))));
+    while (mCoalescedContacts.size() < 2) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+
+    dbus_connection_remove_filter(serviceBus, countGetContactAttributes, &calls);
+    g_object_unref(dbusDaemon);
+    QCOMPARE(calls, 1);
+
+    QList<ContactPtr> firstContacts = mCoalescedContacts.value(first);
+    QCOMPARE(firstContacts.size(), 2);
+    QCOMPARE(firstContacts[0]->id(), QString(QLatin1String("alice")));
+    QCOMPARE(firstContacts[1]->id(), QString(QLatin1String("bob")));
+    QCOMPARE(first->invalidHandles(), Tp::UIntList() << firstHandles[2]);
+
+    QList<ContactPtr> secondContacts = mCoalescedContacts.value(second);
+    QCOMPARE(secondContacts.size(), 2);
+    QCOMPARE(secondContacts[0], firstContacts[1]);
+    QCOMPARE(secondContacts[1]->id(), QString(QLatin1String("chris")));
+    QVERIFY(second->invalidHandles().isEmpty());
+    for (int i = 0; i < 2; i++) {
+        QVERIFY(secondContacts[i]->actualFeatures().contains(Contact::FeatureAlias));
+        QCOMPARE(secondContacts[i]->alias(), QString(QLatin1String(aliases[i])));
+    }
+
+    manager->setContactRequestCoalescingEnabled(false);
+
+    // Make the contacts go out of scope, starting releasing their handles, and finish that
+    firstContacts.clear();
+    secondContacts.clear();
+    mCoalescedContacts.clear();
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+}
+
+void TestContacts::testForHandlesChunked()
+{
+    TpHandleRepoIface *serviceRepo =
+        tp_base_connection_get_handles(TP_BASE_CONNECTION(mConnService), TP_HANDLE_TYPE_CONTACT);
+
+    Tp::UIntList handles;
+    handles << tp_handle_ensure(serviceRepo, "alice", NULL, NULL);
+    handles << 31337;
+    handles << tp_handle_ensure(serviceRepo, "bob", NULL, NULL);
+    handles << tp_handle_ensure(serviceRepo, "chris", NULL, NULL);
+    handles << tp_handle_ensure(serviceRepo, "dora", NULL, NULL);
+    QVERIFY(!tp_handle_is_valid(serviceRepo, handles[1], NULL));
+
+    ConnectionLowlevelPtr connLowlevel = mConn->lowlevel();
+    QCOMPARE(connLowlevel->contactAttributesChunkSize(), 0U);
+    connLowlevel->setContactAttributesChunkSize(2);
+    connLowlevel->setMaxContactAttributesChunksInFlight(1);
+    QCOMPARE(connLowlevel->contactAttributesChunkSize(), 2U);
+    QCOMPARE(connLowlevel->maxContactAttributesChunksInFlight(), 1U);
+
+    mRetrievedContacts.clear();
+    mRetrievedHandles.clear();
+    mTotalHandles = 0;
+
+    PendingContacts *pending = mConn->contactManager()->contactsForHandles(handles);
+    QVERIFY(connect(pending,
+                SIGNAL(contactsRetrieved(QList<Tp::ContactPtr>,int,int)),
+                SLOT(onContactsRetrieved(QList<Tp::ContactPtr>,int,int))));
+    QVERIFY(connect(pending,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectPendingContactsFinished(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+
+    // 5 handles in chunks of 2 means 3 calls, each reported as it arrives
+    QCOMPARE(mRetrievedHandles, QList<int>() << 2 << 4 << 5);
+    QCOMPARE(mTotalHandles, 5);
+    QCOMPARE(mRetrievedContacts.size(), 4);
+
+    // The final result is the same as without chunking
+    QCOMPARE(mContacts.size(), 4);
+    QCOMPARE(mInvalidHandles, Tp::UIntList() << handles[1]);
+    QCOMPARE(mContacts[0]->id(), QString(QLatin1String("alice")));
+    QCOMPARE(mContacts[1]->id(), QString(QLatin1String("bob")));
+    QCOMPARE(mContacts[2]->id(), QString(QLatin1String("chris")));
+    QCOMPARE(mContacts[3]->id(), QString(QLatin1String("dora")));
+    foreach (const ContactPtr &contact, mRetrievedContacts) {
+        QVERIFY(mContacts.contains(contact));
+    }
+
+    connLowlevel->setContactAttributesChunkSize(0);
+    connLowlevel->setMaxContactAttributesChunksInFlight(4);
+
+    // Make the contacts go out of scope, starting releasing their handles, and finish that
+    mRetrievedContacts.clear();
+    mContacts.clear();
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+}
+
+void TestContacts::testForHandlesCoalescedChunked()
+{
+    TpHandleRepoIface *serviceRepo =
+        tp_base_connection_get_handles(TP_BASE_CONNECTION(mConnService), TP_HANDLE_TYPE_CONTACT);
+
+    Tp::UIntList firstHandles;
+    firstHandles << tp_handle_ensure(serviceRepo, "ewan", NULL, NULL);
+    firstHandles << tp_handle_ensure(serviceRepo, "fiona", NULL, NULL);
+    firstHandles << tp_handle_ensure(serviceRepo, "gwen", NULL, NULL);
+
+    Tp::UIntList secondHandles;
+    secondHandles << firstHandles[2];
+    secondHandles << tp_handle_ensure(serviceRepo, "hugo", NULL, NULL);
+
+    ContactManagerPtr manager = mConn->contactManager();
+    manager->setContactRequestCoalescingEnabled(true);
+    ConnectionLowlevelPtr connLowlevel = mConn->lowlevel();
+    connLowlevel->setContactAttributesChunkSize(2);
+    connLowlevel->setMaxContactAttributesChunksInFlight(1);
+
+    mRetrievedContacts.clear();
+    mRetrievedHandles.clear();
+    mTotalHandles = 0;
+
+    PendingContacts *first = manager->contactsForHandles(firstHandles);
+    PendingContacts *second = manager->contactsForHandles(secondHandles);
+    QVERIFY(connect(first,
+                SIGNAL(contactsRetrieved(QList<Tp::ContactPtr>,int,int)),
+                SLOT(onContactsRetrieved(QList<Tp::ContactPtr>,int,int))));
+    QVERIFY(connect(first,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectCoalescedPendingContactsFinished(Tp::PendingOperation*))));
+    QVERIFY(connect(second,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectCoalescedPendingContactsFinished(Tp::PendingOperation*))));
+    while (mCoalescedContacts.size() < 2) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+
+    // The 4 handles of the coalesced request come in chunks of 2, the first one holding 2 of the
+    // handles of the first request and the second one the last of them
+    QCOMPARE(mRetrievedHandles, QList<int>() << 2 << 3);
+    QCOMPARE(mTotalHandles, 3);
+    QCOMPARE(mRetrievedContacts.size(), 3);
+
+    QList<ContactPtr> firstContacts = mCoalescedContacts.value(first);
+    QCOMPARE(firstContacts.size(), 3);
+    foreach (const ContactPtr &contact, mRetrievedContacts) {
+        QVERIFY(firstContacts.contains(contact));
+    }
+    QCOMPARE(mCoalescedContacts.value(second).size(), 2);
+
+    manager->setContactRequestCoalescingEnabled(false);
+    connLowlevel->setContactAttributesChunkSize(0);
+    connLowlevel->setMaxContactAttributesChunksInFlight(4);
+
+    // Make the contacts go out of scope, starting releasing their handles, and finish that
+    firstContacts.clear();
+    mRetrievedContacts.clear();
+    mCoalescedContacts.clear();
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+}
+
+void TestContacts::testForHandlesChunkFailure()
+{
+    TpHandleRepoIface *serviceRepo =
+        tp_base_connection_get_handles(TP_BASE_CONNECTION(mConnService), TP_HANDLE_TYPE_CONTACT);
+
+    Tp::UIntList handles;
+    handles << tp_handle_ensure(serviceRepo, "eve", NULL, NULL);
+    handles << tp_handle_ensure(serviceRepo, "frank", NULL, NULL);
+    handles << tp_handle_ensure(serviceRepo, "gina", NULL, NULL);
+    handles << tp_handle_ensure(serviceRepo, "harry", NULL, NULL);
+    handles << tp_handle_ensure(serviceRepo, "ida", NULL, NULL);
+
+    // All of the 3 chunks are sent at once, so that the other two are in flight when the second
+    // one fails
+    ConnectionLowlevelPtr connLowlevel = mConn->lowlevel();
+    connLowlevel->setContactAttributesChunkSize(2);
+    connLowlevel->setMaxContactAttributesChunksInFlight(3);
+
+    int calls = 0;
+    TpDBusDaemon *dbusDaemon = tp_dbus_daemon_dup(NULL);
+    DBusConnection *serviceBus =
+        dbus_g_connection_get_connection(tp_proxy_get_dbus_connection(dbusDaemon));
+    QVERIFY(dbus_connection_add_filter(serviceBus, failSecondGetContactAttributes, &calls, NULL));
+
+    quint64 released = connLowlevel->releasedHandlesCount();
+
+    PendingContactAttributes *pending = connLowlevel->contactAttributes(handles,
+            QStringList(), true);
+    QVERIFY(connect(pending,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectFailure(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mLastError, QString(QLatin1String(TP_ERROR_STR_NOT_AVAILABLE)));
+    QCOMPARE(calls, 3);
+
+    dbus_connection_remove_filter(serviceBus, failSecondGetContactAttributes, &calls);
+    g_object_unref(dbusDaemon);
+
+    // The handles referenced by the chunks which succeeded are released, which also means the
+    // request is no longer counted in flight
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+    QCOMPARE(connLowlevel->releasedHandlesCount(), released + 3);
+
+    connLowlevel->setContactAttributesChunkSize(0);
+    connLowlevel->setMaxContactAttributesChunksInFlight(4);
+}
+
 void TestContacts::testForIdentifiers()
 {
     QStringList validIDs = QStringList() << QLatin1String("Alice")
@@ -608,6 +948,111 @@ void TestContacts::testFeaturesNotRequested()
     processDBusQueue(mConn.data());
 }
 
+void TestContacts::testBulkChangeSignals()
+{
+    QStringList ids = QStringList() << QLatin1String("alice")
+        << QLatin1String("bob") << QLatin1String("chris");
+    const char *aliases[] = {
+        "Alice",
+        "Bob",
+    };
+    static TpTestsContactsConnectionPresenceStatusIndex statuses[] = {
+        TP_TESTS_CONTACTS_CONNECTION_STATUS_BUSY,
+        TP_TESTS_CONTACTS_CONNECTION_STATUS_BUSY,
+        TP_TESTS_CONTACTS_CONNECTION_STATUS_BUSY
+    };
+    static TpTestsContactsConnectionPresenceStatusIndex latterStatuses[] = {
+        TP_TESTS_CONTACTS_CONNECTION_STATUS_AWAY,
+        TP_TESTS_CONTACTS_CONNECTION_STATUS_AWAY
+    };
+    const char *messages[] = {
+        "",
+        "",
+        ""
+    };
+    Features features = Features()
+        << Contact::FeatureAlias
+        << Contact::FeatureSimplePresence;
+    TpHandleRepoIface *serviceRepo =
+        tp_base_connection_get_handles(TP_BASE_CONNECTION(mConnService), TP_HANDLE_TYPE_CONTACT);
+
+    Tp::UIntList handles;
+    for (int i = 0; i < 3; i++) {
+        handles.push_back(tp_handle_ensure(serviceRepo, ids[i].toLatin1().constData(), NULL, NULL));
+        QVERIFY(handles[i] != 0);
+    }
+
+    tp_tests_contacts_connection_change_presences(mConnService, 3, handles.toVector().constData(),
+            statuses, messages);
+
+    ContactManagerPtr contactManager = mConn->contactManager();
+    PendingContacts *pending = contactManager->contactsForHandles(handles, features);
+    QVERIFY(connect(pending,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectPendingContactsFinished(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mContacts.size(), 3);
+
+    QVERIFY(contactManager->contactChangeSignalsEnabled());
+    contactManager->setContactChangeSignalsEnabled(false);
+    QVERIFY(!contactManager->contactChangeSignalsEnabled());
+
+    QVERIFY(connect(contactManager.data(),
+                SIGNAL(presencesChanged(Tp::Contacts)),
+                SLOT(onPresencesChanged(Tp::Contacts))));
+    QVERIFY(connect(contactManager.data(),
+                SIGNAL(aliasesChanged(Tp::Contacts)),
+                SLOT(onAliasesChanged(Tp::Contacts))));
+    foreach (const ContactPtr &contact, mContacts) {
+        QVERIFY(connect(contact.data(),
+                    SIGNAL(presenceChanged(Tp::Presence)),
+                    SLOT(onContactPresenceChanged())));
+    }
+
+    // Changing two presences in one go gives a single bulk signal and no per-contact ones
+    tp_tests_contacts_connection_change_presences(mConnService, 2, handles.toVector().constData(),
+            latterStatuses, messages);
+    tp_tests_contacts_connection_change_aliases(mConnService, 2, handles.toVector().constData(),
+            aliases);
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+
+    QCOMPARE(mPresencesChanged.size(), 1);
+    QCOMPARE(mPresencesChanged[0], Contacts() << mContacts[0] << mContacts[1]);
+    QCOMPARE(mAliasesChanged.size(), 1);
+    QCOMPARE(mAliasesChanged[0], Contacts() << mContacts[0] << mContacts[1]);
+    QCOMPARE(mContactPresenceChanges, 0);
+    QCOMPARE(mContacts[0]->presence().status(), QString(QLatin1String("away")));
+    QCOMPARE(mContacts[1]->alias(), QString(QLatin1String("Bob")));
+
+    // Unchanged presences are not signalled
+    tp_tests_contacts_connection_change_presences(mConnService, 2, handles.toVector().constData(),
+            latterStatuses, messages);
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+    QCOMPARE(mPresencesChanged.size(), 1);
+
+    // With the per-contact signals back on, both kinds are emitted
+    contactManager->setContactChangeSignalsEnabled(true);
+    tp_tests_contacts_connection_change_presences(mConnService, 3, handles.toVector().constData(),
+            statuses, messages);
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+
+    QCOMPARE(mPresencesChanged.size(), 2);
+    QCOMPARE(mPresencesChanged[1], Contacts() << mContacts[0] << mContacts[1]);
+    QCOMPARE(mContactPresenceChanges, 2);
+
+    QVERIFY(disconnect(contactManager.data(), 0, this, 0));
+    mPresencesChanged.clear();
+    mAliasesChanged.clear();
+    mContactPresenceChanges = 0;
+
+    mContacts.clear();
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+}
+
 void TestContacts::testUpgrade()
 {
     QStringList ids = QStringList() << QLatin1String("alice")
@@ -775,6 +1220,66 @@ void TestContacts::testSelfContactFallback()
     g_object_unref(connService);
 }
 
+void TestContacts::benchmarkContactsForHandles_data()
+{
+    QTest::addColumn<int>("featureSet");
+
+    QTest::newRow("bare") << 0;
+    QTest::newRow("alias and presence") << 1;
+    QTest::newRow("roster") << 2;
+    QTest::newRow("everything") << 3;
+}
+
+void TestContacts::benchmarkContactsForHandles()
+{
+    QFETCH(int, featureSet);
+
+    Features features;
+    if (featureSet >= 1) {
+        features << Contact::FeatureAlias << Contact::FeatureSimplePresence;
+    }
+    if (featureSet >= 2) {
+        features << Contact::FeatureAvatarToken << Contact::FeatureCapabilities;
+    }
+    if (featureSet >= 3) {
+        features << Contact::FeatureLocation << Contact::FeatureInfo
+            << Contact::FeatureAddresses << Contact::FeatureClientTypes;
+    }
+
+    static const int numContacts = 1000;
+    TpHandleRepoIface *serviceRepo =
+        tp_base_connection_get_handles(TP_BASE_CONNECTION(mConnService), TP_HANDLE_TYPE_CONTACT);
+    Tp::UIntList handles;
+    for (int i = 0; i < numContacts; ++i) {
+        QByteArray id = QString(QLatin1String("footprint%1@example.com")).arg(i).toLatin1();
+        handles << tp_handle_ensure(serviceRepo, id.constData(), NULL, NULL);
+    }
+
+    // Warm the service up, so the first round isn't the only one paying for its setup
+    PendingContacts *pending = mConn->contactManager()->contactsForHandles(handles, features);
+    QVERIFY(connect(pending,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectPendingContactsFinished(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    mContacts.clear();
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+
+    // The contacts are dropped after each round, so every round builds them from scratch
+    QBENCHMARK {
+        pending = mConn->contactManager()->contactsForHandles(handles, features);
+        QVERIFY(connect(pending,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectPendingContactsFinished(Tp::PendingOperation*))));
+        QCOMPARE(mLoop->exec(), 0);
+        QCOMPARE(mContacts.size(), numContacts);
+
+        mContacts.clear();
+        mLoop->processEvents();
+        processDBusQueue(mConn.data());
+    }
+}
+
 void TestContacts::cleanup()
 {
     cleanupImpl();
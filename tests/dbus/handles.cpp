@@ -2,13 +2,17 @@
 
 #include <tests/lib/glib-helpers/test-conn-helper.h>
 
+#include <tests/lib/glib/contacts-conn.h>
 #include <tests/lib/glib/simple-conn.h>
 
 #define TP_QT_ENABLE_LOWLEVEL_API
 
+#include <TelepathyQt/ChannelFactory>
 #include <TelepathyQt/Connection>
 #include <TelepathyQt/ConnectionLowlevel>
+#include <TelepathyQt/ContactFactory>
 #include <TelepathyQt/PendingHandles>
+#include <TelepathyQt/PendingReady>
 #include <TelepathyQt/ReferencedHandles>
 
 #include <telepathy-glib/debug.h>
@@ -21,7 +25,7 @@ class TestHandles : public Test
 
 public:
     TestHandles(QObject *parent = 0)
-        : Test(parent), mConn(0)
+        : Test(parent), mConn(0), mMortalConn(0)
     { }
 
 protected Q_SLOTS:
@@ -32,12 +36,17 @@ private Q_SLOTS:
     void init();
 
     void testRequestAndRelease();
+    void testReleaseGracePeriod();
+    void testReleaseSweepOutlivesProxy();
+    void benchmarkReferencedHandlesChurn();
 
     void cleanup();
     void cleanupTestCase();
 
 private:
     TestConnHelper *mConn;
+    // The simple connection has immortal handles, which are never referenced or released
+    TestConnHelper *mMortalConn;
     ReferencedHandles mHandles;
 };
 
@@ -65,6 +74,14 @@ void TestHandles::initTestCase()
             "protocol", "simple",
             NULL);
     QCOMPARE(mConn->connect(), true);
+
+    mMortalConn = new TestConnHelper(this,
+            TP_TESTS_TYPE_LEGACY_CONTACTS_CONNECTION,
+            "account", "mortal@example.com",
+            "protocol", "legacy",
+            NULL);
+    QCOMPARE(mMortalConn->connect(), true);
+    QVERIFY(!mMortalConn->client()->lowlevel()->hasImmortalHandles());
 }
 
 void TestHandles::init()
@@ -111,6 +128,136 @@ void TestHandles::testRequestAndRelease()
     processDBusQueue(mConn->client().data());
 }
 
+void TestHandles::testReleaseGracePeriod()
+{
+    ConnectionLowlevelPtr lowlevel = mMortalConn->client()->lowlevel();
+    QVERIFY(!lowlevel->hasImmortalHandles());
+
+    QCOMPARE(lowlevel->handleReleaseGracePeriod(), 0);
+    QCOMPARE(lowlevel->handleReleaseBatchSize(), 0U);
+    lowlevel->setHandleReleaseGracePeriod(60 * 1000);
+
+    QStringList ids = QStringList() << QLatin1String("dave")
+        << QLatin1String("eve") << QLatin1String("frank");
+
+    PendingHandles *pending = lowlevel->requestHandles(Tp::HandleTypeContact, ids);
+    QVERIFY(connect(pending,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectPendingHandlesFinished(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    ReferencedHandles handles = mHandles;
+    mHandles = ReferencedHandles();
+    Tp::UIntList saveHandles = handles.toList();
+
+    quint64 released = lowlevel->releasedHandlesCount();
+    quint64 resurrected = lowlevel->resurrectedHandlesCount();
+
+    // Dropping the handles and getting them back within the grace period doesn't release them
+    handles = ReferencedHandles();
+    mLoop->processEvents();
+    processDBusQueue(mMortalConn->client().data());
+    QCOMPARE(lowlevel->releasedHandlesCount(), released);
+
+    pending = lowlevel->referenceHandles(Tp::HandleTypeContact, saveHandles);
+    QVERIFY(connect(pending,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectPendingHandlesFinished(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    handles = mHandles;
+    mHandles = ReferencedHandles();
+    QCOMPARE(handles.toList(), saveHandles);
+    QCOMPARE(lowlevel->resurrectedHandlesCount(), resurrected + saveHandles.size());
+    QCOMPARE(lowlevel->releasedHandlesCount(), released);
+
+    // Reaching the batch size releases them right away
+    lowlevel->setHandleReleaseBatchSize(saveHandles.size());
+    handles = ReferencedHandles();
+    for (int i = 0; i < 100 && lowlevel->releasedHandlesCount() == released; ++i) {
+        QTest::qWait(10);
+    }
+    processDBusQueue(mMortalConn->client().data());
+    QCOMPARE(lowlevel->releasedHandlesCount(), released + saveHandles.size());
+    QCOMPARE(lowlevel->resurrectedHandlesCount(), resurrected + saveHandles.size());
+
+    lowlevel->setHandleReleaseGracePeriod(0);
+    lowlevel->setHandleReleaseBatchSize(0);
+}
+
+void TestHandles::testReleaseSweepOutlivesProxy()
+{
+    ConnectionLowlevelPtr lowlevel = mMortalConn->client()->lowlevel();
+    QVERIFY(!lowlevel->hasImmortalHandles());
+
+    // Another proxy for the same connection shares the handle tracking with ours
+    ConnectionPtr other = Connection::create(mMortalConn->client()->busName(),
+            mMortalConn->client()->objectPath(),
+            ChannelFactory::create(QDBusConnection::sessionBus()),
+            ContactFactory::create());
+    QVERIFY(connect(other->becomeReady(),
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectSuccessfulCall(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    other->lowlevel()->setHandleReleaseGracePeriod(100);
+
+    QStringList ids = QStringList() << QLatin1String("gina") << QLatin1String("harry");
+    PendingHandles *pending = other->lowlevel()->requestHandles(Tp::HandleTypeContact, ids);
+    QVERIFY(connect(pending,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectPendingHandlesFinished(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    quint64 released = lowlevel->releasedHandlesCount();
+
+    // The other proxy schedules the sweep, and goes away before the grace period ends
+    mHandles = ReferencedHandles();
+    other.reset();
+    mLoop->processEvents();
+    QCOMPARE(lowlevel->releasedHandlesCount(), released);
+
+    // Ours still does the sweep
+    for (int i = 0; i < 100 && lowlevel->releasedHandlesCount() == released; ++i) {
+        QTest::qWait(10);
+    }
+    QCOMPARE(lowlevel->releasedHandlesCount(), released + ids.size());
+    processDBusQueue(mMortalConn->client().data());
+}
+
+void TestHandles::benchmarkReferencedHandlesChurn()
+{
+    // Immortal handles would skip the refcounting entirely
+    ConnectionLowlevelPtr lowlevel = mMortalConn->client()->lowlevel();
+    QVERIFY(!lowlevel->hasImmortalHandles());
+
+    QStringList ids;
+    for (int i = 0; i < 100; ++i) {
+        ids << QString(QLatin1String("churn%1")).arg(i);
+    }
+
+    PendingHandles *pending = lowlevel->requestHandles(Tp::HandleTypeContact, ids);
+    QVERIFY(connect(pending,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectPendingHandlesFinished(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    ReferencedHandles handles = mHandles;
+    mHandles = ReferencedHandles();
+    QCOMPARE(handles.size(), ids.size());
+
+    // Each single handle container built and each detached copy references its handles, and
+    // drops the references again when destroyed, as contacts and channels do all the time
+    QBENCHMARK {
+        for (int i = 0; i < handles.size(); ++i) {
+            ReferencedHandles single = handles.mid(i, 1);
+            ReferencedHandles copy = handles;
+            copy.swap(0, i);
+        }
+    }
+
+    QCOMPARE(handles.size(), ids.size());
+
+    handles = ReferencedHandles();
+    mLoop->processEvents();
+    processDBusQueue(mMortalConn->client().data());
+}
+
 void TestHandles::cleanup()
 {
     cleanupImpl();
@@ -121,6 +268,9 @@ void TestHandles::cleanupTestCase()
     QCOMPARE(mConn->disconnect(), true);
     delete mConn;
 
+    QCOMPARE(mMortalConn->disconnect(), true);
+    delete mMortalConn;
+
     cleanupTestCaseImpl();
 }
 
@@ -57,6 +57,8 @@ private Q_SLOTS:
 
     void testMessages();
     void testLegacyText();
+    void testDelayedAcknowledge();
+    void testSpilledMessages();
 
     void cleanup();
     void cleanupTestCase();
@@ -64,6 +66,7 @@ private Q_SLOTS:
 private:
     void commonTest(bool withMessages);
     void sendText(const char *text);
+    int servicePendingMessages();
 
     TestConnHelper *mConn;
     TpHandleRepoIface *mContactRepo;
@@ -120,6 +123,17 @@ void TestTextChan::sendText(const char *text)
     qDebug() << "message send mainloop finished";
 }
 
+int TestTextChan::servicePendingMessages()
+{
+    QDBusPendingCallWatcher watcher(
+            mChan->interface<Client::ChannelTypeTextInterface>()->ListPendingMessages(false));
+    connect(&watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), mLoop, SLOT(quit()));
+    mLoop->exec();
+
+    QDBusPendingReply<PendingTextMessageList> reply = watcher;
+    return reply.isValid() ? reply.value().size() : -1;
+}
+
 void TestTextChan::initTestCase()
 {
     initTestCaseImpl();
@@ -534,6 +548,100 @@ void TestTextChan::testLegacyText()
     commonTest(false);
 }
 
+void TestTextChan::testDelayedAcknowledge()
+{
+    mChan = TextChannel::create(mConn->client(), mMessagesChanPath, QVariantMap());
+    QVERIFY(connect(mChan->becomeReady(TextChannel::FeatureMessageQueue),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(connect(mChan.data(),
+                SIGNAL(messageReceived(const Tp::ReceivedMessage &)),
+                SLOT(onMessageReceived(const Tp::ReceivedMessage &))));
+
+    QCOMPARE(mChan->acknowledgeDelay(), 0);
+    QCOMPARE(mChan->acknowledgeBatchSize(), static_cast<int>(TextChannel::DefaultAcknowledgeBatchSize));
+
+    // Long enough never to elapse during the test
+    mChan->setAcknowledgeDelay(60 * 60 * 1000);
+    mChan->setAcknowledgeBatchSize(3);
+
+    sendText("One");
+    sendText("Two");
+    sendText("Three");
+    sendText("Four");
+    processDBusQueue(mChan.data());
+    while (received.size() != 4) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+
+    QCOMPARE(servicePendingMessages(), 4);
+
+    // Taken off the queue right away, but not acknowledged yet
+    mChan->acknowledge(QList<ReceivedMessage>() << received.at(0));
+    mChan->acknowledge(QList<ReceivedMessage>() << received.at(1));
+    QCOMPARE(mChan->messageQueue().size(), 2);
+    QCOMPARE(servicePendingMessages(), 4);
+
+    // The batch is full, and acknowledged in one go
+    mChan->acknowledge(QList<ReceivedMessage>() << received.at(2));
+    QCOMPARE(mChan->messageQueue().size(), 1);
+    QCOMPARE(servicePendingMessages(), 1);
+
+    mChan->acknowledge(QList<ReceivedMessage>() << received.at(3));
+    QCOMPARE(mChan->messageQueue().size(), 0);
+    QCOMPARE(servicePendingMessages(), 1);
+
+    mChan->flushAcknowledgements();
+    QCOMPARE(servicePendingMessages(), 0);
+}
+
+void TestTextChan::testSpilledMessages()
+{
+    mChan = TextChannel::create(mConn->client(), mMessagesChanPath, QVariantMap());
+    QVERIFY(connect(mChan->becomeReady(TextChannel::FeatureMessageQueue),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(connect(mChan.data(),
+                SIGNAL(messageReceived(const Tp::ReceivedMessage &)),
+                SLOT(onMessageReceived(const Tp::ReceivedMessage &))));
+
+    QCOMPARE(mChan->messageQueueLimit(), 0);
+    QCOMPARE(mChan->messageQueueMemoryLimit(), Q_INT64_C(0));
+    mChan->setMessageQueueLimit(1);
+
+    sendText("One");
+    sendText("Two");
+    sendText("Three");
+    processDBusQueue(mChan.data());
+    while (received.size() != 3) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+
+    QCOMPARE(mChan->spilledMessagesCount(), 2);
+    QVERIFY(mChan->spilledMessagesSize() > 0);
+    QVERIFY(mChan->messageQueueMemoryUsage() > 0);
+
+    // Restored transparently
+    QList<ReceivedMessage> queue = mChan->messageQueue();
+    QCOMPARE(queue.size(), 3);
+    for (int i = 0; i < queue.size(); ++i) {
+        QCOMPARE(queue.at(i).text(), received.at(i).text());
+        QVERIFY(queue.at(i).sender() == received.at(i).sender());
+        QCOMPARE(queue.at(i).received(), received.at(i).received());
+        QVERIFY(queue.at(i).isFromChannel(mChan));
+    }
+
+    // Both the messages as received and their restored copies can be acknowledged
+    mChan->acknowledge(QList<ReceivedMessage>() << received.at(0) << queue.at(1));
+    QCOMPARE(mChan->spilledMessagesCount(), 0);
+    QCOMPARE(mChan->spilledMessagesSize(), Q_INT64_C(0));
+    QCOMPARE(mChan->messageQueue().size(), 1);
+    QVERIFY(mChan->messageQueue().at(0) == received.at(2));
+    QCOMPARE(servicePendingMessages(), 1);
+}
+
 void TestTextChan::cleanup()
 {
     received.clear();
@@ -5,6 +5,8 @@
 #include <TelepathyQt/Feature>
 #include <TelepathyQt/Types>
 
+#include "TelepathyQt/feature-set-internal.h"
+
 using namespace Tp;
 
 namespace {
@@ -29,6 +31,11 @@ public:
 
 private Q_SLOTS:
     void testFeaturesHash();
+    void testFeatureIndexes();
+    void testFeatureSet();
+
+    void benchmarkFeaturesContains();
+    void benchmarkFeatureSetContains();
 };
 
 TestFeatures::TestFeatures(QObject *parent)
@@ -68,6 +75,102 @@ void TestFeatures::testFeaturesHash()
     QVERIFY(qHash(fs1.toSet()) != qHash(fs2.toSet()));
 }
 
+void TestFeatures::testFeatureIndexes()
+{
+    Feature f1(QLatin1String("TestFeatureIndexes"), 0);
+    Feature f2(QLatin1String("TestFeatureIndexes"), 1, true);
+    Feature f3(QLatin1String("TestFeatureIndexesToo"), 0);
+
+    QVERIFY(featureIndex(f1) != featureIndex(f2));
+    QVERIFY(featureIndex(f1) != featureIndex(f3));
+    QVERIFY(featureIndex(f2) != featureIndex(f3));
+
+    // Equal features share their index, whatever their criticality or how they were built
+    QCOMPARE(featureIndex(Feature(QLatin1String("TestFeatureIndexes"), 0, true)), featureIndex(f1));
+    Feature copy;
+    copy = f2;
+    QCOMPARE(copy, f2);
+    QCOMPARE(featureIndex(copy), featureIndex(f2));
+    QVERIFY(copy.isCritical());
+
+    // The indexes are dense
+    uint first = featureIndex(Feature(QLatin1String("TestFeatureIndexesDense"), 0));
+    for (uint i = 1; i < 10; ++i) {
+        QCOMPARE(featureIndex(Feature(QLatin1String("TestFeatureIndexesDense"), i)), first + i);
+    }
+
+    QCOMPARE(featureIndex(Feature()), featureIndex(Feature()));
+}
+
+void TestFeatures::testFeatureSet()
+{
+    QList<Feature> fs;
+    for (int i = 0; i < 300; ++i) {
+        fs << Feature(QLatin1String("TestFeatureSet"), i);
+    }
+
+    FeatureSet empty;
+    QVERIFY(empty.isEmpty());
+    QCOMPARE(empty.size(), 0);
+    QVERIFY(!empty.contains(fs[0]));
+    QVERIFY(empty.contains(FeatureSet()));
+
+    FeatureSet some;
+    some << fs[0] << fs[1] << fs[299];
+    QCOMPARE(some.size(), 3);
+    QVERIFY(some.contains(fs[0]));
+    QVERIFY(some.contains(fs[299]));
+    QVERIFY(!some.contains(fs[2]));
+    QVERIFY(some.contains(empty));
+    QVERIFY(!empty.contains(some));
+
+    FeatureSet all(fs.toSet());
+    QCOMPARE(all.size(), 300);
+    QVERIFY(all.contains(some));
+    QVERIFY(!some.contains(all));
+    QCOMPARE(FeatureSet(some) & all, some);
+    QCOMPARE(FeatureSet(all) | some, all);
+    QCOMPARE((all - some).size(), 297);
+    QVERIFY((some - all).isEmpty());
+
+    QVERIFY(some.remove(fs[299]));
+    QVERIFY(!some.remove(fs[299]));
+    QCOMPARE(some, FeatureSet(Features() << fs[0] << fs[1]));
+    QVERIFY(some != all);
+}
+
+void TestFeatures::benchmarkFeaturesContains()
+{
+    Features requested;
+    for (int i = 0; i < 10; ++i) {
+        requested << Feature(QLatin1String("Tp::Contact"), i);
+    }
+    Features wanted = Features() << Feature(QLatin1String("Tp::Contact"), 1) <<
+        Feature(QLatin1String("Tp::Contact"), 4);
+
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i) {
+            QVERIFY((wanted - requested).isEmpty());
+        }
+    }
+}
+
+void TestFeatures::benchmarkFeatureSetContains()
+{
+    FeatureSet requested;
+    for (int i = 0; i < 10; ++i) {
+        requested << Feature(QLatin1String("Tp::Contact"), i);
+    }
+    FeatureSet wanted = FeatureSet(Feature(QLatin1String("Tp::Contact"), 1)) <<
+        Feature(QLatin1String("Tp::Contact"), 4);
+
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i) {
+            QVERIFY(requested.contains(wanted));
+        }
+    }
+}
+
 QTEST_MAIN(TestFeatures)
 
 #include "_gen/features.cpp.moc.hpp"
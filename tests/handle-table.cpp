@@ -0,0 +1,253 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/SharedPtr>
+
+#include "TelepathyQt/handle-table-internal.h"
+
+using namespace Tp;
+
+namespace {
+
+class Item;
+typedef SharedPtr<Item> ItemPtr;
+
+class Item : public RefCounted
+{
+    Q_DISABLE_COPY(Item)
+
+public:
+    static ItemPtr create(uint handle) { return ItemPtr(new Item(handle)); }
+
+    uint handle() const { return mHandle; }
+
+private:
+    Item(uint handle) : mHandle(handle) { }
+
+    uint mHandle;
+};
+
+// Mirrors what ContactManager used to do: only drop a dangling entry when looking it up again
+ItemPtr legacyLookup(QHash<uint, WeakPtr<Item> > &items, uint handle)
+{
+    ItemPtr ret;
+    if (items.contains(handle)) {
+        ret = ItemPtr(items.value(handle));
+        if (!ret) {
+            items.remove(handle);
+        }
+    }
+    return ret;
+}
+
+}
+
+class TestHandleTable : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestHandleTable(QObject *parent = 0);
+
+private Q_SLOTS:
+    void testInsertLookup();
+    void testDeadEntries();
+    void testSweep();
+    void testChurn();
+    void testCollisions();
+
+    void benchmarkChurnLegacy();
+    void benchmarkChurn();
+};
+
+TestHandleTable::TestHandleTable(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void TestHandleTable::testInsertLookup()
+{
+    HandleTable<Item> table;
+    QCOMPARE(table.count(), 0);
+    QVERIFY(!table.value(1));
+
+    QList<ItemPtr> items;
+    for (uint handle = 1; handle <= 1000; ++handle) {
+        items << Item::create(handle);
+        table.insert(handle, items.last());
+    }
+
+    QCOMPARE(table.count(), 1000);
+    QCOMPARE(table.liveCount(), 1000);
+    QCOMPARE(table.deadCount(), 0);
+    QCOMPARE(table.totalInserted(), Q_UINT64_C(1000));
+    QVERIFY(table.count() * 4 <= table.capacity() * 3);
+
+    foreach (const ItemPtr &item, items) {
+        QCOMPARE(table.value(item->handle()).data(), item.data());
+    }
+    QVERIFY(!table.value(1001));
+
+    // Inserting again for the same handle replaces the entry
+    ItemPtr replacement = Item::create(1);
+    table.insert(1, replacement);
+    QCOMPARE(table.count(), 1000);
+    QCOMPARE(table.value(1).data(), replacement.data());
+}
+
+void TestHandleTable::testDeadEntries()
+{
+    HandleTable<Item> table;
+
+    QList<ItemPtr> items;
+    for (uint handle = 1; handle <= 100; ++handle) {
+        items << Item::create(handle);
+        table.insert(handle, items.last());
+    }
+
+    // Drop every other item
+    QList<ItemPtr> alive;
+    for (int i = 0; i < items.size(); i += 2) {
+        alive << items[i];
+    }
+    items.clear();
+
+    QCOMPARE(table.count(), 100);
+    QCOMPARE(table.liveCount(), 50);
+    QCOMPARE(table.deadCount(), 50);
+
+    // Looking a dead entry up removes it
+    QVERIFY(!table.value(2));
+    QCOMPARE(table.count(), 99);
+    QCOMPARE(table.deadCount(), 49);
+
+    foreach (const ItemPtr &item, alive) {
+        QCOMPARE(table.value(item->handle()).data(), item.data());
+    }
+}
+
+void TestHandleTable::testSweep()
+{
+    HandleTable<Item> table;
+
+    QList<ItemPtr> items;
+    for (uint handle = 1; handle <= 100; ++handle) {
+        items << Item::create(handle);
+        table.insert(handle, items.last());
+    }
+    ItemPtr survivor = items[42];
+    items.clear();
+
+    QCOMPARE(table.deadCount(), 99);
+    QCOMPARE(table.sweep(table.capacity()), 99);
+    QCOMPARE(table.count(), 1);
+    QCOMPARE(table.deadCount(), 0);
+    QCOMPARE(table.value(survivor->handle()).data(), survivor.data());
+
+    survivor.reset();
+    QCOMPARE(table.sweep(table.capacity()), 1);
+    QCOMPARE(table.count(), 0);
+    QCOMPARE(table.sweep(table.capacity()), 0);
+}
+
+void TestHandleTable::testChurn()
+{
+    HandleTable<Item> table;
+
+    // Lots of short-lived items, as contacts joining and leaving a busy chat room; only the last
+    // few are alive at any time
+    QQueue<ItemPtr> alive;
+    for (uint handle = 1; handle <= 100000; ++handle) {
+        alive.enqueue(Item::create(handle));
+        table.insert(handle, alive.last());
+        if (alive.size() > 50) {
+            alive.dequeue();
+        }
+
+        QVERIFY(table.count() < 1000);
+    }
+
+    QCOMPARE(table.totalInserted(), Q_UINT64_C(100000));
+    QCOMPARE(table.liveCount(), 50);
+    QVERIFY(table.capacity() <= 1024);
+
+    foreach (const ItemPtr &item, alive) {
+        QCOMPARE(table.value(item->handle()).data(), item.data());
+    }
+}
+
+void TestHandleTable::testCollisions()
+{
+    HandleTable<Item> table;
+    QHash<uint, ItemPtr> expected;
+
+    qsrand(42);
+
+    // Handles sharing their low bits, and random deaths in the middle of probe sequences
+    for (int round = 0; round < 20; ++round) {
+        for (uint i = 1; i <= 200; ++i) {
+            uint handle = (i << 12) + round;
+            expected.insert(handle, Item::create(handle));
+            table.insert(handle, expected.value(handle));
+        }
+
+        foreach (uint handle, expected.keys()) {
+            if (qrand() % 3 == 0) {
+                expected.remove(handle);
+                if (qrand() % 2 == 0) {
+                    QVERIFY(!table.value(handle));
+                }
+            }
+        }
+
+        table.sweep(qrand() % 64);
+
+        foreach (const ItemPtr &item, expected) {
+            QCOMPARE(table.value(item->handle()).data(), item.data());
+        }
+        QCOMPARE(table.liveCount(), expected.size());
+    }
+}
+
+void TestHandleTable::benchmarkChurnLegacy()
+{
+    QBENCHMARK {
+        QHash<uint, WeakPtr<Item> > items;
+        QQueue<ItemPtr> alive;
+        for (uint handle = 1; handle <= 20000; ++handle) {
+            ItemPtr item = legacyLookup(items, handle);
+            if (!item) {
+                item = Item::create(handle);
+                items.insert(handle, item);
+            }
+            alive.enqueue(item);
+            if (alive.size() > 200) {
+                alive.dequeue();
+            }
+            legacyLookup(items, alive.head()->handle());
+        }
+    }
+}
+
+void TestHandleTable::benchmarkChurn()
+{
+    QBENCHMARK {
+        HandleTable<Item> items;
+        QQueue<ItemPtr> alive;
+        for (uint handle = 1; handle <= 20000; ++handle) {
+            ItemPtr item = items.value(handle);
+            if (!item) {
+                item = Item::create(handle);
+                items.insert(handle, item);
+            }
+            alive.enqueue(item);
+            if (alive.size() > 200) {
+                alive.dequeue();
+            }
+            items.value(alive.head()->handle());
+        }
+    }
+}
+
+QTEST_MAIN(TestHandleTable)
+
+#include "_gen/handle-table.cpp.moc.hpp"
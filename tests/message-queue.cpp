@@ -0,0 +1,284 @@
+#include <QtTest/QtTest>
+
+#include "TelepathyQt/message-queue-internal.h"
+
+using namespace Tp;
+
+namespace {
+
+// Stands for ReceivedMessage, which compares by identity and has no public default constructor
+class FakeMessage
+{
+public:
+    FakeMessage(uint pendingId, int serial) : mPendingId(pendingId), mSerial(serial) { }
+
+    uint pendingId() const { return mPendingId; }
+    int serial() const { return mSerial; }
+
+    bool operator==(const FakeMessage &other) const { return mSerial == other.mSerial; }
+
+private:
+    uint mPendingId;
+    int mSerial;
+};
+
+// Spills the messages as their serial, except those the test wants to keep in memory
+class FakeCodec
+{
+public:
+    typedef QPair<uint, int> Spilled;
+
+    FakeCodec(int keepEvery = 0) : mKeepEvery(keepEvery) { }
+
+    uint pendingId(const FakeMessage &message) const
+    {
+        return message.pendingId();
+    }
+
+    bool spill(const FakeMessage &message, Spilled *spilled) const
+    {
+        if (mKeepEvery && message.serial() % mKeepEvery == 0) {
+            return false;
+        }
+        *spilled = qMakePair(message.pendingId(), message.serial());
+        return true;
+    }
+
+    FakeMessage restore(const Spilled &spilled) const
+    {
+        return FakeMessage(spilled.first, spilled.second);
+    }
+
+    bool matches(const Spilled &spilled, const FakeMessage &message) const
+    {
+        return spilled.second == message.serial();
+    }
+
+    qint64 size(const FakeMessage &) const { return 100; }
+    qint64 size(const Spilled &) const { return 10; }
+
+private:
+    int mKeepEvery;
+};
+
+typedef MessageQueue<FakeMessage, FakeCodec> FakeMessageQueue;
+
+QList<int> serials(const QList<FakeMessage> &messages)
+{
+    QList<int> ret;
+    foreach (const FakeMessage &message, messages) {
+        ret << message.serial();
+    }
+    return ret;
+}
+
+}
+
+class TestMessageQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestMessageQueue(QObject *parent = 0);
+
+private Q_SLOTS:
+    void testAppendRemove();
+    void testDuplicatePendingIds();
+    void testCompaction();
+    void testSpill();
+    void testSpillMemoryLimit();
+
+    void benchmarkRemoveLegacy();
+    void benchmarkRemove();
+};
+
+TestMessageQueue::TestMessageQueue(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void TestMessageQueue::testAppendRemove()
+{
+    FakeMessageQueue queue;
+    QVERIFY(queue.isEmpty());
+    QVERIFY(queue.toList().isEmpty());
+
+    for (int i = 0; i < 10; ++i) {
+        queue.append(FakeMessage(100 + i, i));
+    }
+    QCOMPARE(queue.size(), 10);
+    QCOMPARE(serials(queue.toList()), QList<int>() << 0 << 1 << 2 << 3 << 4 << 5 << 6 << 7 << 8 << 9);
+
+    QCOMPARE(serials(queue.takeAll(103)), QList<int>() << 3);
+    QVERIFY(queue.takeAll(103).isEmpty());
+    QVERIFY(queue.remove(FakeMessage(107, 7)));
+    QVERIFY(!queue.remove(FakeMessage(107, 7)));
+    // Same pending id, but another message
+    QVERIFY(!queue.remove(FakeMessage(108, 42)));
+
+    QCOMPARE(queue.size(), 8);
+    QCOMPARE(serials(queue.toList()), QList<int>() << 0 << 1 << 2 << 4 << 5 << 6 << 8 << 9);
+
+    queue.append(FakeMessage(110, 10));
+    QCOMPARE(serials(queue.toList()), QList<int>() << 0 << 1 << 2 << 4 << 5 << 6 << 8 << 9 << 10);
+}
+
+void TestMessageQueue::testDuplicatePendingIds()
+{
+    FakeMessageQueue queue;
+    queue.append(FakeMessage(1, 0));
+    queue.append(FakeMessage(2, 1));
+    queue.append(FakeMessage(1, 2));
+    queue.append(FakeMessage(3, 3));
+    queue.append(FakeMessage(1, 4));
+
+    QVERIFY(queue.remove(FakeMessage(1, 2)));
+    QCOMPARE(serials(queue.takeAll(1)), QList<int>() << 0 << 4);
+    QCOMPARE(serials(queue.toList()), QList<int>() << 1 << 3);
+}
+
+void TestMessageQueue::testCompaction()
+{
+    FakeMessageQueue queue;
+    QList<int> expected;
+
+    qsrand(42);
+
+    // Interleave arrivals and removals, so that the holes get compacted away many times over
+    int serial = 0;
+    for (int round = 0; round < 50; ++round) {
+        for (int i = 0; i < 100; ++i, ++serial) {
+            queue.append(FakeMessage(serial % 500, serial));
+            expected << serial;
+        }
+
+        foreach (int candidate, expected) {
+            // Already gone with another message having the same pending id
+            if (!expected.contains(candidate) || qrand() % 3 == 0) {
+                continue;
+            }
+
+            if (qrand() % 2) {
+                QVERIFY(queue.remove(FakeMessage(candidate % 500, candidate)));
+                expected.removeOne(candidate);
+            } else {
+                QList<int> removed = serials(queue.takeAll(candidate % 500));
+                QVERIFY(removed.contains(candidate));
+                foreach (int other, removed) {
+                    QVERIFY(expected.removeOne(other));
+                }
+            }
+        }
+
+        QCOMPARE(queue.size(), expected.size());
+        QCOMPARE(serials(queue.toList()), expected);
+    }
+}
+
+void TestMessageQueue::testSpill()
+{
+    // Every 10th message can't be spilled
+    FakeMessageQueue queue(FakeCodec(10));
+    queue.setLimits(5, 0);
+
+    QList<int> expected;
+    for (int i = 1; i <= 100; ++i) {
+        queue.append(FakeMessage(i, i));
+        expected << i;
+    }
+
+    QCOMPARE(queue.size(), 100);
+    // The messages which can't be spilled are kept over the limit
+    QCOMPARE(queue.spilledCount(), 90);
+    QCOMPARE(queue.memoryUsage(), Q_INT64_C(1000));
+    QCOMPARE(queue.spilledSize(), Q_INT64_C(900));
+    QCOMPARE(serials(queue.toList()), expected);
+
+    // Spilled messages are found back by their restored copies
+    QList<FakeMessage> list = queue.toList();
+    QVERIFY(queue.remove(list.at(0)));
+    QCOMPARE(serials(queue.takeAll(2)), QList<int>() << 2);
+    // Kept in memory
+    QVERIFY(queue.remove(FakeMessage(10, 10)));
+    expected.removeOne(1);
+    expected.removeOne(2);
+    expected.removeOne(10);
+    QCOMPARE(queue.spilledCount(), 88);
+    QCOMPARE(serials(queue.toList()), expected);
+
+    // Removing lots of them compacts the queue, the newest messages still being spilled first
+    for (int i = 3; i <= 80; ++i) {
+        if (i % 10) {
+            QCOMPARE(serials(queue.takeAll(i)), QList<int>() << i);
+            expected.removeOne(i);
+        }
+    }
+    for (int i = 101; i <= 110; ++i) {
+        queue.append(FakeMessage(i, i));
+        expected << i;
+    }
+    QCOMPARE(serials(queue.toList()), expected);
+    QCOMPARE(queue.size() - queue.spilledCount(), 10);
+    QCOMPARE(queue.memoryUsage(), Q_INT64_C(1000));
+
+    // Raising the limits doesn't restore anything
+    queue.setLimits(0, 0);
+    queue.append(FakeMessage(111, 111));
+    QCOMPARE(queue.size() - queue.spilledCount(), 11);
+}
+
+void TestMessageQueue::testSpillMemoryLimit()
+{
+    FakeMessageQueue queue;
+    for (int i = 0; i < 10; ++i) {
+        queue.append(FakeMessage(i, i));
+    }
+    QCOMPARE(queue.spilledCount(), 0);
+    QCOMPARE(queue.memoryUsage(), Q_INT64_C(1000));
+
+    queue.setLimits(0, 450);
+    QCOMPARE(queue.spilledCount(), 6);
+    QCOMPARE(queue.memoryUsage(), Q_INT64_C(400));
+    QCOMPARE(queue.spilledSize(), Q_INT64_C(60));
+    QCOMPARE(queue.toList().size(), 10);
+}
+
+void TestMessageQueue::benchmarkRemoveLegacy()
+{
+    QBENCHMARK {
+        QList<FakeMessage> messages;
+        for (int i = 0; i < 5000; ++i) {
+            messages << FakeMessage(i, i);
+        }
+
+        // What TextChannel used to do for each removal event
+        for (uint id = 0; id < 5000; id += 2) {
+            int i = 0;
+            while (i < messages.size()) {
+                if (messages.at(i).pendingId() == id) {
+                    messages.removeAt(i);
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+}
+
+void TestMessageQueue::benchmarkRemove()
+{
+    QBENCHMARK {
+        FakeMessageQueue messages;
+        for (int i = 0; i < 5000; ++i) {
+            messages.append(FakeMessage(i, i));
+        }
+
+        for (uint id = 0; id < 5000; id += 2) {
+            messages.takeAll(id);
+        }
+    }
+}
+
+QTEST_MAIN(TestMessageQueue)
+
+#include "_gen/message-queue.cpp.moc.hpp"
@@ -0,0 +1,203 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/Message>
+#include <TelepathyQt/Types>
+
+using namespace Tp;
+
+namespace {
+
+MessagePart part(const char *contentType, const QString &content,
+        const char *alternative = 0)
+{
+    MessagePart ret;
+    ret.insert(QLatin1String("content-type"), QDBusVariant(QLatin1String(contentType)));
+    ret.insert(QLatin1String("content"), QDBusVariant(content));
+    if (alternative) {
+        ret.insert(QLatin1String("alternative"), QDBusVariant(QLatin1String(alternative)));
+    }
+    return ret;
+}
+
+// A message as sent by an XMPP client, with HTML and plain text alternatives, and an
+// attachment having a textual description
+MessagePartList richParts(int serial)
+{
+    MessagePart header;
+    header.insert(QLatin1String("message-sent"), QDBusVariant(static_cast<qlonglong>(1234567890)));
+    header.insert(QLatin1String("message-received"),
+            QDBusVariant(static_cast<qlonglong>(1234567891)));
+    header.insert(QLatin1String("message-type"),
+            QDBusVariant(static_cast<uint>(ChannelTextMessageTypeNormal)));
+    header.insert(QLatin1String("message-token"),
+            QDBusVariant(QString(QLatin1String("token-%1")).arg(serial)));
+    header.insert(QLatin1String("message-sender"), QDBusVariant(42u));
+    header.insert(QLatin1String("message-sender-id"),
+            QDBusVariant(QLatin1String("someone@example.com")));
+    header.insert(QLatin1String("sender-nickname"), QDBusVariant(QLatin1String("Someone")));
+    header.insert(QLatin1String("pending-message-id"), QDBusVariant(static_cast<uint>(serial)));
+
+    return MessagePartList() << header
+        << part("text/html", QLatin1String("<b>Hello</b> world"), "main")
+        << part("text/plain", QLatin1String("Hello world"), "main")
+        << part("image/png", QLatin1String("not really a picture"), "picture")
+        << part("text/plain", QLatin1String(" [a picture]"), "picture");
+}
+
+// What Message::text() used to do on every call
+QString legacyText(const MessagePartList &parts)
+{
+    QSet<QString> altGroupsUsed;
+    QString text;
+
+    for (int i = 1; i < parts.size(); i++) {
+        QString altGroup = parts.at(i).value(QLatin1String("alternative")).variant().toString();
+        QString contentType = parts.at(i).value(QLatin1String("content-type")).variant().toString();
+
+        if (contentType == QLatin1String("text/plain")) {
+            if (!altGroup.isEmpty()) {
+                if (altGroupsUsed.contains(altGroup)) {
+                    continue;
+                } else {
+                    altGroupsUsed << altGroup;
+                }
+            }
+
+            QVariant content = parts.at(i).value(QLatin1String("content")).variant();
+            if (content.type() == QVariant::String) {
+                text += content.toString();
+            }
+        }
+    }
+
+    return text;
+}
+
+}
+
+class TestMessage : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestMessage(QObject *parent = 0);
+
+private Q_SLOTS:
+    void testHeader();
+    void testText();
+    void testNonTextContent();
+
+    void benchmarkAccessorsLegacy();
+    void benchmarkAccessors();
+    void benchmarkFirstAccess();
+};
+
+TestMessage::TestMessage(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void TestMessage::testHeader()
+{
+    Message message(richParts(7));
+    QCOMPARE(message.sent(), QDateTime::fromTime_t(1234567890));
+    QCOMPARE(message.messageType(), ChannelTextMessageTypeNormal);
+    QCOMPARE(message.messageToken(), QString(QLatin1String("token-7")));
+    QVERIFY(!message.isSpecificToDBusInterface());
+    QVERIFY(!message.dbusInterface().isNull());
+    QVERIFY(!message.isTruncated());
+    QCOMPARE(message.size(), 5);
+
+    Message other(ChannelTextMessageTypeAction, QLatin1String("waves"));
+    QCOMPARE(other.messageType(), ChannelTextMessageTypeAction);
+    QVERIFY(!other.sent().isValid());
+    QVERIFY(other.messageToken().isEmpty());
+    QVERIFY(!other.messageToken().isNull());
+}
+
+void TestMessage::testText()
+{
+    Message message(richParts(1));
+    QCOMPARE(message.text(), QString(QLatin1String("Hello world [a picture]")));
+    QCOMPARE(message.text(), legacyText(message.parts()));
+
+    MessagePartList parts = MessagePartList() << MessagePart()
+        << part("text/plain", QLatin1String("One"))
+        << part("text/plain", QLatin1String(", two"));
+    parts[2].insert(QLatin1String("truncated"), QDBusVariant(true));
+    Message plain(parts);
+    QCOMPARE(plain.text(), QString(QLatin1String("One, two")));
+    QVERIFY(plain.isTruncated());
+}
+
+void TestMessage::testNonTextContent()
+{
+    // Every non-text part has a text/plain alternative
+    QVERIFY(!Message(richParts(1)).hasNonTextContent());
+
+    MessagePartList parts = richParts(1);
+    parts.removeLast();
+    QVERIFY(Message(parts).hasNonTextContent());
+
+    parts = richParts(1);
+    parts << part("image/png", QLatin1String("no alternative"));
+    QVERIFY(Message(parts).hasNonTextContent());
+
+    parts = richParts(1);
+    parts[0].insert(QLatin1String("interface"),
+            QDBusVariant(QLatin1String("org.example.Interface")));
+    Message specific(parts);
+    QVERIFY(specific.isSpecificToDBusInterface());
+    QVERIFY(specific.hasNonTextContent());
+
+    QVERIFY(Message(MessagePartList() << MessagePart()).hasNonTextContent());
+}
+
+void TestMessage::benchmarkAccessorsLegacy()
+{
+    Message message(richParts(1));
+    MessagePartList parts = message.parts();
+
+    QBENCHMARK {
+        // What a chat log view does when painting a message
+        legacyText(parts);
+        parts.at(0).value(QLatin1String("message-sent")).variant().toUInt();
+        parts.at(0).value(QLatin1String("message-type")).variant().toUInt();
+        parts.at(0).value(QLatin1String("message-token")).variant().toString();
+        parts.at(0).value(QLatin1String("interface")).variant().toString();
+    }
+}
+
+void TestMessage::benchmarkAccessors()
+{
+    Message message(richParts(1));
+
+    QBENCHMARK {
+        message.text();
+        message.sent();
+        message.messageType();
+        message.messageToken();
+        message.isSpecificToDBusInterface();
+    }
+}
+
+void TestMessage::benchmarkFirstAccess()
+{
+    QList<MessagePartList> partLists;
+    for (int i = 0; i < 1000; ++i) {
+        partLists << richParts(i);
+    }
+
+    // The parts are parsed when the message is built, so that is the cost paid once per message
+    QBENCHMARK_ONCE {
+        foreach (const MessagePartList &parts, partLists) {
+            Message message(parts);
+            message.text();
+        }
+    }
+}
+
+QTEST_MAIN(TestMessage)
+
+#include "_gen/message.cpp.moc.hpp"
@@ -0,0 +1,286 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/Debug>
+#include <TelepathyQt/Feature>
+#include <TelepathyQt/IntrospectionTrace>
+#include <TelepathyQt/PendingReady>
+#include <TelepathyQt/ReadinessHelper>
+#include <TelepathyQt/RefCounted>
+#include <TelepathyQt/SharedPtr>
+
+using namespace Tp;
+
+namespace {
+
+class Object : public RefCounted
+{
+};
+
+enum {
+    StatusOnline = 1,
+    StatusOffline = 2
+};
+
+}
+
+class TestReadinessHelper : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestReadinessHelper(QObject *parent = 0);
+
+private Q_SLOTS:
+    void init();
+
+    void testParallelIntrospection();
+    void testNoOpFeatures();
+    void testMissingDependency();
+    void testIntrospectionTrace();
+
+    void cleanup();
+
+private:
+    struct Introspection
+    {
+        TestReadinessHelper *test;
+        Feature feature;
+    };
+
+    static void introspect(void *data);
+
+    Feature feature(const char *name);
+    void addIntrospectable(const Feature &feature, const Features &dependsOn = Features(),
+            uint status = StatusOnline);
+    void spin();
+
+    SharedPtr<Object> mObject;
+    ReadinessHelper *mHelper;
+    QList<Introspection *> mIntrospections;
+    QList<Feature> mStarted;
+    int mInFlight;
+    int mMaxInFlight;
+};
+
+TestReadinessHelper::TestReadinessHelper(QObject *parent)
+    : QObject(parent),
+      mHelper(0)
+{
+    Tp::enableDebug(true);
+    Tp::enableWarnings(true);
+}
+
+void TestReadinessHelper::introspect(void *data)
+{
+    Introspection *introspection = static_cast<Introspection *>(data);
+    TestReadinessHelper *test = introspection->test;
+    test->mStarted << introspection->feature;
+    test->mMaxInFlight = qMax(test->mMaxInFlight, ++test->mInFlight);
+}
+
+Feature TestReadinessHelper::feature(const char *name)
+{
+    return Feature(QLatin1String(name), 0);
+}
+
+void TestReadinessHelper::addIntrospectable(const Feature &feature, const Features &dependsOn,
+        uint status)
+{
+    Introspection *introspection = new Introspection;
+    introspection->test = this;
+    introspection->feature = feature;
+    mIntrospections << introspection;
+
+    ReadinessHelper::Introspectables introspectables;
+    introspectables.insert(feature, ReadinessHelper::Introspectable(
+                QSet<uint>() << status, dependsOn, QStringList(),
+                &TestReadinessHelper::introspect, introspection));
+    mHelper->addIntrospectables(introspectables);
+}
+
+void TestReadinessHelper::spin()
+{
+    QTest::qWait(10);
+}
+
+void TestReadinessHelper::init()
+{
+    mObject = SharedPtr<Object>(new Object);
+    mHelper = new ReadinessHelper(mObject.data(), StatusOnline);
+    mStarted.clear();
+    mInFlight = 0;
+    mMaxInFlight = 0;
+}
+
+void TestReadinessHelper::testParallelIntrospection()
+{
+    Feature a = feature("TestParallelA");
+    Feature b = feature("TestParallelB");
+    Feature c = feature("TestParallelC");
+    Feature d = feature("TestParallelD");
+    Feature e = feature("TestParallelE");
+
+    addIntrospectable(a);
+    addIntrospectable(b);
+    addIntrospectable(c);
+    addIntrospectable(d, Features() << a << b);
+    addIntrospectable(e, Features() << d);
+
+    PendingReady *pr = mHelper->becomeReady(Features() << c << e);
+    spin();
+
+    // All the features without pending dependencies are introspected at once
+    QCOMPARE(mStarted.toSet(), (Features() << a << b << c));
+    QCOMPARE(mMaxInFlight, 3);
+
+    mHelper->setIntrospectCompleted(a, true);
+    --mInFlight;
+    spin();
+    QCOMPARE(mStarted.size(), 3);
+
+    mHelper->setIntrospectCompleted(b, true);
+    --mInFlight;
+    spin();
+    QCOMPARE(mStarted.size(), 4);
+    QCOMPARE(mStarted.last(), d);
+
+    mHelper->setIntrospectCompleted(d, true);
+    --mInFlight;
+    spin();
+    QCOMPARE(mStarted.size(), 5);
+    QCOMPARE(mStarted.last(), e);
+    QVERIFY(!pr->isFinished());
+
+    mHelper->setIntrospectCompleted(c, true);
+    mHelper->setIntrospectCompleted(e, true);
+    mInFlight -= 2;
+    spin();
+    QVERIFY(pr->isFinished());
+    QVERIFY(pr->isValid());
+    QVERIFY(mHelper->isReady(Features() << a << b << c << d << e));
+}
+
+void TestReadinessHelper::testNoOpFeatures()
+{
+    Feature noOp1 = feature("TestNoOp1");
+    Feature noOp2 = feature("TestNoOp2");
+    Feature a = feature("TestNoOpA");
+    Feature b = feature("TestNoOpB");
+
+    // Nothing to do for the no-op features in the current status, which must not hold the others
+    // back
+    addIntrospectable(noOp1, Features(), StatusOffline);
+    addIntrospectable(noOp2, Features(), StatusOffline);
+    addIntrospectable(a);
+    addIntrospectable(b, Features() << noOp1 << noOp2);
+
+    PendingReady *pr = mHelper->becomeReady(Features() << a << b);
+    spin();
+
+    QCOMPARE(mStarted.toSet(), (Features() << a << b));
+    QCOMPARE(mMaxInFlight, 2);
+    QVERIFY(mHelper->isReady(Features() << noOp1 << noOp2));
+
+    mHelper->setIntrospectCompleted(a, true);
+    mHelper->setIntrospectCompleted(b, true);
+    spin();
+    QVERIFY(pr->isFinished());
+    QVERIFY(pr->isValid());
+}
+
+void TestReadinessHelper::testMissingDependency()
+{
+    Feature a = feature("TestMissingA");
+    Feature b = feature("TestMissingB");
+    Feature c = feature("TestMissingC");
+    Feature d = feature("TestMissingD");
+
+    addIntrospectable(a);
+    addIntrospectable(b, Features() << a);
+    addIntrospectable(c, Features() << b);
+    addIntrospectable(d);
+
+    PendingReady *pr = mHelper->becomeReady(Features() << c << d);
+    spin();
+    QCOMPARE(mStarted.toSet(), (Features() << a << d));
+
+    mHelper->setIntrospectCompleted(a, false, TP_QT_ERROR_NOT_AVAILABLE,
+            QLatin1String("Not available"));
+    mHelper->setIntrospectCompleted(d, true);
+    spin();
+
+    // The whole dependency chain fails at once, without being introspected
+    QCOMPARE(mStarted.size(), 2);
+    QCOMPARE(mHelper->missingFeatures(), Features(Features() << a << b << c));
+    QVERIFY(mHelper->isReady(d));
+    QVERIFY(pr->isFinished());
+    QVERIFY(pr->isError());
+}
+
+void TestReadinessHelper::testIntrospectionTrace()
+{
+    Feature a = feature("TestTraceA");
+    Feature b = feature("TestTraceB");
+
+    IntrospectionTrace::setEnabled(true);
+    IntrospectionTrace::clear();
+
+    addIntrospectable(a);
+    addIntrospectable(b, Features() << a);
+
+    PendingReady *pr = mHelper->becomeReady(Features() << b);
+    spin();
+    mHelper->setIntrospectCompleted(a, true);
+    spin();
+    mHelper->setIntrospectCompleted(b, false, TP_QT_ERROR_NOT_AVAILABLE,
+            QLatin1String("Not available"));
+    spin();
+    QVERIFY(pr->isFinished());
+
+    IntrospectionTrace::setEnabled(false);
+
+    QList<IntrospectionEvent> events = IntrospectionTrace::events();
+    QCOMPARE(events.size(), 3);
+
+    QCOMPARE(events[0].type, IntrospectionEvent::BecomeReady);
+    QVERIFY(events[0].name.contains(QLatin1String("TestTraceB")));
+    QVERIFY(!events[0].success);
+
+    QCOMPARE(events[1].type, IntrospectionEvent::Introspection);
+    QCOMPARE(events[1].name, QString(QLatin1String("TestTraceA#0")));
+    QVERIFY(events[1].success);
+    QVERIFY(events[1].endTime >= events[1].startTime);
+
+    QCOMPARE(events[2].type, IntrospectionEvent::Introspection);
+    QCOMPARE(events[2].name, QString(QLatin1String("TestTraceB#0")));
+    QVERIFY(!events[2].success);
+    QCOMPARE(events[2].errorName, TP_QT_ERROR_NOT_AVAILABLE);
+    QVERIFY(events[2].startTime >= events[1].endTime);
+
+    QByteArray trace = IntrospectionTrace::toChromeTrace();
+    QVERIFY(trace.contains("\"traceEvents\""));
+    QVERIFY(trace.contains("TestTraceA#0"));
+
+    // Nothing is recorded while disabled
+    IntrospectionTrace::clear();
+    addIntrospectable(feature("TestTraceC"));
+    mHelper->becomeReady(feature("TestTraceC"));
+    spin();
+    QVERIFY(IntrospectionTrace::events().isEmpty());
+}
+
+void TestReadinessHelper::cleanup()
+{
+    IntrospectionTrace::setEnabled(false);
+    IntrospectionTrace::clear();
+    delete mHelper;
+    mHelper = 0;
+    mObject.reset();
+    qDeleteAll(mIntrospections);
+    mIntrospections.clear();
+}
+
+QTEST_MAIN(TestReadinessHelper)
+
+#include "_gen/readiness-helper.cpp.moc.hpp"
@@ -0,0 +1,227 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/Debug>
+#include <TelepathyQt/Types>
+
+#include "TelepathyQt/contact-attribute-keys-internal.h"
+#include "TelepathyQt/roster-snapshot-internal.h"
+
+using namespace Tp;
+
+namespace {
+
+RosterSnapshot::Entry makeEntry(int i)
+{
+    RosterSnapshot::Entry entry;
+    entry.id = QString(QLatin1String("contact%1@example.com")).arg(i);
+    entry.alias = QString(QLatin1String("Contact %1")).arg(i);
+    entry.avatarTokenKnown = (i % 3) != 0;
+    if (entry.avatarTokenKnown) {
+        entry.avatarToken = QString::number(i, 16);
+    }
+    entry.presence.type = ConnectionPresenceTypeAway;
+    entry.presence.status = QLatin1String("away");
+    entry.presence.statusMessage = QString::fromUtf8("Out to lunch \xc3\xa9");
+    entry.groups << QLatin1String("Friends") << QString(QLatin1String("Group %1")).arg(i % 4);
+    entry.subscribe = SubscriptionStateYes;
+    entry.publish = SubscriptionStateAsk;
+    entry.publishRequest = QLatin1String("Let me in");
+    return entry;
+}
+
+}
+
+class TestRosterSnapshot : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestRosterSnapshot(QObject *parent = 0);
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void testSaveLoad();
+    void testAttributes();
+    void testEmpty();
+    void testMissing();
+    void testCorrupt();
+
+    void cleanup();
+
+private:
+    QString mFileName;
+};
+
+TestRosterSnapshot::TestRosterSnapshot(QObject *parent)
+    : QObject(parent)
+{
+    Tp::enableDebug(true);
+    Tp::enableWarnings(true);
+}
+
+void TestRosterSnapshot::initTestCase()
+{
+    Tp::registerTypes();
+}
+
+void TestRosterSnapshot::init()
+{
+    mFileName = QString(QLatin1String("%1/roster-snapshot-test-%2/roster")).
+        arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+    QFile::remove(mFileName);
+}
+
+void TestRosterSnapshot::testSaveLoad()
+{
+    QList<RosterSnapshot::Entry> entries;
+    for (int i = 0; i < 100; ++i) {
+        entries << makeEntry(i);
+    }
+    QVERIFY(RosterSnapshot::save(mFileName, entries));
+
+    RosterSnapshot snapshot(mFileName);
+    QVERIFY(!snapshot.isLoaded());
+    QVERIFY(snapshot.load());
+    QVERIFY(snapshot.isLoaded());
+    QCOMPARE(snapshot.count(), entries.size());
+
+    foreach (const RosterSnapshot::Entry &expected, entries) {
+        int index = snapshot.indexOf(expected.id);
+        QVERIFY(index >= 0);
+
+        RosterSnapshot::Entry entry = snapshot.entry(index);
+        QCOMPARE(entry.id, expected.id);
+        QCOMPARE(entry.alias, expected.alias);
+        QCOMPARE(entry.avatarTokenKnown, expected.avatarTokenKnown);
+        QCOMPARE(entry.avatarToken, expected.avatarToken);
+        QCOMPARE(entry.presence.type, expected.presence.type);
+        QCOMPARE(entry.presence.status, expected.presence.status);
+        QCOMPARE(entry.presence.statusMessage, expected.presence.statusMessage);
+        QCOMPARE(entry.groups, expected.groups);
+        QCOMPARE(entry.subscribe, expected.subscribe);
+        QCOMPARE(entry.publish, expected.publish);
+        QCOMPARE(entry.publishRequest, expected.publishRequest);
+    }
+
+    QCOMPARE(snapshot.indexOf(QLatin1String("stranger@example.com")), -1);
+
+    // Saving again replaces the snapshot, even while the old one is still mapped
+    entries.removeFirst();
+    QVERIFY(RosterSnapshot::save(mFileName, entries));
+    QCOMPARE(snapshot.count(), entries.size() + 1);
+
+    QVERIFY(snapshot.load());
+    QCOMPARE(snapshot.count(), entries.size());
+    QCOMPARE(snapshot.indexOf(makeEntry(0).id), -1);
+
+    snapshot.unload();
+    QVERIFY(!snapshot.isLoaded());
+    QCOMPARE(snapshot.count(), 0);
+}
+
+void TestRosterSnapshot::testAttributes()
+{
+    QList<RosterSnapshot::Entry> entries;
+    entries << makeEntry(1) << makeEntry(3);
+    QVERIFY(RosterSnapshot::save(mFileName, entries));
+
+    RosterSnapshot snapshot(mFileName);
+    QVERIFY(snapshot.load());
+
+    QVariantMap attributes = snapshot.attributes(snapshot.indexOf(makeEntry(1).id));
+    ContactAttributeValues values(attributes);
+    QCOMPARE(qdbus_cast<QString>(values.value(ContactAttributeKeys::ContactId)),
+            makeEntry(1).id);
+    QCOMPARE(qdbus_cast<QString>(values.value(ContactAttributeKeys::Alias)),
+            makeEntry(1).alias);
+    QCOMPARE(qdbus_cast<QString>(values.value(ContactAttributeKeys::AvatarToken)),
+            QString(QLatin1String("1")));
+    QCOMPARE(qdbus_cast<SimplePresence>(values.value(
+                    ContactAttributeKeys::SimplePresence)).status,
+            QString(QLatin1String("away")));
+    QCOMPARE(qdbus_cast<QStringList>(values.value(ContactAttributeKeys::Groups)),
+            makeEntry(1).groups);
+    QCOMPARE(qdbus_cast<uint>(values.value(ContactAttributeKeys::Subscribe)),
+            static_cast<uint>(SubscriptionStateYes));
+    QCOMPARE(qdbus_cast<uint>(values.value(ContactAttributeKeys::Publish)),
+            static_cast<uint>(SubscriptionStateAsk));
+
+    // An unknown avatar token must not show up as an empty one
+    attributes = snapshot.attributes(snapshot.indexOf(makeEntry(3).id));
+    QVERIFY(!ContactAttributeValues(attributes).contains(ContactAttributeKeys::AvatarToken));
+}
+
+void TestRosterSnapshot::testEmpty()
+{
+    QVERIFY(RosterSnapshot::save(mFileName, QList<RosterSnapshot::Entry>()));
+
+    RosterSnapshot snapshot(mFileName);
+    QVERIFY(snapshot.load());
+    QCOMPARE(snapshot.count(), 0);
+}
+
+void TestRosterSnapshot::testMissing()
+{
+    RosterSnapshot snapshot(mFileName);
+    QVERIFY(!snapshot.load());
+    QVERIFY(!snapshot.isLoaded());
+    QCOMPARE(snapshot.count(), 0);
+    QCOMPARE(snapshot.indexOf(makeEntry(0).id), -1);
+}
+
+void TestRosterSnapshot::testCorrupt()
+{
+    QList<RosterSnapshot::Entry> entries;
+    entries << makeEntry(1) << makeEntry(2);
+    QVERIFY(RosterSnapshot::save(mFileName, entries));
+
+    QFile file(mFileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QByteArray contents = file.readAll();
+    file.close();
+
+    RosterSnapshot snapshot(mFileName);
+
+    // Truncated
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(contents.left(contents.size() - 2));
+    file.close();
+    QVERIFY(!snapshot.load());
+
+    // Unknown format
+    QByteArray corrupt = contents;
+    corrupt[0] = corrupt[0] ^ 0xff;
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(corrupt);
+    file.close();
+    QVERIFY(!snapshot.load());
+
+    // A string reference pointing past the string pool; the first field of the first contact
+    // record is the offset of its identifier, right after the 24 bytes header
+    corrupt = contents;
+    corrupt.replace(24, 4, QByteArray(4, '\x7f'));
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(corrupt);
+    file.close();
+    QVERIFY(!snapshot.load());
+    QVERIFY(!snapshot.isLoaded());
+
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(contents);
+    file.close();
+    QVERIFY(snapshot.load());
+    QCOMPARE(snapshot.count(), 2);
+}
+
+void TestRosterSnapshot::cleanup()
+{
+    QFile::remove(mFileName);
+    QDir().rmdir(QFileInfo(mFileName).absolutePath());
+}
+
+QTEST_MAIN(TestRosterSnapshot)
+
+#include "_gen/roster-snapshot.cpp.moc.hpp"
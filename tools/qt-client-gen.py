@@ -471,14 +471,14 @@ void %(name)s::invalidate(Tp::DBusProxy *proxy,
         QDBusMessage callMessage = QDBusMessage::createMethodCall(this->service(), this->path(),
                 this->staticInterfaceName(), QLatin1String("%s"));
         callMessage << %s;
-        return this->connection().asyncCall(callMessage, timeout);
+        return this->internalAsyncCall(callMessage, timeout);
     }
 """ % (name, ' << '.join(['QVariant::fromValue(%s)' % argnames[i] for i in inargs])))
         else:
             self.h("""
         QDBusMessage callMessage = QDBusMessage::createMethodCall(this->service(), this->path(),
                 this->staticInterfaceName(), QLatin1String("%s"));
-        return this->connection().asyncCall(callMessage, timeout);
+        return this->internalAsyncCall(callMessage, timeout);
     }
 """ % name)
 